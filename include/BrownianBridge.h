@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ *   Builds Brownian paths in Brownian bridge order: the first normal
+ *   sets the final value, the second the value half way, the next
+ *   two the values at the quarters and so on. The paths have the
+ *   same distribution as when they are built step by step, but the
+ *   first few normals decide most of their shape. With quasi-random
+ *   numbers, whose first dimensions are the most evenly spread, this
+ *   makes the effective dimension of a pricing far smaller.
+ */
+class BrownianBridge {
+public:
+    /*  A bridge for a Brownian motion sampled at nSteps
+        equally spaced times, with unit variance per step */
+    explicit BrownianBridge( int nSteps );
+
+    /*  The number of steps */
+    int getSteps() const {
+        return nSteps;
+    }
+
+    /*  Replace the normals of n paths with the increments of their
+        Brownian motions. Element p of normal i of the bridge
+        order, and afterwards of step i, is values[i*stride + p]. */
+    void transform( double* values, int n, int stride ) const;
+
+private:
+    int nSteps;
+    /*  The step whose value the i'th normal decides, and the steps
+        whose values are already known on either side of it, with
+        -1 for the start of the path */
+    std::vector<int> bridgeIndex;
+    std::vector<int> leftIndex;
+    std::vector<int> rightIndex;
+    /*  The weights of the values either side and the standard
+        deviation of the value given them */
+    std::vector<double> leftWeight;
+    std::vector<double> rightWeight;
+    std::vector<double> sd;
+};
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testBrownianBridge();
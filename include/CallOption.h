@@ -9,7 +9,15 @@ public:
 
     /*  Returns the payoff at maturity given a column vector
         of scenarios */
-    Matrix payoffAtMaturity( const Matrix& stockAtMaturity ) const;
+    Matrix payoffAtMaturity( const MatrixView& stockAtMaturity ) const;
+
+    /*  The payoff is Lipschitz, so its Greeks can be
+        estimated pathwise */
+    bool hasPayoffDerivative() const {
+        return true;
+    }
+    /*  Returns the derivative of the payoff at maturity */
+    Matrix derivativeAtMaturity( const MatrixView& stockAtMaturity ) const;
 
     double price( const MultiStockModel& bsm )
         const;
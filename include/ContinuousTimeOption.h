@@ -4,6 +4,22 @@
 #include "Priceable.h"
 #include "Matrix.h"
 
+/**
+ *  Something whose payoffs are computed from the same simulation
+ *  as an option's and whose price is known exactly. Monte Carlo
+ *  pricers can use it to cancel much of the noise in the option's
+ *  payoffs.
+ */
+struct ControlVariate {
+    /*  The payoffs of the control in each scenario */
+    std::function<Matrix( const MarketSimulation& )> payoff;
+    /*  The exact price of the control */
+    double price;
+    /*  The statistics of each path the control's payoff needs
+        as well as those the option needs */
+    PathStatistics statistics;
+};
+
 /**
  *  Interface class for an option whose payoff should
  *  be approximated by looking at stock prices over all time
@@ -22,6 +38,31 @@ public:
         ) const = 0;
     /*  Is the option path-dependent?*/
     virtual bool isPathDependent() const = 0;
+    /*  The statistics of each path the payoff depends on. If
+        there are any, the payoff can be computed from a simulation
+        that only keeps these rather than whole paths. */
+    virtual PathStatistics getPathStatistics() const {
+        return PathStatistics();
+    }
+    /*  Find a control variate for pricing the option in the
+        given model. Returns false if there isn't a suitable one. */
+    virtual bool getControlVariate( const MultiStockModel& model,
+                                    ControlVariate& control ) const {
+        return false;
+    }
+    /*  Is the payoff a Lipschitz function of the final price of
+        one stock, whose derivative payoffDerivative gives? If so
+        the option's Greeks can be estimated pathwise. */
+    virtual bool hasPayoffDerivative() const {
+        return false;
+    }
+    /*  The derivative of each scenario's payoff with respect to
+        the final price of the stock */
+    virtual Matrix payoffDerivative(
+        const MarketSimulation& simulation
+        ) const {
+        throw std::logic_error( "The option's payoff has no derivative" );
+    }
 	/*  What stocks does the contract depend upon? */
 	virtual std::set<std::string>
 		getStocks() const = 0;
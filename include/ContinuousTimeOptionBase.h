@@ -2,6 +2,7 @@
 
 #include "ContinuousTimeOption.h"
 #include "MultiStockModel.h"
+#include "MatrixView.h"
 
 /**
  *  Convenience class for eliminating the drudgery of
@@ -53,13 +54,25 @@ public:
 	/**
 	*  Compute the payoff given the prices for the stock
 	*/
-	virtual Matrix payoff(const Matrix& stockPrices) const = 0;
+	virtual Matrix payoff(const MatrixView& stockPrices) const = 0;
+
+	/**
+	*  Compute the payoff given summaries of the paths of the
+	*  stock. Options that ask for path statistics must
+	*  override this.
+	*/
+	virtual Matrix payoff(const PathSummary& summary) const {
+		throw std::logic_error("The option has no payoff for path summaries");
+	}
 
 	/**
 	*  Compute the payoff given the a simulation of the market
 	*/
 	Matrix payoff(const MarketSimulation& sim) const {
-		return payoff(*sim.getStockPrices(getStock()));
+		if (sim.hasPathSummaries()) {
+			return payoff(sim.getPathSummary(getStock()));
+		}
+		return payoff(sim.getStockPrices(getStock()));
 	}
 
 	/*  What stocks does the contract depend upon */
@@ -2,6 +2,7 @@
 
 #include "stdafx.h"
 #include "Task.h"
+#include "Future.h"
 
 /*  An executor will execute tasks on mutliple threads */
 class Executor
@@ -12,19 +13,109 @@ public:
   /*  Add a task to the executor */
   virtual void addTask(
       std::shared_ptr<Task> task) = 0;
-  /*  Wait until all tasks are complete */
   /*  Add a function object to the executor */
   virtual void addTask(
       std::function<void()> functor) = 0;
+  /*  Wait until all tasks are complete. If any of them threw,
+      the first exception is rethrown once they have all finished. */
   virtual void join() = 0;
+  /*  The number of threads that run the tasks */
+  virtual int nThreads() const = 0;
+  /*  Run a function object as a task, returning a Future for its
+      result. Waiting on the future only waits for this task. */
+  template <typename F>
+  Future<typename std::invoke_result<F>::type> submit(F f);
+  /*  Call body(first, last) for consecutive ranges covering
+      [begin, end), running the ranges as separate tasks and
+      waiting for them, but not for the executor's other tasks.
+      The calling thread runs ranges too, so this may be called
+      from one of the executor's own tasks. The first exception
+      a range throws is rethrown. Each range has grainSize elements
+      except perhaps the last. A grainSize of 0 chooses one
+      which depends only on the length of the range. */
+  void parallelFor(int begin, int end,
+                   const std::function<void(int, int)> &body,
+                   int grainSize = 0);
+  /*  Combine the values of body(first, last) over ranges covering
+      [begin, end). The ranges are the same as for parallelFor and
+      are combined in order, so the result does not depend on the
+      number of threads or the order the tasks finish. */
+  template <typename T, typename Body, typename Combine>
+  T parallelReduce(int begin, int end, T identity,
+                   Body body, Combine combine,
+                   int grainSize = 0);
+  /*  Sum the values of body(first, last) as above */
+  double parallelReduce(int begin, int end,
+                        const std::function<double(int, int)> &body,
+                        int grainSize = 0);
+  /*  The grain size parallelFor uses for a range of length n */
+  static int chooseGrainSize(int n, int grainSize);
+  /*  How an executor hands tasks to its threads */
+  enum Scheduling
+  {
+    /*  One queue shared by all the threads */
+    SHARED_QUEUE,
+    /*  A queue per thread, idle threads steal from the others */
+    WORK_STEALING
+  };
   /*  Factory method */
   static std::shared_ptr<Executor> newInstance();
   /*  Factory method */
   static std::shared_ptr<Executor> newInstance(
       int maxThreads);
+  /*  Factory method */
+  static std::shared_ptr<Executor> newInstance(
+      int maxThreads, Scheduling scheduling);
+  /*  Factory method for an executor that runs its tasks on a
+      thread pool shared by the whole process. This starts no
+      threads and join only waits for this executor's tasks. */
+  static std::shared_ptr<Executor> newSharedInstance();
+  /*  Factory method for an executor whose tasks may block waiting
+      for each other, like the stages of a pipeline. They run on a
+      process-wide pool which starts a thread whenever a task would
+      otherwise wait for one, and keeps it for later tasks. */
+  static std::shared_ptr<Executor> newSharedBlockingInstance();
 };
 
 typedef std::shared_ptr<Executor> SPExecutor;
 
+/*  A value on a cache line of its own, so that threads writing
+    neighbouring values don't slow each other down */
+template <typename T>
+struct alignas(64) CacheLinePadded
+{
+  T value;
+};
+
+template <typename F>
+Future<typename std::invoke_result<F>::type> Executor::submit(F f)
+{
+  typedef typename std::invoke_result<F>::type R;
+  auto state = std::make_shared<FutureState<R>>(f);
+  addTask([state]()
+          { state->run(); });
+  return Future<R>(state);
+}
+
+template <typename T, typename Body, typename Combine>
+T Executor::parallelReduce(int begin, int end, T identity,
+                           Body body, Combine combine,
+                           int grainSize)
+{
+  int grain = chooseGrainSize(end - begin, grainSize);
+  int nRanges = (end - begin + grain - 1) / grain;
+  std::vector<CacheLinePadded<T>> partials(nRanges, CacheLinePadded<T>{identity});
+  parallelFor(
+      begin, end, [&](int first, int last)
+      { partials[(first - begin) / grain].value = body(first, last); },
+      grain);
+  T result = identity;
+  for (const CacheLinePadded<T> &partial : partials)
+  {
+    result = combine(result, partial.value);
+  }
+  return result;
+}
+
 /*  Test method */
 void testExecutor();
\ No newline at end of file
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "stdafx.h"
+
+template <typename T>
+class Future;
+
+/**
+ *   The state shared by a Future and the task computing its value.
+ *   Whoever calls run first computes the value, so a thread waiting
+ *   for a task that hasn't started yet simply runs it itself rather
+ *   than blocking a pool thread.
+ */
+template <typename T>
+class FutureState
+{
+public:
+    explicit FutureState(std::function<T()> work) : work(work),
+                                                    claimed(false),
+                                                    ready(false)
+    {
+    }
+
+    /*  Compute the value, unless another thread already has */
+    void run()
+    {
+        if (claimed.exchange(true))
+        {
+            return;
+        }
+        try
+        {
+            if constexpr (std::is_void<T>::value)
+            {
+                work();
+                value = true;
+            }
+            else
+            {
+                value = work();
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        // release anything the work captured
+        work = nullptr;
+        std::vector<std::function<void()>> toRun;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            ready = true;
+            toRun.swap(continuations);
+        }
+        finished.notify_all();
+        for (auto &continuation : toRun)
+        {
+            continuation();
+        }
+    }
+
+    /*  Has the value been computed? */
+    bool isReady()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return ready;
+    }
+
+    /*  Wait for the value, computing it here if nobody has started */
+    void wait()
+    {
+        run();
+        std::unique_lock<std::mutex> lock(mtx);
+        finished.wait(lock, [this]()
+                      { return ready; });
+    }
+
+    /*  The value, rethrowing any exception the work threw */
+    T get()
+    {
+        wait();
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        if constexpr (!std::is_void<T>::value)
+        {
+            return *value;
+        }
+    }
+
+    /*  Call a function once the value is ready, straight away if
+        it already is */
+    void onReady(std::function<void()> continuation)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!ready)
+            {
+                continuations.push_back(continuation);
+                return;
+            }
+        }
+        continuation();
+    }
+
+private:
+    std::function<T()> work;
+    /*  Set by the first call to run */
+    std::atomic<bool> claimed;
+    std::mutex mtx;
+    std::condition_variable finished;
+    bool ready;
+    std::optional<typename std::conditional<std::is_void<T>::value, bool, T>::type> value;
+    std::exception_ptr error;
+    std::vector<std::function<void()>> continuations;
+};
+
+/**
+ *   The result of a task submitted to an Executor. Copies of a
+ *   Future share the same result.
+ */
+template <typename T>
+class Future
+{
+public:
+    Future()
+    {
+    }
+
+    explicit Future(std::shared_ptr<FutureState<T>> state) : state(state)
+    {
+    }
+
+    /*  Does this refer to a task? */
+    bool valid() const
+    {
+        return state != nullptr;
+    }
+
+    /*  Has the task finished? */
+    bool isReady() const
+    {
+        ASSERT(valid());
+        return state->isReady();
+    }
+
+    /*  Wait for the task to finish */
+    void wait() const
+    {
+        ASSERT(valid());
+        state->wait();
+    }
+
+    /*  Wait for the result. If the task threw, so does this. */
+    T get() const
+    {
+        ASSERT(valid());
+        return state->get();
+    }
+
+    /*  A future for f applied to our result, or for f() if we have
+        no result. f is called by the thread that finishes this task,
+        or right away if it has finished, so it should be quick or
+        submit its own work. Exceptions pass through to the new
+        future. */
+    template <typename F>
+    auto then(F f) const
+    {
+        ASSERT(valid());
+        typedef decltype(callWith(f, state)) R;
+        std::shared_ptr<FutureState<T>> antecedent = state;
+        auto next = std::make_shared<FutureState<R>>(
+            [antecedent, f]() -> R
+            { return callWith(f, antecedent); });
+        state->onReady([next]()
+                       { next->run(); });
+        return Future<R>(next);
+    }
+
+private:
+    std::shared_ptr<FutureState<T>> state;
+
+    /*  Call f with the result of a finished task */
+    template <typename F>
+    static auto callWith(const F &f, const std::shared_ptr<FutureState<T>> &s)
+    {
+        if constexpr (std::is_void<T>::value)
+        {
+            s->get();
+            return f();
+        }
+        else
+        {
+            return f(s->get());
+        }
+    }
+};
+
+/*  Test method */
+void testFuture();
@@ -17,9 +17,41 @@ public:
         this->barrier=barrier;
     }
 
+    /*  Is the barrier monitored continuously rather than only
+        at the simulated times? Continuous monitoring is priced
+        with a Brownian bridge correction between the times, which
+        is accurate with far fewer steps. Whole paths are summarised
+        for the correction after they are generated, so the price
+        is the same whether or not path summaries are used. */
+    bool isContinuouslyMonitored() const {
+        return continuouslyMonitored;
+    }
+
+    void setContinuouslyMonitored(bool continuouslyMonitored) {
+        this->continuouslyMonitored=continuouslyMonitored;
+    }
+
     bool isPathDependent() const {
         return true;
     }
+
+    /*  The knockouts are calls, so the call with the same strike
+        and maturity is the control. It pays the same whenever the
+        barrier isn't reached. */
+    bool getControlVariate( const MultiStockModel& model,
+                            ControlVariate& control ) const;
+protected:
+    /*  Use the given continuously monitored copy of the option as
+        the control, whose payoff is computed with the Brownian
+        bridge from the same paths. Its price is known exactly and
+        it only differs from the option on paths that come close
+        to the barrier, so it is a far better control than the
+        call for a barrier monitored at the steps. */
+    void getContinuousControl( std::shared_ptr<const KnockoutOption> continuous,
+                               double continuousPrice,
+                               const MultiStockModel& model,
+                               ControlVariate& control ) const;
 private:
     double barrier;
+    bool continuouslyMonitored = false;
 };
\ No newline at end of file
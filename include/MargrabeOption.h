@@ -32,6 +32,14 @@ public:
 		return pricer.price(*this, model);
 	}
 
+	/*  The price given by Margrabe's formula */
+	double analyticPrice(const MultiStockModel& model) const;
+
+	/*  The payoff S_1-S_2 is the control, as its price
+		is S_1-S_2 today */
+	bool getControlVariate(const MultiStockModel& model,
+		ControlVariate& control) const override;
+
 
 	std::string stock1;
 	std::string stock2;
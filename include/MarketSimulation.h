@@ -2,30 +2,103 @@
 
 #include "stdafx.h"
 #include "Matrix.h"
+#include "MatrixView.h"
+#include "PathSummary.h"
+
+/*  How a simulation arranges each stock's prices in memory. Every
+	stock has one contiguous block. PATHS_BY_STEP keeps the prices
+	of all paths at a time step together, which is the layout of a
+	Matrix with a row per path. PATHS_BY_PATH keeps each path's
+	prices over time together, which suits payoffs that walk along
+	one path at a time. */
+enum PathLayout {
+	PATHS_BY_STEP,
+	PATHS_BY_PATH
+};
 
 class MarketSimulation {
 public:
+	/*  An empty simulation, for use with addSimulation */
+	MarketSimulation();
+
+	/*  A simulation of nPaths paths with nSteps prices for each
+		of the given stocks. All the prices live in one block of
+		memory, stock by stock, which the path generator fills in
+		place using getStockBlock. */
+	MarketSimulation(const std::vector<std::string>& stocks,
+		int nPaths,
+		int nSteps,
+		PathLayout layout = PATHS_BY_STEP);
 
 	/**
 	 *  Store a simulation
 	 */
 	void addSimulation(const std::string& stock,
-		SPCMatrix matrix) {
-		simulations[stock] = matrix;
-	}
+		SPCMatrix matrix);
 
 	/**
 	 *   Returns a matrix of stock prices
 	 *   rows represent different scenarios
-	 *   columns represent different time points
+	 *   columns represent different time points.
+	 *   The view is into the simulation's own storage,
+	 *   so it is only valid while the simulation or
+	 *   a copy of it exists.
 	 */
-	SPCMatrix getStockPrices( const std::string& stock)
-		const {
-		auto pos = simulations.find(stock);
-		ASSERT(pos != simulations.end());
-		return pos->second;
+	MatrixView getStockPrices(const std::string& stock) const;
+
+	/*  A simulation of the first nSteps steps of these paths, which
+		ends earlier on the same time grid. It shares the prices
+		rather than copying them. Summaries of the paths can't be
+		cut short, so the simulation must hold the paths. */
+	MarketSimulation firstSteps(int nSteps) const;
+
+	/*  Store summaries of a stock's paths, for a simulation
+		that doesn't keep the paths themselves */
+	void addPathSummary(const std::string& stock,
+		SPCPathSummary summary);
+
+	/*  The summaries of a stock's paths */
+	const PathSummary& getPathSummary(const std::string& stock) const;
+
+	/*  Does the simulation hold summaries of the paths
+		rather than the paths? */
+	bool hasPathSummaries() const {
+		return !summaries.empty();
+	}
+
+	/*  The layout of the prices of the stocks given when the
+		simulation was created */
+	PathLayout getLayout() const {
+		return layout;
+	}
+
+	/*  The start of the block holding the prices of the i'th
+		stock given when the simulation was created */
+	double* getStockBlock(int i) {
+		ASSERT(paths && i >= 0 && i < paths->nCols());
+		return paths->begin() + (size_t)i * paths->nRows();
 	}
 
 private:
-	std::map< std::string, SPCMatrix> simulations;
-};
\ No newline at end of file
+	/*  Views of each stock's prices */
+	std::map< std::string, MatrixView> simulations;
+	/*  The prices of all the stocks, one column per stock,
+		or null for an empty simulation. Copies of the
+		simulation share it. */
+	std::shared_ptr<Matrix> paths;
+	/*  The layout of paths */
+	PathLayout layout;
+	/*  Matrices added with addSimulation */
+	std::vector<SPCMatrix> addedMatrices;
+	/*  Summaries of each stock's paths */
+	std::map< std::string, SPCPathSummary> summaries;
+};
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testMarketSimulation();
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "stdafx.h"
+#include "MatrixAllocator.h"
+
+template <typename E> class MatrixExpression;
+class MatrixView;
 
 class Matrix {
 public:
@@ -20,12 +24,17 @@ public:
     explicit Matrix( double value );
     /*  Create a vector */
     explicit Matrix( std::vector<double> data, bool rowVector=0 );
+    /*  Copy the contents of a view, see MatrixView.h */
+    explicit Matrix( const MatrixView& view );
+    /*  Evaluate a lazy expression, see MatrixExpression.h */
+    template <typename E>
+    Matrix( const MatrixExpression<E>& expression );
 
     /**
      *  Destructor, cleans up the data created
      */
     ~Matrix() {
-        delete[] data;
+        deallocate();
     }
 
     /**
@@ -92,13 +101,9 @@ public:
 
     /**
      *   The assignment operator must be implemented by the rule
-     *   of three
+     *   of three. If the sizes match we reuse our existing storage.
      */
-    Matrix& operator=( const Matrix& other ) {
-        delete[] data;
-        assign( other );
-        return *this;
-    }
+    Matrix& operator=( const Matrix& other );
 
     /**
      *   This must be implemented by the rule of three
@@ -107,6 +112,32 @@ public:
         assign( other );
     }
 
+    /**
+     *   Move constructor, steals the storage of a temporary
+     *   so no allocation is needed
+     */
+    Matrix( Matrix&& other ) noexcept
+        : nrows( other.nrows ),
+          ncols( other.ncols ),
+          data( other.data ),
+          endPointer( other.endPointer ),
+          allocator( other.allocator ) {
+        other.release();
+    }
+
+    /**
+     *   Move assignment, swaps storage with the temporary
+     *   which then cleans up our old data
+     */
+    Matrix& operator=( Matrix&& other ) noexcept {
+        std::swap( nrows, other.nrows );
+        std::swap( ncols, other.ncols );
+        std::swap( data, other.data );
+        std::swap( endPointer, other.endPointer );
+        std::swap( allocator, other.allocator );
+        return *this;
+    }
+
     /*  Access a pointer to the first element */
     const double* begin() const {
         return data;
@@ -152,6 +183,9 @@ public:
     }
     /*  Entrywise multiplication */
     void times( const Matrix& other );
+    /*  Entrywise multiplication by a lazy expression */
+    template <typename E>
+    void times( const MatrixExpression<E>& expression );
     /*  Tests the value of each cell and replaces the value with valueIfTrue or valueIfFalse
         according to whether the current value is 1 or 0 */
     void test( const Matrix& valueIfTrue, const Matrix& valueIfFalse );
@@ -168,6 +202,16 @@ public:
     /*  Subtraction */
     Matrix& operator-=( const Matrix& other );
 
+    /*  Evaluate a lazy expression in a single pass */
+    template <typename E>
+    Matrix& operator=( const MatrixExpression<E>& expression );
+    /*  Add a lazy expression in a single pass */
+    template <typename E>
+    Matrix& operator+=( const MatrixExpression<E>& expression );
+    /*  Subtract a lazy expression in a single pass */
+    template <typename E>
+    Matrix& operator-=( const MatrixExpression<E>& expression );
+
     /*  Assign a column to match a column in another matrix */
     void setCol( int col, const Matrix& other, int otherCol);
     /*  Assign a column to match a row in another matrix */
@@ -200,6 +244,13 @@ public:
         return j*nrows + i;
     }
 
+    /*  
+     *  The number of buffers allocated by all matrices
+     *  so far, whichever allocator they came from. Useful for
+     *  checking code for needless temporaries.
+     */
+    static long long allocationCount();
+
 private:
     
     /*  The number of rows in the matrx */
@@ -210,6 +261,8 @@ private:
     double* data;
     /*  Pointer to one after the end of the data */
     double* endPointer;
+    /*  Where the data came from */
+    MatrixAllocator* allocator;
 
 
     /**
@@ -217,6 +270,38 @@ private:
      * the same data as another matrix
      */
     void assign( const Matrix& other );
+
+    /**
+     *  Allocate storage for the given number of entries
+     *  using the current allocator
+     */
+    void allocate( int size );
+
+    /**
+     *  Give our storage back to the allocator it came from
+     */
+    void deallocate() {
+        if (data) {
+            allocator->deallocate( data, (int)(endPointer-data) );
+        }
+    }
+
+    /**
+     *  Write the values of an expression into our storage
+     */
+    template <typename E>
+    void evaluate( const E& expression );
+
+    /**
+     *  Leave this matrix empty after its storage has been taken
+     */
+    void release() {
+        nrows = 0;
+        ncols = 0;
+        data = 0;
+        endPointer = 0;
+        allocator = 0;
+    }
 };
 
 /*  Define shared ptr to a matrix type */
@@ -229,30 +314,65 @@ std::ostream& operator<<(std::ostream& out, const Matrix& m );
 /*  Multiply a matrix by a scalar */
 Matrix operator*(const Matrix& m, double scalar );
 
+/*  Multiply a matrix by a scalar, reusing a temporary's storage */
+Matrix operator*(Matrix&& m, double scalar );
+
 /*  Matrix multiplication */
 Matrix operator*(const Matrix& a, const Matrix& b);
 
+/*  Matrix multiplication into an existing matrix, out = alpha*a*b */
+void multiply(const Matrix& a, const Matrix& b, Matrix& out, double alpha=1.0 );
+
 /*  Multiply a matrix by a scalar */
 inline Matrix operator*(double scalar, const Matrix& m ) {
     return m*scalar;
 }
 
+/*  Multiply a matrix by a scalar, reusing a temporary's storage */
+inline Matrix operator*(double scalar, Matrix&& m ) {
+    return std::move(m)*scalar;
+}
+
 /*  Add a scalar to every element of a matrix */
 Matrix operator+(const Matrix& m, double scalar );
 
+/*  Add a scalar to every element of a matrix */
+Matrix operator+(Matrix&& m, double scalar );
+
 /*  Add a scalar to every element of a matrix */
 inline Matrix operator+(double scalar, const Matrix& m ) {
     return m+scalar;
 }
 
+/*  Add a scalar to every element of a matrix */
+inline Matrix operator+(double scalar, Matrix&& m ) {
+    return std::move(m)+scalar;
+}
+
 /*  Add two matrices */
 Matrix operator+(const Matrix& x, const Matrix& y );
+/*  Add two matrices, reusing a temporary's storage */
+Matrix operator+(Matrix&& x, const Matrix& y );
+/*  Add two matrices, reusing a temporary's storage */
+Matrix operator+(const Matrix& x, Matrix&& y );
+/*  Add two matrices, reusing a temporary's storage */
+Matrix operator+(Matrix&& x, Matrix&& y );
 /*  Subtraction */
 Matrix operator-(double scalar, const Matrix& m );
+/*  Subtraction, reusing a temporary's storage */
+Matrix operator-(double scalar, Matrix&& m );
 /*  Subtract a scalar from a matrix */
 Matrix operator-(const Matrix& m, double scalar );
+/*  Subtract a scalar from a matrix, reusing a temporary's storage */
+Matrix operator-(Matrix&& m, double scalar );
 /*  Subtract two matrices */
 Matrix operator-(const Matrix& x, const Matrix& y );
+/*  Subtract two matrices, reusing a temporary's storage */
+Matrix operator-(Matrix&& x, const Matrix& y );
+/*  Subtract two matrices, reusing a temporary's storage */
+Matrix operator-(const Matrix& x, Matrix&& y );
+/*  Subtract two matrices, reusing a temporary's storage */
+Matrix operator-(Matrix&& x, Matrix&& y );
 
 /*  Comparison operator */
 Matrix operator>(const Matrix& x, double s );
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "stdafx.h"
+
+/*  The alignment in bytes of every matrix's storage */
+const int MATRIX_ALIGNMENT = 64;
+
+/**
+ *   Supplies the storage for matrices. New matrices use the current
+ *   allocator of the thread creating them, which is the heap unless
+ *   a MatrixAllocatorScope says otherwise. A matrix remembers where
+ *   its storage came from and gives it back there.
+ */
+class MatrixAllocator {
+public:
+    virtual ~MatrixAllocator() {}
+    /*  Storage for n doubles aligned to MATRIX_ALIGNMENT bytes */
+    virtual double* allocate( int n ) = 0;
+    /*  Give back storage obtained from allocate */
+    virtual void deallocate( double* p, int n ) = 0;
+
+    /*  The allocator new matrices on this thread use */
+    static MatrixAllocator& current();
+    /*  The allocator which goes straight to the heap */
+    static MatrixAllocator& heap();
+    /*  The number of times any allocator has called the heap */
+    static long long heapCallCount();
+
+protected:
+    /*  Aligned heap storage, counted by heapCallCount */
+    static double* heapAllocate( int n );
+    /*  Free storage from heapAllocate */
+    static void heapDeallocate( double* p );
+};
+
+/**
+ *   Hands out storage from large blocks. Giving back a single matrix's
+ *   storage does nothing, instead reset() makes all of it available
+ *   again in one shot. Once it has grown to fit the working set an
+ *   arena makes no heap calls at all.
+ *
+ *   An arena should only be used by one thread, and every matrix
+ *   using it must be destroyed before it is reset or destroyed.
+ *   Matrices may be destroyed on other threads.
+ */
+class MatrixArena : public MatrixAllocator {
+public:
+    /*  Create an arena which gets blockSize doubles at a time */
+    explicit MatrixArena( int blockSize=(1<<20) );
+    ~MatrixArena();
+
+    double* allocate( int n );
+    void deallocate( double* p, int n );
+
+    /*  Make all the storage available again. Throws logic_error,
+        leaving the storage alone, if any of it is still in use. */
+    void reset();
+    /*  The number of doubles the arena holds */
+    long long capacity() const;
+
+private:
+    struct Block {
+        double* data;
+        int size;
+    };
+    int blockSize;
+    std::vector<Block> blocks;
+    /*  The block we are allocating from and how much of it is used */
+    int currentBlock;
+    int used;
+    /*  The number of doubles handed out since the last reset */
+    long long totalUsed;
+    /*  The number of buffers not given back yet, which may
+        be given back from other threads */
+    std::atomic<int> live;
+
+    MatrixArena( const MatrixArena& ) = delete;
+    MatrixArena& operator=( const MatrixArena& ) = delete;
+};
+
+/**
+ *   Makes an allocator the current one for this thread until
+ *   the end of the scope
+ */
+class MatrixAllocatorScope {
+public:
+    explicit MatrixAllocatorScope( MatrixAllocator& allocator );
+    ~MatrixAllocatorScope();
+private:
+    MatrixAllocator* previous;
+
+    MatrixAllocatorScope( const MatrixAllocatorScope& ) = delete;
+    MatrixAllocatorScope& operator=( const MatrixAllocatorScope& ) = delete;
+};
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testMatrixAllocator();
@@ -0,0 +1,456 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Matrix.h"
+#include "MatrixView.h"
+#include "MatrixKernels.h"
+
+/**
+ *   Lazily evaluated element-wise matrix arithmetic.
+ *
+ *   Wrapping a matrix with lazy() turns the usual operators into
+ *   expression templates: nothing is computed until the expression
+ *   is assigned to a Matrix, at which point the whole expression is
+ *   evaluated in a single pass with no temporaries. For example
+ *
+ *       currentLogStock += lazy(driftTerm) + W;
+ *       Matrix p = positivePart( lazy(prices) - strike );
+ *
+ *   Expressions only hold references to their matrices, so they
+ *   should be evaluated in the statement that creates them rather
+ *   than stored with auto.
+ *
+ *   The pass works through the entries in chunks small enough to
+ *   stay in the L1 cache, so that functions such as exp can use the
+ *   vector kernels from MatrixKernels.h on a whole chunk at a time.
+ */
+
+/*  The number of entries evaluated at a time */
+static const int EXPRESSION_CHUNK = 512;
+
+template <typename E>
+class MatrixExpression {
+public:
+    /*  The expression this really is */
+    const E& self() const {
+        return static_cast<const E&>(*this);
+    }
+    /*  The number of rows in the result */
+    int nRows() const {
+        return self().nRows();
+    }
+    /*  The number of columns in the result */
+    int nCols() const {
+        return self().nCols();
+    }
+    /*  Evaluate the i'th entry of the result */
+    double operator[]( int i ) const {
+        return self()[i];
+    }
+    /*  Write entries first to first+n-1 of the result to out,
+        where n is at most EXPRESSION_CHUNK. Out is only written
+        once every other matrix in the expression has been read, so
+        it may be the storage of the leftmost one. */
+    void evaluate( int first, int n, double* out ) const {
+        self().evaluate( first, n, out );
+    }
+    /*  Whether writing entry i of the result to begin[i] as we go
+        could change entries of the expression still to be read */
+    bool aliases( const double* begin, const double* end ) const {
+        return self().aliases( begin, end );
+    }
+};
+
+/**
+ *   The leaf of an expression, wrapping a matrix
+ */
+class MatrixReference : public MatrixExpression<MatrixReference> {
+public:
+    explicit MatrixReference( const Matrix& m ) :
+        nrows( m.nRows() ),
+        ncols( m.nCols() ),
+        data( m.begin() ) {
+    }
+    int nRows() const {
+        return nrows;
+    }
+    int nCols() const {
+        return ncols;
+    }
+    double operator[]( int i ) const {
+        return data[i];
+    }
+    void evaluate( int first, int n, double* out ) const {
+        if (out!=data+first) {
+            memcpy( out, data+first, sizeof(double)*n );
+        }
+    }
+    bool aliases( const double* begin, const double* end ) const {
+        // reading entry i just before writing it is safe
+        return data!=begin && data<end && begin<data+nrows*ncols;
+    }
+private:
+    int nrows;
+    int ncols;
+    const double* data;
+};
+
+/**
+ *   Apply a function to every element of an expression
+ */
+template <typename E, typename Op>
+class UnaryExpression : public MatrixExpression<UnaryExpression<E, Op> > {
+public:
+    UnaryExpression( const E& e, Op op ) : e( e ), op( op ) {
+    }
+    int nRows() const {
+        return e.nRows();
+    }
+    int nCols() const {
+        return e.nCols();
+    }
+    double operator[]( int i ) const {
+        return op( e[i] );
+    }
+    void evaluate( int first, int n, double* out ) const {
+        e.evaluate( first, n, out );
+        apply( op, out, n );
+    }
+    bool aliases( const double* begin, const double* end ) const {
+        return e.aliases( begin, end );
+    }
+private:
+    E e;
+    Op op;
+};
+
+/**
+ *   Combine two expressions of the same size element by element
+ */
+template <typename L, typename R, typename Op>
+class BinaryExpression : public MatrixExpression<BinaryExpression<L, R, Op> > {
+public:
+    BinaryExpression( const L& l, const R& r, Op op ) : l( l ), r( r ), op( op ) {
+        ASSERT( l.nRows()==r.nRows() && l.nCols()==r.nCols() );
+    }
+    int nRows() const {
+        return l.nRows();
+    }
+    int nCols() const {
+        return l.nCols();
+    }
+    double operator[]( int i ) const {
+        return op( l[i], r[i] );
+    }
+    void evaluate( int first, int n, double* out ) const {
+        // the right hand side first, so that out isn't written
+        // before it has been read
+        double right[EXPRESSION_CHUNK];
+        r.evaluate( first, n, right );
+        l.evaluate( first, n, out );
+        for (int i=0; i<n; i++) {
+            out[i] = op( out[i], right[i] );
+        }
+    }
+    bool aliases( const double* begin, const double* end ) const {
+        return l.aliases( begin, end ) || r.aliases( begin, end );
+    }
+private:
+    L l;
+    R r;
+    Op op;
+};
+
+/**
+ *   The leaf of an expression, wrapping a row, a column or a
+ *   contiguous block of a MatrixView
+ */
+class MatrixViewReference : public MatrixExpression<MatrixViewReference> {
+public:
+    explicit MatrixViewReference( const MatrixView& v ) :
+        nrows( v.nRows() ),
+        ncols( v.nCols() ),
+        stride( v.linearStride() ),
+        data( v.begin() ) {
+    }
+    int nRows() const {
+        return nrows;
+    }
+    int nCols() const {
+        return ncols;
+    }
+    double operator[]( int i ) const {
+        return data[i*stride];
+    }
+    void evaluate( int first, int n, double* out ) const {
+        const double* p = data + (long long)first*stride;
+        for (int i=0; i<n; i++) {
+            out[i] = p[i*stride];
+        }
+    }
+    bool aliases( const double* begin, const double* end ) const {
+        int n = nrows*ncols;
+        if (n==0 || (stride==1 && data==begin)) {
+            return false;
+        }
+        return data<end && begin<data+(n-1)*stride+1;
+    }
+private:
+    int nrows;
+    int ncols;
+    int stride;
+    const double* data;
+};
+
+/*  Start a lazily evaluated expression */
+inline MatrixReference lazy( const Matrix& m ) {
+    return MatrixReference( m );
+}
+
+/*  Start a lazily evaluated expression reading a view */
+inline MatrixViewReference lazy( const MatrixView& v ) {
+    return MatrixViewReference( v );
+}
+
+/*  Functors used to build expressions */
+namespace expressionops {
+    struct Plus { double operator()( double a, double b ) const { return a + b; } };
+    struct Minus { double operator()( double a, double b ) const { return a - b; } };
+    struct Times { double operator()( double a, double b ) const { return a * b; } };
+    struct Greater { double operator()( double a, double b ) const { return a > b; } };
+    struct GreaterEqual { double operator()( double a, double b ) const { return a >= b; } };
+    struct Less { double operator()( double a, double b ) const { return a < b; } };
+    struct LessEqual { double operator()( double a, double b ) const { return a <= b; } };
+    struct Equal { double operator()( double a, double b ) const { return a == b; } };
+    struct NotEqual { double operator()( double a, double b ) const { return a != b; } };
+
+    /*  Apply a binary operator with a fixed right hand side */
+    template <typename Op>
+    struct BindRight {
+        double s;
+        Op op;
+        BindRight( double s ) : s( s ) {}
+        double operator()( double a ) const { return op( a, s ); }
+    };
+    /*  Apply a binary operator with a fixed left hand side */
+    template <typename Op>
+    struct BindLeft {
+        double s;
+        Op op;
+        BindLeft( double s ) : s( s ) {}
+        double operator()( double a ) const { return op( s, a ); }
+    };
+
+    struct Negate { double operator()( double a ) const { return -a; } };
+    struct Exp { double operator()( double a ) const { return std::exp( a ); } };
+    struct Log { double operator()( double a ) const { return std::log( a ); } };
+    struct Sqrt { double operator()( double a ) const { return std::sqrt( a ); } };
+    struct PositivePart { double operator()( double a ) const { return (a>0.0) ? a : 0.0; } };
+    struct NegativePart { double operator()( double a ) const { return (a<0.0) ? a : 0.0; } };
+
+    /*  Apply a function to n values in place */
+    template <typename Op>
+    inline void apply( const Op& op, double* x, int n ) {
+        for (int i=0; i<n; i++) {
+            x[i] = op( x[i] );
+        }
+    }
+    /*  Functions with a vector kernel use it */
+    inline void apply( const Exp&, double* x, int n ) { vectorExp( x, n ); }
+    inline void apply( const Log&, double* x, int n ) { vectorLog( x, n ); }
+    inline void apply( const Sqrt&, double* x, int n ) { vectorSqrt( x, n ); }
+    inline void apply( const PositivePart&, double* x, int n ) { vectorPositivePart( x, n ); }
+    inline void apply( const NegativePart&, double* x, int n ) { vectorNegativePart( x, n ); }
+}
+
+/*
+ *   Define an element-wise operator for every combination of expression,
+ *   matrix and scalar where at least one side is an expression.
+ */
+#define MATRIX_EXPRESSION_OPERATOR( OP, FUNCTOR ) \
+template <typename L, typename R> \
+inline BinaryExpression<L, R, expressionops::FUNCTOR> OP( \
+        const MatrixExpression<L>& l, const MatrixExpression<R>& r ) { \
+    return BinaryExpression<L, R, expressionops::FUNCTOR>( \
+        l.self(), r.self(), expressionops::FUNCTOR() ); \
+} \
+template <typename L> \
+inline BinaryExpression<L, MatrixReference, expressionops::FUNCTOR> OP( \
+        const MatrixExpression<L>& l, const Matrix& r ) { \
+    return BinaryExpression<L, MatrixReference, expressionops::FUNCTOR>( \
+        l.self(), MatrixReference( r ), expressionops::FUNCTOR() ); \
+} \
+template <typename R> \
+inline BinaryExpression<MatrixReference, R, expressionops::FUNCTOR> OP( \
+        const Matrix& l, const MatrixExpression<R>& r ) { \
+    return BinaryExpression<MatrixReference, R, expressionops::FUNCTOR>( \
+        MatrixReference( l ), r.self(), expressionops::FUNCTOR() ); \
+} \
+template <typename L> \
+inline UnaryExpression<L, expressionops::BindRight<expressionops::FUNCTOR> > OP( \
+        const MatrixExpression<L>& l, double s ) { \
+    return UnaryExpression<L, expressionops::BindRight<expressionops::FUNCTOR> >( \
+        l.self(), expressionops::BindRight<expressionops::FUNCTOR>( s ) ); \
+} \
+template <typename R> \
+inline UnaryExpression<R, expressionops::BindLeft<expressionops::FUNCTOR> > OP( \
+        double s, const MatrixExpression<R>& r ) { \
+    return UnaryExpression<R, expressionops::BindLeft<expressionops::FUNCTOR> >( \
+        r.self(), expressionops::BindLeft<expressionops::FUNCTOR>( s ) ); \
+}
+
+MATRIX_EXPRESSION_OPERATOR( operator+, Plus )
+MATRIX_EXPRESSION_OPERATOR( operator-, Minus )
+MATRIX_EXPRESSION_OPERATOR( operator>, Greater )
+MATRIX_EXPRESSION_OPERATOR( operator>=, GreaterEqual )
+MATRIX_EXPRESSION_OPERATOR( operator<, Less )
+MATRIX_EXPRESSION_OPERATOR( operator<=, LessEqual )
+MATRIX_EXPRESSION_OPERATOR( operator==, Equal )
+MATRIX_EXPRESSION_OPERATOR( operator!=, NotEqual )
+/*  Entrywise multiplication, operator* is reserved for the matrix product */
+MATRIX_EXPRESSION_OPERATOR( times, Times )
+
+#undef MATRIX_EXPRESSION_OPERATOR
+
+/*  Multiply an expression by a scalar */
+template <typename E>
+inline UnaryExpression<E, expressionops::BindRight<expressionops::Times> > operator*(
+        const MatrixExpression<E>& e, double s ) {
+    return UnaryExpression<E, expressionops::BindRight<expressionops::Times> >(
+        e.self(), expressionops::BindRight<expressionops::Times>( s ) );
+}
+
+/*  Multiply an expression by a scalar */
+template <typename E>
+inline UnaryExpression<E, expressionops::BindRight<expressionops::Times> > operator*(
+        double s, const MatrixExpression<E>& e ) {
+    return e*s;
+}
+
+/*
+ *   Define an element-wise function of an expression
+ */
+#define MATRIX_EXPRESSION_FUNCTION( NAME, FUNCTOR ) \
+template <typename E> \
+inline UnaryExpression<E, expressionops::FUNCTOR> NAME( const MatrixExpression<E>& e ) { \
+    return UnaryExpression<E, expressionops::FUNCTOR>( e.self(), expressionops::FUNCTOR() ); \
+}
+
+MATRIX_EXPRESSION_FUNCTION( operator-, Negate )
+MATRIX_EXPRESSION_FUNCTION( exp, Exp )
+MATRIX_EXPRESSION_FUNCTION( log, Log )
+MATRIX_EXPRESSION_FUNCTION( sqrt, Sqrt )
+MATRIX_EXPRESSION_FUNCTION( positivePart, PositivePart )
+MATRIX_EXPRESSION_FUNCTION( negativePart, NegativePart )
+
+#undef MATRIX_EXPRESSION_FUNCTION
+
+/*
+ *   Evaluation of expressions in a single pass
+ */
+
+template <typename E>
+Matrix::Matrix( const MatrixExpression<E>& expression ) {
+    allocate( expression.nRows()*expression.nCols() );
+    nrows = expression.nRows();
+    ncols = expression.nCols();
+    evaluate( expression.self() );
+}
+
+template <typename E>
+Matrix& Matrix::operator=( const MatrixExpression<E>& expression ) {
+    if (expression.aliases( data, data+nrows*ncols )) {
+        // the expression reads a view of our storage, so
+        // evaluate it into new storage before giving up the old
+        Matrix result( expression );
+        return *this = std::move( result );
+    }
+    if (nrows*ncols != expression.nRows()*expression.nCols()) {
+        deallocate();
+        allocate( expression.nRows()*expression.nCols() );
+    }
+    nrows = expression.nRows();
+    ncols = expression.nCols();
+    evaluate( expression.self() );
+    return *this;
+}
+
+template <typename E>
+Matrix& Matrix::operator+=( const MatrixExpression<E>& expression ) {
+    ASSERT( nrows==expression.nRows() && ncols==expression.nCols() );
+    if (expression.aliases( data, data+nrows*ncols )) {
+        Matrix values( expression );
+        return *this += lazy( values );
+    }
+    const E& e = expression.self();
+    int n = nrows*ncols;
+    double chunk[EXPRESSION_CHUNK];
+    for (int first=0; first<n; first+=EXPRESSION_CHUNK) {
+        int size = std::min( EXPRESSION_CHUNK, n-first );
+        e.evaluate( first, size, chunk );
+        double* d = data+first;
+        for (int i=0; i<size; i++) {
+            d[i] += chunk[i];
+        }
+    }
+    return *this;
+}
+
+template <typename E>
+Matrix& Matrix::operator-=( const MatrixExpression<E>& expression ) {
+    ASSERT( nrows==expression.nRows() && ncols==expression.nCols() );
+    if (expression.aliases( data, data+nrows*ncols )) {
+        Matrix values( expression );
+        return *this -= lazy( values );
+    }
+    const E& e = expression.self();
+    int n = nrows*ncols;
+    double chunk[EXPRESSION_CHUNK];
+    for (int first=0; first<n; first+=EXPRESSION_CHUNK) {
+        int size = std::min( EXPRESSION_CHUNK, n-first );
+        e.evaluate( first, size, chunk );
+        double* d = data+first;
+        for (int i=0; i<size; i++) {
+            d[i] -= chunk[i];
+        }
+    }
+    return *this;
+}
+
+template <typename E>
+void Matrix::times( const MatrixExpression<E>& expression ) {
+    ASSERT( nrows==expression.nRows() && ncols==expression.nCols() );
+    if (expression.aliases( data, data+nrows*ncols )) {
+        Matrix values( expression );
+        times( lazy( values ) );
+        return;
+    }
+    const E& e = expression.self();
+    int n = nrows*ncols;
+    double chunk[EXPRESSION_CHUNK];
+    for (int first=0; first<n; first+=EXPRESSION_CHUNK) {
+        int size = std::min( EXPRESSION_CHUNK, n-first );
+        e.evaluate( first, size, chunk );
+        double* d = data+first;
+        for (int i=0; i<size; i++) {
+            d[i] *= chunk[i];
+        }
+    }
+}
+
+template <typename E>
+void Matrix::evaluate( const E& e ) {
+    int n = nrows*ncols;
+    for (int first=0; first<n; first+=EXPRESSION_CHUNK) {
+        e.evaluate( first, std::min( EXPRESSION_CHUNK, n-first ), data+first );
+    }
+}
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testMatrixExpression();
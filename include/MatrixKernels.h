@@ -0,0 +1,91 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ *   Low level numerical kernels working on raw column-major
+ *   arrays. The Matrix class uses these for its heavy lifting.
+ *
+ *   Each kernel has a portable version and, on x86 compilers that
+ *   support it, AVX2 and AVX-512 versions. The version to use is
+ *   chosen at run time according to what the CPU supports.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FINMATLIB_X86_SIMD 1
+#endif
+
+/*  The instruction sets the kernels know how to use */
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512 = 2
+};
+
+/*  The best instruction set supported by this CPU */
+SimdLevel detectSimdLevel();
+/*  The instruction set the kernels currently use */
+SimdLevel getSimdLevel();
+/*  Restrict the kernels to the given instruction set. Levels the CPU
+    doesn't support are ignored. Useful for testing and benchmarks. */
+void setSimdLevel( SimdLevel level );
+/*  A readable name for an instruction set */
+const char* simdLevelName( SimdLevel level );
+
+/**
+ *  General matrix multiplication, c = alpha*a*b + beta*c, where
+ *  a is m by k, b is k by n and c is m by n. lda, ldb and ldc are
+ *  the distances between consecutive columns of each matrix.
+ */
+void gemm( int m, int n, int k,
+           double alpha,
+           const double* a, int lda,
+           const double* b, int ldb,
+           double beta,
+           double* c, int ldc );
+
+/*  Exponentiate n values in place */
+void vectorExp( double* x, int n );
+/*  Take the log of n values in place */
+void vectorLog( double* x, int n );
+/*  Square root n values in place */
+void vectorSqrt( double* x, int n );
+/*  Raise n values to a power in place */
+void vectorPow( double* x, int n, double power );
+/*  Raise n values to the corresponding powers in place */
+void vectorPow( double* x, const double* power, int n );
+/*  Replace n values with their positive part */
+void vectorPositivePart( double* x, int n );
+/*  Replace n values with their negative part */
+void vectorNegativePart( double* x, int n );
+
+/*  Replace n uniform random numbers with the inverse of the normal
+    cumulative distribution function, using the same Moro algorithm
+    as norminv */
+void vectorNormInv( double* x, int n );
+
+/*  The comparisons supported by vectorCompare */
+enum Comparison {
+    COMPARE_LESS,
+    COMPARE_LESS_EQUAL,
+    COMPARE_GREATER,
+    COMPARE_GREATER_EQUAL,
+    COMPARE_EQUAL,
+    COMPARE_NOT_EQUAL
+};
+
+/*  Set out[i] to 1 if x[i] compares true with s and 0 otherwise */
+void vectorCompare( const double* x, double s, double* out, int n,
+                    Comparison comparison );
+/*  Set out[i] to 1 if x[i] compares true with y[i] and 0 otherwise */
+void vectorCompare( const double* x, const double* y, double* out, int n,
+                    Comparison comparison );
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testMatrixKernels();
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Matrix.h"
+
+/**
+ *   A read-only window onto the storage of a Matrix. Taking a
+ *   column, row or block of a view costs nothing, so functions that
+ *   only read part of a matrix should take a const MatrixView&.
+ *   A Matrix converts to a view of the whole matrix automatically.
+ *
+ *   Element (i,j) of the view is data[i*rowStride + j*colStride].
+ *   The view does not own its data, so the matrix must outlive it.
+ */
+class MatrixView {
+public:
+    /*  View some data with the given strides */
+    MatrixView( const double* data, int nrows, int ncols,
+                int rowStride, int colStride ) :
+        data( data ),
+        nrows( nrows ),
+        ncols( ncols ),
+        rowStride( rowStride ),
+        colStride( colStride ) {
+    }
+
+    /*  View a whole matrix */
+    MatrixView( const Matrix& m ) :
+        data( m.begin() ),
+        nrows( m.nRows() ),
+        ncols( m.nCols() ),
+        rowStride( 1 ),
+        colStride( m.nRows() ) {
+    }
+
+    /*  The number of rows in the view */
+    int nRows() const {
+        return nrows;
+    }
+
+    /*  The number of columns in the view */
+    int nCols() const {
+        return ncols;
+    }
+
+    /*  The distance between consecutive rows */
+    int getRowStride() const {
+        return rowStride;
+    }
+
+    /*  The distance between consecutive columns */
+    int getColStride() const {
+        return colStride;
+    }
+
+    /*  A pointer to element (0,0) */
+    const double* begin() const {
+        return data;
+    }
+
+    /*  Access a cell using parentheses */
+    const double& operator()( int i, int j ) const {
+        ASSERT( i>=0 && i<nrows && j>=0 && j<ncols );
+        return data[ i*rowStride + j*colStride ];
+    }
+
+    /*  Access a cell of a row or column vector */
+    const double& operator()( int i ) const {
+        ASSERT( nrows==1 || ncols==1 );
+        return (ncols==1) ? (*this)(i,0) : (*this)(0,i);
+    }
+
+    /*  The given column */
+    MatrixView col( int j ) const {
+        ASSERT( j>=0 && j<ncols );
+        return MatrixView( data + j*colStride, nrows, 1, rowStride, colStride );
+    }
+
+    /*  The given row */
+    MatrixView row( int i ) const {
+        ASSERT( i>=0 && i<nrows );
+        return MatrixView( data + i*rowStride, 1, ncols, rowStride, colStride );
+    }
+
+    /*  The rows from firstRow to firstRow+count-1 */
+    MatrixView rowRange( int firstRow, int count ) const {
+        return block( firstRow, 0, count, ncols );
+    }
+
+    /*  The block of the given size whose top left is (i,j) */
+    MatrixView block( int i, int j, int blockRows, int blockCols ) const {
+        ASSERT( i>=0 && blockRows>=0 && i+blockRows<=nrows );
+        ASSERT( j>=0 && blockCols>=0 && j+blockCols<=ncols );
+        return MatrixView( data + i*rowStride + j*colStride,
+                           blockRows, blockCols, rowStride, colStride );
+    }
+
+    /*  Is the view laid out like a Matrix, i.e. column-major
+        with no gaps? */
+    bool isContiguous() const {
+        return rowStride==1 && (colStride==nrows || ncols<=1);
+    }
+
+    /*  The distance between elements i and i+1 when the view is read
+        in column-major order. Only vectors and contiguous views
+        can be read this way. */
+    int linearStride() const {
+        if (ncols==1) {
+            return rowStride;
+        } else if (nrows==1) {
+            return colStride;
+        }
+        ASSERT( isContiguous() );
+        return 1;
+    }
+
+private:
+    const double* data;
+    int nrows;
+    int ncols;
+    int rowStride;
+    int colStride;
+};
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testMatrixView();
@@ -4,6 +4,78 @@
 #include "ContinuousTimeOption.h"
 #include "MultiStockModel.h"
 
+/**
+ *   A Monte Carlo price together with its accuracy
+ */
+struct MonteCarloResult {
+    /*  The estimated price */
+    double price;
+    /*  The standard error of the estimate */
+    double standardError;
+    /*  The 95% confidence interval for the price */
+    double confidenceLower;
+    double confidenceUpper;
+    /*  The number of scenarios used. With antithetic variates
+        each scenario is a pair of paths. */
+    long long nScenarios;
+    /*  The time taken in seconds */
+    double elapsed;
+    /*  How many times as many paths plain Monte Carlo would need
+        for the same standard error. This is the variance of a
+        single path's payoff divided by the variance per path of
+        the estimate, so it is 1 without variance reduction. */
+    double varianceReduction;
+    /*  The estimated coefficient of the control variate,
+        or 0 if there wasn't one */
+    double controlCoefficient;
+};
+
+/**
+ *   The ways the pricer can estimate Greeks
+ */
+enum GreeksMethod {
+    /*  Differentiate each path's discounted payoff. Delta and vega
+        are then unbiased with the least variance, and gamma is the
+        derivative of the pathwise delta weighted by the likelihood
+        ratio of the final price. Needs the derivative of the
+        payoff, so only applies to payoffs that are Lipschitz in
+        the final price. */
+    GREEKS_PATHWISE,
+    /*  Weight each path's discounted payoff by the derivative of
+        the log of the path's density. This applies to payoffs with
+        jumps, such as barriers, but needs the whole paths, and the
+        variance of delta and gamma grows as the first step
+        shrinks. The Brownian bridge makes a payoff depend on the
+        volatility other than through the simulated prices, so it
+        doesn't apply to continuously monitored barriers. */
+    GREEKS_LIKELIHOOD_RATIO,
+    /*  Central differences of the prices from models with the
+        stock price and volatility bumped, driven by the same
+        normals as the price. This applies to any option, but
+        simulates four more sets of paths and is biased by the
+        square of the bump. */
+    GREEKS_BUMP
+};
+
+/**
+ *   A Monte Carlo price and its sensitivities to the stock price
+ *   and the volatility, each with its standard error
+ */
+struct MonteCarloGreeks {
+    double price;
+    double delta;
+    double gamma;
+    double vega;
+    double priceError;
+    double deltaError;
+    double gammaError;
+    double vegaError;
+    /*  How the Greeks were estimated */
+    GreeksMethod method;
+    /*  The number of scenarios used */
+    long long nScenarios;
+};
+
 class MonteCarloPricer {
 public:
     /*  Constructor */
@@ -14,12 +86,121 @@ public:
     int nSteps;
 	/*  The number of concurrent tasks to run */
 	int nTasks;
+	/*  Should each task allocate its matrices from its own arena
+	    rather than the heap? */
+	bool useArena;
+	/*  Should paths be generated and evaluated concurrently? Blocks
+	    of paths are passed from generating tasks to evaluating tasks
+	    through a bounded queue, so memory use depends on the queue
+	    depth rather than the number of scenarios. Antithetic
+	    variates, control variates and moment matching aren't used
+	    when streaming. */
+	bool streaming;
+	/*  The number of scenarios in each block when streaming */
+	int pathsPerBlock;
+	/*  The number of blocks that may wait to be evaluated when
+	    streaming */
+	int queueDepth;
+	/*  Should options whose payoffs only need some statistics of
+	    each path be priced by accumulating those statistics as the
+	    paths are generated, rather than storing the paths? */
+	bool usePathSummaries;
+	/*  Should each scenario be a pair of paths, the second driven
+	    by the negated normals of the first? The scenario's payoff
+	    is the average over the pair. */
+	bool antithetic;
+	/*  Should the option's control variate be used if it has
+	    one? Its coefficient is estimated from the same scenarios
+	    as the price, which biases the price by O(1/n). */
+	bool controlVariate;
+	/*  Should each step's normals be shifted and scaled to have
+	    mean 0 and variance 1 over each batch of scenarios? The
+	    scenarios are then not quite independent, so the standard
+	    error is approximate, and the price depends on how the
+	    scenarios are split into batches and tasks. */
+	bool momentMatching;
+	/*  Should the normals come from a scrambled Sobol sequence
+	    rather than Philox? For smooth payoffs quasi-random points
+	    converge faster than 1/sqrt(n). The standard error is still
+	    estimated as if the scenarios were independent, which
+	    overstates the error. */
+	bool quasiRandom;
+	/*  Should quasi-random paths be built in Brownian bridge order,
+	    so that the first dimensions of the Sobol sequence, which
+	    are the most evenly spread, decide the final prices? */
+	bool brownianBridge;
+	/*  The seed of the random numbers, or of the scrambling
+	    of the Sobol sequence */
+	uint64_t seed;
+	/*  How greeks estimates the Greeks. If the method doesn't
+	    apply to an option, the likelihood ratio is used instead of
+	    pathwise derivatives, and bumps instead of the likelihood
+	    ratio. */
+	GreeksMethod greeksMethod;
+	/*  The size of the bumps to the stock price and the
+	    volatility, as a fraction of each */
+	double greeksBump;
+	/*  If positive, priceWithError stops once the standard error of
+	    the price is below this. nScenarios is then the most
+	    scenarios it will use. */
+	double targetStandardError;
+	/*  If positive, priceWithError stops once this many seconds
+	    have been spent */
+	double timeBudget;
     /*  Price a path dependent option */
     double price( const ContinuousTimeOption& option,
                   const BlackScholesModel& model ) const;
 	/*  Price a path dependent option */
 	double price(const ContinuousTimeOption& option,
 		const MultiStockModel& model) const;
+	/*  Price an option, also estimating the accuracy of the price.
+	    Without a target standard error or a time budget this uses
+	    nScenarios scenarios. Otherwise the scenarios are generated
+	    in rounds, shared between the tasks, and the combined
+	    standard error and time taken are checked between rounds
+	    to decide whether to stop. Streaming isn't used. */
+	MonteCarloResult priceWithError(const ContinuousTimeOption& option,
+		const BlackScholesModel& model) const;
+	/*  Price an option, also estimating the accuracy of the price */
+	MonteCarloResult priceWithError(const ContinuousTimeOption& option,
+		const MultiStockModel& model) const;
+	/*  Price several options, possibly on different stocks of the
+	    model, in groups that share one set of scenarios. The paths
+	    of every stock a group needs are simulated once, up to its
+	    latest maturity, on a time grid with a step at each
+	    maturity, and each option's payoff is evaluated on the paths
+	    up to its own maturity. Options with the same maturity are
+	    always grouped. Groups with different maturities are merged
+	    if one grid giving each path dependent option at least
+	    nSteps has no more steps than their own grids together, so
+	    some options may be monitored more often than if they were
+	    priced alone. Path summaries are only kept if a group's
+	    maturities are all the same and its options' barriers don't
+	    differ. Otherwise an option with a continuously monitored
+	    barrier summarises its own part of the whole paths, so it
+	    still has the Brownian bridge. Streaming isn't used. */
+	std::vector<double> price(
+		const std::vector<SPCContinuousTimeOption>& options,
+		const MultiStockModel& model) const;
+	/*  Price several options from one set of scenarios, also
+	    estimating the accuracy of each price. An adaptive pricing
+	    stops once every option's standard error is below the
+	    target. */
+	std::vector<MonteCarloResult> priceWithError(
+		const std::vector<SPCContinuousTimeOption>& options,
+		const MultiStockModel& model) const;
+	/*  Estimate an option's price, delta, gamma and vega from one
+	    set of scenarios. These are the scenarios price uses, and
+	    there is neither streaming, adaptive stopping nor variance
+	    reduction other than quasi-random numbers. */
+	MonteCarloGreeks greeks(const ContinuousTimeOption& option,
+		const BlackScholesModel& model) const;
+	/*  Estimate the price and Greeks of several options on the
+	    model's stock, sharing scenarios between groups of them
+	    as for the batch price */
+	std::vector<MonteCarloGreeks> greeks(
+		const std::vector<SPCContinuousTimeOption>& options,
+		const BlackScholesModel& model) const;
 };
 
 void testMonteCarloPricer();
@@ -4,6 +4,8 @@
 #include "Matrix.h"
 #include "BlackScholesModel.h"
 #include "MarketSimulation.h"
+#include "Philox.h"
+#include "Sobol.h"
 
 /**
  *   A model for a collection of stocks that uses
@@ -20,6 +22,17 @@ public:
 		Matrix drifts,
 		Matrix covarianceMatrix);
 
+	/*  Create a factor model, in which the covariance matrix is
+		B*B' + D for an n by k matrix of factor loadings B and a
+		diagonal matrix D of idiosyncratic variances, given as a
+		column vector. Paths cost O(n*k) per step rather than
+		O(n*n), which matters for large universes. */
+	MultiStockModel(std::vector<std::string> stocks,
+		Matrix stockPrices,
+		Matrix drifts,
+		Matrix factorLoadings,
+		Matrix idiosyncraticVariances);
+
 	/*  The risk free rate */
 	double getRiskFreeRate() const {
 		return riskFreeRate;
@@ -36,6 +49,14 @@ public:
 	void setDate(double date ) {
 		this->date = date;
 	}
+	/*  How the simulations from generatePricePaths are laid out */
+	PathLayout getPathLayout() const {
+		return pathLayout;
+	}
+	/*  Setter */
+	void setPathLayout(PathLayout pathLayout) {
+		this->pathLayout = pathLayout;
+	}
 	/*  Get the names of the stocks */
 	std::vector<std::string> getStocks() {
 		return stockNames;
@@ -45,9 +66,34 @@ public:
 		return stockPrices(getIndex(stock),0);
 	}
 
-	Matrix getCovarianceMatrix() {
-		return covarianceMatrix;
+	/*  The covariance matrix. For a factor model this is
+		computed each time it is asked for. */
+	Matrix getCovarianceMatrix() const;
+
+	/*  The covariance of the log returns of two stocks */
+	double getCovariance(const std::string& stock1,
+		const std::string& stock2) const;
+
+	/*  Change the covariance matrix. A factor model becomes a
+		model with a full covariance matrix. */
+	void setCovarianceMatrix(const Matrix& covarianceMatrix);
+
+	/*  Is the covariance given by factor loadings? */
+	bool isFactorModel() const {
+		return nFactors > 0;
 	}
+	/*  The number of factors, or zero if this isn't a factor model */
+	int getNumberOfFactors() const {
+		return nFactors;
+	}
+
+	/*  A factor of the covariance matrix A, that is a square matrix
+		B with B*B' equal to A. Normally this is the lower triangular
+		Cholesky factor. If A is only positive semidefinite up to
+		rounding the pivoted factor from cholPivoted is used instead.
+		It is computed the first time it is needed and shared by
+		copies of the model until the covariance changes. */
+	std::shared_ptr<const Matrix> getCholeskyFactor() const;
 
 	/*  Extract the 1-d sub model for a given
 		stock code */
@@ -72,12 +118,84 @@ public:
 		double toDate,
 		int nPaths,
 		int nSteps) const;
+	/*  Returns paths firstPath to firstPath+nPaths-1 of a
+		simulation in the P measure. Every path has its own random
+		numbers, so how the paths are split into batches or tasks
+		doesn't change them. */
+	MarketSimulation generatePricePaths(
+		const Philox& rng,
+		long long firstPath,
+		double toDate,
+		int nPaths,
+		int nSteps) const;
+	/*  Returns paths firstPath to firstPath+nPaths-1 of a
+		simulation in the Q measure */
+	MarketSimulation generateRiskNeutralPricePaths(
+		const Philox& rng,
+		long long firstPath,
+		double toDate,
+		int nPaths,
+		int nSteps) const;
+	/*  Returns summaries of paths firstPath to firstPath+nPaths-1
+		of a simulation in the Q measure. Only the given statistics
+		of each path are kept, and they are accumulated as the paths
+		are generated, so memory use doesn't grow with the number
+		of steps. The paths are the same as those from
+		generateRiskNeutralPricePaths. */
+	MarketSimulation generateRiskNeutralPathSummaries(
+		const Philox& rng,
+		long long firstPath,
+		double toDate,
+		int nPaths,
+		int nSteps,
+		const PathStatistics& statistics) const;
 	/* How many random numbers are needed
 	   to generate the given paths? */
 	long long randSize(long long nPaths,
-					   long long nSteps) {
-		return stockNames.size()*nPaths*nSteps;
+					   long long nSteps) const {
+		return (stockNames.size() + nFactors)*nPaths*nSteps;
 	}
+	/*  Fills a matrix with the normal random numbers
+		for the given time step */
+	typedef std::function<void(int step, Matrix& normals)> NormalSource;
+	/*  Draws the normals for paths firstPath onwards from
+		their own Philox streams, as the Philox overloads do */
+	static NormalSource philoxNormals(const Philox& rng, long long firstPath);
+	/*  Draws the normals for paths firstPath onwards from points
+		firstPath+1 onwards of a Sobol sequence with a dimension
+		for each step and stock, skipping point 0 at the corner of
+		the cube. The steps of a path take the dimensions in order
+		or, with brownianBridge set, in Brownian bridge order so
+		that the first dimensions decide the final prices. All the
+		steps' normals are made when the first step's are asked
+		for, so the sequence must have randSize(1, nSteps)
+		dimensions. */
+	static NormalSource sobolNormals(const SobolSequence& sobol,
+		long long firstPath,
+		int nSteps,
+		bool brownianBridge);
+	/*  Negates the normals from another source, which gives
+		the antithetic paths */
+	static NormalSource antitheticNormals(NormalSource normals);
+	/*  Shifts and scales each column of the normals from another
+		source so that it has sample mean 0 and variance 1 */
+	static NormalSource momentMatchedNormals(NormalSource normals);
+	/*  Returns a simulation in the Q measure driven by
+		the given normals */
+	MarketSimulation generateRiskNeutralPricePaths(
+		NormalSource normals,
+		double toDate,
+		int nPaths,
+		int nSteps) const;
+	/*  Returns summaries of a simulation in the Q measure
+		driven by the given normals */
+	MarketSimulation generateRiskNeutralPathSummaries(
+		NormalSource normals,
+		double toDate,
+		int nPaths,
+		int nSteps,
+		const PathStatistics& statistics) const;
+
 	/*  For testing it is useful to have a standard
 		dummy name for stocks */
 	static const std::string DEFAULT_STOCK;
@@ -95,19 +213,61 @@ private:
 	Matrix drifts;
 	/*  A column vector of current stock prices */
 	Matrix stockPrices;
-	/*  The covariance matrix */
+	/*  The covariance matrix, unless this is a factor model */
 	Matrix covarianceMatrix;
+	/*  The number of factors in a factor model, zero otherwise */
+	int nFactors;
+	/*  A factor model's loadings, one row per stock */
+	Matrix factorLoadings;
+	/*  The transpose of the loadings, which path
+		generation multiplies by */
+	Matrix factorLoadingsTransposed;
+	/*  A factor model's idiosyncratic variances */
+	Matrix idiosyncraticVariances;
 	/*  The risk free rate */
 	double riskFreeRate;
 	/*  The current date */
 	double date;
+	/*  The layout of simulated paths */
+	PathLayout pathLayout = PATHS_BY_STEP;
+	/*  The factor of the covariance matrix and its transpose,
+		which is what path generation multiplies by */
+	struct CholeskyFactor {
+		Matrix lower;
+		Matrix transposed;
+		/*  Is it the lower triangular Cholesky factor, rather
+			than the pivoted one? */
+		bool isLower;
+	};
+	/*  The factor, or null if it hasn't been needed yet. Threads
+		pricing with the same model may race to compute it, so it
+		is only read and written atomically. */
+	mutable std::shared_ptr<const CholeskyFactor> cholesky;
+	/*  The factor, computing it if need be */
+	std::shared_ptr<const CholeskyFactor> cachedCholesky() const;
+	/*  Store a factor, made from the heap as it may outlive
+		the caller's arena */
+	void setCholesky(const Matrix& lower, bool isLower) const;
+	/*  The variance of the given stock */
+	double getVariance(int idx) const;
 	/*  Generate price paths with the given drifts */
 	MarketSimulation generatePricePaths(
-		std::mt19937& rng,
+		NormalSource normals,
 		double toDate,
 		int nPaths,
 		int nSteps,
 		Matrix drifts) const;
+	/*  Receives each step's log prices, one column per stock */
+	typedef std::function<void(int step, const Matrix& logPrices)> LogPriceSink;
+	/*  Simulate the log prices with the given drifts,
+		passing each step's to the sink */
+	void simulateLogPrices(
+		NormalSource normals,
+		double toDate,
+		int nPaths,
+		int nSteps,
+		Matrix drifts,
+		LogPriceSink sink) const;
 
 	/*  Gets the index of a given stock in the matrices */
 	int getIndex(const std::string&  stockCode)
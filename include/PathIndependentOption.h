@@ -14,12 +14,38 @@ public:
     virtual ~PathIndependentOption() {}
     /*  Returns the payoff at maturity given a column vector
         of scenarios */
-    virtual Matrix payoffAtMaturity( const Matrix& finalStockPrice) const
+    virtual Matrix payoffAtMaturity( const MatrixView& finalStockPrice) const
         = 0;
     /*  Compute the payoff from a price path */   
     Matrix payoff(
-            const Matrix& stockPrices ) const {
-        return payoffAtMaturity( stockPrices.col( stockPrices.nCols()-1 ) );                
+            const MatrixView& stockPrices ) const {
+        return payoffAtMaturity( stockPrices.col( stockPrices.nCols()-1 ) );
+    }
+    /*  Only the final price is needed */
+    PathStatistics getPathStatistics() const {
+        PathStatistics statistics;
+        statistics.terminal = true;
+        return statistics;
+    }
+    /*  Compute the payoff from the final prices */
+    Matrix payoff( const PathSummary& summary ) const {
+        return payoffAtMaturity( summary.getTerminal() );
+    }
+    /*  Returns the derivative of the payoff at maturity with
+        respect to the final price, for options whose payoff is
+        Lipschitz in it. Those should also override
+        hasPayoffDerivative. */
+    virtual Matrix derivativeAtMaturity( const MatrixView& finalStockPrice ) const {
+        throw std::logic_error( "The option's payoff has no derivative" );
+    }
+    /*  The derivative of each scenario's payoff with respect
+        to the final price */
+    Matrix payoffDerivative( const MarketSimulation& sim ) const {
+        if (sim.hasPathSummaries()) {
+            return derivativeAtMaturity( sim.getPathSummary( getStock() ).getTerminal() );
+        }
+        MatrixView prices = sim.getStockPrices( getStock() );
+        return derivativeAtMaturity( prices.col( prices.nCols()-1 ) );
     }
     /*  Is the option path dependent? */
     bool isPathDependent() const {
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Matrix.h"
+
+class MatrixView;
+
+/**
+ *   The statistics of each simulated path that a payoff needs.
+ *   Many payoffs depend on a path only through a few numbers,
+ *   which can be accumulated as the path is generated instead
+ *   of storing every price.
+ */
+struct PathStatistics {
+    /*  The price at the last step */
+    bool terminal = false;
+    /*  The largest price over the steps */
+    bool maximum = false;
+    /*  The smallest price over the steps */
+    bool minimum = false;
+    /*  The average price over the steps */
+    bool average = false;
+    /*  Whether the price is ever at or above upperBarrier */
+    bool hitsUpper = false;
+    double upperBarrier = 0.0;
+    /*  Whether the price is ever at or below lowerBarrier */
+    bool hitsLower = false;
+    double lowerBarrier = 0.0;
+    /*  The probability that the price never reaches upperBarrier
+        if it is monitored continuously. The path between steps is
+        a Brownian bridge in the log price, so a path that is below
+        the barrier at both ends of a step still crosses it with a
+        probability that can be computed exactly. */
+    bool survivesUpper = false;
+    /*  The probability that the price never reaches lowerBarrier
+        if it is monitored continuously */
+    bool survivesLower = false;
+
+    /*  Are no statistics needed? */
+    bool isEmpty() const {
+        return !(terminal || maximum || minimum || average
+                 || hitsUpper || hitsLower || survivesUpper || survivesLower);
+    }
+
+    /*  Are any statistics needed that use the Brownian bridge? */
+    bool needsBridge() const {
+        return survivesUpper || survivesLower;
+    }
+
+    /*  Can these statistics be kept together with another
+        payoff's? Not if they need different barriers. */
+    bool isCompatible( const PathStatistics& other ) const {
+        bool upper = (hitsUpper || survivesUpper) && (other.hitsUpper || other.survivesUpper);
+        bool lower = (hitsLower || survivesLower) && (other.hitsLower || other.survivesLower);
+        return !(upper && upperBarrier!=other.upperBarrier)
+            && !(lower && lowerBarrier!=other.lowerBarrier);
+    }
+
+    /*  Also keep the statistics another payoff needs. Both
+        must use the same barriers. */
+    void include( const PathStatistics& other ) {
+        if (other.hitsUpper || other.survivesUpper) {
+            ASSERT( !(hitsUpper || survivesUpper) || upperBarrier==other.upperBarrier );
+            upperBarrier = other.upperBarrier;
+        }
+        if (other.hitsLower || other.survivesLower) {
+            ASSERT( !(hitsLower || survivesLower) || lowerBarrier==other.lowerBarrier );
+            lowerBarrier = other.lowerBarrier;
+        }
+        terminal = terminal || other.terminal;
+        maximum = maximum || other.maximum;
+        minimum = minimum || other.minimum;
+        average = average || other.average;
+        hitsUpper = hitsUpper || other.hitsUpper;
+        hitsLower = hitsLower || other.hitsLower;
+        survivesUpper = survivesUpper || other.survivesUpper;
+        survivesLower = survivesLower || other.survivesLower;
+    }
+};
+
+/**
+ *   The requested statistics of a number of paths of one stock,
+ *   each held as a column vector with one row per path
+ */
+class PathSummary {
+public:
+    /*  A summary of nPaths paths, to be filled in by addStep */
+    PathSummary( int nPaths, const PathStatistics& statistics );
+
+    /*  The price at the start of the paths and the variance of
+        the log price over each step, which the survival
+        probabilities need. Call this before adding any steps. */
+    void setBridge( double initialPrice, double stepVariance );
+
+    /*  Include the prices of every path at the next step */
+    void addStep( const double* prices );
+
+    /*  Include every step of some whole paths, one row per path */
+    void addSteps( const MatrixView& prices );
+
+    /*  The statistics kept */
+    const PathStatistics& getStatistics() const {
+        return statistics;
+    }
+    /*  The number of paths */
+    int nPaths() const {
+        return npaths;
+    }
+    /*  The number of steps added so far */
+    int nSteps() const {
+        return nsteps;
+    }
+
+    /*  The final prices */
+    const Matrix& getTerminal() const;
+    /*  The largest price of each path */
+    const Matrix& getMaximum() const;
+    /*  The smallest price of each path */
+    const Matrix& getMinimum() const;
+    /*  The average price of each path */
+    Matrix getAverage() const;
+    /*  1 if the path reached the upper barrier and 0 otherwise */
+    const Matrix& getHitsUpper() const;
+    /*  1 if the path reached the lower barrier and 0 otherwise */
+    const Matrix& getHitsLower() const;
+    /*  The probability the continuous path never reached
+        the upper barrier */
+    const Matrix& getSurvivesUpper() const;
+    /*  The probability the continuous path never reached
+        the lower barrier */
+    const Matrix& getSurvivesLower() const;
+
+private:
+    PathStatistics statistics;
+    int npaths;
+    int nsteps;
+    /*  The statistics, only allocated if they were requested */
+    Matrix terminal;
+    Matrix maximum;
+    Matrix minimum;
+    Matrix total;
+    Matrix hitsUpper;
+    Matrix hitsLower;
+    Matrix survivesUpper;
+    Matrix survivesLower;
+    /*  The log prices at the last step added, for the bridge */
+    Matrix previousLogPrices;
+    Matrix logPrices;
+    Matrix scratch;
+    double initialPrice;
+    double stepVariance;
+};
+
+typedef std::shared_ptr<const PathSummary> SPCPathSummary;
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testPathSummary();
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ *   The Philox-4x32-10 counter-based random number generator of
+ *   Salmon et al, "Parallel Random Numbers: As Easy as 1, 2, 3".
+ *
+ *   Each block of four 32 bit outputs is a keyed hash of a 128 bit
+ *   counter, so jumping to any point in the sequence is free. The
+ *   counter is split into a 64 bit stream number and a 64 bit
+ *   position within that stream, which lets independent tasks read
+ *   from disjoint streams or offsets without any discarding.
+ *
+ *   The class satisfies the standard UniformRandomBitGenerator
+ *   requirements so it can be used with the <random> distributions.
+ */
+class Philox {
+public:
+    typedef uint32_t result_type;
+
+    /*  Create a generator at the start of stream 0 */
+    explicit Philox( uint64_t seed=DEFAULT_SEED );
+
+    /*  Change the key, returning to the start of stream 0 */
+    void seed( uint64_t seed=DEFAULT_SEED );
+
+    /*  Move to the start of the given stream */
+    void setStream( uint64_t stream );
+    /*  The current stream */
+    uint64_t getStream() const {
+        return stream;
+    }
+
+    /*  Move to the given number of outputs into the current stream */
+    void setPosition( uint64_t position );
+    /*  The number of outputs read from the current stream */
+    uint64_t getPosition() const {
+        return position;
+    }
+
+    /*  Skip n outputs in constant time */
+    void discard( unsigned long long n ) {
+        setPosition( position + n );
+    }
+
+    /*  The next 32 random bits */
+    result_type operator()() {
+        uint64_t block = position >> 2;
+        if (block != bufferedBlock) {
+            fillBuffer( block );
+        }
+        return buffer[ (position++) & 3 ];
+    }
+
+    /*  Write n uniform random numbers in (0,1) to out. Each uses one
+        output, exactly as randuniform does. */
+    void uniform( double* out, int n );
+
+    static constexpr result_type min() {
+        return 0;
+    }
+    static constexpr result_type max() {
+        return 0xFFFFFFFFu;
+    }
+
+    /*  The seed used by default */
+    static const uint64_t DEFAULT_SEED = 20111111;
+
+    /*  The Philox-4x32-10 function mapping a counter and key to
+        four random words */
+    static void generateBlock( const uint32_t counter[4],
+                               const uint32_t key[2],
+                               uint32_t out[4] );
+
+private:
+    uint32_t key[2];
+    uint64_t stream;
+    uint64_t position;
+    /*  The last block computed, which holds the next output */
+    uint64_t bufferedBlock;
+    uint32_t buffer[4];
+
+    /*  Compute the given block of the current stream */
+    void fillBuffer( uint64_t block );
+};
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testPhilox();
@@ -22,4 +22,316 @@ private:
 };
 
 
+/**
+ *   Waits for another thread by yielding at first, then sleeping,
+ *   so short waits are fast and long ones are cheap
+ */
+class Backoff {
+public:
+	Backoff() : count(0) {
+	}
+	void pause() {
+		if (count < 64) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		count++;
+	}
+private:
+	int count;
+};
+
+/*  The smallest power of two which is at least n */
+inline size_t ringCapacity(int n) {
+	size_t ret = 1;
+	while ((int)ret < n) {
+		ret *= 2;
+	}
+	return ret;
+}
+
+/**
+ *   A bounded lock-free pipeline between exactly one writing thread
+ *   and one reading thread. Values are copied into a ring buffer, so
+ *   a write only waits when the buffer is full and a read when it is
+ *   empty. The batched readN and writeN copy whole runs of values
+ *   and publish them with a single atomic store.
+ *
+ *   The writer calls close() at the end of the stream, after which
+ *   reads drain the remaining values and then report the end.
+ */
+template <typename T>
+class SpscPipeline {
+public:
+	/*  A pipeline holding at least capacity values */
+	explicit SpscPipeline(int capacity) :
+		buffer(ringCapacity(capacity)),
+		mask(buffer.size() - 1),
+		closed(false),
+		readPosition(0),
+		cachedWritePosition(0),
+		writePosition(0),
+		cachedReadPosition(0) {
+	}
+
+	/*  Write a value if there is room */
+	bool tryWrite(const T& value) {
+		return tryWriteN(&value, 1) == 1;
+	}
+	/*  Write as many of the n values as there is room for,
+		returning how many were written */
+	int tryWriteN(const T* values, int n) {
+		size_t tail = writePosition.load(std::memory_order_relaxed);
+		size_t space = buffer.size() - (tail - cachedReadPosition);
+		if (space < (size_t)n) {
+			cachedReadPosition = readPosition.load(std::memory_order_acquire);
+			space = buffer.size() - (tail - cachedReadPosition);
+		}
+		int count = (int)std::min(space, (size_t)n);
+		for (int i = 0; i < count; i++) {
+			buffer[(tail + i) & mask] = values[i];
+		}
+		writePosition.store(tail + count, std::memory_order_release);
+		return count;
+	}
+	/*  Write a value, waiting for room. Returns false if the
+		pipeline has been closed. */
+	bool write(const T& value) {
+		return writeN(&value, 1);
+	}
+	/*  Write n values, waiting for room */
+	bool writeN(const T* values, int n) {
+		Backoff backoff;
+		while (n > 0) {
+			if (isClosed()) {
+				return false;
+			}
+			int written = tryWriteN(values, n);
+			values += written;
+			n -= written;
+			if (written == 0) {
+				backoff.pause();
+			}
+		}
+		return true;
+	}
+
+	/*  Read a value if there is one */
+	bool tryRead(T& value) {
+		return tryReadN(&value, 1) == 1;
+	}
+	/*  Read up to n values if there are any, returning how many */
+	int tryReadN(T* out, int n) {
+		size_t head = readPosition.load(std::memory_order_relaxed);
+		size_t available = cachedWritePosition - head;
+		if (available < (size_t)n) {
+			cachedWritePosition = writePosition.load(std::memory_order_acquire);
+			available = cachedWritePosition - head;
+		}
+		int count = (int)std::min(available, (size_t)n);
+		for (int i = 0; i < count; i++) {
+			out[i] = std::move(buffer[(head + i) & mask]);
+		}
+		readPosition.store(head + count, std::memory_order_release);
+		return count;
+	}
+	/*  Read a value, waiting for one. Returns false at the end of
+		the stream. */
+	bool read(T& value) {
+		return readN(&value, 1) == 1;
+	}
+	/*  Read between 1 and n values, waiting until there are some.
+		Returns 0 at the end of the stream. */
+	int readN(T* out, int n) {
+		Backoff backoff;
+		while (true) {
+			int count = tryReadN(out, n);
+			if (count > 0) {
+				return count;
+			}
+			if (isClosed()) {
+				// values written before the close are visible now
+				return tryReadN(out, n);
+			}
+			backoff.pause();
+		}
+	}
+
+	/*  Mark the end of the stream */
+	void close() {
+		closed.store(true, std::memory_order_release);
+	}
+	/*  Has the stream ended? */
+	bool isClosed() const {
+		return closed.load(std::memory_order_acquire);
+	}
+	/*  The number of values the pipeline can hold */
+	int capacity() const {
+		return (int)buffer.size();
+	}
+
+private:
+	std::vector<T> buffer;
+	size_t mask;
+	std::atomic<bool> closed;
+	/*  The reader's position and its copy of the writer's, on one
+		cache line, and the writer's equivalents on another */
+	alignas(64) std::atomic<size_t> readPosition;
+	size_t cachedWritePosition;
+	alignas(64) std::atomic<size_t> writePosition;
+	size_t cachedReadPosition;
+};
+
+/**
+ *   A bounded lock-free pipeline which any number of threads may
+ *   write to and read from, using Dmitry Vyukov's ring buffer where
+ *   each cell carries a sequence number saying whose turn it is.
+ *   Values are only ordered per writer. The interface matches
+ *   SpscPipeline.
+ */
+template <typename T>
+class MpmcPipeline {
+public:
+	/*  A pipeline holding at least capacity values */
+	explicit MpmcPipeline(int capacity) :
+		cells(ringCapacity(capacity)),
+		mask(cells.size() - 1),
+		closed(false),
+		writePosition(0),
+		readPosition(0) {
+		for (size_t i = 0; i < cells.size(); i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	/*  Write a value if there is room */
+	bool tryWrite(const T& value) {
+		size_t position = writePosition.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+			if (difference == 0) {
+				if (writePosition.compare_exchange_weak(position, position + 1,
+						std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (difference < 0) {
+				return false;
+			} else {
+				position = writePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	/*  Write as many of the n values as there is room for,
+		returning how many were written */
+	int tryWriteN(const T* values, int n) {
+		int count = 0;
+		while (count < n && tryWrite(values[count])) {
+			count++;
+		}
+		return count;
+	}
+	/*  Write a value, waiting for room. Returns false if the
+		pipeline has been closed. */
+	bool write(const T& value) {
+		return writeN(&value, 1);
+	}
+	/*  Write n values, waiting for room */
+	bool writeN(const T* values, int n) {
+		Backoff backoff;
+		while (n > 0) {
+			if (isClosed()) {
+				return false;
+			}
+			int written = tryWriteN(values, n);
+			values += written;
+			n -= written;
+			if (written == 0) {
+				backoff.pause();
+			}
+		}
+		return true;
+	}
+
+	/*  Read a value if there is one */
+	bool tryRead(T& value) {
+		size_t position = readPosition.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(position + 1);
+			if (difference == 0) {
+				if (readPosition.compare_exchange_weak(position, position + 1,
+						std::memory_order_relaxed)) {
+					value = std::move(cell.value);
+					cell.sequence.store(position + mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (difference < 0) {
+				return false;
+			} else {
+				position = readPosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	/*  Read up to n values if there are any, returning how many */
+	int tryReadN(T* out, int n) {
+		int count = 0;
+		while (count < n && tryRead(out[count])) {
+			count++;
+		}
+		return count;
+	}
+	/*  Read a value, waiting for one. Returns false at the end of
+		the stream. */
+	bool read(T& value) {
+		return readN(&value, 1) == 1;
+	}
+	/*  Read between 1 and n values, waiting until there are some.
+		Returns 0 at the end of the stream. */
+	int readN(T* out, int n) {
+		Backoff backoff;
+		while (true) {
+			int count = tryReadN(out, n);
+			if (count > 0) {
+				return count;
+			}
+			if (isClosed()) {
+				return tryReadN(out, n);
+			}
+			backoff.pause();
+		}
+	}
+
+	/*  Mark the end of the stream. Only close once every writer
+		has finished. */
+	void close() {
+		closed.store(true, std::memory_order_release);
+	}
+	/*  Has the stream ended? */
+	bool isClosed() const {
+		return closed.load(std::memory_order_acquire);
+	}
+	/*  The number of values the pipeline can hold */
+	int capacity() const {
+		return (int)cells.size();
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+	std::vector<Cell> cells;
+	size_t mask;
+	std::atomic<bool> closed;
+	alignas(64) std::atomic<size_t> writePosition;
+	alignas(64) std::atomic<size_t> readPosition;
+};
+
+
 void testPipeline();
\ No newline at end of file
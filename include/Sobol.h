@@ -0,0 +1,86 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ *   The Sobol low discrepancy sequence, for quasi-Monte Carlo.
+ *
+ *   Each point has one 32 bit coordinate per dimension. Points are
+ *   generated in Gray code order, so the next point costs one XOR per
+ *   dimension, and jumping to any point costs at most 32 per
+ *   dimension, which lets independent tasks generate disjoint
+ *   ranges of points.
+ *
+ *   The first dimension is the van der Corput sequence. The next 20
+ *   use the primitive polynomials and initial direction numbers of
+ *   Joe and Kuo, "Constructing Sobol sequences with better
+ *   two-dimensional projections". Further dimensions use the
+ *   remaining primitive polynomials in order of degree, found as
+ *   they are needed, with pseudo-random initial direction numbers
+ *   as suggested by Jaeckel, "Monte Carlo Methods in Finance".
+ *   Paths should be built so that the early dimensions matter most.
+ *
+ *   Copies share their direction numbers, so copying is cheap.
+ */
+class SobolSequence {
+public:
+    /*  Create an unscrambled sequence of points with the
+        given number of dimensions, starting at point 0 */
+    explicit SobolSequence( int dimensions );
+
+    /*  The number of coordinates in each point */
+    int getDimensions() const {
+        return dimensions;
+    }
+
+    /*  Apply a random digital shift, chosen by the seed, to every
+        point. The shifted points are as evenly spread as the
+        originals, and averages over them are unbiased estimates,
+        so independently scrambled copies can be used to measure
+        the error. The same seed always gives the same shift. */
+    void scramble( uint64_t seed );
+
+    /*  Move to the given point in constant time */
+    void setPosition( uint64_t position );
+    /*  The index of the next point */
+    uint64_t getPosition() const {
+        return position;
+    }
+
+    /*  Write the next point's coordinates, as fractions
+        of 2^32, to out */
+    void next( uint32_t* out );
+    /*  Write the next point to out as numbers in (0,1). Each
+        coordinate is at the middle of its 2^-32 wide interval,
+        exactly as Philox::uniform does. */
+    void nextUniform( double* out );
+
+    /*  The number of bits in each coordinate */
+    static const int BITS = 32;
+
+    /*  The degree of the primitive polynomial used for each of the
+        first n dimensions after the first, and its interior
+        coefficients in the notation of Joe and Kuo */
+    static void primitivePolynomials( int n,
+                                      std::vector<int>& degrees,
+                                      std::vector<uint32_t>& coefficients );
+
+private:
+    int dimensions;
+    /*  BITS direction numbers for each dimension */
+    std::shared_ptr<const std::vector<uint32_t> > directions;
+    /*  The digital shift of each dimension */
+    std::vector<uint32_t> shift;
+    /*  The unshifted coordinates of the next point */
+    std::vector<uint32_t> current;
+    uint64_t position;
+};
+
+
+///////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////
+
+void testSobol();
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Executor.h"
+
+/*  The timing of one node of a TaskGraph run */
+struct TaskGraphTiming
+{
+    /*  The node's name */
+    std::string name;
+    /*  The position of the node in the order nodes were started */
+    int order;
+    /*  Which thread ran the node, numbered from 0 in order of
+        first appearance */
+    int thread;
+    /*  Seconds from the start of the run */
+    double start;
+    double finish;
+    /*  The estimated cost of the longest chain of nodes starting
+        with this one, which sets its priority */
+    double criticalPath;
+};
+
+/**
+ *   A set of tasks with dependencies between them. Running the
+ *   graph executes each node once all of its predecessors have
+ *   finished. When several nodes are ready the one at the head of
+ *   the most expensive remaining chain goes first, so the critical
+ *   path is never left waiting behind work that could be done later.
+ */
+class TaskGraph
+{
+public:
+    /*  Add a node which may only run after the given nodes. The cost
+        is an estimate in any units used to prioritise the node.
+        Returns the node's id. */
+    int add(const std::string &name,
+            std::function<void()> work,
+            const std::vector<int> &predecessors = std::vector<int>(),
+            double estimatedCost = 1.0);
+    /*  Make one node wait for another */
+    void addDependency(int before, int after);
+    /*  The number of nodes */
+    int size() const;
+    /*  Run every node on the executor and wait for them all, but
+        not for the executor's other tasks. The calling thread runs
+        nodes too, so this may be called from one of the executor's
+        own tasks. If a node throws, nodes that depend on it are
+        skipped and the exception is rethrown at the end. */
+    void run(Executor &executor);
+    /*  Run every node on the process-wide thread pool */
+    void run();
+    /*  The timings from the last run, one per node that ran, in the
+        order they started */
+    const std::vector<TaskGraphTiming> &getTrace() const;
+    /*  Write the trace in the Chrome trace event format, which
+        chrome://tracing and Perfetto can display */
+    void writeTrace(std::ostream &out) const;
+
+private:
+    struct Node
+    {
+        std::string name;
+        std::function<void()> work;
+        std::vector<int> successors;
+        int nPredecessors;
+        double cost;
+    };
+    std::vector<Node> nodes;
+    std::vector<TaskGraphTiming> trace;
+
+    /*  The state of one run, shared by the threads running it */
+    struct Run;
+
+    /*  The estimated cost of the longest chain from each node,
+        throwing if there is a cycle */
+    std::vector<double> criticalPaths() const;
+};
+
+/*  Test method */
+void testTaskGraph();
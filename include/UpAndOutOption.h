@@ -5,7 +5,21 @@
 class UpAndOutOption : public KnockoutOption {
 public:
     Matrix payoff(
-        const Matrix& prices ) const;
+        const MatrixView& prices ) const;
+    /*  Only the final price and the maximum are needed, or the
+        probability of surviving if the barrier is monitored
+        continuously */
+    PathStatistics getPathStatistics() const;
+    Matrix payoff(
+        const PathSummary& summary ) const;
+    /*  The price if the barrier is monitored continuously, which
+        is known exactly when the barrier is above the strike and
+        the stock price */
+    double continuousPrice( const MultiStockModel& model ) const;
+    /*  If the barrier is monitored at the steps, the control is
+        the continuously monitored option when its price is known */
+    bool getControlVariate( const MultiStockModel& model,
+                            ControlVariate& control ) const;
 };
 
 typedef std::shared_ptr<UpAndOutOption> SPUpAndOutOption;
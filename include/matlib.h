@@ -2,30 +2,32 @@
 
 #include "stdafx.h"
 #include "Matrix.h"
+#include "MatrixView.h"
+#include "Philox.h"
 
 
 /*  Create a linearly spaced vector */
 Matrix linspace( double from, double to, int numPoints, bool rowVector=0 );
 /*  Compute the sum of a matrix's rows */
-Matrix sumRows( const Matrix& m );
+Matrix sumRows( const MatrixView& m );
 /*  Compute the sum of a matrix's cols */
-Matrix sumCols( const Matrix& m );
+Matrix sumCols( const MatrixView& m );
 /*  Compute the mean of a matrix's rows */
-Matrix meanRows( const Matrix& m );
+Matrix meanRows( const MatrixView& m );
 /*  Compute the mean of a matrix's cols */
-Matrix meanCols( const Matrix& m );
+Matrix meanCols( const MatrixView& m );
 /*  Compute the standard deviation of a matrix's rows */
-Matrix stdRows( const Matrix& m, bool population=0 );
+Matrix stdRows( const MatrixView& m, bool population=0 );
 /*  Compute the standard deviation of a matrix's rows */
-Matrix stdCols( const Matrix& m, bool population=0 );
+Matrix stdCols( const MatrixView& m, bool population=0 );
 /*  Compute the minimum entry of each row */
-Matrix minOverRows( const Matrix& m );
+Matrix minOverRows( const MatrixView& m );
 /*  Compute the minimum entry of each col */
-Matrix minOverCols( const Matrix& m );
+Matrix minOverCols( const MatrixView& m );
 /*  Compute the maximum entry of each row */
-Matrix maxOverRows( const Matrix& m );
+Matrix maxOverRows( const MatrixView& m );
 /*  Compute the maximum entry of each col */
-Matrix maxOverCols( const Matrix& m );
+Matrix maxOverCols( const MatrixView& m );
 /*  Find the given percentile over the rows of a vector */
 Matrix prctileRows( const std::vector<double>& v, double percentage );
 /*  Find the given percentile over the cols of a vector */
@@ -46,6 +48,23 @@ Matrix randuniform(std::mt19937& random,
 /*  Create normally distributed random numbers */
 Matrix randn(std::mt19937& random,
 			 int rows, int cols);
+/*  Create uniformly distributed random numbers, reading
+	the generator in column-major order */
+Matrix randuniform(Philox& random,
+				  int rows, int cols);
+/*  How randn turns uniform random numbers into normal ones */
+enum NormalMethod {
+	NORMAL_SCALAR,	/* norminv one number at a time */
+	NORMAL_SIMD		/* the same inverse CDF, several numbers at a time */
+};
+/*  Create normally distributed random numbers, reading
+	the generator in column-major order */
+Matrix randn(Philox& random,
+			 int rows, int cols,
+			 NormalMethod method=NORMAL_SIMD);
+/*  Write n normally distributed random numbers to out */
+void randn(Philox& random, double* out, int n,
+		   NormalMethod method=NORMAL_SIMD);
 /*  Seeds the default random number generator */
 void rng( const std::string& setting );
 
@@ -58,6 +77,14 @@ inline Matrix exp(const Matrix& m ) {
 	return ret;
 }
 
+/**
+ *  Exponentiate a temporary matrix in place
+ */
+inline Matrix exp(Matrix&& m ) {
+	m.exp();
+	return std::move(m);
+}
+
 /**
  *  Pointwise product
  */
@@ -70,8 +97,20 @@ inline Matrix dotTimes(Matrix& a, const Matrix& b) {
 
 /*  Matrix transpose */
 Matrix transpose(const Matrix& m);
-/*  Cholesky decomposition */
+/*  Cholesky decomposition. If m is only positive semidefinite the
+	factor from cholPivoted is returned, which isn't triangular. */
 Matrix chol(const Matrix& m);
+/*  Cholesky decomposition of a matrix which is numerically positive
+	definite. Returns false, leaving l unspecified, if it isn't. */
+bool tryChol(const Matrix& m, Matrix& l);
+/*  A factor b with b*b' equal to the positive semidefinite matrix m
+	up to the tolerance, using Cholesky decomposition with diagonal
+	pivoting. Directions whose remaining variance is below tolerance
+	times the largest variance are dropped, which also discards the
+	small negative eigenvalues of matrices that are only semidefinite
+	up to rounding. b is square, its rows are in the order of m and
+	columns beyond the numerical rank are zero. */
+Matrix cholPivoted(const Matrix& m, double tolerance=1e-12, int* rank=NULL);
 
 
 /**
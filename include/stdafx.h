@@ -2,9 +2,12 @@
 
 #include <iostream>
 #include <cmath>
+#include <cfloat>
 #include <cstring>
 #include <ctime>
 #include <vector>
+#include <deque>
+#include <queue>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
@@ -18,5 +21,12 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <atomic>
+#include <new>
+#include <cstdint>
+#include <chrono>
+#include <optional>
+#include <type_traits>
+#include <exception>
 #include "testing.h"
 
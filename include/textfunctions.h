@@ -11,6 +11,13 @@
  */
 std::string escapeJavascriptString( const std::string& in );
 
+/**
+ *  Replace quote characters, backslashes and control
+ *  characters in a string with the escape sequences
+ *  needed to place it into a JSON string
+ */
+std::string escapeJsonString( const std::string& in );
+
 
 
 void testTextFunctions();
\ No newline at end of file
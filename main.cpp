@@ -7,13 +7,25 @@
 #include "include/LineChart.h"
 #include "include/BlackScholesModel.h"
 #include "include/MultiStockModel.h"
+#include "include/MarketSimulation.h"
+#include "include/PathSummary.h"
 #include "include/Histogram.h"
 #include "include/MonteCarloPricer.h"
 #include "include/UpAndOutOption.h"
 #include "include/DownAndOutOption.h"
 #include "include/Portfolio.h"
 #include "include/Matrix.h"
+#include "include/MatrixView.h"
+#include "include/MatrixAllocator.h"
+#include "include/MatrixExpression.h"
+#include "include/MatrixKernels.h"
+#include "include/Philox.h"
+#include "include/Sobol.h"
+#include "include/BrownianBridge.h"
 #include "include/Executor.h"
+#include "include/Pipeline.h"
+#include "include/Future.h"
+#include "include/TaskGraph.h"
 #include "include/threadingexamples.h"
 #include "include/MargrabeOption.h"
 #include "include/RectangleRulePricer.h"
@@ -23,7 +35,16 @@ using namespace std;
 int main() {
 
     testMatrix();
+    testMatrixView();
+    testMatrixAllocator();
+    testMatrixExpression();
+    testMatrixKernels();
+    testPhilox();
+    testSobol();
+    testBrownianBridge();
     testMatlib();
+    testPathSummary();
+    testMarketSimulation();
     testMultiStockModel();
 	testBlackScholesModel();
 	testGeometry();
@@ -39,6 +60,9 @@ int main() {
     testPortfolio();
     testPutOption();
 	testExecutor();
+	testFuture();
+	testTaskGraph();
+	testPipeline();
 	testThreadingExamples();
 	testUpAndOutOption();
 	testMargrabeOption();
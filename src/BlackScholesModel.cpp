@@ -26,7 +26,7 @@ Matrix BlackScholesModel::
 	MarketSimulation sim
 		= msm.generateRiskNeutralPricePaths(
 			rng, toDate, nPaths, nSteps);
-	return *sim.getStockPrices(MultiStockModel::DEFAULT_STOCK);
+	return Matrix(sim.getStockPrices(MultiStockModel::DEFAULT_STOCK));
 }
 
 /**
@@ -41,7 +41,7 @@ Matrix BlackScholesModel:: generatePricePaths(
 	MarketSimulation sim
 		= msm.generatePricePaths(
 		rng, toDate, nPaths, nSteps);
-	return *sim.getStockPrices( MultiStockModel::DEFAULT_STOCK);
+	return Matrix(sim.getStockPrices( MultiStockModel::DEFAULT_STOCK));
 }
 
 
@@ -0,0 +1,176 @@
+#include "BrownianBridge.h"
+
+#include "matlib.h"
+
+using namespace std;
+
+BrownianBridge::BrownianBridge( int nSteps ) :
+    nSteps( nSteps ),
+    bridgeIndex( nSteps ),
+    leftIndex( nSteps ),
+    rightIndex( nSteps ),
+    leftWeight( nSteps ),
+    rightWeight( nSteps ),
+    sd( nSteps ) {
+    ASSERT( nSteps>=1 );
+    // step i is the value at time i+1. known[i] is set once it has
+    // been decided.
+    vector<bool> known( nSteps, false );
+    bridgeIndex[0] = nSteps-1;
+    leftIndex[0] = -1;
+    rightIndex[0] = -1;
+    leftWeight[0] = 0.0;
+    rightWeight[0] = 0.0;
+    sd[0] = sqrt( (double)nSteps );
+    known[nSteps-1] = true;
+    int j = 0;
+    for (int i=1; i<nSteps; i++) {
+        // fill the gaps from left to right, bisecting each,
+        // and start again once they have all been halved
+        while (known[j]) {
+            j++;
+        }
+        int k = j;
+        while (!known[k]) {
+            k++;
+        }
+        // steps j to k-1 are unknown, and step l is half way
+        int l = j + (k - 1 - j)/2;
+        double gap = k + 1 - j;
+        known[l] = true;
+        bridgeIndex[i] = l;
+        leftIndex[i] = j - 1;
+        rightIndex[i] = k;
+        leftWeight[i] = (k - l)/gap;
+        rightWeight[i] = (l + 1 - j)/gap;
+        sd[i] = sqrt( (l + 1 - j)*(k - l)/gap );
+        j = k + 1;
+        if (j>=nSteps) {
+            j = 0;
+        }
+    }
+}
+
+void BrownianBridge::transform( double* values, int n, int stride ) const {
+    vector<double> path( (size_t)nSteps*n );
+    for (int i=0; i<nSteps; i++) {
+        const double* z = values + (size_t)i*stride;
+        double* w = &path[(size_t)bridgeIndex[i]*n];
+        double s = sd[i];
+        if (rightIndex[i]<0) {
+            for (int p=0; p<n; p++) {
+                w[p] = s*z[p];
+            }
+        } else if (leftIndex[i]<0) {
+            const double* right = &path[(size_t)rightIndex[i]*n];
+            double b = rightWeight[i];
+            for (int p=0; p<n; p++) {
+                w[p] = b*right[p] + s*z[p];
+            }
+        } else {
+            const double* left = &path[(size_t)leftIndex[i]*n];
+            const double* right = &path[(size_t)rightIndex[i]*n];
+            double a = leftWeight[i];
+            double b = rightWeight[i];
+            for (int p=0; p<n; p++) {
+                w[p] = a*left[p] + b*right[p] + s*z[p];
+            }
+        }
+    }
+    for (int i=0; i<nSteps; i++) {
+        double* increment = values + (size_t)i*stride;
+        const double* w = &path[(size_t)i*n];
+        if (i==0) {
+            copy( w, w + n, increment );
+        } else {
+            const double* previous = w - n;
+            for (int p=0; p<n; p++) {
+                increment[p] = w[p] - previous[p];
+            }
+        }
+    }
+}
+
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static void testFirstNormalSetsEnd() {
+    BrownianBridge bridge( 8 );
+    vector<double> z( 8, 0.0 );
+    z[0] = 1.0;
+    bridge.transform( &z[0], 1, 1 );
+    // the path is a straight line to sqrt(8)
+    for (int i=0; i<8; i++) {
+        ASSERT_APPROX_EQUAL( z[i], sqrt( 8.0 )/8, 1e-14 );
+    }
+}
+
+static void testCovariance() {
+    // the bridge is linear, so its columns applied to the unit
+    // vectors must give paths with covariance min(s,t)
+    for (int nSteps : { 1, 2, 3, 7, 8, 13, 64 }) {
+        BrownianBridge bridge( nSteps );
+        // normal i of path p is at i*nSteps + p, so the paths are
+        // the columns of the identity
+        Matrix values( nSteps, nSteps );
+        for (int i=0; i<nSteps; i++) {
+            values( i, i ) = 1.0;
+        }
+        bridge.transform( values.begin(), nSteps, nSteps );
+        // add up the increments to get the paths
+        Matrix paths( nSteps, nSteps );
+        for (int p=0; p<nSteps; p++) {
+            double w = 0.0;
+            for (int i=0; i<nSteps; i++) {
+                w += values( p, i );
+                paths( i, p ) = w;
+            }
+        }
+        Matrix covariance = paths*transpose( paths );
+        for (int s=0; s<nSteps; s++) {
+            for (int t=0; t<nSteps; t++) {
+                ASSERT_APPROX_EQUAL( covariance( s, t ), min( s, t ) + 1.0, 1e-10 );
+            }
+        }
+    }
+}
+
+static void testStride() {
+    // several paths with the normals of each step spread out
+    int nSteps = 5;
+    int n = 3;
+    int stride = 4;
+    vector<double> values( nSteps*stride, -99.0 );
+    Philox rng;
+    for (int i=0; i<nSteps; i++) {
+        randn( rng, &values[i*stride], n );
+    }
+    vector<double> single( nSteps );
+    BrownianBridge bridge( nSteps );
+    vector<vector<double> > expected( n );
+    for (int p=0; p<n; p++) {
+        for (int i=0; i<nSteps; i++) {
+            single[i] = values[i*stride + p];
+        }
+        bridge.transform( &single[0], 1, 1 );
+        expected[p] = single;
+    }
+    bridge.transform( &values[0], n, stride );
+    for (int p=0; p<n; p++) {
+        for (int i=0; i<nSteps; i++) {
+            ASSERT_APPROX_EQUAL( values[i*stride + p], expected[p][i], 1e-14 );
+        }
+    }
+    // the padding is left alone
+    ASSERT( values[stride - 1]==-99.0 );
+}
+
+void testBrownianBridge() {
+    TEST( testFirstNormalSetsEnd );
+    TEST( testCovariance );
+    TEST( testStride );
+}
@@ -1,12 +1,15 @@
 #include "CallOption.h"
 
 #include "matlib.h"
+#include "MatrixExpression.h"
 
 
-Matrix CallOption::payoffAtMaturity( const Matrix& stockAtMaturity ) const {
-    Matrix val = stockAtMaturity - getStrike();
-    val.positivePart();
-    return val;
+Matrix CallOption::payoffAtMaturity( const MatrixView& stockAtMaturity ) const {
+    return positivePart( lazy(stockAtMaturity) - getStrike() );
+}
+
+Matrix CallOption::derivativeAtMaturity( const MatrixView& stockAtMaturity ) const {
+    return lazy(stockAtMaturity) > getStrike();
 }
 
 
@@ -1,18 +1,73 @@
 #include "DownAndOutOption.h"
 #include "KnockoutOption.h"
 #include "matlib.h"
+#include "MonteCarloPricer.h"
+#include "MatrixExpression.h"
 
 using namespace std;
 
 Matrix DownAndOutOption::payoff(
-        const Matrix& prices ) const {
+        const MatrixView& prices ) const {
     Matrix min = minOverRows( prices );
-    Matrix didntHit = min > getBarrier();
-    Matrix p = prices.col( prices.nCols()-1);
-    p -= getStrike();
-    p.positivePart();
-    p.times(didntHit);
-    return p;
+    MatrixView finalPrices = prices.col( prices.nCols()-1 );
+    return times( positivePart( lazy(finalPrices) - getStrike() ),
+                  lazy(min) > getBarrier() );
+}
+
+PathStatistics DownAndOutOption::getPathStatistics() const {
+    PathStatistics statistics;
+    statistics.terminal = true;
+    if (isContinuouslyMonitored()) {
+        statistics.survivesLower = true;
+        statistics.lowerBarrier = getBarrier();
+    } else {
+        statistics.minimum = true;
+    }
+    return statistics;
+}
+
+Matrix DownAndOutOption::payoff(
+        const PathSummary& summary ) const {
+    if (isContinuouslyMonitored()) {
+        // the expected payoff given the prices at the steps
+        return times( positivePart( lazy(summary.getTerminal()) - getStrike() ),
+                      summary.getSurvivesLower() );
+    }
+    return times( positivePart( lazy(summary.getTerminal()) - getStrike() ),
+                  lazy(summary.getMinimum()) > getBarrier() );
+}
+
+double DownAndOutOption::continuousPrice( const MultiStockModel& model ) const {
+    BlackScholesModel m = model.getBlackScholesModel( getStock() );
+    double S = m.stockPrice;
+    double K = getStrike();
+    double H = getBarrier();
+    double r = m.riskFreeRate;
+    double sigma = m.volatility;
+    double T = getMaturity() - m.date;
+    ASSERT( H<K && H<S );
+    double sigmaRootT = sigma*sqrt(T);
+    double lambda = (r + 0.5*sigma*sigma)/(sigma*sigma);
+    double discount = exp(-r*T);
+    double d1 = log(S/K)/sigmaRootT + lambda*sigmaRootT;
+    double call = S*normcdf(d1) - K*discount*normcdf(d1 - sigmaRootT);
+    // the down and in call, which together with this makes a call
+    double y = log(H*H/(S*K))/sigmaRootT + lambda*sigmaRootT;
+    double downAndIn = S*pow(H/S, 2*lambda)*normcdf(y)
+        - K*discount*pow(H/S, 2*lambda - 2)*normcdf(y - sigmaRootT);
+    return call - downAndIn;
+}
+
+bool DownAndOutOption::getControlVariate( const MultiStockModel& model,
+                                          ControlVariate& control ) const {
+    double S = model.getBlackScholesModel( getStock() ).stockPrice;
+    if (!isContinuouslyMonitored() && getBarrier()<getStrike() && getBarrier()<S) {
+        auto continuous = make_shared<DownAndOutOption>( *this );
+        continuous->setContinuouslyMonitored( true );
+        getContinuousControl( continuous, continuousPrice( model ), model, control );
+        return true;
+    }
+    return KnockoutOption::getControlVariate( model, control );
 }
 
 /////////////////////////////////////
@@ -21,6 +76,25 @@ Matrix DownAndOutOption::payoff(
 //
 /////////////////////////////////////
 
+static void testContinuousMonitoring() {
+    BlackScholesModel model;
+    model.stockPrice = 100;
+    model.volatility = 0.2;
+    model.riskFreeRate = 0.05;
+    model.date = 0;
+
+    DownAndOutOption o;
+    o.setBarrier(90);
+    o.setStrike(100);
+    o.setMaturity(1.0);
+    o.setContinuouslyMonitored(true);
+
+    MonteCarloPricer pricer;
+    pricer.nScenarios = 400000;
+    pricer.nSteps = 20;
+    ASSERT_APPROX_EQUAL( pricer.price( o, model ), o.continuousPrice( MultiStockModel( model ) ), 0.1 );
+}
+
 
 void testDownAndOutOption() {
     DownAndOutOption o;
@@ -32,4 +106,5 @@ void testDownAndOutOption() {
     ASSERT_APPROX_EQUAL( o.payoff( prices ).asScalar(), 10.0, 0.001);
     prices(0,0) = 40;
     ASSERT_APPROX_EQUAL( o.payoff( prices ).asScalar(), 0.0, 0.001);
+    TEST( testContinuousMonitoring );
 }
\ No newline at end of file
@@ -4,167 +4,744 @@
 
 using namespace std;
 
+class ThreadPool;
+class ExecutorImpl;
+
+/**
+ *   A task that calls a function object
+ */
+class FunctorTask : public Task
+{
+public:
+    FunctorTask(function<void()> functor) : functor_(functor) {}
+    void execute()
+    {
+        functor_();
+    }
+
+private:
+    function<void()> functor_;
+};
+
+/**
+ *   A task waiting for a thread and the executor it belongs to. It
+ *   sits both in the pool's queue and in its executor's, and the
+ *   first thread to take it from either runs it.
+ */
+struct QueuedTask
+{
+    /*  Null once a thread has taken the task */
+    shared_ptr<Task> task;
+    ExecutorImpl *owner;
+};
+
+typedef shared_ptr<QueuedTask> SPQueuedTask;
+
 /**
- *   Implementation of executor
+ *   Implementation of executor. The tasks run on a thread pool,
+ *   which may be shared with other executors.
  */
 class ExecutorImpl : public Executor
 {
 public:
-    ExecutorImpl(int maxThreads);
+    ExecutorImpl(shared_ptr<ThreadPool> pool);
+    ~ExecutorImpl();
     void addTask(shared_ptr<Task> task);
     void addTask(function<void()> functor);
     void join();
+    int nThreads() const;
 
-    /*  The maximum number of threads that may run at once */
-    int maxThreads;
-    /*  The current number of running threads */
-    int numRunningThreads;
-    /*  Mutex to coordinate threads */
-    mutex mtx;
-    /*  Condition variable used to signal when no tasks are running */
-    condition_variable cv;
-    /*  Queue where we add tasks we aren't ready to run */
-    vector<shared_ptr<Task>> queue;
-    /*  Threads we have created */
-    vector<thread *> threads;
-    /*  Weak pointer to the executor */
-    weak_ptr<ExecutorImpl> self;
+    /*  The pool that runs our tasks */
+    shared_ptr<ThreadPool> pool;
+    /*  The remaining fields are guarded by the pool's mutex */
+    /*  The number of our tasks that are queued or running */
+    int numPendingTasks;
+    /*  Our tasks that may still be in the pool's queue, oldest first */
+    deque<SPQueuedTask> queued;
+    /*  The first exception one of our tasks threw since the last join */
+    exception_ptr error;
 };
 
 /**
- *  Each thread calls the runTasks method which takes
- *  this form of data as a parameter
+ *   A fixed set of worker threads which sleep until there is
+ *   something in the queue
  */
-class RunData
+class ThreadPool
 {
 public:
-    /*  The associated executor */
-    shared_ptr<ExecutorImpl> executor;
-    /*  The current task */
-    shared_ptr<Task> firstTask;
-    /*  The thread that is running */
-    thread *runningThread;
-
-    RunData(shared_ptr<ExecutorImpl> executor, shared_ptr<Task> firstTask) : executor(executor),
-                                                                             firstTask(firstTask),
-                                                                             runningThread(NULL) {}
+    /*  A pool that grows starts another thread whenever a task
+        would otherwise wait for one, so tasks may block waiting
+        for each other. It keeps its threads for later tasks. */
+    ThreadPool(int nThreads, bool grows = false);
+    ~ThreadPool();
+    /*  Queue a task on behalf of an executor */
+    void add(ExecutorImpl *owner, shared_ptr<Task> task);
+    /*  Wait until all the executor's tasks have finished. Rather
+        than sit idle the calling thread runs the executor's queued
+        tasks itself, so a task may safely wait for other tasks.
+        Returns the first exception the tasks threw, if any. */
+    exception_ptr waitFor(ExecutorImpl *owner);
+    /*  The number of worker threads, at least one */
+    int size();
+
+private:
+    /*  What the workers share. They keep it alive themselves, so
+        a worker can finish safely after the pool is destroyed. */
+    struct State
+    {
+        /*  Mutex guarding the queue and every executor's tasks */
+        mutex mtx;
+        /*  Signalled when a task is queued or the pool is stopping */
+        condition_variable workAvailable;
+        /*  Signalled when an executor's last task finishes */
+        condition_variable tasksFinished;
+        /*  Tasks waiting for a thread, run in the order they were added */
+        deque<SPQueuedTask> queue;
+        /*  The number of tasks in the queue no thread has taken */
+        int numUnstarted = 0;
+        /*  The number of workers running a task. A worker which
+            has finished its task counts as free, even before it
+            is back waiting for the next. */
+        int numBusy = 0;
+        /*  Set when the workers should exit */
+        bool stopping = false;
+    };
+    shared_ptr<State> state;
+    /*  Does the pool grow? */
+    const bool grows;
+    /*  The worker threads, guarded by the mutex if the pool grows */
+    vector<thread> workers;
+
+    /*  The body of each worker thread */
+    static void runWorker(shared_ptr<State> state);
+    /*  Run a task with the lock released, on a worker which is
+        otherwise free or on some other thread */
+    static void run(State &state, unique_lock<mutex> &lock,
+                    const SPQueuedTask &item, bool onFreeWorker);
 };
 
+ThreadPool::ThreadPool(int nThreads, bool grows) : state(make_shared<State>()),
+                                                   grows(grows)
+{
+    for (int i = 0; i < nThreads; i++)
+    {
+        workers.push_back(thread(&ThreadPool::runWorker, state));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(state->mtx);
+        state->stopping = true;
+    }
+    state->workAvailable.notify_all();
+    for (thread &worker : workers)
+    {
+        // when a task holds the last reference to a private pool, the
+        // pool is destroyed on one of its own workers, which can't
+        // join itself. It exits by itself once the queue is empty.
+        if (worker.get_id() == this_thread::get_id())
+        {
+            worker.detach();
+        }
+        else
+        {
+            worker.join();
+        }
+    }
+}
+
+void ThreadPool::add(ExecutorImpl *owner, shared_ptr<Task> task)
+{
+    SPQueuedTask item = make_shared<QueuedTask>(QueuedTask{task, owner});
+    {
+        lock_guard<mutex> lock(state->mtx);
+        owner->numPendingTasks++;
+        owner->queued.push_back(item);
+        state->queue.push_back(item);
+        state->numUnstarted++;
+        // start a thread only if the task would wait for one
+        int numFree = (int)workers.size() - state->numBusy;
+        if (grows && state->numUnstarted > numFree)
+        {
+            workers.push_back(thread(&ThreadPool::runWorker, state));
+        }
+    }
+    state->workAvailable.notify_one();
+}
+
+void ThreadPool::run(State &state, unique_lock<mutex> &lock,
+                     const SPQueuedTask &item, bool onFreeWorker)
+{
+    ExecutorImpl *owner = item->owner;
+    shared_ptr<Task> task = move(item->task);
+    state.numUnstarted--;
+    if (onFreeWorker)
+    {
+        state.numBusy++;
+    }
+    if (!owner->queued.empty() && owner->queued.front() == item)
+    {
+        owner->queued.pop_front();
+    }
+    lock.unlock();
+    exception_ptr error;
+    try
+    {
+        task->execute();
+    }
+    catch (...)
+    {
+        error = current_exception();
+    }
+    lock.lock();
+    if (error && !owner->error)
+    {
+        owner->error = error;
+    }
+    owner->numPendingTasks--;
+    if (owner->numPendingTasks == 0)
+    {
+        state.tasksFinished.notify_all();
+    }
+    if (onFreeWorker)
+    {
+        state.numBusy--;
+    }
+    // the task may hold the last reference to its executor, whose
+    // destructor takes the lock
+    lock.unlock();
+    task.reset();
+    lock.lock();
+}
+
+void ThreadPool::runWorker(shared_ptr<State> state)
+{
+    unique_lock<mutex> lock(state->mtx);
+    while (true)
+    {
+        state->workAvailable.wait(lock, [&state]()
+                                  { return state->stopping || !state->queue.empty(); });
+        if (state->queue.empty())
+        {
+            return;
+        }
+        SPQueuedTask item = state->queue.front();
+        state->queue.pop_front();
+        if (item->task)
+        {
+            run(*state, lock, item, true);
+        }
+    }
+}
+
+int ThreadPool::size()
+{
+    // a growing pool adds workers under the lock
+    lock_guard<mutex> lock(state->mtx);
+    return max(1, (int)workers.size());
+}
+
+exception_ptr ThreadPool::waitFor(ExecutorImpl *owner)
+{
+    unique_lock<mutex> lock(state->mtx);
+    while (owner->numPendingTasks > 0)
+    {
+        // skip tasks the workers have already taken
+        while (!owner->queued.empty() && !owner->queued.front()->task)
+        {
+            owner->queued.pop_front();
+        }
+        if (owner->queued.empty())
+        {
+            // the remaining tasks are running on other threads
+            state->tasksFinished.wait(lock);
+        }
+        else
+        {
+            SPQueuedTask item = owner->queued.front();
+            owner->queued.pop_front();
+            // the calling thread is already counted if it is a worker
+            run(*state, lock, item, false);
+        }
+    }
+    owner->queued.clear();
+    exception_ptr error = owner->error;
+    owner->error = nullptr;
+    return error;
+}
+
 /**
- *   When a thread exits, we must delete the associated thread object
- *   This class performs this task
+ *   Creates an executor
  */
-class ThreadCleanup
+ExecutorImpl::ExecutorImpl(shared_ptr<ThreadPool> pool) : pool(pool),
+                                                          numPendingTasks(0)
 {
-public:
-    mutex &mtx;
-    RunData *runData;
-    ThreadCleanup(mutex &mtx,
-                  RunData *runData) : mtx(mtx),
-                                      runData(runData)
+}
+
+/**
+ *   The pool refers to the executor until its tasks are done. A
+ *   destructor can't throw, so any exception from them is dropped.
+ */
+ExecutorImpl::~ExecutorImpl()
+{
+    pool->waitFor(this);
+}
+
+/**
+ *   Add a task to the executor
+ */
+void ExecutorImpl::addTask(shared_ptr<Task> task)
+{
+    pool->add(this, task);
+}
+
+void ExecutorImpl::addTask(function<void()> functor)
+{
+    addTask(make_shared<FunctorTask>(functor));
+}
+
+/**
+ *   Wait until all tasks have completed
+ */
+void ExecutorImpl::join()
+{
+    exception_ptr error = pool->waitFor(this);
+    if (error)
     {
+        rethrow_exception(error);
     }
+}
 
-    ~ThreadCleanup()
+int ExecutorImpl::nThreads() const
+{
+    return pool->size();
+}
+
+/**
+ *   The queues and threads behind a WorkStealingExecutor. Each
+ *   thread has its own queue of tasks. A thread works through its
+ *   own queue newest first, which keeps recently touched data in
+ *   its cache, and when that is empty it steals the oldest task
+ *   from a randomly chosen thread. Threads only contend for a
+ *   queue's lock when stealing, so many small tasks scale much
+ *   better than with one shared queue. The threads share ownership
+ *   of the pool, so one that destroys the executor from a task can
+ *   still finish safely.
+ */
+class WorkStealingPool
+{
+public:
+    WorkStealingPool(int nThreads);
+    /*  Start the worker threads */
+    static void start(const shared_ptr<WorkStealingPool> &pool);
+    /*  The number of worker threads */
+    int size() const
     {
-        lock_guard<mutex> lock(mtx);
-        runData->runningThread->detach();
-        delete runData->runningThread;
-        delete runData;
+        return (int)queues.size();
     }
+    void addTask(shared_ptr<Task> task);
+    /*  Wait until all tasks have completed, running tasks meanwhile.
+        Returns the first exception the tasks threw, if any. */
+    exception_ptr join();
+    /*  Make the workers exit once the queues are empty, and wait
+        for all of them but the calling thread */
+    void stop();
+
+private:
+    /*  A thread's queue, on its own cache line */
+    struct alignas(64) WorkQueue
+    {
+        mutex mtx;
+        deque<shared_ptr<Task>> tasks;
+    };
+    /*  One queue per worker */
+    vector<unique_ptr<WorkQueue>> queues;
+    /*  The worker threads */
+    vector<thread> workers;
+    /*  The number of tasks queued or running */
+    atomic<int> numPendingTasks;
+    /*  The number of tasks in the queues */
+    atomic<int> numQueuedTasks;
+    /*  The number of threads waiting for work */
+    atomic<int> numSleeping;
+    /*  Where the next task from outside the pool goes */
+    atomic<unsigned> nextQueue;
+    /*  Guards sleeping, stopping and error */
+    mutex sleepMutex;
+    /*  Signalled when there is work, the last task finishes
+        or the pool is stopping */
+    condition_variable wakeUp;
+    /*  Set when the workers should exit */
+    bool stopping;
+    /*  The first exception a task threw since the last join */
+    exception_ptr error;
+
+    /*  The pool and queue of the current thread if it is a worker */
+    static thread_local WorkStealingPool *currentPool;
+    static thread_local int currentQueue;
+
+    /*  Take a task from our own queue, or steal one. Runs it and
+        returns true if there was one. */
+    bool runOneTask(int ownQueue, minstd_rand &random);
+    /*  Sleep until there may be something to do */
+    void sleep(const function<bool()> &wakeCondition);
+    /*  The body of each worker thread */
+    static void runWorker(shared_ptr<WorkStealingPool> pool, int index);
 };
 
+thread_local WorkStealingPool *WorkStealingPool::currentPool = NULL;
+thread_local int WorkStealingPool::currentQueue = -1;
+
+WorkStealingPool::WorkStealingPool(int nThreads) : numPendingTasks(0),
+                                                   numQueuedTasks(0),
+                                                   numSleeping(0),
+                                                   nextQueue(0),
+                                                   stopping(false)
+{
+    for (int i = 0; i < nThreads; i++)
+    {
+        queues.push_back(make_unique<WorkQueue>());
+    }
+}
+
+void WorkStealingPool::start(const shared_ptr<WorkStealingPool> &pool)
+{
+    for (int i = 0; i < (int)pool->queues.size(); i++)
+    {
+        pool->workers.push_back(thread(&WorkStealingPool::runWorker, pool, i));
+    }
+}
+
+void WorkStealingPool::stop()
+{
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (thread &worker : workers)
+    {
+        // a worker can't join itself, see ThreadPool
+        if (worker.get_id() == this_thread::get_id())
+        {
+            worker.detach();
+        }
+        else
+        {
+            worker.join();
+        }
+    }
+}
+
 /**
- *   Run tasks that have been added to the executor
+ *   Tasks added by a worker go on its own queue, others are dealt
+ *   out to the queues in turn
  */
-void runTasks(RunData *runData)
+void WorkStealingPool::addTask(shared_ptr<Task> task)
 {
+    int index = currentQueue;
+    if (currentPool != this)
+    {
+        index = nextQueue++ % queues.size();
+    }
+    numPendingTasks++;
+    {
+        lock_guard<mutex> lock(queues[index]->mtx);
+        queues[index]->tasks.push_back(task);
+    }
+    numQueuedTasks++;
+    // a sleeper registers before checking numQueuedTasks, so one of
+    // us must see the other
+    if (numSleeping > 0)
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        wakeUp.notify_one();
+    }
+}
 
-    shared_ptr<ExecutorImpl> executor = runData->executor;
-    shared_ptr<Task> currentTask = runData->firstTask;
-    runData->firstTask.reset();
+bool WorkStealingPool::runOneTask(int ownQueue, minstd_rand &random)
+{
+    shared_ptr<Task> task;
+    if (ownQueue >= 0)
+    {
+        WorkQueue &queue = *queues[ownQueue];
+        lock_guard<mutex> lock(queue.mtx);
+        if (!queue.tasks.empty())
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+    }
+    int n = (int)queues.size();
+    int victim = random() % n;
+    for (int i = 0; i < n && !task; i++, victim = (victim + 1) % n)
+    {
+        if (victim == ownQueue)
+        {
+            continue;
+        }
+        WorkQueue &queue = *queues[victim];
+        lock_guard<mutex> lock(queue.mtx);
+        if (!queue.tasks.empty())
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task)
+    {
+        return false;
+    }
+    numQueuedTasks--;
+    try
+    {
+        task->execute();
+    }
+    catch (...)
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        if (!error)
+        {
+            error = current_exception();
+        }
+    }
+    if (--numPendingTasks == 0)
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        wakeUp.notify_all();
+    }
+    return true;
+}
 
-    ThreadCleanup tc(executor->mtx, runData);
+void WorkStealingPool::sleep(const function<bool()> &wakeCondition)
+{
+    unique_lock<mutex> lock(sleepMutex);
+    numSleeping++;
+    wakeUp.wait(lock, [&]()
+                { return numQueuedTasks > 0 || wakeCondition(); });
+    numSleeping--;
+}
 
-    bool taskToPerform = true;
-    while (taskToPerform)
+void WorkStealingPool::runWorker(shared_ptr<WorkStealingPool> pool, int index)
+{
+    currentPool = pool.get();
+    currentQueue = index;
+    minstd_rand random(index + 1);
+    while (true)
     {
-        currentTask->execute();
-        taskToPerform = false;
-        lock_guard<mutex> lock(executor->mtx);
-        if (executor->queue.size() > 0)
+        if (pool->runOneTask(index, random))
         {
-            taskToPerform = true;
-            currentTask = executor->queue.back();
-            executor->queue.pop_back();
+            continue;
+        }
+        pool->sleep([&pool]()
+                    { return pool->stopping; });
+        lock_guard<mutex> lock(pool->sleepMutex);
+        if (pool->stopping && pool->numQueuedTasks == 0)
+        {
+            return;
         }
     }
+}
 
-    lock_guard<mutex> lock(executor->mtx);
-    executor->numRunningThreads--;
-    if (executor->numRunningThreads == 0)
+exception_ptr WorkStealingPool::join()
+{
+    int ownQueue = (currentPool == this) ? currentQueue : -1;
+    minstd_rand random((unsigned)hash<thread::id>()(this_thread::get_id()));
+    while (numPendingTasks > 0)
     {
-        executor->cv.notify_all();
+        if (runOneTask(ownQueue, random))
+        {
+            continue;
+        }
+        sleep([this]()
+              { return numPendingTasks == 0; });
     }
+    lock_guard<mutex> lock(sleepMutex);
+    exception_ptr result = error;
+    error = nullptr;
+    return result;
 }
 
 /**
- *   Creates an executor
+ *   An executor whose threads steal work from each other, see
+ *   WorkStealingPool
  */
-ExecutorImpl::ExecutorImpl(int maxThreads) : maxThreads(maxThreads),
-                                             numRunningThreads(0)
+class WorkStealingExecutor : public Executor
 {
+public:
+    WorkStealingExecutor(int nThreads);
+    ~WorkStealingExecutor();
+    void addTask(shared_ptr<Task> task);
+    void addTask(function<void()> functor);
+    void join();
+    int nThreads() const;
+
+private:
+    shared_ptr<WorkStealingPool> pool;
+};
+
+WorkStealingExecutor::WorkStealingExecutor(int nThreads)
+    : pool(make_shared<WorkStealingPool>(nThreads))
+{
+    WorkStealingPool::start(pool);
 }
 
 /**
- *   Add a task to the executor
+ *   Waits for the tasks, dropping any exception they threw
  */
-void ExecutorImpl::addTask(shared_ptr<Task> task)
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+    pool->join();
+    pool->stop();
+}
+
+void WorkStealingExecutor::addTask(shared_ptr<Task> task)
+{
+    pool->addTask(task);
+}
+
+void WorkStealingExecutor::addTask(function<void()> functor)
+{
+    addTask(make_shared<FunctorTask>(functor));
+}
+
+/**
+ *   Wait until all tasks have completed
+ */
+void WorkStealingExecutor::join()
 {
-    lock_guard<mutex> lock(mtx);
-    if (numRunningThreads >= maxThreads)
+    exception_ptr error = pool->join();
+    if (error)
     {
-        queue.push_back(task);
+        rethrow_exception(error);
     }
-    else
+}
+
+int WorkStealingExecutor::nThreads() const
+{
+    return pool->size();
+}
+
+/*  Automatically sized ranges aim for this many tasks, enough to
+    balance the load on a large machine. The count doesn't depend
+    on the number of threads, so neither does the order in which
+    parallelReduce combines the ranges. */
+static const int AUTO_RANGE_COUNT = 256;
+/*  Automatically sized ranges have at least this many elements, so
+    that small loops aren't swamped by the cost of scheduling */
+static const int AUTO_MIN_GRAIN = 64;
+
+int Executor::chooseGrainSize(int n, int grainSize)
+{
+    if (grainSize > 0)
     {
-        numRunningThreads++;
-        shared_ptr<ExecutorImpl> sharedPtr(self);
-        RunData *runData = new RunData(sharedPtr, task);
-        thread *t = new thread(runTasks, runData);
-        runData->runningThread = t;
+        return grainSize;
     }
+    return max(AUTO_MIN_GRAIN, (n + AUTO_RANGE_COUNT - 1) / AUTO_RANGE_COUNT);
 }
 
-void ExecutorImpl::addTask(function<void()> functor)
+/**
+ *   The ranges of one call to parallelFor. Each task claims the
+ *   next unclaimed range until there are none left, and so does the
+ *   calling thread, so the call never waits for a range that is
+ *   still queued. The tasks may run after the call has returned,
+ *   when they find nothing to claim and don't touch the body.
+ */
+struct ParallelForState
 {
-    class FunctorTask : public Task
+    ParallelForState(int begin, int end, int grain,
+                     const function<void(int, int)> &body)
+        : begin(begin), end(end), grain(grain),
+          nRanges((end - begin + grain - 1) / grain),
+          body(&body), nextRange(0), nFinished(0) {}
+
+    /*  Run unclaimed ranges until there are none left */
+    void runRanges()
     {
-    public:
-        FunctorTask(function<void()> functor) : functor_(functor) {}
-        void execute()
+        for (int range = nextRange++; range < nRanges; range = nextRange++)
         {
-            functor_();
+            int first = begin + range * grain;
+            int last = min(end, first + grain);
+            try
+            {
+                (*body)(first, last);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(mtx);
+                if (!error)
+                {
+                    error = current_exception();
+                }
+            }
+            lock_guard<mutex> lock(mtx);
+            if (++nFinished == nRanges)
+            {
+                allFinished.notify_all();
+            }
         }
+    }
 
-    private:
-        function<void()> functor_;
-    };
+    /*  Wait for the ranges other threads have claimed */
+    void wait()
+    {
+        unique_lock<mutex> lock(mtx);
+        allFinished.wait(lock, [this]()
+                         { return nFinished == nRanges; });
+    }
+
+    const int begin;
+    const int end;
+    const int grain;
+    const int nRanges;
+    const function<void(int, int)> *body;
+    atomic<int> nextRange;
+    mutex mtx;
+    condition_variable allFinished;
+    /*  Guarded by mtx */
+    int nFinished;
+    exception_ptr error;
+};
 
-    shared_ptr<Task> functorTask = make_shared<FunctorTask>(functor);
-    addTask(functorTask);
+void Executor::parallelFor(int begin, int end,
+                           const function<void(int, int)> &body,
+                           int grainSize)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+    int grain = chooseGrainSize(end - begin, grainSize);
+    auto state = make_shared<ParallelForState>(begin, end, grain, body);
+    // one task per range besides the calling thread's share
+    for (int i = 1; i < state->nRanges; i++)
+    {
+        addTask([state]()
+                { state->runRanges(); });
+    }
+    state->runRanges();
+    state->wait();
+    if (state->error)
+    {
+        rethrow_exception(state->error);
+    }
+}
+
+double Executor::parallelReduce(int begin, int end,
+                                const function<double(int, int)> &body,
+                                int grainSize)
+{
+    return parallelReduce(begin, end, 0.0, body, plus<double>(), grainSize);
 }
 
 /**
- *   Wait until all threads have completed
+ *  The number of threads to use when none is specified
  */
-void ExecutorImpl::join()
+static int defaultNumThreads()
 {
-    unique_lock<mutex> lock(mtx);
-    while (numRunningThreads > 0)
-    {
-        cv.wait(lock);
-    }
+    return max(1, (int)thread::hardware_concurrency());
 }
 
 /**
@@ -172,7 +749,7 @@ void ExecutorImpl::join()
  */
 shared_ptr<Executor> Executor::newInstance()
 {
-    return newInstance(thread::hardware_concurrency());
+    return newInstance(defaultNumThreads());
 }
 
 /**
@@ -180,9 +757,41 @@ shared_ptr<Executor> Executor::newInstance()
  */
 shared_ptr<Executor> Executor::newInstance(int maxThreads)
 {
-    shared_ptr<ExecutorImpl> ret = make_shared<ExecutorImpl>(maxThreads);
-    ret->self = ret;
-    return ret;
+    ASSERT(maxThreads >= 1);
+    return make_shared<ExecutorImpl>(make_shared<ThreadPool>(maxThreads));
+}
+
+/**
+ *  Returns an executor with the given scheduling
+ */
+shared_ptr<Executor> Executor::newInstance(int maxThreads, Scheduling scheduling)
+{
+    if (scheduling == WORK_STEALING)
+    {
+        ASSERT(maxThreads >= 1);
+        return make_shared<WorkStealingExecutor>(maxThreads);
+    }
+    return newInstance(maxThreads);
+}
+
+/**
+ *  Returns an executor using the process-wide pool
+ */
+shared_ptr<Executor> Executor::newSharedInstance()
+{
+    static shared_ptr<ThreadPool> sharedPool =
+        make_shared<ThreadPool>(defaultNumThreads());
+    return make_shared<ExecutorImpl>(sharedPool);
+}
+
+/**
+ *  Returns an executor using the process-wide pool for blocking tasks
+ */
+shared_ptr<Executor> Executor::newSharedBlockingInstance()
+{
+    static shared_ptr<ThreadPool> blockingPool =
+        make_shared<ThreadPool>(0, true);
+    return make_shared<ExecutorImpl>(blockingPool);
 }
 
 static void test100Tasks()
@@ -248,23 +857,12 @@ static void testComputeMeanTasks()
 
     int nTasks = 8;
     shared_ptr<Executor> executor = Executor::newInstance(nTasks);
-    vector<double> taskSum(nTasks);
     int taskVecLength = (vec.size() + nTasks - 1) / nTasks;
-    for (int i = 0; i < nTasks; i++)
-    {
-        auto lmbd = [&, taskVecLength, i]()
-        {
-            int startIdx = i * taskVecLength;
-            int endIdx = min((i + 1) * taskVecLength, static_cast<int>(vec.size()));
-            for (; startIdx < endIdx; startIdx++)
-            {
-                taskSum[i] += vec[startIdx];
-            }
-        };
-        executor->addTask(lmbd);
-    }
-    executor->join();
-    double calcMean = accumulate(taskSum.begin(), taskSum.end(), 0.0) / vec.size();
+    double taskSum = executor->parallelReduce(
+        0, (int)vec.size(), [&](int first, int last)
+        { return accumulate(vec.begin() + first, vec.begin() + last, 0.0); },
+        taskVecLength);
+    double calcMean = taskSum / vec.size();
     ASSERT_APPROX_EQUAL(mean, calcMean, 0.01);
 }
 
@@ -305,10 +903,492 @@ static void testComputeMeanThreads()
     ASSERT_APPROX_EQUAL(mean, calcMean, 0.01);
 }
 
+static void testThreadsAreReused()
+{
+    int nThreads = 3;
+    shared_ptr<Executor> executor = Executor::newInstance(nThreads);
+    mutex idsMutex;
+    set<thread::id> ids;
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 10; i++)
+        {
+            executor->addTask([&]()
+                              {
+                                  lock_guard<mutex> lock(idsMutex);
+                                  ids.insert(this_thread::get_id()); });
+        }
+        executor->join();
+    }
+    // the workers and the thread calling join
+    ASSERT((int)ids.size() <= nThreads + 1);
+}
+
+static void testBlockingTasks()
+{
+    // each task waits until all of them have started, which needs a
+    // thread for every task
+    mutex idsMutex;
+    set<thread::id> ids;
+    int nTasks = 6;
+    for (int round = 0; round < 10; round++)
+    {
+        shared_ptr<Executor> executor = Executor::newSharedBlockingInstance();
+        atomic<int> started(0);
+        for (int i = 0; i < nTasks; i++)
+        {
+            executor->addTask([&]()
+                              {
+                                  {
+                                      lock_guard<mutex> lock(idsMutex);
+                                      ids.insert(this_thread::get_id());
+                                  }
+                                  started++;
+                                  while (started < nTasks)
+                                  {
+                                      this_thread::yield();
+                                  } });
+        }
+        executor->join();
+    }
+    // later rounds reuse the threads the first one started
+    ASSERT((int)ids.size() <= nTasks + 1);
+}
+
+static void testSharedInstancesJoinSeparately()
+{
+    atomic<bool> release(false);
+    atomic<bool> slowDone(false);
+    shared_ptr<Executor> slow = Executor::newSharedInstance();
+    slow->addTask([&]()
+                  {
+                      while (!release)
+                      {
+                          this_thread::yield();
+                      }
+                      slowDone = true; });
+    // joining a second executor does not wait for the first
+    int value = 0;
+    shared_ptr<Executor> fast = Executor::newSharedInstance();
+    fast->addTask([&]()
+                  { value = 1; });
+    fast->join();
+    ASSERT(value == 1);
+    ASSERT(!slowDone);
+    release = true;
+    slow->join();
+    ASSERT(slowDone);
+}
+
+static void testNestedJoin()
+{
+    // tasks waiting on tasks cannot starve the shared pool
+    shared_ptr<Executor> outer = Executor::newSharedInstance();
+    int nOuter = 8;
+    vector<int> totals(nOuter, 0);
+    for (int i = 0; i < nOuter; i++)
+    {
+        outer->addTask([&totals, i]()
+                       {
+                           vector<int> parts(4, 0);
+                           shared_ptr<Executor> inner = Executor::newSharedInstance();
+                           for (int j = 0; j < 4; j++)
+                           {
+                               inner->addTask([&parts, i, j]()
+                                              { parts[j] = i * j; });
+                           }
+                           inner->join();
+                           totals[i] = accumulate(parts.begin(), parts.end(), 0); });
+    }
+    outer->join();
+    for (int i = 0; i < nOuter; i++)
+    {
+        ASSERT(totals[i] == 6 * i);
+    }
+}
+
+static void testPoolPerformance()
+{
+    int nRounds = 500;
+    int nTasks = 4;
+    atomic<int> count(0);
+
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < nRounds; round++)
+    {
+        vector<thread> threads;
+        for (int i = 0; i < nTasks; i++)
+        {
+            threads.push_back(thread([&count]()
+                                     { count++; }));
+        }
+        for (thread &t : threads)
+        {
+            t.join();
+        }
+    }
+    double threadTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < nRounds; round++)
+    {
+        shared_ptr<Executor> executor = Executor::newSharedInstance();
+        for (int i = 0; i < nTasks; i++)
+        {
+            executor->addTask([&count]()
+                              { count++; });
+        }
+        executor->join();
+    }
+    double poolTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ASSERT(count == 2 * nRounds * nTasks);
+    INFO(nRounds << " rounds of " << nTasks << " tiny tasks\n"
+                 << "New thread per task: " << threadTime << "s\n"
+                 << "Shared pool: " << poolTime << "s");
+}
+
+static void testWorkStealing()
+{
+    shared_ptr<Executor> executor = Executor::newInstance(4, Executor::WORK_STEALING);
+    vector<int> vals(100, 0);
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            executor->addTask([&vals, i]()
+                              { vals[i]++; });
+        }
+        executor->join();
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT(vals[i] == 3);
+    }
+
+    // tasks can add more tasks, which go on their own thread's queue
+    atomic<int> leaves(0);
+    function<void(int)> spawn = [&](int depth)
+    {
+        if (depth == 0)
+        {
+            leaves++;
+            return;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            executor->addTask([&spawn, depth]()
+                              { spawn(depth - 1); });
+        }
+    };
+    executor->addTask([&spawn]()
+                      { spawn(10); });
+    executor->join();
+    ASSERT(leaves == 1024);
+}
+
+static void testWorkStealingPerformance()
+{
+    int nTasks = 100000;
+    int nCores = max(1, (int)thread::hardware_concurrency());
+    stringstream report;
+    report << nTasks << " small tasks on " << nCores << " cores, "
+           << "tasks per second and speedup over one thread";
+    if (nCores < 2)
+    {
+        report << "\nOnly one core is available, so these show the cost of "
+               << "scheduling rather than any scaling";
+    }
+    for (int scheduling = Executor::SHARED_QUEUE; scheduling <= Executor::WORK_STEALING; scheduling++)
+    {
+        report << "\n"
+               << (scheduling == Executor::SHARED_QUEUE ? "Shared queue:" : "Work stealing:");
+        double oneThreadTime = 0.0;
+        double allCoresTime = 0.0;
+        // always try a few threads so stealing happens even on small
+        // machines, and finish with every core
+        vector<int> threadCounts;
+        for (int nThreads = 1; nThreads < max(4, nCores); nThreads *= 2)
+        {
+            threadCounts.push_back(nThreads);
+        }
+        threadCounts.push_back(max(4, nCores));
+        for (int nThreads : threadCounts)
+        {
+            shared_ptr<Executor> executor =
+                Executor::newInstance(nThreads, (Executor::Scheduling)scheduling);
+            vector<double> results(nTasks, 0.0);
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < nTasks; i++)
+            {
+                executor->addTask([&results, i]()
+                                  {
+                                      double total = 0.0;
+                                      for (int j = 1; j <= 100; j++)
+                                      {
+                                          total += sqrt((double)(i + j));
+                                      }
+                                      results[i] = total; });
+            }
+            executor->join();
+            double time = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-6);
+            ASSERT(results[nTasks - 1] > 0.0);
+            if (nThreads == 1)
+            {
+                oneThreadTime = time;
+            }
+            if (nThreads == nCores)
+            {
+                allCoresTime = time;
+            }
+            report << " " << nThreads << " threads " << nTasks / time * 1e-6 << "M ("
+                   << oneThreadTime / time << "x)";
+        }
+        // with more than one core, stealing must make use of them
+        if (scheduling == Executor::WORK_STEALING && nCores >= 2)
+        {
+            ASSERT(allCoresTime < oneThreadTime);
+        }
+    }
+    INFO(report.str());
+}
+
+static void testParallelFor()
+{
+    for (int grainSize : {0, 1, 7, 1000})
+    {
+        shared_ptr<Executor> executor = Executor::newSharedInstance();
+        vector<int> counts(1000, 0);
+        executor->parallelFor(
+            0, 1000, [&](int first, int last)
+            {
+                for (int i = first; i < last; i++)
+                {
+                    counts[i]++;
+                } },
+            grainSize);
+        for (int count : counts)
+        {
+            ASSERT(count == 1);
+        }
+    }
+    // empty ranges do nothing
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    executor->parallelFor(5, 5, [](int, int)
+                          { ASSERT(false); });
+}
+
+static void testNestedParallelFor()
+{
+    for (Executor::Scheduling scheduling : {Executor::SHARED_QUEUE, Executor::WORK_STEALING})
+    {
+        // the only thread is busy with the outer task, so the
+        // inner ranges can only run on the thread that waits for them
+        shared_ptr<Executor> executor = Executor::newInstance(1, scheduling);
+        Executor *raw = executor.get();
+        vector<int> counts(10, 0);
+        executor->addTask([raw, &counts]()
+                          { raw->parallelFor(0, 10, [&counts](int first, int last)
+                                             {
+                                                 for (int i = first; i < last; i++)
+                                                 {
+                                                     counts[i]++;
+                                                 } },
+                                             1); });
+        executor->join();
+        for (int count : counts)
+        {
+            ASSERT(count == 1);
+        }
+    }
+}
+
+static void testParallelForIgnoresOtherTasks()
+{
+    // a parallelFor neither waits for nor reports the executor's other tasks
+    shared_ptr<Executor> executor = Executor::newInstance(2);
+    atomic<bool> release(false);
+    executor->addTask([&release]()
+                      {
+                          while (!release)
+                          {
+                              this_thread::yield();
+                          }
+                          throw runtime_error("unrelated task failed"); });
+    int total = executor->parallelReduce(
+        0, 100, 0, [](int first, int last)
+        { return last - first; },
+        plus<int>(), 10);
+    ASSERT(total == 100);
+    release = true;
+    bool thrown = false;
+    try
+    {
+        executor->join();
+    }
+    catch (const runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+
+    // an exception from a range reaches the caller
+    thrown = false;
+    try
+    {
+        executor->parallelFor(0, 20, [](int first, int)
+                              {
+                                  if (first == 7)
+                                  {
+                                      throw runtime_error("range failed");
+                                  } },
+                              1);
+    }
+    catch (const runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    executor->join();
+}
+
+static void testParallelReduce()
+{
+    int n = 100003;
+    vector<double> values(n);
+    mt19937 random;
+    uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (double &v : values)
+    {
+        v = dist(random) * pow(10.0, 10.0 * dist(random));
+    }
+    auto sumRange = [&](int first, int last)
+    {
+        return accumulate(values.begin() + first, values.begin() + last, 0.0);
+    };
+
+    // the sum is bit for bit the same whatever executes it, with
+    // a given grain size or an automatic one
+    int grain = 1000;
+    double expected = Executor::newInstance(1)->parallelReduce(0, n, sumRange, grain);
+    double expectedAuto = Executor::newInstance(1)->parallelReduce(0, n, sumRange);
+    for (int nThreads : {2, 3, 8})
+    {
+        ASSERT(Executor::newInstance(nThreads)->parallelReduce(0, n, sumRange, grain) == expected);
+        ASSERT(Executor::newInstance(nThreads, Executor::WORK_STEALING)->parallelReduce(0, n, sumRange, grain) == expected);
+        ASSERT(Executor::newInstance(nThreads)->parallelReduce(0, n, sumRange) == expectedAuto);
+        ASSERT(Executor::newInstance(nThreads, Executor::WORK_STEALING)->parallelReduce(0, n, sumRange) == expectedAuto);
+    }
+    ASSERT_APPROX_EQUAL(expectedAuto, expected, 1e-6 * fabs(expected) + 1e-3);
+    ASSERT_APPROX_EQUAL(expected, accumulate(values.begin(), values.end(), 0.0),
+                        1e-6 * fabs(expected) + 1e-3);
+
+    // other types and operations
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    int largest = executor->parallelReduce(
+        0, n, 0, [](int, int last)
+        { return last - 1; },
+        [](int a, int b)
+        { return max(a, b); });
+    ASSERT(largest == n - 1);
+}
+
+static void testChooseGrainSize()
+{
+    // many ranges, but never tiny ones, whatever the number of threads
+    shared_ptr<Executor> one = Executor::newInstance(1);
+    shared_ptr<Executor> four = Executor::newInstance(4, Executor::WORK_STEALING);
+    ASSERT(one->nThreads() == 1 && four->nThreads() == 4);
+    ASSERT(Executor::chooseGrainSize(100000, 0) == 391);
+    ASSERT(Executor::chooseGrainSize(100, 0) == 64);
+    ASSERT(Executor::chooseGrainSize(100, 7) == 7);
+}
+
+static void testJoinRethrows()
+{
+    vector<shared_ptr<Executor>> executors = {
+        Executor::newInstance(2),
+        Executor::newInstance(2, Executor::WORK_STEALING),
+        Executor::newSharedInstance()};
+    for (shared_ptr<Executor> executor : executors)
+    {
+        atomic<int> nRun(0);
+        for (int i = 0; i < 20; i++)
+        {
+            executor->addTask([&nRun, i]()
+                              {
+                                  nRun++;
+                                  if (i == 7)
+                                  {
+                                      throw runtime_error("task failed");
+                                  } });
+        }
+        bool thrown = false;
+        try
+        {
+            executor->join();
+        }
+        catch (const runtime_error &)
+        {
+            thrown = true;
+        }
+        ASSERT(thrown);
+        ASSERT(nRun == 20);
+        // the error is reported once and the executor still works
+        executor->addTask([&nRun]()
+                          { nRun++; });
+        executor->join();
+        ASSERT(nRun == 21);
+    }
+}
+
+static void testDestroyFromOwnWorker()
+{
+    for (Executor::Scheduling scheduling : {Executor::SHARED_QUEUE, Executor::WORK_STEALING})
+    {
+        // the task holds the last reference, so the executor and
+        // its threads go when one of them finishes with the task
+        atomic<bool> released(false);
+        atomic<bool> ran(false);
+        {
+            shared_ptr<Executor> executor = Executor::newInstance(2, scheduling);
+            executor->addTask([executor, &released, &ran]()
+                              {
+                                  while (!released)
+                                  {
+                                      this_thread::yield();
+                                  }
+                                  ran = true; });
+        }
+        released = true;
+        while (!ran)
+        {
+            this_thread::yield();
+        }
+        // give the detached thread time to exit
+        this_thread::sleep_for(chrono::milliseconds(20));
+        ASSERT(ran);
+    }
+}
+
 void testExecutor()
 {
     TEST(test100Tasks);
     TEST(test100FunctorTasks);
     TEST(testComputeMeanTasks);
     TEST(testComputeMeanThreads);
+    TEST(testThreadsAreReused);
+    TEST(testBlockingTasks);
+    TEST(testSharedInstancesJoinSeparately);
+    TEST(testNestedJoin);
+    TEST(testJoinRethrows);
+    TEST(testDestroyFromOwnWorker);
+    TEST(testPoolPerformance);
+    TEST(testWorkStealing);
+    TEST(testWorkStealingPerformance);
+    TEST(testParallelFor);
+    TEST(testNestedParallelFor);
+    TEST(testParallelForIgnoresOtherTasks);
+    TEST(testParallelReduce);
+    TEST(testChooseGrainSize);
 }
@@ -0,0 +1,124 @@
+#include "Future.h"
+#include "Executor.h"
+
+using namespace std;
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static void testSubmit()
+{
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    Future<int> answer = executor->submit([]()
+                                          { return 6 * 7; });
+    int sideEffect = 0;
+    Future<void> done = executor->submit([&sideEffect]()
+                                         { sideEffect = 1; });
+    ASSERT(answer.get() == 42);
+    // the result can be read more than once
+    ASSERT(answer.get() == 42);
+    done.get();
+    ASSERT(sideEffect == 1);
+    ASSERT(answer.isReady() && done.isReady());
+    executor->join();
+}
+
+static void testExceptions()
+{
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    Future<double> failure = executor->submit([]() -> double
+                                              { throw runtime_error("no price"); });
+    Future<double> next = failure.then([](double x)
+                                       { return x + 1.0; });
+    bool thrown = false;
+    try
+    {
+        failure.get();
+    }
+    catch (const runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    thrown = false;
+    try
+    {
+        next.get();
+    }
+    catch (const runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    executor->join();
+}
+
+static void testThen()
+{
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    Future<string> chained = executor->submit([]()
+                                              { return 21; })
+                                 .then([](int x)
+                                       { return 2.0 * x; })
+                                 .then([](double x)
+                                       { return to_string((int)x); });
+    ASSERT(chained.get() == "42");
+    // continuing a finished future runs straight away
+    Future<int> finished = executor->submit([]()
+                                            { return 1; });
+    finished.wait();
+    Future<int> continued = finished.then([](int x)
+                                          { return x + 1; });
+    ASSERT(continued.isReady() && continued.get() == 2);
+    Future<void> noResult = executor->submit([]() {});
+    ASSERT(noResult.then([]()
+                         { return 3; })
+               .get() == 3);
+    executor->join();
+}
+
+static void testIndependentResults()
+{
+    // a result is available while other tasks are still running
+    atomic<bool> release(false);
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    Future<int> slow = executor->submit([&release]()
+                                        {
+                                            while (!release)
+                                            {
+                                                this_thread::yield();
+                                            }
+                                            return 1; });
+    Future<int> fast = executor->submit([]()
+                                        { return 2; });
+    ASSERT(fast.get() == 2);
+    ASSERT(!slow.isReady());
+    release = true;
+    ASSERT(slow.get() == 1);
+    executor->join();
+}
+
+static void testWaitingInsideTasks()
+{
+    // with one thread the inner task can only run if get runs it
+    shared_ptr<Executor> executor = Executor::newInstance(1);
+    Future<int> outer = executor->submit([&executor]()
+                                         {
+                                             Future<int> inner = executor->submit([]()
+                                                                                  { return 1; });
+                                             return inner.get() + 1; });
+    ASSERT(outer.get() == 2);
+    executor->join();
+}
+
+void testFuture()
+{
+    TEST(testSubmit);
+    TEST(testExceptions);
+    TEST(testThen);
+    TEST(testIndependentResults);
+    TEST(testWaitingInsideTasks);
+}
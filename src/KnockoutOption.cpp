@@ -1 +1,42 @@
-#include "KnockoutOption.h"
\ No newline at end of file
+#include "KnockoutOption.h"
+
+#include "CallOption.h"
+
+using namespace std;
+
+bool KnockoutOption::getControlVariate( const MultiStockModel& model,
+                                        ControlVariate& control ) const {
+    auto call = make_shared<CallOption>();
+    call->setStock( getStock() );
+    call->setStrike( getStrike() );
+    call->setMaturity( getMaturity() );
+    control.payoff = [call]( const MarketSimulation& sim ) {
+        return ((const ContinuousTimeOption&)*call).payoff( sim );
+    };
+    control.price = call->price( model );
+    control.statistics = call->getPathStatistics();
+    return true;
+}
+
+void KnockoutOption::getContinuousControl( shared_ptr<const KnockoutOption> continuous,
+                                           double continuousPrice,
+                                           const MultiStockModel& model,
+                                           ControlVariate& control ) const {
+    ASSERT( continuous->isContinuouslyMonitored() );
+    BlackScholesModel bsm = model.getBlackScholesModel( getStock() );
+    double initialPrice = bsm.stockPrice;
+    double variance = bsm.volatility*bsm.volatility*(getMaturity() - bsm.date);
+    control.payoff = [continuous, initialPrice, variance]( const MarketSimulation& sim ) {
+        if (sim.hasPathSummaries()) {
+            return continuous->payoff( sim.getPathSummary( continuous->getStock() ) );
+        }
+        // summarise the whole paths
+        MatrixView prices = sim.getStockPrices( continuous->getStock() );
+        PathSummary summary( prices.nRows(), continuous->getPathStatistics() );
+        summary.setBridge( initialPrice, variance/prices.nCols() );
+        summary.addSteps( prices );
+        return continuous->payoff( summary );
+    };
+    control.price = continuousPrice;
+    control.statistics = continuous->getPathStatistics();
+}
@@ -3,6 +3,7 @@
 #include "stdafx.h"
 #include "testing.h"
 #include "matlib.h"
+#include "MatrixExpression.h"
 
 using namespace std;
 
@@ -14,14 +15,41 @@ set<string> MargrabeOption::getStocks() const {
 Matrix MargrabeOption::payoff(
 	const MarketSimulation& simulation
 	) const {
-	auto stockPrices1 = simulation.getStockPrices(stock1);
-	int nSteps = stockPrices1->nCols();
-	Matrix finalPrices1 = stockPrices1->col(nSteps - 1);
-	auto stockPrices2 = simulation.getStockPrices(stock2);
-	Matrix finalPrices2 = stockPrices2->col(nSteps - 1);
-	Matrix ret = finalPrices1 - finalPrices2;
-	ret.positivePart();
-	return ret;
+	MatrixView stockPrices1 = simulation.getStockPrices(stock1);
+	int nSteps = stockPrices1.nCols();
+	MatrixView finalPrices1 = stockPrices1.col(nSteps - 1);
+	MatrixView stockPrices2 = simulation.getStockPrices(stock2);
+	MatrixView finalPrices2 = stockPrices2.col(nSteps - 1);
+	return positivePart(lazy(finalPrices1) - lazy(finalPrices2));
+}
+
+double MargrabeOption::analyticPrice(const MultiStockModel& model) const {
+	double S1 = model.getBlackScholesModel(stock1).stockPrice;
+	double S2 = model.getBlackScholesModel(stock2).stockPrice;
+	double variance = model.getCovariance(stock1, stock1)
+		+ model.getCovariance(stock2, stock2)
+		- 2 * model.getCovariance(stock1, stock2);
+	double T = maturity - model.getDate();
+	double sigma = sqrt(variance*T);
+	double d1 = (log(S1 / S2) + 0.5*sigma*sigma) / sigma;
+	double d2 = d1 - sigma;
+	return S1*normcdf(d1) - S2*normcdf(d2);
+}
+
+bool MargrabeOption::getControlVariate(const MultiStockModel& model,
+	ControlVariate& control) const {
+	string first = stock1;
+	string second = stock2;
+	control.payoff = [first, second](const MarketSimulation& simulation) {
+		MatrixView stockPrices1 = simulation.getStockPrices(first);
+		MatrixView stockPrices2 = simulation.getStockPrices(second);
+		int nSteps = stockPrices1.nCols();
+		return Matrix(lazy(stockPrices1.col(nSteps - 1))
+			- lazy(stockPrices2.col(nSteps - 1)));
+	};
+	control.price = model.getBlackScholesModel(stock1).stockPrice
+		- model.getBlackScholesModel(stock2).stockPrice;
+	return true;
 }
 
 
@@ -62,6 +90,7 @@ static void testAnalyticalFormula() {
 
 	double analyticalPrice = S1*normcdf(d1) - S2*normcdf(d2);
 	ASSERT_APPROX_EQUAL(monteCarloPrice, analyticalPrice, 0.01);
+	ASSERT_APPROX_EQUAL(m.analyticPrice(model), analyticalPrice, 1e-10);
 }
 
 
@@ -0,0 +1,136 @@
+#include "MarketSimulation.h"
+
+using namespace std;
+
+MarketSimulation::MarketSimulation() :
+	layout(PATHS_BY_STEP) {
+}
+
+MarketSimulation::MarketSimulation(const vector<string>& stocks,
+	int nPaths,
+	int nSteps,
+	PathLayout layout) :
+	paths(make_shared<Matrix>(nPaths*nSteps, (int)stocks.size(), false)),
+	layout(layout) {
+	for (int j = 0; j < (int)stocks.size(); j++) {
+		const double* block = getStockBlock(j);
+		if (layout == PATHS_BY_STEP) {
+			simulations.insert_or_assign(stocks[j],
+				MatrixView(block, nPaths, nSteps, 1, nPaths));
+		} else {
+			simulations.insert_or_assign(stocks[j],
+				MatrixView(block, nPaths, nSteps, nSteps, 1));
+		}
+	}
+}
+
+void MarketSimulation::addSimulation(const string& stock,
+	SPCMatrix matrix) {
+	addedMatrices.push_back(matrix);
+	simulations.insert_or_assign(stock, MatrixView(*matrix));
+}
+
+MatrixView MarketSimulation::getStockPrices(const string& stock) const {
+	auto pos = simulations.find(stock);
+	ASSERT(pos != simulations.end());
+	return pos->second;
+}
+
+MarketSimulation MarketSimulation::firstSteps(int nSteps) const {
+	ASSERT(!hasPathSummaries());
+	MarketSimulation ret(*this);
+	for (auto& pair : ret.simulations) {
+		MatrixView& prices = pair.second;
+		prices = prices.block(0, 0, prices.nRows(), nSteps);
+	}
+	return ret;
+}
+
+void MarketSimulation::addPathSummary(const string& stock,
+	SPCPathSummary summary) {
+	summaries[stock] = summary;
+}
+
+const PathSummary& MarketSimulation::getPathSummary(const string& stock) const {
+	auto pos = summaries.find(stock);
+	ASSERT(pos != summaries.end());
+	return *pos->second;
+}
+
+//
+//    Tests
+//
+
+static void testLayouts() {
+	vector<string> stocks({ "Acme", "Bigbank" });
+	int nPaths = 3;
+	int nSteps = 4;
+	for (PathLayout layout : { PATHS_BY_STEP, PATHS_BY_PATH }) {
+		MarketSimulation sim(stocks, nPaths, nSteps, layout);
+		ASSERT(sim.getLayout() == layout);
+		for (int j = 0; j < 2; j++) {
+			double* block = sim.getStockBlock(j);
+			for (int p = 0; p < nPaths; p++) {
+				for (int t = 0; t < nSteps; t++) {
+					int offset = (layout == PATHS_BY_STEP)
+						? t*nPaths + p
+						: p*nSteps + t;
+					block[offset] = 1000 * j + 10 * p + t;
+				}
+			}
+		}
+		// the stocks are consecutive blocks of one allocation
+		MatrixView acme = sim.getStockPrices("Acme");
+		MatrixView bigbank = sim.getStockPrices("Bigbank");
+		ASSERT(bigbank.begin() == acme.begin() + nPaths*nSteps);
+		ASSERT(acme.nRows() == nPaths && acme.nCols() == nSteps);
+		ASSERT(acme(2, 3) == 23);
+		ASSERT(bigbank(1, 2) == 1012);
+		// copies share the prices
+		MarketSimulation copy = sim;
+		ASSERT(copy.getStockPrices("Bigbank").begin() == bigbank.begin());
+	}
+}
+
+static void testFirstSteps() {
+	vector<string> stocks({ "Acme", "Bigbank" });
+	int nPaths = 3;
+	int nSteps = 4;
+	for (PathLayout layout : { PATHS_BY_STEP, PATHS_BY_PATH }) {
+		MarketSimulation sim(stocks, nPaths, nSteps, layout);
+		MatrixView acme = sim.getStockPrices("Acme");
+		double* block = sim.getStockBlock(0);
+		for (int i = 0; i < nPaths*nSteps; i++) {
+			block[i] = i;
+		}
+		MarketSimulation start = sim.firstSteps(2);
+		MatrixView first = start.getStockPrices("Acme");
+		ASSERT(first.nRows() == nPaths && first.nCols() == 2);
+		ASSERT(first.begin() == acme.begin());
+		for (int p = 0; p < nPaths; p++) {
+			for (int t = 0; t < 2; t++) {
+				ASSERT(first(p, t) == acme(p, t));
+			}
+		}
+		ASSERT(start.getStockPrices("Bigbank").nCols() == 2);
+	}
+}
+
+static void testAddSimulation() {
+	MarketSimulation sim;
+	SPMatrix prices(new Matrix("1,2;3,4"));
+	sim.addSimulation("Acme", prices);
+	Matrix(sim.getStockPrices("Acme")).assertEquals(*prices, 0.0);
+	PathStatistics statistics;
+	statistics.terminal = true;
+	shared_ptr<PathSummary> summary = make_shared<PathSummary>(2, statistics);
+	summary->addStep(prices->begin() + 2);
+	sim.addPathSummary("Acme", summary);
+	Matrix("2;4").assertEquals(sim.getPathSummary("Acme").getTerminal(), 0.0);
+}
+
+void testMarketSimulation() {
+	TEST(testLayouts);
+	TEST(testAddSimulation);
+	TEST(testFirstSteps);
+}
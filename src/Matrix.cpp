@@ -1,8 +1,28 @@
 #include "Matrix.h"
 #include "matlib.h"
+#include "MatrixKernels.h"
+#include "MatrixView.h"
 
 using namespace std;
 
+/*  Counts every buffer allocated by a matrix */
+static atomic<long long> nAllocations( 0 );
+
+/*  The number of buffers allocated so far */
+long long Matrix::allocationCount() {
+    return nAllocations.load();
+}
+
+/**
+ *  Allocate the storage for a matrix
+ */
+void Matrix::allocate( int size ) {
+    allocator = &MatrixAllocator::current();
+    data = allocator->allocate( size );
+    endPointer = data+size;
+    nAllocations++;
+}
+
 /**
  *  Initializes a matrix using a string in the format
  *  1,2,3;4,5,6 etc.
@@ -42,8 +62,7 @@ Matrix::Matrix( string s ) {
     stringstream ss;
     ss.str(s);
     int size = nrows*ncols;
-    data = new double[size];
-    endPointer = data+size;
+    allocate( size );
     for (int i=0; i<nrows; i++) {
         for (int j=0; j<ncols; j++) {
             double* p = begin() + offset( i,j );
@@ -56,8 +75,7 @@ Matrix::Matrix( string s ) {
 Matrix::Matrix( int nrows, int ncols, bool zeros )
     : nrows( nrows ), ncols( ncols ) {
     int size = nrows*ncols;
-    data = new double[size];
-    endPointer = data+size;
+    allocate( size );
     if (zeros) {
         // memset is an optimised low level function
         // that should be faster than looping
@@ -68,19 +86,30 @@ Matrix::Matrix( int nrows, int ncols, bool zeros )
 Matrix::Matrix()
     : nrows( 1 ), ncols( 1 ) {
     int size = nrows*ncols;
-    data = new double[size];
-    endPointer = data+size;
+    allocate( size );
     *data = 0.0;
 };
 
 Matrix::Matrix( double value )
     : nrows( 1 ), ncols( 1 ) {
     int size = nrows*ncols;
-    data = new double[size];
-    endPointer = data+size;
+    allocate( size );
     *data = value;
 };
 
+Matrix::Matrix( const MatrixView& view )
+    : nrows( view.nRows() ), ncols( view.nCols() ) {
+    allocate( nrows*ncols );
+    double* dest = data;
+    for (int j=0; j<ncols; j++) {
+        const double* source = view.begin() + j*view.getColStride();
+        int stride = view.getRowStride();
+        for (int i=0; i<nrows; i++) {
+            *(dest++) = source[i*stride];
+        }
+    }
+}
+
 Matrix::Matrix( std::vector<double> vals, bool rowVector )
     : nrows( vals.size()), ncols(1) {
     if (rowVector) {
@@ -88,8 +117,7 @@ Matrix::Matrix( std::vector<double> vals, bool rowVector )
         nrows = 1;
     }
     int size = nrows*ncols;
-    data = new double[size];
-    endPointer = data+size;
+    allocate( size );
     for (int i=0; i<size; i++) {
         data[i] = vals[i];
     }
@@ -105,11 +133,29 @@ void Matrix::assign( const Matrix& other ) {
     nrows = other.nrows;
     ncols = other.ncols;
     int size = nrows*ncols;
-    data = new double[size];
-    endPointer = data+size;
+    allocate( size );
     memcpy( data, other.data, sizeof( double )*size );
 }
 
+/**
+ *  Copy another matrix into this one. When the sizes match
+ *  there is no need to allocate new storage.
+ */
+Matrix& Matrix::operator=( const Matrix& other ) {
+    if (this == &other) {
+        return *this;
+    }
+    if (nrows*ncols == other.nrows*other.ncols) {
+        nrows = other.nrows;
+        ncols = other.ncols;
+        memcpy( data, other.data, sizeof( double )*nrows*ncols );
+    } else {
+        deallocate();
+        assign( other );
+    }
+    return *this;
+}
+
 
 /*  
  *   Assert two matrices are identical
@@ -217,56 +263,36 @@ Matrix Matrix::col( int j ) const {
 
 /*  Exponentiate every element */
 void Matrix::exp() {
-	for (double* p=begin(); p!=end(); p++) {
-		*p = std::exp(*p);
-	}
+	vectorExp( begin(), nrows*ncols );
 }
 /*  Square root every element */
 void Matrix::sqrt() {
-	for (double* p=begin(); p!=end(); p++) {
-		*p = std::sqrt(*p);
-	}
+	vectorSqrt( begin(), nrows*ncols );
 }
 /*  Take the log of every element */
 void Matrix::log() {
-	for (double* p=begin(); p!=end(); p++) {
-		*p = std::log(*p);
-	}
+	vectorLog( begin(), nrows*ncols );
 }
 
 /*  Entrywise raising to a power */
 void Matrix::pow( double power ) {
-	for (double* p=begin(); p!=end(); p++) {
-		*p = std::pow(*p, power);
-	}
+	vectorPow( begin(), nrows*ncols, power );
 }
 
 /*  Take the positive part of every element in the matrix */
 void Matrix::positivePart() {
-	for (double* p=begin(); p!=end(); p++) {
-        double val = *p;
-		*p = (val>0.0) ? val : 0.0;
-	}
+	vectorPositivePart( begin(), nrows*ncols );
 }
 /*  Take the negative part of every element in the matrix */
 void Matrix::negativePart() {
-	for (double* p=begin(); p!=end(); p++) {
-        double val = *p;
-		*p = (val<0.0) ? val : 0.0;
-	}
+	vectorNegativePart( begin(), nrows*ncols );
 }
 
 
 /*  Entrywise raising to a power */
 void Matrix::pow( const Matrix& power ) {
     ASSERT( nRows()==power.nRows() && nCols()==power.nCols());
-	double* p1=begin();
-	const double* p2=power.begin();
-	while (p1!=end()) {
-		*p1=std::pow(*p1,*p2);
-		p1++;
-		p2++;
-	}
+	vectorPow( begin(), power.begin(), nrows*ncols );
 }
 
 /*  Entrywise multiplication */
@@ -375,6 +401,11 @@ Matrix operator*(const Matrix& m, double scalar ) {
 }
 
 
+Matrix operator*(Matrix&& m, double scalar ) {
+    m *= scalar;
+    return std::move( m );
+}
+
 Matrix operator+(const Matrix& m, double scalar ) {
     Matrix ret(m.nRows(), m.nCols(), 0 );
     double* dest = ret.begin();
@@ -387,6 +418,11 @@ Matrix operator+(const Matrix& m, double scalar ) {
 }
 
 
+Matrix operator+(Matrix&& m, double scalar ) {
+    m += scalar;
+    return std::move( m );
+}
+
 Matrix operator+(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
     Matrix ret(x.nRows(), x.nCols(), 0 );
@@ -400,6 +436,21 @@ Matrix operator+(const Matrix& x, const Matrix& y ) {
     return ret;
 }
 
+Matrix operator+(Matrix&& x, const Matrix& y ) {
+    x += y;
+    return std::move( x );
+}
+
+Matrix operator+(const Matrix& x, Matrix&& y ) {
+    y += x;
+    return std::move( y );
+}
+
+Matrix operator+(Matrix&& x, Matrix&& y ) {
+    x += y;
+    return std::move( x );
+}
+
 Matrix operator-(double scalar, const Matrix& m ) {
     Matrix ret(m.nRows(), m.nCols(), 0 );
     double* dest = ret.begin();
@@ -411,6 +462,13 @@ Matrix operator-(double scalar, const Matrix& m ) {
     return ret;
 }
 
+Matrix operator-(double scalar, Matrix&& m ) {
+    for (double* p=m.begin(); p!=m.end(); p++) {
+        *p = scalar - *p;
+    }
+    return std::move( m );
+}
+
 Matrix operator-(const Matrix& m, double scalar ) {
     Matrix ret(m.nRows(), m.nCols(), 0 );
     double* dest = ret.begin();
@@ -422,6 +480,11 @@ Matrix operator-(const Matrix& m, double scalar ) {
     return ret;
 }
 
+Matrix operator-(Matrix&& m, double scalar ) {
+    m -= scalar;
+    return std::move( m );
+}
+
 Matrix operator-(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
     Matrix ret(x.nRows(), x.nCols(), 0);
@@ -435,168 +498,124 @@ Matrix operator-(const Matrix& x, const Matrix& y ) {
     return ret;
 }
 
+Matrix operator-(Matrix&& x, const Matrix& y ) {
+    x -= y;
+    return std::move( x );
+}
+
+Matrix operator-(const Matrix& x, Matrix&& y ) {
+    ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
+    const double* s1 = x.begin();
+    for (double* p=y.begin(); p!=y.end(); p++) {
+        *p = *(s1++) - *p;
+    }
+    return std::move( y );
+}
+
+Matrix operator-(Matrix&& x, Matrix&& y ) {
+    x -= y;
+    return std::move( x );
+}
+
 
 /*  Comparison operator */
 Matrix operator>(const Matrix& x, double s ) {
-    Matrix ret(x.nRows(), x.nCols(), 0 );
-    double* dest = ret.begin();
-    const double* source = x.begin();
-    const double* end = x.end();
-    while (source!=end) {
-        *(dest++) = *(source++) > s;
-    }
+    Matrix ret(x.nRows(), x.nCols(), false );
+    vectorCompare( x.begin(), s, ret.begin(), x.nRows()*x.nCols(), COMPARE_GREATER );
     return ret;
 }
 /*  Comparison operator */
 Matrix operator>=(const Matrix& x, double s ) {
-    Matrix ret(x.nRows(), x.nCols(), 0 );
-    double* dest = ret.begin();
-    const double* source = x.begin();
-    const double* end = x.end();
-    while (source!=end) {
-        *(dest++) = *(source++) >= s;
-    }
+    Matrix ret(x.nRows(), x.nCols(), false );
+    vectorCompare( x.begin(), s, ret.begin(), x.nRows()*x.nCols(), COMPARE_GREATER_EQUAL );
     return ret;
 }
 /*  Comparison operator */
 Matrix operator<(const Matrix& x, double s ) {
-    Matrix ret(x.nRows(), x.nCols(), 0 );
-    double* dest = ret.begin();
-    const double* source = x.begin();
-    const double* end = x.end();
-    while (source!=end) {
-        *(dest++) = *(source++) < s;
-    }
+    Matrix ret(x.nRows(), x.nCols(), false );
+    vectorCompare( x.begin(), s, ret.begin(), x.nRows()*x.nCols(), COMPARE_LESS );
     return ret;
 }
 /*  Comparison operator */
 Matrix operator<=(const Matrix& x, double s ) {
-    Matrix ret(x.nRows(), x.nCols(), 0 );
-    double* dest = ret.begin();
-    const double* source = x.begin();
-    const double* end = x.end();
-    while (source!=end) {
-        *(dest++) = *(source++) <= s;
-    }
+    Matrix ret(x.nRows(), x.nCols(), false );
+    vectorCompare( x.begin(), s, ret.begin(), x.nRows()*x.nCols(), COMPARE_LESS_EQUAL );
     return ret;
 }
 /*  Comparison operator */
 Matrix operator==(const Matrix& x, double s ) {
-    Matrix ret(x.nRows(), x.nCols(), 0 );
-    double* dest = ret.begin();
-    const double* source = x.begin();
-    const double* end = x.end();
-    while (source!=end) {
-        *(dest++) = *(source++) == s;
-    }
+    Matrix ret(x.nRows(), x.nCols(), false );
+    vectorCompare( x.begin(), s, ret.begin(), x.nRows()*x.nCols(), COMPARE_EQUAL );
     return ret;
 }
 /*  Comparison operator */
-Matrix operator!=(const Matrix& x, double s) {
-    Matrix ret(x.nRows(), x.nCols(), 0 );
-    double* dest = ret.begin();
-    const double* source = x.begin();
-    const double* end = x.end();
-    while (source!=end) {
-        *(dest++) = *(source++) != s;
-    }
+Matrix operator!=(const Matrix& x, double s ) {
+    Matrix ret(x.nRows(), x.nCols(), false );
+    vectorCompare( x.begin(), s, ret.begin(), x.nRows()*x.nCols(), COMPARE_NOT_EQUAL );
     return ret;
 }
 
 /*  Comparison operator */
 Matrix operator>(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
-    Matrix ret(x.nRows(), x.nCols(), 0);
-    double* dest = ret.begin();
-    const double* s1 = x.begin();
-    const double* s2 = y.begin();
-    const double* end = x.end();
-    while (s1!=end) {
-        *(dest++) = *(s1++) > *(s2++);
-    }
+    Matrix ret(x.nRows(), x.nCols(), false);
+    vectorCompare( x.begin(), y.begin(), ret.begin(), x.nRows()*x.nCols(), COMPARE_GREATER );
     return ret;
 }
 /*  Comparison operator */
-Matrix operator>=(const Matrix& x,  const Matrix&  y ) {
+Matrix operator>=(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
-    Matrix ret(x.nRows(), x.nCols(), 0);
-    double* dest = ret.begin();
-    const double* s1 = x.begin();
-    const double* s2 = y.begin();
-    const double* end = x.end();
-    while (s1!=end) {
-        *(dest++) = *(s1++) >= *(s2++);
-    }
+    Matrix ret(x.nRows(), x.nCols(), false);
+    vectorCompare( x.begin(), y.begin(), ret.begin(), x.nRows()*x.nCols(), COMPARE_GREATER_EQUAL );
     return ret;
 }
 /*  Comparison operator */
-Matrix operator<(const Matrix& x,  const Matrix&  y ) {
+Matrix operator<(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
-    Matrix ret(x.nRows(), x.nCols(), 0);
-    double* dest = ret.begin();
-    const double* s1 = x.begin();
-    const double* s2 = y.begin();
-    const double* end = x.end();
-    while (s1!=end) {
-        *(dest++) = *(s1++) < *(s2++);
-    }
+    Matrix ret(x.nRows(), x.nCols(), false);
+    vectorCompare( x.begin(), y.begin(), ret.begin(), x.nRows()*x.nCols(), COMPARE_LESS );
     return ret;
 }
 /*  Comparison operator */
-Matrix operator<=(const Matrix& x,  const Matrix&  y ) {
+Matrix operator<=(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
-    Matrix ret(x.nRows(), x.nCols(), 0);
-    double* dest = ret.begin();
-    const double* s1 = x.begin();
-    const double* s2 = y.begin();
-    const double* end = x.end();
-    while (s1!=end) {
-        *(dest++) = *(s1++) <= *(s2++);
-    }
+    Matrix ret(x.nRows(), x.nCols(), false);
+    vectorCompare( x.begin(), y.begin(), ret.begin(), x.nRows()*x.nCols(), COMPARE_LESS_EQUAL );
     return ret;
 }
 /*  Comparison operator */
-Matrix operator==(const Matrix& x,  const Matrix&  y ) {
+Matrix operator==(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
-    Matrix ret(x.nRows(), x.nCols(), 0);
-    double* dest = ret.begin();
-    const double* s1 = x.begin();
-    const double* s2 = y.begin();
-    const double* end = x.end();
-    while (s1!=end) {
-        *(dest++) = *(s1++) == *(s2++);
-    }
+    Matrix ret(x.nRows(), x.nCols(), false);
+    vectorCompare( x.begin(), y.begin(), ret.begin(), x.nRows()*x.nCols(), COMPARE_EQUAL );
     return ret;
 }
 /*  Comparison operator */
-Matrix operator!=(const Matrix& x,  const Matrix&  y) {
+Matrix operator!=(const Matrix& x, const Matrix& y ) {
     ASSERT( x.nRows()==y.nRows() && x.nCols()==y.nCols());
-    Matrix ret(x.nRows(), x.nCols(), 0);
-    double* dest = ret.begin();
-    const double* s1 = x.begin();
-    const double* s2 = y.begin();
-    const double* end = x.end();
-    while (s1!=end) {
-        *(dest++) = *(s1++) != *(s2++);
-    }
+    Matrix ret(x.nRows(), x.nCols(), false);
+    vectorCompare( x.begin(), y.begin(), ret.begin(), x.nRows()*x.nCols(), COMPARE_NOT_EQUAL );
     return ret;
 }
 
 /*  Matrix product */
 Matrix operator*(const Matrix& a, const Matrix& b) {
+	Matrix ret(a.nRows(), b.nCols(), false);
+	multiply(a, b, ret);
+	return ret;
+}
+
+/*  Matrix product written into an existing matrix */
+void multiply(const Matrix& a, const Matrix& b, Matrix& out, double alpha) {
 	int m = a.nRows();
 	int r = a.nCols();
 	int n = b.nCols();
 	ASSERT(b.nRows() == r);
-	Matrix ret(m, n);
-	for (int i = 0; i < m; i++) {
-		for (int j = 0; j < n; j++) {
-			for (int k = 0; k < r; k++) {
-				ret(i, j) += a(i, k)*b(k, j);
-			}
-		}
+	ASSERT(&out != &a && &out != &b);
+	if (out.nRows() != m || out.nCols() != n) {
+		out = Matrix(m, n, false);
 	}
-	return ret;
+	gemm(m, n, r, alpha, a.begin(), m, b.begin(), r, 0.0, out.begin(), m);
 }
 
 
@@ -649,6 +668,47 @@ static void testCopy() {
     };
 }
 
+static void testMove() {
+    Matrix m("1,2,3;4,5,6");
+    long long before = Matrix::allocationCount();
+    // the move constructor steals the storage
+    Matrix n( std::move(m) );
+    ASSERT( Matrix::allocationCount()==before );
+    Matrix("1,2,3;4,5,6").assertEquals( n, 0.001 );
+    // as does move assignment
+    Matrix o(2,3);
+    before = Matrix::allocationCount();
+    o = std::move( n );
+    ASSERT( Matrix::allocationCount()==before );
+    Matrix("1,2,3;4,5,6").assertEquals( o, 0.001 );
+    // copying into a matrix of the same size reuses its storage
+    Matrix p(3,2);
+    before = Matrix::allocationCount();
+    p = o;
+    ASSERT( Matrix::allocationCount()==before );
+    o.assertEquals( p, 0.001 );
+}
+
+static void testTemporariesReused() {
+    Matrix m("1,2;3,4");
+    Matrix expected("-5,-10;-15,-20");
+    long long before = Matrix::allocationCount();
+    // only the first operation needs new storage
+    Matrix actual = 1 - (2*m + m + 1 + m) - m;
+    ASSERT( Matrix::allocationCount()-before==1 );
+    expected.assertEquals( actual, 0.001 );
+
+    Matrix a("1,2;3,4");
+    Matrix b("5,6;7,8");
+    (a - (a+b)).assertEquals( Matrix("-5,-6;-7,-8"), 0.001 );
+    ((a+b) - (b+b)).assertEquals( Matrix("-4,-4;-4,-4"), 0.001 );
+    ((a+b) + (a+b)).assertEquals( Matrix("12,16;20,24"), 0.001 );
+    (a + (a+b)).assertEquals( Matrix("7,10;13,16"), 0.001 );
+    (1.0 + (a+b)).assertEquals( Matrix("7,9;11,13"), 0.001 );
+    (10.0 - (a+b)).assertEquals( Matrix("4,2;0,-2"), 0.001 );
+    ((a+b) - 1.0).assertEquals( Matrix("5,7;9,11"), 0.001 );
+}
+
 static void testAdditionAndSubtrationOperators() {
     Matrix z=zeros(3,2);
     Matrix m=ones(3,2);
@@ -888,6 +948,13 @@ static void testMatrixMultiplication() {
 	Matrix product = a*b;
 	Matrix expected("22,28;49,64");
 	product.assertEquals(expected,0.001);
+
+	// multiplying into an existing matrix reuses its storage
+	Matrix out(2,2);
+	long long before = Matrix::allocationCount();
+	multiply(a, b, out, 0.5);
+	ASSERT( Matrix::allocationCount()==before );
+	out.assertEquals(0.5*expected,0.001);
 }
 
 static void testUsageExamples() {
@@ -926,6 +993,8 @@ void testMatrix() {
     TEST( testSetRow);
     TEST( testSetCol );
     TEST( testCopy);
+    TEST( testMove );
+    TEST( testTemporariesReused );
     TEST( testAdditionAndSubtrationOperators );
 	TEST( testComparisonOperators );
 	TEST( testFunctions);
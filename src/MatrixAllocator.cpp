@@ -0,0 +1,255 @@
+#include "MatrixAllocator.h"
+#include "Matrix.h"
+
+using namespace std;
+
+/*  Counts calls to the heap made for matrix storage */
+static atomic<long long> nHeapCalls( 0 );
+
+/*  The allocator each thread is currently using, null for the heap */
+static thread_local MatrixAllocator* currentAllocator = 0;
+
+/*  The number of doubles in one aligned unit */
+static const int ALIGNMENT_DOUBLES = MATRIX_ALIGNMENT/sizeof(double);
+
+/**
+ *  The default allocator, every matrix gets its own heap block
+ */
+class HeapAllocator : public MatrixAllocator {
+public:
+    double* allocate( int n ) {
+        return heapAllocate( n );
+    }
+    void deallocate( double* p, int n ) {
+        heapDeallocate( p );
+    }
+};
+
+MatrixAllocator& MatrixAllocator::heap() {
+    static HeapAllocator heapAllocator;
+    return heapAllocator;
+}
+
+MatrixAllocator& MatrixAllocator::current() {
+    if (currentAllocator==0) {
+        return heap();
+    }
+    return *currentAllocator;
+}
+
+long long MatrixAllocator::heapCallCount() {
+    return nHeapCalls.load();
+}
+
+double* MatrixAllocator::heapAllocate( int n ) {
+    nHeapCalls++;
+    void* p = ::operator new( sizeof(double)*n, align_val_t( MATRIX_ALIGNMENT ) );
+    return static_cast<double*>( p );
+}
+
+void MatrixAllocator::heapDeallocate( double* p ) {
+    ::operator delete( p, align_val_t( MATRIX_ALIGNMENT ) );
+}
+
+//
+//   MatrixArena
+//
+
+MatrixArena::MatrixArena( int blockSize ) :
+    blockSize( blockSize ),
+    currentBlock( 0 ),
+    used( 0 ),
+    totalUsed( 0 ),
+    live( 0 ) {
+}
+
+MatrixArena::~MatrixArena() {
+    for (Block& block : blocks) {
+        heapDeallocate( block.data );
+    }
+}
+
+double* MatrixArena::allocate( int n ) {
+    // round up so the next buffer is aligned too
+    int size = ((n + ALIGNMENT_DOUBLES - 1)/ALIGNMENT_DOUBLES)*ALIGNMENT_DOUBLES;
+    while (currentBlock<(int)blocks.size()
+           && used+size>blocks[currentBlock].size) {
+        currentBlock++;
+        used = 0;
+    }
+    if (currentBlock==(int)blocks.size()) {
+        Block block;
+        block.size = max( blockSize, size );
+        block.data = heapAllocate( block.size );
+        blocks.push_back( block );
+        used = 0;
+    }
+    double* ret = blocks[currentBlock].data + used;
+    used += size;
+    totalUsed += size;
+    live++;
+    return ret;
+}
+
+void MatrixArena::deallocate( double* p, int n ) {
+    live--;
+}
+
+void MatrixArena::reset() {
+    if (live!=0) {
+        // the matrices still using the storage would dangle
+        throw logic_error( "MatrixArena reset while matrices still use it" );
+    }
+    if (blocks.size()>1) {
+        // the working set needed several blocks, replace them with
+        // one block big enough for all of it next time
+        long long needed = max( totalUsed, capacity() );
+        for (Block& block : blocks) {
+            heapDeallocate( block.data );
+        }
+        blocks.clear();
+        Block block;
+        block.size = (int)needed;
+        block.data = heapAllocate( block.size );
+        blocks.push_back( block );
+    }
+    currentBlock = 0;
+    used = 0;
+    totalUsed = 0;
+}
+
+long long MatrixArena::capacity() const {
+    long long total = 0;
+    for (const Block& block : blocks) {
+        total += block.size;
+    }
+    return total;
+}
+
+//
+//   MatrixAllocatorScope
+//
+
+MatrixAllocatorScope::MatrixAllocatorScope( MatrixAllocator& allocator ) :
+    previous( currentAllocator ) {
+    currentAllocator = &allocator;
+}
+
+MatrixAllocatorScope::~MatrixAllocatorScope() {
+    currentAllocator = previous;
+}
+
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static bool isAligned( const double* p ) {
+    return ((size_t)p) % MATRIX_ALIGNMENT == 0;
+}
+
+static void testAlignment() {
+    Matrix a( 3, 1 );
+    Matrix b( 5, 7 );
+    ASSERT( isAligned( a.begin() ) && isAligned( b.begin() ) );
+    MatrixArena arena;
+    MatrixAllocatorScope scope( arena );
+    Matrix c( 3, 1 );
+    Matrix d( 5, 7 );
+    Matrix e = c + 1.0;
+    ASSERT( isAligned( c.begin() ) && isAligned( d.begin() ) && isAligned( e.begin() ) );
+}
+
+static void testArena() {
+    MatrixArena arena( 1000 );
+    long long before = MatrixAllocator::heapCallCount();
+    {
+        MatrixAllocatorScope scope( arena );
+        Matrix a( 10, 10 );
+        Matrix b = a + 1.0;
+        Matrix("1,1;1,1").assertEquals( Matrix( 2, 2 ) + 1.0, 0.001 );
+        ASSERT( b(9,9)==1.0 );
+        // only the arena's block comes from the heap
+        ASSERT( MatrixAllocator::heapCallCount()==before+1 );
+        // too big for the block, so the arena grows
+        Matrix big( 100, 20 );
+        ASSERT( MatrixAllocator::heapCallCount()==before+2 );
+    }
+    // outside the scope we use the heap again
+    Matrix c( 2, 2 );
+    ASSERT( MatrixAllocator::heapCallCount()==before+3 );
+
+    // after a reset the working set fits in one block
+    arena.reset();
+    ASSERT( arena.capacity()>=2000+100+8 );
+    before = MatrixAllocator::heapCallCount();
+    for (int i=0; i<10; i++) {
+        {
+            MatrixAllocatorScope scope( arena );
+            Matrix a( 10, 10 );
+            Matrix big( 100, 20 );
+        }
+        arena.reset();
+    }
+    ASSERT( MatrixAllocator::heapCallCount()==before );
+}
+
+static void testScopesNest() {
+    MatrixArena outer;
+    MatrixArena inner;
+    MatrixAllocatorScope outerScope( outer );
+    ASSERT( &MatrixAllocator::current()==&outer );
+    {
+        MatrixAllocatorScope innerScope( inner );
+        ASSERT( &MatrixAllocator::current()==&inner );
+        MatrixAllocatorScope heapScope( MatrixAllocator::heap() );
+        ASSERT( &MatrixAllocator::current()==&MatrixAllocator::heap() );
+    }
+    ASSERT( &MatrixAllocator::current()==&outer );
+}
+
+static void testMovesKeepTheirAllocator() {
+    // moves swap storage, each buffer must still go back to
+    // the allocator it came from
+    Matrix fromHeap( 4, 4 );
+    MatrixArena arena;
+    {
+        MatrixAllocatorScope scope( arena );
+        Matrix fromArena( 4, 4 );
+        fromArena += 2.0;
+        fromHeap = std::move( fromArena );
+        ASSERT( fromHeap(0,0)==2.0 );
+        fromArena = std::move( fromHeap );
+    }
+    arena.reset();
+    ASSERT( fromHeap(0,0)==0.0 );
+}
+
+static void testResetWhileInUse() {
+    MatrixArena arena;
+    bool thrown = false;
+    {
+        MatrixAllocatorScope scope( arena );
+        Matrix a( 10, 10 );
+        a += 1.0;
+        try {
+            arena.reset();
+        } catch (const logic_error&) {
+            thrown = true;
+        }
+        // the storage was left alone
+        ASSERT( a(9,9)==1.0 );
+    }
+    ASSERT( thrown );
+    arena.reset();
+}
+
+void testMatrixAllocator() {
+    TEST( testAlignment );
+    TEST( testArena );
+    TEST( testScopesNest );
+    TEST( testMovesKeepTheirAllocator );
+    TEST( testResetWhileInUse );
+}
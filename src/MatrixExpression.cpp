@@ -0,0 +1,146 @@
+#include "MatrixExpression.h"
+#include "matlib.h"
+
+using namespace std;
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static void testArithmetic() {
+    Matrix a("1,2;3,4");
+    Matrix b("5,6;7,8");
+    Matrix sum = lazy(a) + b;
+    sum.assertEquals( a+b, 0.001 );
+    Matrix difference = a - lazy(b);
+    difference.assertEquals( a-b, 0.001 );
+    Matrix scaled = 2.0*lazy(a) + lazy(b)*3.0 - 1.0;
+    scaled.assertEquals( 2.0*a + b*3.0 - 1.0, 0.001 );
+    Matrix reversed = 1.0 - lazy(a) + 10.0;
+    reversed.assertEquals( 1.0 - a + 10.0, 0.001 );
+    Matrix negated = -lazy(a);
+    negated.assertEquals( -1.0*a, 0.001 );
+    Matrix product = times( lazy(a), b );
+    Matrix expected = a;
+    expected.times( b );
+    product.assertEquals( expected, 0.001 );
+}
+
+static void testFunctions() {
+    Matrix a("-1,2;3,-4");
+    Matrix m = a;
+    m.exp();
+    Matrix( exp( lazy(a) ) ).assertEquals( m, 0.001 );
+    m = a;
+    m.positivePart();
+    Matrix( positivePart( lazy(a) ) ).assertEquals( m, 0.001 );
+    m = a;
+    m.negativePart();
+    Matrix( negativePart( lazy(a) ) ).assertEquals( m, 0.001 );
+    Matrix b("1,2;3,4");
+    m = b;
+    m.log();
+    Matrix( log( lazy(b) ) ).assertEquals( m, 0.001 );
+    m = b;
+    m.sqrt();
+    Matrix( sqrt( lazy(b) ) ).assertEquals( m, 0.001 );
+}
+
+static void testComparisons() {
+    Matrix a("1,2;3,4");
+    Matrix b("3,3;3,3");
+    Matrix( lazy(a) > b ).assertEquals( a>b, 0.001 );
+    Matrix( lazy(a) >= b ).assertEquals( a>=b, 0.001 );
+    Matrix( lazy(a) < 3.0 ).assertEquals( a<3.0, 0.001 );
+    Matrix( 3.0 <= lazy(a) ).assertEquals( 3.0<=a, 0.001 );
+    Matrix( lazy(a) == b ).assertEquals( a==b, 0.001 );
+    Matrix( lazy(a) != 3.0 ).assertEquals( a!=3.0, 0.001 );
+}
+
+static void testAssignment() {
+    Matrix a("1,2;3,4");
+    Matrix b("5,6;7,8");
+    Matrix m("1,1;1,1");
+    long long before = Matrix::allocationCount();
+    m += lazy(a) + b;
+    m -= lazy(b) - 1.0;
+    m.times( lazy(a) + 0.0 );
+    ASSERT( Matrix::allocationCount()==before );
+    Matrix("3,8;15,24").assertEquals( m, 0.001 );
+
+    // an expression can read the matrix it is assigned to
+    before = Matrix::allocationCount();
+    m = exp( lazy(m) - m );
+    ASSERT( Matrix::allocationCount()==before );
+    Matrix("1,1;1,1").assertEquals( m, 0.001 );
+
+    // assigning to a matrix of a different size reallocates
+    Matrix column(3,1);
+    before = Matrix::allocationCount();
+    column = lazy(a) + b;
+    ASSERT( Matrix::allocationCount()==before+1 );
+    (a+b).assertEquals( column, 0.001 );
+
+    // an expression can read a view of the matrix it is assigned to
+    Matrix square("1,2,3;4,5,6;7,8,9");
+    square = lazy( MatrixView(square).col(1) ) + 1.0;
+    Matrix("3;6;9").assertEquals( square, 0.001 );
+    Matrix v("1;2;3;4");
+    v = lazy( MatrixView(v).rowRange(1,3) ) + lazy( MatrixView(v).rowRange(0,3) );
+    Matrix("3;5;7").assertEquals( v, 0.001 );
+
+    // several chunks, reading the target on the right hand side
+    Matrix x = randuniform( 40, 40 );
+    Matrix big = randuniform( 40, 40 );
+    Matrix expectedBig = x + exp( big );
+    big = lazy(x) + exp( lazy(big) );
+    expectedBig.assertEquals( big, 1e-12 );
+}
+
+/*  Helper for the eager benchmark */
+static Matrix positivePart( Matrix&& m ) {
+    m.positivePart();
+    return std::move( m );
+}
+
+static void testPerformance() {
+    int n = 1000;
+    Matrix a = randuniform( n, n );
+    Matrix b = randuniform( n, n );
+    Matrix c = randuniform( n, n );
+    int nRepeats = 10;
+
+    Matrix eager(n, n);
+    long long before = Matrix::allocationCount();
+    clock_t start = clock();
+    for (int i=0; i<nRepeats; i++) {
+        eager = positivePart( exp( a + b*2.0 - c ) - 1.5 );
+    }
+    double eagerTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+    long long eagerAllocations = Matrix::allocationCount()-before;
+
+    Matrix fused(n, n);
+    before = Matrix::allocationCount();
+    start = clock();
+    for (int i=0; i<nRepeats; i++) {
+        fused = positivePart( exp( lazy(a) + lazy(b)*2.0 - c ) - 1.5 );
+    }
+    double fusedTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+    long long fusedAllocations = Matrix::allocationCount()-before;
+
+    fused.assertEquals( eager, 1e-12 );
+    ASSERT( fusedAllocations==0 );
+    INFO( "1M element expression, " << nRepeats << " repeats\n"
+        << "Eager: " << eagerTime << "s, " << eagerAllocations << " allocations\n"
+        << "Fused: " << fusedTime << "s, " << fusedAllocations << " allocations" );
+}
+
+void testMatrixExpression() {
+    TEST( testArithmetic );
+    TEST( testFunctions );
+    TEST( testComparisons );
+    TEST( testAssignment );
+    TEST( testPerformance );
+}
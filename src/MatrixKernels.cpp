@@ -0,0 +1,1450 @@
+#include "MatrixKernels.h"
+#include "Matrix.h"
+#include "matlib.h"
+
+#ifdef FINMATLIB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/*  The instruction set in use, -1 until we've looked at the CPU */
+static atomic<int> currentSimdLevel( -1 );
+
+/*  Ask the CPU what it supports */
+SimdLevel detectSimdLevel() {
+#ifdef FINMATLIB_X86_SIMD
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (avx2 && __builtin_cpu_supports("avx512f")) {
+        return SIMD_AVX512;
+    }
+    if (avx2) {
+        return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+/*  The instruction set the kernels currently use */
+SimdLevel getSimdLevel() {
+    int level = currentSimdLevel.load();
+    if (level<0) {
+        level = detectSimdLevel();
+        currentSimdLevel.store( level );
+    }
+    return (SimdLevel)level;
+}
+
+/*  Restrict the instruction set */
+void setSimdLevel( SimdLevel level ) {
+    currentSimdLevel.store( min( level, detectSimdLevel() ) );
+}
+
+/*  A readable name for an instruction set */
+const char* simdLevelName( SimdLevel level ) {
+    switch (level) {
+    case SIMD_AVX512:
+        return "AVX-512";
+    case SIMD_AVX2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+//
+//   Matrix multiplication
+//
+//   The work is done by a micro-kernel which computes an mr by nr
+//   block of c held in registers. For large matrices we copy blocks
+//   of a and b into contiguous "packed" buffers sized to stay in cache
+//   and run the micro-kernel over them. When a is tall and skinny and
+//   b is small, which is the shape we see multiplying random numbers
+//   by a Cholesky factor, the micro-kernel reads a and b directly.
+//   When b is at most 8 by 8 a dedicated kernel keeps all of it in
+//   registers and streams a through once.
+//
+
+/*
+ *  Compute c += alpha*a*b for an mr by nr block of c where
+ *  a(i,p) = a[i + p*aStride] and b(p,j) = b[p*bStrideP + j*bStrideJ]
+ */
+typedef void (*MicroKernel)( int kc, double alpha,
+                             const double* a, int aStride,
+                             const double* b, int bStrideP, int bStrideJ,
+                             double* c, int ldc );
+
+/*  A micro-kernel and the size of block it computes */
+struct GemmKernel {
+    int mr;
+    int nr;
+    MicroKernel kernel;
+};
+
+/*  Block sizes for the packed algorithm */
+static const int GEMM_KC = 256;
+static const int GEMM_MC = 128;
+static const int GEMM_NC = 2048;
+/*  Below this size b is small enough to be used without packing */
+static const int GEMM_SMALL = 64;
+/*  Below this size b fits in registers */
+static const int GEMM_TINY = 8;
+
+/*  Portable micro-kernel, the compiler will vectorize what it can */
+static void microKernelScalar( int kc, double alpha,
+                               const double* a, int aStride,
+                               const double* b, int bStrideP, int bStrideJ,
+                               double* c, int ldc ) {
+    const int MR = 8;
+    const int NR = 4;
+    double acc[NR][MR];
+    memset( acc, 0, sizeof(acc) );
+    for (int p=0; p<kc; p++) {
+        const double* ap = a + p*aStride;
+        const double* bp = b + p*bStrideP;
+        for (int j=0; j<NR; j++) {
+            double bv = bp[j*bStrideJ];
+            for (int i=0; i<MR; i++) {
+                acc[j][i] += ap[i]*bv;
+            }
+        }
+    }
+    for (int j=0; j<NR; j++) {
+        for (int i=0; i<MR; i++) {
+            c[i + j*ldc] += alpha*acc[j][i];
+        }
+    }
+}
+
+#ifdef FINMATLIB_X86_SIMD
+
+/*  AVX2 micro-kernel computing an 8 by 4 block */
+__attribute__((target("avx2,fma")))
+static void microKernelAvx2( int kc, double alpha,
+                             const double* a, int aStride,
+                             const double* b, int bStrideP, int bStrideJ,
+                             double* c, int ldc ) {
+    __m256d c00 = _mm256_setzero_pd(), c10 = _mm256_setzero_pd();
+    __m256d c01 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c02 = _mm256_setzero_pd(), c12 = _mm256_setzero_pd();
+    __m256d c03 = _mm256_setzero_pd(), c13 = _mm256_setzero_pd();
+    for (int p=0; p<kc; p++) {
+        const double* ap = a + p*aStride;
+        const double* bp = b + p*bStrideP;
+        __m256d a0 = _mm256_loadu_pd( ap );
+        __m256d a1 = _mm256_loadu_pd( ap+4 );
+        __m256d bv = _mm256_broadcast_sd( bp );
+        c00 = _mm256_fmadd_pd( a0, bv, c00 );
+        c10 = _mm256_fmadd_pd( a1, bv, c10 );
+        bv = _mm256_broadcast_sd( bp + bStrideJ );
+        c01 = _mm256_fmadd_pd( a0, bv, c01 );
+        c11 = _mm256_fmadd_pd( a1, bv, c11 );
+        bv = _mm256_broadcast_sd( bp + 2*bStrideJ );
+        c02 = _mm256_fmadd_pd( a0, bv, c02 );
+        c12 = _mm256_fmadd_pd( a1, bv, c12 );
+        bv = _mm256_broadcast_sd( bp + 3*bStrideJ );
+        c03 = _mm256_fmadd_pd( a0, bv, c03 );
+        c13 = _mm256_fmadd_pd( a1, bv, c13 );
+    }
+    __m256d av = _mm256_set1_pd( alpha );
+    __m256d acc[8] = { c00, c10, c01, c11, c02, c12, c03, c13 };
+    for (int j=0; j<4; j++) {
+        double* cj = c + j*ldc;
+        _mm256_storeu_pd( cj, _mm256_fmadd_pd( av, acc[2*j], _mm256_loadu_pd( cj ) ) );
+        _mm256_storeu_pd( cj+4, _mm256_fmadd_pd( av, acc[2*j+1], _mm256_loadu_pd( cj+4 ) ) );
+    }
+}
+
+/*  AVX-512 micro-kernel computing a 16 by 4 block */
+__attribute__((target("avx512f")))
+static void microKernelAvx512( int kc, double alpha,
+                               const double* a, int aStride,
+                               const double* b, int bStrideP, int bStrideJ,
+                               double* c, int ldc ) {
+    __m512d c00 = _mm512_setzero_pd(), c10 = _mm512_setzero_pd();
+    __m512d c01 = _mm512_setzero_pd(), c11 = _mm512_setzero_pd();
+    __m512d c02 = _mm512_setzero_pd(), c12 = _mm512_setzero_pd();
+    __m512d c03 = _mm512_setzero_pd(), c13 = _mm512_setzero_pd();
+    for (int p=0; p<kc; p++) {
+        const double* ap = a + p*aStride;
+        const double* bp = b + p*bStrideP;
+        __m512d a0 = _mm512_loadu_pd( ap );
+        __m512d a1 = _mm512_loadu_pd( ap+8 );
+        __m512d bv = _mm512_set1_pd( bp[0] );
+        c00 = _mm512_fmadd_pd( a0, bv, c00 );
+        c10 = _mm512_fmadd_pd( a1, bv, c10 );
+        bv = _mm512_set1_pd( bp[bStrideJ] );
+        c01 = _mm512_fmadd_pd( a0, bv, c01 );
+        c11 = _mm512_fmadd_pd( a1, bv, c11 );
+        bv = _mm512_set1_pd( bp[2*bStrideJ] );
+        c02 = _mm512_fmadd_pd( a0, bv, c02 );
+        c12 = _mm512_fmadd_pd( a1, bv, c12 );
+        bv = _mm512_set1_pd( bp[3*bStrideJ] );
+        c03 = _mm512_fmadd_pd( a0, bv, c03 );
+        c13 = _mm512_fmadd_pd( a1, bv, c13 );
+    }
+    __m512d av = _mm512_set1_pd( alpha );
+    __m512d acc[8] = { c00, c10, c01, c11, c02, c12, c03, c13 };
+    for (int j=0; j<4; j++) {
+        double* cj = c + j*ldc;
+        _mm512_storeu_pd( cj, _mm512_fmadd_pd( av, acc[2*j], _mm512_loadu_pd( cj ) ) );
+        _mm512_storeu_pd( cj+8, _mm512_fmadd_pd( av, acc[2*j+1], _mm512_loadu_pd( cj+8 ) ) );
+    }
+}
+
+#endif
+
+/*  Choose the micro-kernel for the current instruction set */
+static GemmKernel chooseGemmKernel() {
+    GemmKernel ret = { 8, 4, &microKernelScalar };
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        ret.mr = 16;
+        ret.kernel = &microKernelAvx512;
+    } else if (level==SIMD_AVX2) {
+        ret.kernel = &microKernelAvx2;
+    }
+#endif
+    return ret;
+}
+
+/*  c += alpha*a*b over a block of rows and columns, used for edges
+    and when b has fewer columns than a micro-kernel. We work on a few
+    hundred rows at a time so that they stay in the L1 cache. */
+static void gemmEdge( int iStart, int iEnd, int jStart, int jEnd, int k,
+                      double alpha,
+                      const double* a, int lda,
+                      const double* b, int ldb,
+                      double* c, int ldc ) {
+    const int ROWS = 256;
+    for (int i0=iStart; i0<iEnd; i0+=ROWS) {
+        int i1 = min( i0+ROWS, iEnd );
+        for (int j=jStart; j<jEnd; j++) {
+            double* cj = c + j*ldc;
+            for (int p=0; p<k; p++) {
+                double bv = alpha*b[p + j*ldb];
+                const double* ap = a + p*lda;
+                for (int i=i0; i<i1; i++) {
+                    cj[i] += ap[i]*bv;
+                }
+            }
+        }
+    }
+}
+
+/*  c += alpha*a*b for rows iStart to m when b is K by n with n at
+    most GEMM_TINY, one row of a at a time */
+template <int K>
+static void gemmTinyScalar( int iStart, int m, int n, double alpha,
+                            const double* a, int lda,
+                            const double* b, int ldb,
+                            double* c, int ldc ) {
+    double bv[K*GEMM_TINY];
+    for (int j=0; j<n; j++) {
+        for (int p=0; p<K; p++) {
+            bv[p + j*K] = alpha*b[p + j*ldb];
+        }
+    }
+    for (int i=iStart; i<m; i++) {
+        double ai[K];
+        for (int p=0; p<K; p++) {
+            ai[p] = a[i + p*lda];
+        }
+        for (int j=0; j<n; j++) {
+            double sum = 0.0;
+            for (int p=0; p<K; p++) {
+                sum += ai[p]*bv[p + j*K];
+            }
+            c[i + j*ldc] += sum;
+        }
+    }
+}
+
+#ifdef FINMATLIB_X86_SIMD
+
+/*  As above, four rows at a time with b broadcast into registers.
+    Returns the number of rows done. */
+template <int K>
+__attribute__((target("avx2,fma")))
+static int gemmTinyAvx2( int m, int n, double alpha,
+                         const double* a, int lda,
+                         const double* b, int ldb,
+                         double* c, int ldc ) {
+    __m256d bv[K*GEMM_TINY];
+    for (int j=0; j<n; j++) {
+        for (int p=0; p<K; p++) {
+            bv[p + j*K] = _mm256_set1_pd( alpha*b[p + j*ldb] );
+        }
+    }
+    int i = 0;
+    for (; i+4<=m; i+=4) {
+        __m256d av[K];
+        for (int p=0; p<K; p++) {
+            av[p] = _mm256_loadu_pd( a + i + p*lda );
+        }
+        for (int j=0; j<n; j++) {
+            double* cj = c + i + j*ldc;
+            __m256d acc = _mm256_loadu_pd( cj );
+            for (int p=0; p<K; p++) {
+                acc = _mm256_fmadd_pd( av[p], bv[p + j*K], acc );
+            }
+            _mm256_storeu_pd( cj, acc );
+        }
+    }
+    return i;
+}
+
+/*  As above, eight rows at a time */
+template <int K>
+__attribute__((target("avx512f")))
+static int gemmTinyAvx512( int m, int n, double alpha,
+                           const double* a, int lda,
+                           const double* b, int ldb,
+                           double* c, int ldc ) {
+    __m512d bv[K*GEMM_TINY];
+    for (int j=0; j<n; j++) {
+        for (int p=0; p<K; p++) {
+            bv[p + j*K] = _mm512_set1_pd( alpha*b[p + j*ldb] );
+        }
+    }
+    int i = 0;
+    for (; i+8<=m; i+=8) {
+        __m512d av[K];
+        for (int p=0; p<K; p++) {
+            av[p] = _mm512_loadu_pd( a + i + p*lda );
+        }
+        for (int j=0; j<n; j++) {
+            double* cj = c + i + j*ldc;
+            __m512d acc = _mm512_loadu_pd( cj );
+            for (int p=0; p<K; p++) {
+                acc = _mm512_fmadd_pd( av[p], bv[p + j*K], acc );
+            }
+            _mm512_storeu_pd( cj, acc );
+        }
+    }
+    return i;
+}
+
+#endif
+
+/*  c += alpha*a*b when b is K by n with n at most GEMM_TINY. This is
+    the shape of random numbers times a small Cholesky factor: b stays
+    in registers and a is read once. */
+template <int K>
+static void gemmTiny( int m, int n, double alpha,
+                      const double* a, int lda,
+                      const double* b, int ldb,
+                      double* c, int ldc ) {
+    int done = 0;
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        done = gemmTinyAvx512<K>( m, n, alpha, a, lda, b, ldb, c, ldc );
+    } else if (level==SIMD_AVX2) {
+        done = gemmTinyAvx2<K>( m, n, alpha, a, lda, b, ldb, c, ldc );
+    }
+#endif
+    gemmTinyScalar<K>( done, m, n, alpha, a, lda, b, ldb, c, ldc );
+}
+
+/*  c += alpha*a*b reading a and b directly, for small b */
+static void gemmDirect( const GemmKernel& gk, int m, int n, int k,
+                        double alpha,
+                        const double* a, int lda,
+                        const double* b, int ldb,
+                        double* c, int ldc ) {
+    int mMain = m - m % gk.mr;
+    int nMain = n - n % gk.nr;
+    // work down the rows so each slab of a is reused for every column
+    for (int i=0; i<mMain; i+=gk.mr) {
+        for (int j=0; j<nMain; j+=gk.nr) {
+            gk.kernel( k, alpha, a+i, lda, b + j*ldb, 1, ldb,
+                       c + i + j*ldc, ldc );
+        }
+    }
+    gemmEdge( mMain, m, 0, n, k, alpha, a, lda, b, ldb, c, ldc );
+    gemmEdge( 0, mMain, nMain, n, k, alpha, a, lda, b, ldb, c, ldc );
+}
+
+/*  c += alpha*a*b copying blocks of a and b into cache friendly buffers */
+static void gemmPacked( const GemmKernel& gk, int m, int n, int k,
+                        double alpha,
+                        const double* a, int lda,
+                        const double* b, int ldb,
+                        double* c, int ldc ) {
+    int mr = gk.mr;
+    int nr = gk.nr;
+    int mcMax = ((GEMM_MC + mr - 1)/mr)*mr;
+    int ncMax = ((min( n, GEMM_NC ) + nr - 1)/nr)*nr;
+    vector<double> packedA( mcMax*GEMM_KC );
+    vector<double> packedB( ncMax*GEMM_KC );
+    vector<double> tile( mr*nr );
+
+    for (int jc=0; jc<n; jc+=GEMM_NC) {
+        int nc = min( GEMM_NC, n-jc );
+        for (int pc=0; pc<k; pc+=GEMM_KC) {
+            int kc = min( GEMM_KC, k-pc );
+            // pack b into panels of nr columns, zero padded
+            double* pb = &packedB[0];
+            for (int jr=0; jr<nc; jr+=nr) {
+                for (int p=0; p<kc; p++) {
+                    for (int jj=0; jj<nr; jj++) {
+                        int j = jc+jr+jj;
+                        *(pb++) = (jr+jj<nc) ? b[pc+p + j*ldb] : 0.0;
+                    }
+                }
+            }
+            for (int ic=0; ic<m; ic+=mcMax) {
+                int mc = min( mcMax, m-ic );
+                // pack a into panels of mr rows, zero padded
+                double* pa = &packedA[0];
+                for (int ir=0; ir<mc; ir+=mr) {
+                    for (int p=0; p<kc; p++) {
+                        const double* src = a + ic + ir + (pc+p)*lda;
+                        for (int ii=0; ii<mr; ii++) {
+                            *(pa++) = (ir+ii<mc) ? src[ii] : 0.0;
+                        }
+                    }
+                }
+                for (int jr=0; jr<nc; jr+=nr) {
+                    const double* bPanel = &packedB[jr*kc];
+                    for (int ir=0; ir<mc; ir+=mr) {
+                        const double* aPanel = &packedA[ir*kc];
+                        double* cBlock = c + ic + ir + (jc+jr)*ldc;
+                        int rows = min( mr, mc-ir );
+                        int cols = min( nr, nc-jr );
+                        if (rows==mr && cols==nr) {
+                            gk.kernel( kc, alpha, aPanel, mr, bPanel, nr, 1,
+                                       cBlock, ldc );
+                        } else {
+                            // partial block at the edge of c
+                            fill( tile.begin(), tile.end(), 0.0 );
+                            gk.kernel( kc, alpha, aPanel, mr, bPanel, nr, 1,
+                                       &tile[0], mr );
+                            for (int jj=0; jj<cols; jj++) {
+                                for (int ii=0; ii<rows; ii++) {
+                                    cBlock[ii + jj*ldc] += tile[ii + jj*mr];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*  c = alpha*a*b + beta*c */
+void gemm( int m, int n, int k,
+           double alpha,
+           const double* a, int lda,
+           const double* b, int ldb,
+           double beta,
+           double* c, int ldc ) {
+    for (int j=0; j<n; j++) {
+        double* cj = c + j*ldc;
+        if (beta==0.0) {
+            memset( cj, 0, sizeof(double)*m );
+        } else if (beta!=1.0) {
+            for (int i=0; i<m; i++) {
+                cj[i] *= beta;
+            }
+        }
+    }
+    if (m==0 || n==0 || k==0 || alpha==0.0) {
+        return;
+    }
+    if (k<=GEMM_TINY && n<=GEMM_TINY) {
+        switch (k) {
+        case 1: gemmTiny<1>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        case 2: gemmTiny<2>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        case 3: gemmTiny<3>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        case 4: gemmTiny<4>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        case 5: gemmTiny<5>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        case 6: gemmTiny<6>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        case 7: gemmTiny<7>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        default: gemmTiny<8>( m, n, alpha, a, lda, b, ldb, c, ldc ); return;
+        }
+    }
+    GemmKernel gk = chooseGemmKernel();
+    if (k<=GEMM_SMALL && n<=GEMM_SMALL) {
+        gemmDirect( gk, m, n, k, alpha, a, lda, b, ldb, c, ldc );
+    } else {
+        gemmPacked( gk, m, n, k, alpha, a, lda, b, ldb, c, ldc );
+    }
+}
+
+//
+//   Element-wise functions
+//
+//   exp reduces its argument to r = x - n*log(2) with |r| <= log(2)/2,
+//   sums the Taylor series of exp(r) and multiplies by 2^n, which is
+//   built directly in the exponent bits. log splits x into 2^e*m with
+//   sqrt(1/2) <= m < sqrt(2) and uses the fdlibm series for log(m).
+//   Both are accurate to a couple of ulps. Vectors containing values
+//   where the result isn't a normal number (zero, negatives, overflow,
+//   infinities, NaNs) are handed to libm so the edge cases match it.
+//
+
+/*  log2(e) and log(2) split so that n*LN2_HI is exact */
+static const double LOG2E = 1.4426950408889634;
+static const double LN2_HI = 6.93147180369123816490e-01;
+static const double LN2_LO = 1.90821492927058770002e-10;
+/*  The range where exp is a normal number */
+static const double EXP_MIN = -708.0;
+static const double EXP_MAX = 709.0;
+/*  Taylor coefficients of exp, highest degree first */
+static const int EXP_TERMS = 14;
+static const double EXP_COEFFICIENTS[EXP_TERMS] = {
+    1.0/6227020800.0, 1.0/479001600.0, 1.0/39916800.0, 1.0/3628800.0,
+    1.0/362880.0, 1.0/40320.0, 1.0/5040.0, 1.0/720.0, 1.0/120.0,
+    1.0/24.0, 1.0/6.0, 0.5, 1.0, 1.0 };
+/*  fdlibm's coefficients for log(1+f), highest degree first */
+static const int LOG_TERMS = 7;
+static const double LOG_COEFFICIENTS[LOG_TERMS] = {
+    1.479819860511658591e-01, 1.531383769920937332e-01,
+    1.818357216161805012e-01, 2.222219843214978396e-01,
+    2.857142874366239149e-01, 3.999999999940941908e-01,
+    6.666666666666735130e-01 };
+/*  Adding this to a small integer valued double puts the
+    integer in the low bits of its mantissa */
+static const double TWO_TO_52 = 4503599627370496.0;
+static const double SQRT2 = 1.4142135623730951;
+
+static void expScalar( double* x, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = std::exp( x[i] );
+    }
+}
+
+static void logScalar( double* x, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = std::log( x[i] );
+    }
+}
+
+static void sqrtScalar( double* x, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = std::sqrt( x[i] );
+    }
+}
+
+/*  x[i] = x[i]^power[i*powerStride] */
+static void powScalar( double* x, const double* power, int powerStride, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = std::pow( x[i], power[i*powerStride] );
+    }
+}
+
+static void positivePartScalar( double* x, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = (x[i]>0.0) ? x[i] : 0.0;
+    }
+}
+
+static void negativePartScalar( double* x, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = (x[i]<0.0) ? x[i] : 0.0;
+    }
+}
+
+/*  out[i] = x[i] OP y[i*yStride] */
+static void compareScalar( const double* x, const double* y, int yStride,
+                           double* out, int n, Comparison comparison ) {
+    for (int i=0; i<n; i++) {
+        double a = x[i];
+        double b = y[i*yStride];
+        switch (comparison) {
+        case COMPARE_LESS:
+            out[i] = a < b;
+            break;
+        case COMPARE_LESS_EQUAL:
+            out[i] = a <= b;
+            break;
+        case COMPARE_GREATER:
+            out[i] = a > b;
+            break;
+        case COMPARE_GREATER_EQUAL:
+            out[i] = a >= b;
+            break;
+        case COMPARE_EQUAL:
+            out[i] = a == b;
+            break;
+        default:
+            out[i] = a != b;
+            break;
+        }
+    }
+}
+
+/*  Moro's coefficients, as used by norminv */
+static const double MORO_A[4] = { -25.44106049637, 41.39119773534,
+                                  -18.61500062529, 2.50662823884 };
+static const double MORO_B[5] = { 3.13082909833, -21.06224101826,
+                                  23.08336743743, -8.47351093090, 1.0 };
+static const int MORO_C_TERMS = 9;
+static const double MORO_C[MORO_C_TERMS] = {
+    0.0000003960315187, 0.0000002888167364, 0.0000321767881768,
+    0.0003951896511919, 0.0038405729373609, 0.0276438810333863,
+    0.1607979714918209, 0.9761690190917186, 0.3374754822726147 };
+/*  Moro uses a rational approximation when |x-0.5| is below this */
+static const double MORO_CENTRAL = 0.42;
+
+static void normInvScalar( double* x, int n ) {
+    for (int i=0; i<n; i++) {
+        x[i] = norminv( x[i] );
+    }
+}
+
+#ifdef FINMATLIB_X86_SIMD
+
+/*  exp of four values in [EXP_MIN, EXP_MAX] */
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256d expAvx2( __m256d x ) {
+    __m256d n = _mm256_round_pd( _mm256_mul_pd( x, _mm256_set1_pd( LOG2E ) ),
+                                 _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+    __m256d r = _mm256_fnmadd_pd( n, _mm256_set1_pd( LN2_HI ), x );
+    r = _mm256_fnmadd_pd( n, _mm256_set1_pd( LN2_LO ), r );
+    __m256d p = _mm256_set1_pd( EXP_COEFFICIENTS[0] );
+    for (int i=1; i<EXP_TERMS; i++) {
+        p = _mm256_fmadd_pd( p, r, _mm256_set1_pd( EXP_COEFFICIENTS[i] ) );
+    }
+    __m256d biased = _mm256_add_pd( n, _mm256_set1_pd( TWO_TO_52 + 1023.0 ) );
+    __m256i scale = _mm256_slli_epi64( _mm256_castpd_si256( biased ), 52 );
+    return _mm256_mul_pd( p, _mm256_castsi256_pd( scale ) );
+}
+
+/*  log of four positive normal numbers */
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256d logAvx2( __m256d x ) {
+    const __m256d one = _mm256_set1_pd( 1.0 );
+    const __m256d half = _mm256_set1_pd( 0.5 );
+    __m256i bits = _mm256_castpd_si256( x );
+    __m256i exponent = _mm256_or_si256( _mm256_srli_epi64( bits, 52 ),
+                                        _mm256_castpd_si256( _mm256_set1_pd( TWO_TO_52 ) ) );
+    __m256d e = _mm256_sub_pd( _mm256_castsi256_pd( exponent ),
+                               _mm256_set1_pd( TWO_TO_52 + 1023.0 ) );
+    __m256i mantissa = _mm256_or_si256(
+        _mm256_and_si256( bits, _mm256_set1_epi64x( 0x000FFFFFFFFFFFFFLL ) ),
+        _mm256_set1_epi64x( 0x3FF0000000000000LL ) );
+    __m256d m = _mm256_castsi256_pd( mantissa );
+    __m256d big = _mm256_cmp_pd( m, _mm256_set1_pd( SQRT2 ), _CMP_GT_OQ );
+    m = _mm256_blendv_pd( m, _mm256_mul_pd( m, half ), big );
+    e = _mm256_add_pd( e, _mm256_and_pd( big, one ) );
+
+    __m256d f = _mm256_sub_pd( m, one );
+    __m256d s = _mm256_div_pd( f, _mm256_add_pd( f, _mm256_set1_pd( 2.0 ) ) );
+    __m256d z = _mm256_mul_pd( s, s );
+    __m256d q = _mm256_set1_pd( LOG_COEFFICIENTS[0] );
+    for (int i=1; i<LOG_TERMS; i++) {
+        q = _mm256_fmadd_pd( q, z, _mm256_set1_pd( LOG_COEFFICIENTS[i] ) );
+    }
+    __m256d R = _mm256_mul_pd( q, z );
+    __m256d hfsq = _mm256_mul_pd( _mm256_mul_pd( half, f ), f );
+    // e*ln2_hi - ((hfsq - (s*(hfsq+R) + e*ln2_lo)) - f)
+    __m256d t = _mm256_fmadd_pd( s, _mm256_add_pd( hfsq, R ),
+                                 _mm256_mul_pd( e, _mm256_set1_pd( LN2_LO ) ) );
+    t = _mm256_sub_pd( _mm256_sub_pd( hfsq, t ), f );
+    return _mm256_fmsub_pd( e, _mm256_set1_pd( LN2_HI ), t );
+}
+
+/*  Mask of the lanes in [lo, hi], false for NaNs */
+__attribute__((target("avx2,fma"), always_inline))
+static inline int inRangeAvx2( __m256d x, double lo, double hi ) {
+    __m256d inRange = _mm256_and_pd( _mm256_cmp_pd( x, _mm256_set1_pd( lo ), _CMP_GE_OQ ),
+                                     _mm256_cmp_pd( x, _mm256_set1_pd( hi ), _CMP_LE_OQ ) );
+    return _mm256_movemask_pd( inRange );
+}
+
+__attribute__((target("avx2,fma")))
+static void expAvx2( double* x, int n ) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m256d v = _mm256_loadu_pd( x+i );
+        if (inRangeAvx2( v, EXP_MIN, EXP_MAX )==0xF) {
+            _mm256_storeu_pd( x+i, expAvx2( v ) );
+        } else {
+            expScalar( x+i, 4 );
+        }
+    }
+    expScalar( x+i, n-i );
+}
+
+__attribute__((target("avx2,fma")))
+static void logAvx2( double* x, int n ) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m256d v = _mm256_loadu_pd( x+i );
+        if (inRangeAvx2( v, DBL_MIN, DBL_MAX )==0xF) {
+            _mm256_storeu_pd( x+i, logAvx2( v ) );
+        } else {
+            logScalar( x+i, 4 );
+        }
+    }
+    logScalar( x+i, n-i );
+}
+
+__attribute__((target("avx2,fma")))
+static void sqrtAvx2( double* x, int n ) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        _mm256_storeu_pd( x+i, _mm256_sqrt_pd( _mm256_loadu_pd( x+i ) ) );
+    }
+    sqrtScalar( x+i, n-i );
+}
+
+/*  x^p computed as exp(p*log(x)) */
+__attribute__((target("avx2,fma")))
+static void powAvx2( double* x, const double* power, int powerStride, int n ) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m256d v = _mm256_loadu_pd( x+i );
+        __m256d p = (powerStride==0) ? _mm256_set1_pd( power[0] )
+                                     : _mm256_loadu_pd( power+i );
+        if (inRangeAvx2( v, DBL_MIN, DBL_MAX )==0xF) {
+            __m256d t = _mm256_mul_pd( p, logAvx2( v ) );
+            if (inRangeAvx2( t, EXP_MIN, EXP_MAX )==0xF) {
+                _mm256_storeu_pd( x+i, expAvx2( t ) );
+                continue;
+            }
+        }
+        powScalar( x+i, power+i*powerStride, powerStride, 4 );
+    }
+    powScalar( x+i, power+i*powerStride, powerStride, n-i );
+}
+
+__attribute__((target("avx2,fma")))
+static void positivePartAvx2( double* x, int n ) {
+    // max returns its second argument for NaNs and signed zeros
+    const __m256d zero = _mm256_setzero_pd();
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        _mm256_storeu_pd( x+i, _mm256_max_pd( _mm256_loadu_pd( x+i ), zero ) );
+    }
+    positivePartScalar( x+i, n-i );
+}
+
+__attribute__((target("avx2,fma")))
+static void negativePartAvx2( double* x, int n ) {
+    const __m256d zero = _mm256_setzero_pd();
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        _mm256_storeu_pd( x+i, _mm256_min_pd( _mm256_loadu_pd( x+i ), zero ) );
+    }
+    negativePartScalar( x+i, n-i );
+}
+
+template <int PREDICATE>
+__attribute__((target("avx2,fma")))
+static void compareAvx2( const double* x, const double* y, int yStride,
+                         double* out, int n ) {
+    const __m256d one = _mm256_set1_pd( 1.0 );
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m256d b = (yStride==0) ? _mm256_set1_pd( y[0] ) : _mm256_loadu_pd( y+i );
+        __m256d mask = _mm256_cmp_pd( _mm256_loadu_pd( x+i ), b, PREDICATE );
+        _mm256_storeu_pd( out+i, _mm256_and_pd( mask, one ) );
+    }
+}
+
+/*  Moro's inverse normal CDF of four values in [DBL_MIN, 1-DBL_MIN].
+    Both branches are computed and blended unless all the values
+    are central. */
+__attribute__((target("avx2,fma"), always_inline))
+static inline __m256d normInvAvx2( __m256d u ) {
+    const __m256d half = _mm256_set1_pd( 0.5 );
+    const __m256d signBit = _mm256_set1_pd( -0.0 );
+    __m256d y = _mm256_sub_pd( u, half );
+    __m256d r = _mm256_mul_pd( y, y );
+    __m256d numerator = _mm256_set1_pd( MORO_A[0] );
+    for (int i=1; i<4; i++) {
+        numerator = _mm256_fmadd_pd( numerator, r, _mm256_set1_pd( MORO_A[i] ) );
+    }
+    __m256d denominator = _mm256_set1_pd( MORO_B[0] );
+    for (int i=1; i<5; i++) {
+        denominator = _mm256_fmadd_pd( denominator, r, _mm256_set1_pd( MORO_B[i] ) );
+    }
+    __m256d central = _mm256_div_pd( _mm256_mul_pd( y, numerator ), denominator );
+
+    __m256d absY = _mm256_andnot_pd( signBit, y );
+    __m256d isTail = _mm256_cmp_pd( absY, _mm256_set1_pd( MORO_CENTRAL ), _CMP_GE_OQ );
+    if (_mm256_movemask_pd( isTail )==0) {
+        return central;
+    }
+    // the tail uses the smaller of u and 1-u
+    __m256d tailU = _mm256_min_pd( u, _mm256_sub_pd( _mm256_set1_pd( 1.0 ), u ) );
+    __m256d s = logAvx2( _mm256_xor_pd( logAvx2( tailU ), signBit ) );
+    __m256d t = _mm256_set1_pd( MORO_C[0] );
+    for (int i=1; i<MORO_C_TERMS; i++) {
+        t = _mm256_fmadd_pd( t, s, _mm256_set1_pd( MORO_C[i] ) );
+    }
+    // t is positive, give it the sign of y
+    __m256d tail = _mm256_or_pd( t, _mm256_and_pd( y, signBit ) );
+    return _mm256_blendv_pd( central, tail, isTail );
+}
+
+__attribute__((target("avx2,fma")))
+static void normInvAvx2( double* x, int n ) {
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        __m256d u = _mm256_loadu_pd( x+i );
+        if (inRangeAvx2( u, DBL_MIN, 1.0-DBL_EPSILON )==0xF) {
+            _mm256_storeu_pd( x+i, normInvAvx2( u ) );
+        } else {
+            normInvScalar( x+i, 4 );
+        }
+    }
+    normInvScalar( x+i, n-i );
+}
+
+/*  exp of eight values in [EXP_MIN, EXP_MAX] */
+__attribute__((target("avx512f"), always_inline))
+static inline __m512d expAvx512( __m512d x ) {
+    __m512d n = _mm512_roundscale_pd( _mm512_mul_pd( x, _mm512_set1_pd( LOG2E ) ),
+                                      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+    __m512d r = _mm512_fnmadd_pd( n, _mm512_set1_pd( LN2_HI ), x );
+    r = _mm512_fnmadd_pd( n, _mm512_set1_pd( LN2_LO ), r );
+    __m512d p = _mm512_set1_pd( EXP_COEFFICIENTS[0] );
+    for (int i=1; i<EXP_TERMS; i++) {
+        p = _mm512_fmadd_pd( p, r, _mm512_set1_pd( EXP_COEFFICIENTS[i] ) );
+    }
+    __m512d biased = _mm512_add_pd( n, _mm512_set1_pd( TWO_TO_52 + 1023.0 ) );
+    __m512i scale = _mm512_slli_epi64( _mm512_castpd_si512( biased ), 52 );
+    return _mm512_mul_pd( p, _mm512_castsi512_pd( scale ) );
+}
+
+/*  log of eight positive normal numbers */
+__attribute__((target("avx512f"), always_inline))
+static inline __m512d logAvx512( __m512d x ) {
+    const __m512d one = _mm512_set1_pd( 1.0 );
+    const __m512d half = _mm512_set1_pd( 0.5 );
+    __m512i bits = _mm512_castpd_si512( x );
+    __m512i exponent = _mm512_or_si512( _mm512_srli_epi64( bits, 52 ),
+                                        _mm512_castpd_si512( _mm512_set1_pd( TWO_TO_52 ) ) );
+    __m512d e = _mm512_sub_pd( _mm512_castsi512_pd( exponent ),
+                               _mm512_set1_pd( TWO_TO_52 + 1023.0 ) );
+    __m512i mantissa = _mm512_or_si512(
+        _mm512_and_si512( bits, _mm512_set1_epi64( 0x000FFFFFFFFFFFFFLL ) ),
+        _mm512_set1_epi64( 0x3FF0000000000000LL ) );
+    __m512d m = _mm512_castsi512_pd( mantissa );
+    __mmask8 big = _mm512_cmp_pd_mask( m, _mm512_set1_pd( SQRT2 ), _CMP_GT_OQ );
+    m = _mm512_mask_mul_pd( m, big, m, half );
+    e = _mm512_mask_add_pd( e, big, e, one );
+
+    __m512d f = _mm512_sub_pd( m, one );
+    __m512d s = _mm512_div_pd( f, _mm512_add_pd( f, _mm512_set1_pd( 2.0 ) ) );
+    __m512d z = _mm512_mul_pd( s, s );
+    __m512d q = _mm512_set1_pd( LOG_COEFFICIENTS[0] );
+    for (int i=1; i<LOG_TERMS; i++) {
+        q = _mm512_fmadd_pd( q, z, _mm512_set1_pd( LOG_COEFFICIENTS[i] ) );
+    }
+    __m512d R = _mm512_mul_pd( q, z );
+    __m512d hfsq = _mm512_mul_pd( _mm512_mul_pd( half, f ), f );
+    __m512d t = _mm512_fmadd_pd( s, _mm512_add_pd( hfsq, R ),
+                                 _mm512_mul_pd( e, _mm512_set1_pd( LN2_LO ) ) );
+    t = _mm512_sub_pd( _mm512_sub_pd( hfsq, t ), f );
+    return _mm512_fmsub_pd( e, _mm512_set1_pd( LN2_HI ), t );
+}
+
+/*  Mask of the lanes in [lo, hi], false for NaNs */
+__attribute__((target("avx512f"), always_inline))
+static inline __mmask8 inRangeAvx512( __m512d x, double lo, double hi ) {
+    return _mm512_cmp_pd_mask( x, _mm512_set1_pd( lo ), _CMP_GE_OQ )
+         & _mm512_cmp_pd_mask( x, _mm512_set1_pd( hi ), _CMP_LE_OQ );
+}
+
+__attribute__((target("avx512f")))
+static void expAvx512( double* x, int n ) {
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m512d v = _mm512_loadu_pd( x+i );
+        if (inRangeAvx512( v, EXP_MIN, EXP_MAX )==0xFF) {
+            _mm512_storeu_pd( x+i, expAvx512( v ) );
+        } else {
+            expScalar( x+i, 8 );
+        }
+    }
+    expScalar( x+i, n-i );
+}
+
+__attribute__((target("avx512f")))
+static void logAvx512( double* x, int n ) {
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m512d v = _mm512_loadu_pd( x+i );
+        if (inRangeAvx512( v, DBL_MIN, DBL_MAX )==0xFF) {
+            _mm512_storeu_pd( x+i, logAvx512( v ) );
+        } else {
+            logScalar( x+i, 8 );
+        }
+    }
+    logScalar( x+i, n-i );
+}
+
+__attribute__((target("avx512f")))
+static void sqrtAvx512( double* x, int n ) {
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        _mm512_storeu_pd( x+i, _mm512_sqrt_pd( _mm512_loadu_pd( x+i ) ) );
+    }
+    sqrtScalar( x+i, n-i );
+}
+
+__attribute__((target("avx512f")))
+static void powAvx512( double* x, const double* power, int powerStride, int n ) {
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m512d v = _mm512_loadu_pd( x+i );
+        __m512d p = (powerStride==0) ? _mm512_set1_pd( power[0] )
+                                     : _mm512_loadu_pd( power+i );
+        if (inRangeAvx512( v, DBL_MIN, DBL_MAX )==0xFF) {
+            __m512d t = _mm512_mul_pd( p, logAvx512( v ) );
+            if (inRangeAvx512( t, EXP_MIN, EXP_MAX )==0xFF) {
+                _mm512_storeu_pd( x+i, expAvx512( t ) );
+                continue;
+            }
+        }
+        powScalar( x+i, power+i*powerStride, powerStride, 8 );
+    }
+    powScalar( x+i, power+i*powerStride, powerStride, n-i );
+}
+
+__attribute__((target("avx512f")))
+static void positivePartAvx512( double* x, int n ) {
+    const __m512d zero = _mm512_setzero_pd();
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        _mm512_storeu_pd( x+i, _mm512_max_pd( _mm512_loadu_pd( x+i ), zero ) );
+    }
+    positivePartScalar( x+i, n-i );
+}
+
+__attribute__((target("avx512f")))
+static void negativePartAvx512( double* x, int n ) {
+    const __m512d zero = _mm512_setzero_pd();
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        _mm512_storeu_pd( x+i, _mm512_min_pd( _mm512_loadu_pd( x+i ), zero ) );
+    }
+    negativePartScalar( x+i, n-i );
+}
+
+template <int PREDICATE>
+__attribute__((target("avx512f")))
+static void compareAvx512( const double* x, const double* y, int yStride,
+                           double* out, int n ) {
+    const __m512d one = _mm512_set1_pd( 1.0 );
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m512d b = (yStride==0) ? _mm512_set1_pd( y[0] ) : _mm512_loadu_pd( y+i );
+        __mmask8 mask = _mm512_cmp_pd_mask( _mm512_loadu_pd( x+i ), b, PREDICATE );
+        _mm512_storeu_pd( out+i, _mm512_maskz_mov_pd( mask, one ) );
+    }
+}
+
+/*  Moro's inverse normal CDF of eight values in [DBL_MIN, 1-DBL_MIN] */
+__attribute__((target("avx512f"), always_inline))
+static inline __m512d normInvAvx512( __m512d u ) {
+    const __m512d half = _mm512_set1_pd( 0.5 );
+    __m512d y = _mm512_sub_pd( u, half );
+    __m512d r = _mm512_mul_pd( y, y );
+    __m512d numerator = _mm512_set1_pd( MORO_A[0] );
+    for (int i=1; i<4; i++) {
+        numerator = _mm512_fmadd_pd( numerator, r, _mm512_set1_pd( MORO_A[i] ) );
+    }
+    __m512d denominator = _mm512_set1_pd( MORO_B[0] );
+    for (int i=1; i<5; i++) {
+        denominator = _mm512_fmadd_pd( denominator, r, _mm512_set1_pd( MORO_B[i] ) );
+    }
+    __m512d central = _mm512_div_pd( _mm512_mul_pd( y, numerator ), denominator );
+
+    __mmask8 isTail = _mm512_cmp_pd_mask( _mm512_abs_pd( y ),
+                                          _mm512_set1_pd( MORO_CENTRAL ), _CMP_GE_OQ );
+    if (isTail==0) {
+        return central;
+    }
+    __m512d tailU = _mm512_min_pd( u, _mm512_sub_pd( _mm512_set1_pd( 1.0 ), u ) );
+    __m512d s = logAvx512( _mm512_sub_pd( _mm512_setzero_pd(), logAvx512( tailU ) ) );
+    __m512d t = _mm512_set1_pd( MORO_C[0] );
+    for (int i=1; i<MORO_C_TERMS; i++) {
+        t = _mm512_fmadd_pd( t, s, _mm512_set1_pd( MORO_C[i] ) );
+    }
+    // t is positive, negate it where y is
+    __mmask8 negative = _mm512_cmp_pd_mask( y, _mm512_setzero_pd(), _CMP_LT_OQ );
+    __m512d tail = _mm512_mask_sub_pd( t, negative, _mm512_setzero_pd(), t );
+    return _mm512_mask_blend_pd( isTail, central, tail );
+}
+
+__attribute__((target("avx512f")))
+static void normInvAvx512( double* x, int n ) {
+    int i = 0;
+    for (; i+8<=n; i+=8) {
+        __m512d u = _mm512_loadu_pd( x+i );
+        if (inRangeAvx512( u, DBL_MIN, 1.0-DBL_EPSILON )==0xFF) {
+            _mm512_storeu_pd( x+i, normInvAvx512( u ) );
+        } else {
+            normInvScalar( x+i, 8 );
+        }
+    }
+    normInvScalar( x+i, n-i );
+}
+
+/*  Compare the whole vectors at the given level, returning
+    how many values were done */
+template <int PREDICATE>
+static int compareSimd( SimdLevel level, const double* x, const double* y,
+                        int yStride, double* out, int n ) {
+    if (level==SIMD_AVX512) {
+        compareAvx512<PREDICATE>( x, y, yStride, out, n );
+        return n - n%8;
+    }
+    compareAvx2<PREDICATE>( x, y, yStride, out, n );
+    return n - n%4;
+}
+
+#endif
+
+void vectorExp( double* x, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        expAvx512( x, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        expAvx2( x, n );
+        return;
+    }
+#endif
+    expScalar( x, n );
+}
+
+void vectorLog( double* x, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        logAvx512( x, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        logAvx2( x, n );
+        return;
+    }
+#endif
+    logScalar( x, n );
+}
+
+void vectorSqrt( double* x, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        sqrtAvx512( x, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        sqrtAvx2( x, n );
+        return;
+    }
+#endif
+    sqrtScalar( x, n );
+}
+
+/*  x[i] = x[i]^power[i*powerStride] at the current level */
+static void vectorPow( double* x, const double* power, int powerStride, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        powAvx512( x, power, powerStride, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        powAvx2( x, power, powerStride, n );
+        return;
+    }
+#endif
+    powScalar( x, power, powerStride, n );
+}
+
+void vectorPow( double* x, int n, double power ) {
+    vectorPow( x, &power, 0, n );
+}
+
+void vectorPow( double* x, const double* power, int n ) {
+    vectorPow( x, power, 1, n );
+}
+
+void vectorPositivePart( double* x, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        positivePartAvx512( x, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        positivePartAvx2( x, n );
+        return;
+    }
+#endif
+    positivePartScalar( x, n );
+}
+
+void vectorNegativePart( double* x, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        negativePartAvx512( x, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        negativePartAvx2( x, n );
+        return;
+    }
+#endif
+    negativePartScalar( x, n );
+}
+
+/*  out[i] = x[i] OP y[i*yStride] at the current level */
+static void vectorCompare( const double* x, const double* y, int yStride,
+                           double* out, int n, Comparison comparison ) {
+    int done = 0;
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level!=SIMD_SCALAR) {
+        // the predicate has to be a compile time constant
+        switch (comparison) {
+        case COMPARE_LESS:
+            done = compareSimd<_CMP_LT_OQ>( level, x, y, yStride, out, n );
+            break;
+        case COMPARE_LESS_EQUAL:
+            done = compareSimd<_CMP_LE_OQ>( level, x, y, yStride, out, n );
+            break;
+        case COMPARE_GREATER:
+            done = compareSimd<_CMP_GT_OQ>( level, x, y, yStride, out, n );
+            break;
+        case COMPARE_GREATER_EQUAL:
+            done = compareSimd<_CMP_GE_OQ>( level, x, y, yStride, out, n );
+            break;
+        case COMPARE_EQUAL:
+            done = compareSimd<_CMP_EQ_OQ>( level, x, y, yStride, out, n );
+            break;
+        default:
+            // != is true when either side is NaN
+            done = compareSimd<_CMP_NEQ_UQ>( level, x, y, yStride, out, n );
+            break;
+        }
+    }
+#endif
+    compareScalar( x+done, y+done*yStride, yStride, out+done, n-done, comparison );
+}
+
+void vectorCompare( const double* x, double s, double* out, int n,
+                    Comparison comparison ) {
+    vectorCompare( x, &s, 0, out, n, comparison );
+}
+
+void vectorCompare( const double* x, const double* y, double* out, int n,
+                    Comparison comparison ) {
+    vectorCompare( x, y, 1, out, n, comparison );
+}
+
+void vectorNormInv( double* x, int n ) {
+#ifdef FINMATLIB_X86_SIMD
+    SimdLevel level = getSimdLevel();
+    if (level==SIMD_AVX512) {
+        normInvAvx512( x, n );
+        return;
+    } else if (level==SIMD_AVX2) {
+        normInvAvx2( x, n );
+        return;
+    }
+#endif
+    normInvScalar( x, n );
+}
+
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+/*  The textbook triple loop, used to check the kernels */
+static Matrix naiveProduct( const Matrix& a, const Matrix& b ) {
+    Matrix ret( a.nRows(), b.nCols() );
+    for (int i=0; i<a.nRows(); i++) {
+        for (int j=0; j<b.nCols(); j++) {
+            for (int k=0; k<a.nCols(); k++) {
+                ret(i,j) += a(i,k)*b(k,j);
+            }
+        }
+    }
+    return ret;
+}
+
+static void testGemmShapes() {
+    int shapes[][3] = { {1,1,1}, {7,3,5}, {8,4,4}, {33,5,17}, {1000,3,3},
+                        {1003,8,8}, {13,2,7}, {1001,9,3},
+                        {37,70,65}, {130,300,9}, {300,257,301} };
+    SimdLevel best = detectSimdLevel();
+    for (int level=SIMD_SCALAR; level<=best; level++) {
+        setSimdLevel( (SimdLevel)level );
+        for (auto& shape : shapes) {
+            Matrix a = randuniform( shape[0], shape[1] );
+            Matrix b = randuniform( shape[1], shape[2] );
+            Matrix expected = naiveProduct( a, b );
+            (a*b).assertEquals( expected, 1e-10 );
+
+            // check alpha and beta are respected
+            Matrix c = randuniform( shape[0], shape[2] );
+            Matrix expectedC = 0.5*c + expected*2.0;
+            gemm( shape[0], shape[2], shape[1], 2.0,
+                  a.begin(), shape[0], b.begin(), shape[1],
+                  0.5, c.begin(), shape[0] );
+            c.assertEquals( expectedC, 1e-10 );
+        }
+    }
+    setSimdLevel( best );
+}
+
+static void testGemmPerformance() {
+    int shapes[][3] = { {100000,3,3}, {100000,1,3}, {100000,8,8},
+                        {100000,20,20}, {10000,64,64},
+                        {500,500,500}, {2000,50,2000} };
+    for (auto& shape : shapes) {
+        Matrix a = randuniform( shape[0], shape[1] );
+        Matrix b = randuniform( shape[1], shape[2] );
+        bool isTiny = shape[1]<=GEMM_TINY && shape[2]<=GEMM_TINY;
+        // the small products are quick, so time several
+        int nRepeats = isTiny ? 20 : 1;
+        double flops = 2.0*shape[0]*shape[1]*shape[2]*nRepeats;
+
+        Matrix expected;
+        clock_t start = clock();
+        for (int r=0; r<nRepeats; r++) {
+            expected = naiveProduct( a, b );
+        }
+        double naiveTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+        Matrix actual;
+        start = clock();
+        for (int r=0; r<nRepeats; r++) {
+            actual = a*b;
+        }
+        double blockedTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+        actual.assertEquals( expected, 1e-9 );
+
+        INFO( shape[0] << "x" << shape[1] << " times " << shape[1] << "x" << shape[2]
+            << " (" << simdLevelName( getSimdLevel() ) << ")\n"
+            << "Naive: " << naiveTime << "s, "
+            << flops/max( naiveTime, 1e-6 )*1e-9 << " GFLOP/s\n"
+            << "Blocked: " << blockedTime << "s, "
+            << flops/max( blockedTime, 1e-6 )*1e-9 << " GFLOP/s" );
+    }
+}
+
+/*  Check a kernel's output against libm, allowing a relative error of
+    tolerance and treating NaNs as equal */
+static void assertMatchesLibm( const vector<double>& actual,
+                               const vector<double>& expected,
+                               double tolerance ) {
+    ASSERT( actual.size()==expected.size() );
+    for (size_t i=0; i<actual.size(); i++) {
+        double a = actual[i];
+        double e = expected[i];
+        if (std::isnan( e )) {
+            ASSERT( std::isnan( a ) );
+        } else if (a!=e) {
+            ASSERT( fabs( a-e ) <= tolerance*fabs( e ) );
+        }
+    }
+}
+
+/*  Values over a wide range plus the awkward ones */
+static vector<double> testValues( double low, double high, int n ) {
+    Matrix u = randuniform( n, 1 );
+    vector<double> ret( u.begin(), u.end() );
+    for (double& x : ret) {
+        x = low + (high-low)*x;
+    }
+    double special[] = { 0.0, -0.0, 1.0, -1.0, 1e-310, -1e-310, DBL_MIN, DBL_MAX,
+                         -708.5, 709.5, -745.0, 800.0, -800.0,
+                         INFINITY, -INFINITY, NAN };
+    ret.insert( ret.begin() + n/2, special, special + sizeof(special)/sizeof(double) );
+    return ret;
+}
+
+static void testElementwiseAccuracy() {
+    const double ULP = DBL_EPSILON;
+    int n = 10001;
+    vector<double> wide = testValues( -700.0, 700.0, n );
+    vector<double> small = testValues( -1.0, 1.0, n );
+    vector<double> positive = testValues( 0.0, 100.0, n );
+    vector<double> logUniform = testValues( -700.0, 700.0, n );
+    for (double& x : logUniform) {
+        x = std::exp( x );
+    }
+    vector<double> powers = testValues( -3.0, 3.0, (int)positive.size()-16 );
+
+    SimdLevel best = detectSimdLevel();
+    for (int level=SIMD_SCALAR; level<=best; level++) {
+        setSimdLevel( (SimdLevel)level );
+        for (const vector<double>* values : { &wide, &small, &positive, &logUniform }) {
+            const vector<double>& x = *values;
+            vector<double> expected( x.size() );
+            vector<double> actual = x;
+
+            transform( x.begin(), x.end(), expected.begin(), [](double v) { return std::exp(v); } );
+            vectorExp( &actual[0], (int)actual.size() );
+            assertMatchesLibm( actual, expected, 2*ULP );
+
+            actual = x;
+            transform( x.begin(), x.end(), expected.begin(), [](double v) { return std::log(v); } );
+            vectorLog( &actual[0], (int)actual.size() );
+            assertMatchesLibm( actual, expected, 2*ULP );
+
+            actual = x;
+            transform( x.begin(), x.end(), expected.begin(), [](double v) { return std::sqrt(v); } );
+            vectorSqrt( &actual[0], (int)actual.size() );
+            assertMatchesLibm( actual, expected, 0.0 );
+
+            actual = x;
+            transform( x.begin(), x.end(), expected.begin(), [](double v) { return (v>0.0) ? v : 0.0; } );
+            vectorPositivePart( &actual[0], (int)actual.size() );
+            assertMatchesLibm( actual, expected, 0.0 );
+
+            actual = x;
+            transform( x.begin(), x.end(), expected.begin(), [](double v) { return (v<0.0) ? v : 0.0; } );
+            vectorNegativePart( &actual[0], (int)actual.size() );
+            assertMatchesLibm( actual, expected, 0.0 );
+
+            // compare each value with its neighbour and with zero
+            vector<double> shifted( x.begin()+1, x.end() );
+            shifted.push_back( x[0] );
+            int m = (int)x.size();
+            vectorCompare( &x[0], &shifted[0], &actual[0], m, COMPARE_LESS );
+            for (int i=0; i<m; i++) ASSERT( actual[i]==(x[i]<shifted[i]) );
+            vectorCompare( &x[0], &shifted[0], &actual[0], m, COMPARE_NOT_EQUAL );
+            for (int i=0; i<m; i++) ASSERT( actual[i]==(x[i]!=shifted[i]) );
+            vectorCompare( &x[0], &shifted[0], &actual[0], m, COMPARE_GREATER_EQUAL );
+            for (int i=0; i<m; i++) ASSERT( actual[i]==(x[i]>=shifted[i]) );
+            vectorCompare( &x[0], 0.0, &actual[0], m, COMPARE_GREATER );
+            for (int i=0; i<m; i++) ASSERT( actual[i]==(x[i]>0.0) );
+            vectorCompare( &x[0], 1.0, &actual[0], m, COMPARE_EQUAL );
+            for (int i=0; i<m; i++) ASSERT( actual[i]==(x[i]==1.0) );
+            vectorCompare( &x[0], 0.0, &actual[0], m, COMPARE_LESS_EQUAL );
+            for (int i=0; i<m; i++) ASSERT( actual[i]==(x[i]<=0.0) );
+        }
+
+        // exp(p*log(x)) loses about |p*log(x)| ulps
+        for (double p : { 0.5, 2.0, -1.5, 3.7 }) {
+            vector<double> expected( positive.size() );
+            vector<double> actual = positive;
+            transform( positive.begin(), positive.end(), expected.begin(),
+                       [p](double v) { return std::pow(v, p); } );
+            vectorPow( &actual[0], (int)actual.size(), p );
+            assertMatchesLibm( actual, expected, 32*ULP );
+        }
+        vector<double> expected( positive.size() );
+        vector<double> actual = positive;
+        transform( positive.begin(), positive.end(), powers.begin(), expected.begin(),
+                   [](double v, double p) { return std::pow(v, p); } );
+        vectorPow( &actual[0], &powers[0], (int)actual.size() );
+        assertMatchesLibm( actual, expected, 32*ULP );
+    }
+    setSimdLevel( best );
+}
+
+static void testElementwisePerformance() {
+    int n = 1000000;
+    int nRepeats = 20;
+    Matrix u = randuniform( n, 1 );
+    vector<double> x( n );
+    SimdLevel best = detectSimdLevel();
+    const char* names[] = { "exp", "log", "sqrt", "pow", "positivePart", "compare" };
+    for (int kernel=0; kernel<6; kernel++) {
+        stringstream report;
+        report << names[kernel] << " of " << n << " values";
+        for (int level=SIMD_SCALAR; level<=best; level++) {
+            setSimdLevel( (SimdLevel)level );
+            double time = 0.0;
+            for (int r=0; r<nRepeats; r++) {
+                // keep the inputs in a range where every function is defined
+                for (int i=0; i<n; i++) {
+                    x[i] = 0.1 + 5.0*u(i,0);
+                }
+                clock_t start = clock();
+                switch (kernel) {
+                case 0: vectorExp( &x[0], n ); break;
+                case 1: vectorLog( &x[0], n ); break;
+                case 2: vectorSqrt( &x[0], n ); break;
+                case 3: vectorPow( &x[0], n, 0.7 ); break;
+                case 4: vectorPositivePart( &x[0], n ); break;
+                default: vectorCompare( &x[0], 2.5, &x[0], n, COMPARE_GREATER ); break;
+                }
+                time += (double)(clock()-start)/CLOCKS_PER_SEC;
+            }
+            report << "\n" << simdLevelName( (SimdLevel)level ) << ": "
+                   << n*(double)nRepeats/max( time, 1e-6 )*1e-6 << "M values/s";
+        }
+        INFO( report.str() );
+    }
+    setSimdLevel( best );
+}
+
+static void testNormInvAccuracy() {
+    // uniform values, the edges of Moro's central region and the tails
+    int n = 10001;
+    Matrix u = randuniform( n, 1 );
+    vector<double> x( u.begin(), u.end() );
+    double special[] = { 0.08, 0.0800000001, 0.92, 0.9199999999, 0.5,
+                         1e-10, 1.0-1e-10, 1e-300, DBL_MIN, 1e-310,
+                         0.0, 1.0, DBL_EPSILON, 1.0-DBL_EPSILON, NAN };
+    x.insert( x.begin() + n/2, special, special + sizeof(special)/sizeof(double) );
+    vector<double> expected( x.size() );
+    transform( x.begin(), x.end(), expected.begin(), [](double v) { return norminv(v); } );
+
+    SimdLevel best = detectSimdLevel();
+    for (int level=SIMD_SCALAR; level<=best; level++) {
+        setSimdLevel( (SimdLevel)level );
+        vector<double> actual = x;
+        vectorNormInv( &actual[0], (int)actual.size() );
+        // the SIMD log and fused multiply adds round differently
+        assertMatchesLibm( actual, expected, 1e-13 );
+    }
+    setSimdLevel( best );
+}
+
+static void testNormInvPerformance() {
+    int n = 1000000;
+    int nRepeats = 10;
+    vector<double> x( n );
+    stringstream report;
+    report << "randn of " << n << " values";
+    SimdLevel best = detectSimdLevel();
+    double scalarTime = 0.0;
+    Philox random;
+    for (int r=0; r<nRepeats; r++) {
+        clock_t start = clock();
+        randn( random, &x[0], n, NORMAL_SCALAR );
+        scalarTime += (double)(clock()-start)/CLOCKS_PER_SEC;
+    }
+    report << "\nNORMAL_SCALAR: " << n*(double)nRepeats/max( scalarTime, 1e-6 )*1e-6 << "M values/s";
+    for (int level=SIMD_SCALAR; level<=best; level++) {
+        setSimdLevel( (SimdLevel)level );
+        double time = 0.0;
+        for (int r=0; r<nRepeats; r++) {
+            clock_t start = clock();
+            randn( random, &x[0], n, NORMAL_SIMD );
+            time += (double)(clock()-start)/CLOCKS_PER_SEC;
+        }
+        report << "\nNORMAL_SIMD " << simdLevelName( (SimdLevel)level ) << ": "
+               << n*(double)nRepeats/max( time, 1e-6 )*1e-6 << "M values/s";
+    }
+    setSimdLevel( best );
+    INFO( report.str() );
+}
+
+void testMatrixKernels() {
+    TEST( testGemmShapes );
+    TEST( testGemmPerformance );
+    TEST( testElementwiseAccuracy );
+    TEST( testElementwisePerformance );
+    TEST( testNormInvAccuracy );
+    TEST( testNormInvPerformance );
+}
@@ -0,0 +1,136 @@
+#include "MatrixView.h"
+#include "MatrixExpression.h"
+#include "matlib.h"
+#include "UpAndOutOption.h"
+
+using namespace std;
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static void testAccess() {
+    Matrix m("1,2,3;4,5,6;7,8,9");
+    MatrixView v( m );
+    ASSERT( v.nRows()==3 && v.nCols()==3 );
+    ASSERT( v.isContiguous() );
+    ASSERT( v(1,2)==6.0 );
+
+    MatrixView column = v.col( 1 );
+    ASSERT( column.nRows()==3 && column.nCols()==1 );
+    ASSERT( column(0)==2.0 && column(2)==8.0 );
+
+    MatrixView row = v.row( 2 );
+    ASSERT( row.nRows()==1 && row.nCols()==3 );
+    ASSERT( row(0)==7.0 && row(2)==9.0 );
+    ASSERT( !row.isContiguous() );
+
+    MatrixView block = v.block( 1, 1, 2, 2 );
+    Matrix("5,6;8,9").assertEquals( Matrix( block ), 0.001 );
+    ASSERT( !block.isContiguous() );
+    Matrix("8").assertEquals( Matrix( block.row(1).col(0) ), 0.001 );
+
+    Matrix("4,5,6;7,8,9").assertEquals( Matrix( v.rowRange( 1, 2 ) ), 0.001 );
+    Matrix("3;6;9").assertEquals( Matrix( v.col(2) ), 0.001 );
+    Matrix("4,5,6").assertEquals( Matrix( v.row(1) ), 0.001 );
+
+    // views see changes to the matrix
+    m(0,1) = 10.0;
+    ASSERT( column(0)==10.0 );
+}
+
+static void testNoAllocations() {
+    Matrix m = randuniform( 100, 50 );
+    long long before = Matrix::allocationCount();
+    double total = 0.0;
+    for (int j=0; j<m.nCols(); j++) {
+        MatrixView column = MatrixView( m ).col( j );
+        total += column( 99 );
+        MatrixView block = MatrixView( m ).block( 10, j, 20, 1 );
+        total += block( 19 );
+    }
+    ASSERT( Matrix::allocationCount()==before );
+    ASSERT( total>0.0 );
+}
+
+static void testReductions() {
+    Matrix m = randuniform( 7, 5 );
+    MatrixView v( m );
+    // every reduction of a view should match the same reduction of a copy
+    MatrixView views[] = { v, v.block( 1, 1, 5, 3 ), v.col( 2 ), v.row( 3 ),
+                           v.rowRange( 2, 4 ) };
+    for (const MatrixView& view : views) {
+        Matrix copy( view );
+        sumRows( copy ).assertEquals( sumRows( view ), 1e-12 );
+        sumCols( copy ).assertEquals( sumCols( view ), 1e-12 );
+        meanRows( copy ).assertEquals( meanRows( view ), 1e-12 );
+        meanCols( copy ).assertEquals( meanCols( view ), 1e-12 );
+        minOverRows( copy ).assertEquals( minOverRows( view ), 1e-12 );
+        maxOverRows( copy ).assertEquals( maxOverRows( view ), 1e-12 );
+        minOverCols( copy ).assertEquals( minOverCols( view ), 1e-12 );
+        maxOverCols( copy ).assertEquals( maxOverCols( view ), 1e-12 );
+        if (view.nCols()>1) {
+            stdRows( copy ).assertEquals( stdRows( view ), 1e-12 );
+        }
+        if (view.nRows()>1) {
+            stdCols( copy ).assertEquals( stdCols( view ), 1e-12 );
+        }
+    }
+}
+
+static void testExpressions() {
+    Matrix m("1,2,3;4,5,6");
+    MatrixView v( m );
+    Matrix sum = lazy( v.col(0) ) + lazy( v.col(2) );
+    Matrix("4;10").assertEquals( sum, 0.001 );
+    Matrix scaled = 2.0*lazy( v.row(1) );
+    Matrix("8,10,12").assertEquals( scaled, 0.001 );
+    Matrix whole = lazy( v ) - m;
+    Matrix("0,0,0;0,0,0").assertEquals( whole, 0.001 );
+}
+
+static void testPayoffOfSubset() {
+    // a payoff can be computed from some of the paths without copying
+    UpAndOutOption o;
+    o.setBarrier( 1.5 );
+    o.setStrike( 0.5 );
+    Matrix paths = 2.0*randuniform( 20, 10 );
+    MatrixView subset = MatrixView( paths ).rowRange( 5, 10 );
+    o.payoff( Matrix( subset ) ).assertEquals( o.payoff( subset ), 1e-12 );
+}
+
+static void testPerformance() {
+    int nPaths = 100000;
+    int nSteps = 100;
+    Matrix paths = randuniform( nPaths, nSteps );
+
+    clock_t start = clock();
+    double copyTotal = 0.0;
+    for (int j=0; j<nSteps; j++) {
+        copyTotal += sumCols( paths.col( j ) ).asScalar();
+    }
+    double copyTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+    start = clock();
+    double viewTotal = 0.0;
+    for (int j=0; j<nSteps; j++) {
+        viewTotal += sumCols( MatrixView( paths ).col( j ) ).asScalar();
+    }
+    double viewTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+    ASSERT_APPROX_EQUAL( copyTotal, viewTotal, 1e-6 );
+    INFO( "Summing " << nSteps << " columns of " << nPaths << " paths\n"
+        << "Copying columns: " << copyTime << "s\n"
+        << "Viewing columns: " << viewTime << "s" );
+}
+
+void testMatrixView() {
+    TEST( testAccess );
+    TEST( testNoAllocations );
+    TEST( testReductions );
+    TEST( testExpressions );
+    TEST( testPayoffOfSubset );
+    TEST( testPerformance );
+}
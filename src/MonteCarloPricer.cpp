@@ -2,13 +2,35 @@
 
 #include "matlib.h"
 #include "CallOption.h"
+#include "PutOption.h"
 #include "Executor.h"
+#include "UpAndOutOption.h"
+#include "DownAndOutOption.h"
+#include "MargrabeOption.h"
+#include "MatrixAllocator.h"
+#include "Pipeline.h"
+#include "MatrixExpression.h"
 
 using namespace std;
 
 MonteCarloPricer::MonteCarloPricer() : nScenarios(100000),
 									   nSteps(10),
-									   nTasks(1)
+									   nTasks(1),
+									   useArena(true),
+									   streaming(false),
+									   pathsPerBlock(4096),
+									   queueDepth(4),
+									   usePathSummaries(true),
+									   antithetic(false),
+									   controlVariate(false),
+									   momentMatching(false),
+									   quasiRandom(false),
+									   brownianBridge(true),
+									   seed(Philox::DEFAULT_SEED),
+									   greeksMethod(GREEKS_PATHWISE),
+									   greeksBump(0.01),
+									   targetStandardError(0.0),
+									   timeBudget(0.0)
 {
 }
 
@@ -22,38 +44,554 @@ double MonteCarloPricer::price(
 	return price(option, msm);
 }
 
-double singleThreadedPrice(
-	int taskNumber,
+/*  The scenarios to generate at once when only summaries of the
+	paths are kept. Their memory doesn't grow with the number of
+	steps, and small batches keep each step's columns in cache. */
+static const int SUMMARY_BATCH_SIZE = 4096;
+
+/*  Generate some scenarios up to toDate from the given normals,
+	keeping only the given path statistics if summarise is set */
+static MarketSimulation generateScenarios(
+	const MultiStockModel &model,
+	MultiStockModel::NormalSource normals,
 	int nScenarios,
 	int nSteps,
+	double toDate,
+	bool summarise,
+	const PathStatistics &statistics)
+{
+	if (summarise)
+	{
+		return model.generateRiskNeutralPathSummaries(
+			normals, toDate, nScenarios, nSteps, statistics);
+	}
+	return model.generateRiskNeutralPricePaths(
+		normals, toDate, nScenarios, nSteps);
+}
+
+/*  The normals for scenarios firstScenario onwards. sobol is
+	only used for quasi-random numbers. */
+static MultiStockModel::NormalSource scenarioNormals(
+	const MonteCarloPricer &pricer,
+	const Philox &rng,
+	const SobolSequence &sobol,
+	long long firstScenario,
+	int nSteps)
+{
+	if (pricer.quasiRandom)
+	{
+		return MultiStockModel::sobolNormals(sobol, firstScenario, nSteps, pricer.brownianBridge);
+	}
+	return MultiStockModel::philoxNormals(rng, firstScenario);
+}
+
+/*  A Sobol sequence with enough dimensions for the model's
+	paths, or a placeholder if the pricer isn't quasi-random */
+static SobolSequence sobolSequence(
+	const MonteCarloPricer &pricer,
+	const MultiStockModel &model,
+	int nSteps)
+{
+	if (!pricer.quasiRandom)
+	{
+		return SobolSequence(1);
+	}
+	SobolSequence sobol((int)model.randSize(1, nSteps));
+	sobol.scramble(pricer.seed);
+	return sobol;
+}
+
+/*  Sums over some scenarios from which the price and its standard
+	error are estimated. With antithetic variates the payoff of a
+	scenario is the average over its pair of paths. */
+struct PayoffSums
+{
+	long long n = 0;
+	double sum = 0.0;
+	double sumSquares = 0.0;
+	/*  The same for the control variate's payoffs, and the sum of
+		the products of the option's and the control's payoffs */
+	double controlSum = 0.0;
+	double controlSumSquares = 0.0;
+	double crossSum = 0.0;
+	/*  The same for the payoffs of the individual paths, which
+		is what plain Monte Carlo would have used */
+	long long nPaths = 0;
+	double pathSum = 0.0;
+	double pathSumSquares = 0.0;
+
+	PayoffSums &operator+=(const PayoffSums &other)
+	{
+		n += other.n;
+		sum += other.sum;
+		sumSquares += other.sumSquares;
+		controlSum += other.controlSum;
+		controlSumSquares += other.controlSumSquares;
+		crossSum += other.crossSum;
+		nPaths += other.nPaths;
+		pathSum += other.pathSum;
+		pathSumSquares += other.pathSumSquares;
+		return *this;
+	}
+
+	/*  Add the payoffs of the individual paths */
+	void addPaths(const Matrix &payoffs)
+	{
+		for (const double *p = payoffs.begin(); p != payoffs.end(); p++)
+		{
+			pathSum += *p;
+			pathSumSquares += (*p) * (*p);
+		}
+		nPaths += payoffs.nRows() * payoffs.nCols();
+	}
+};
+
+/*  The undiscounted price and the variance of one scenario's
+	payoff, as estimated from some sums */
+struct PayoffEstimate
+{
+	double mean;
+	double variance;
+	double controlCoefficient;
+	double varianceReduction;
+};
+
+/*  Estimate the undiscounted price, adjusted by the control
+	variate with the least squares coefficient if there is one */
+static PayoffEstimate estimatePayoff(
+	const PayoffSums &sums,
+	const ControlVariate *control,
+	double discount)
+{
+	ASSERT(sums.n >= 1);
+	PayoffEstimate estimate;
+	double n = (double)sums.n;
+	estimate.mean = sums.sum / n;
+	double sumOfDeviations = max(0.0, sums.sumSquares - n * estimate.mean * estimate.mean);
+	estimate.controlCoefficient = 0.0;
+	if (control)
+	{
+		double controlMean = sums.controlSum / n;
+		double controlDeviations = sums.controlSumSquares - n * controlMean * controlMean;
+		double crossDeviations = sums.crossSum - n * estimate.mean * controlMean;
+		if (controlDeviations > 0.0)
+		{
+			double beta = crossDeviations / controlDeviations;
+			estimate.controlCoefficient = beta;
+			estimate.mean -= beta * (controlMean - control->price / discount);
+			sumOfDeviations = max(0.0, sumOfDeviations - beta * crossDeviations);
+		}
+	}
+	estimate.variance = sums.n > 1 ? sumOfDeviations / (n - 1) : 0.0;
+
+	// compare with the variance of a single path
+	double pathMean = sums.pathSum / sums.nPaths;
+	double pathVariance = sums.nPaths > 1
+							  ? max(0.0, (sums.pathSumSquares - sums.nPaths * pathMean * pathMean) / (sums.nPaths - 1))
+							  : 0.0;
+	double pathsPerScenario = (double)sums.nPaths / sums.n;
+	if (estimate.variance > 0.0)
+	{
+		estimate.varianceReduction = pathVariance / (pathsPerScenario * estimate.variance);
+	}
+	else
+	{
+		estimate.varianceReduction = pathVariance > 0.0 ? numeric_limits<double>::infinity() : 1.0;
+	}
+	return estimate;
+}
+
+/*  The option's control variate if the pricer should use one,
+	or null */
+static const ControlVariate *findControlVariate(
+	const MonteCarloPricer &pricer,
 	const ContinuousTimeOption &option,
-	const MultiStockModel &model)
+	const MultiStockModel &model,
+	ControlVariate &control)
 {
+	if (pricer.controlVariate && option.getControlVariate(model, control))
+	{
+		return &control;
+	}
+	return NULL;
+}
 
-	if (!option.isPathDependent())
+/*  The stocks any of the options depend upon */
+static set<string> stocksOf(const vector<const ContinuousTimeOption *> &options)
+{
+	set<string> stocks;
+	for (auto option : options)
 	{
-		nSteps = 1;
+		set<string> optionStocks = option->getStocks();
+		stocks.insert(optionStocks.begin(), optionStocks.end());
 	}
-	double total = 0.0;
+	return stocks;
+}
+
+/**
+ *   A uniform time grid from the pricing date to the latest of
+ *   some options' maturities, with a step at each maturity
+ */
+struct TimeGrid
+{
+	/*  The number of steps, or 0 if there is no grid */
+	int nSteps = 0;
+	/*  The number of steps to each option's maturity */
+	vector<int> optionSteps;
+};
+
+/*  The grid with the fewest steps, up to maxSteps, that puts every
+	option's maturity on it and gives each path dependent option
+	at least pricer.nSteps steps. A single option's grid is the
+	one it would be priced on alone. */
+static TimeGrid fitGrid(
+	const MonteCarloPricer &pricer,
+	const vector<const ContinuousTimeOption *> &options,
+	double date,
+	int maxSteps)
+{
+	double maturity = date;
+	int fewest = 1;
+	for (auto option : options)
+	{
+		maturity = max(maturity, option->getMaturity());
+		fewest = max(fewest, option->isPathDependent() ? pricer.nSteps : 1);
+	}
+	double horizon = maturity - date;
+	TimeGrid grid;
+	for (int n = fewest; n <= maxSteps && grid.nSteps == 0; n++)
+	{
+		grid.optionSteps.clear();
+		for (auto option : options)
+		{
+			double exact = horizon > 0.0 ? n * (option->getMaturity() - date) / horizon : n;
+			int steps = (int)floor(exact + 0.5);
+			int needed = option->isPathDependent() ? pricer.nSteps : 1;
+			if (steps < needed || fabs(exact - steps) > 1e-9 * n)
+			{
+				break;
+			}
+			grid.optionSteps.push_back(steps);
+		}
+		if (grid.optionSteps.size() == options.size())
+		{
+			grid.nSteps = n;
+		}
+	}
+	return grid;
+}
+
+/*  Some of the options to price and their grid */
+struct GridGroup
+{
+	vector<int> indices;
+	TimeGrid grid;
+};
+
+/*  The options with the given indices */
+static vector<const ContinuousTimeOption *> selectOptions(
+	const vector<const ContinuousTimeOption *> &options,
+	const vector<int> &indices)
+{
+	vector<const ContinuousTimeOption *> selected;
+	for (int i : indices)
+	{
+		selected.push_back(options[i]);
+	}
+	return selected;
+}
+
+/*  Split options into groups that share paths. Options with the
+	same maturity always do. Groups of different maturities only
+	share if one grid for both has no more steps than their two
+	grids, so sharing never generates more of the paths than
+	pricing each maturity on its own. */
+static vector<GridGroup> groupByGrid(
+	const MonteCarloPricer &pricer,
+	const vector<const ContinuousTimeOption *> &options,
+	double date)
+{
+	map<double, vector<int>> byMaturity;
+	for (int i = 0; i < (int)options.size(); i++)
+	{
+		byMaturity[options[i]->getMaturity()].push_back(i);
+	}
+	vector<GridGroup> groups;
+	for (auto &entry : byMaturity)
+	{
+		GridGroup next;
+		next.indices = entry.second;
+		next.grid = fitGrid(pricer, selectOptions(options, next.indices), date, numeric_limits<int>::max());
+		bool merged = false;
+		for (GridGroup &group : groups)
+		{
+			vector<int> indices = group.indices;
+			indices.insert(indices.end(), next.indices.begin(), next.indices.end());
+			TimeGrid grid = fitGrid(pricer, selectOptions(options, indices), date,
+									group.grid.nSteps + next.grid.nSteps);
+			if (grid.nSteps > 0)
+			{
+				group.indices = indices;
+				group.grid = grid;
+				merged = true;
+				break;
+			}
+		}
+		if (!merged)
+		{
+			groups.push_back(next);
+		}
+	}
+	return groups;
+}
+
+/**
+ *   Options priced together from one set of scenarios. The paths
+ *   are simulated for every stock the options need, up to the
+ *   latest maturity, on a time grid with a step at each option's
+ *   maturity, and each option sees the paths up to its own
+ *   maturity. A single option's paths are exactly those it
+ *   would be priced from on its own.
+ */
+class OptionGroup
+{
+public:
+	OptionGroup(const MonteCarloPricer &pricer,
+				const vector<const ContinuousTimeOption *> &options,
+				const MultiStockModel &model,
+				const TimeGrid &grid);
+	/*  A group of one option */
+	OptionGroup(const MonteCarloPricer &pricer,
+				const ContinuousTimeOption &option,
+				const MultiStockModel &model);
+	/*  The options in the group */
+	vector<const ContinuousTimeOption *> options;
+	/*  The model of the stocks the options need */
+	MultiStockModel model;
+	/*  Each option's control variate, or null if it doesn't use one */
+	vector<const ControlVariate *> controls;
+	/*  Each option's discount factor */
+	vector<double> discounts;
+	/*  The end of the paths and their number of steps */
+	double maturity;
+	int nSteps;
+	/*  The number of steps to each option's maturity */
+	vector<int> optionSteps;
+	/*  Are only summaries of the paths kept, and which? This
+		is only possible if all the options have the same
+		maturity and none need different barriers. */
+	bool summarise;
+	PathStatistics statistics;
+	/*  Does each option monitor a barrier continuously with the
+		Brownian bridge? From whole paths it then gets summaries
+		of its own paths, so it has the same price as it would
+		from summaries. */
+	vector<bool> bridged;
+
+	/*  The part of the simulation option k sees */
+	MarketSimulation simulationFor(int k, const MarketSimulation &sim) const
+	{
+		return optionSteps[k] == nSteps ? sim : sim.firstSteps(optionSteps[k]);
+	}
+	/*  Option k's payoffs from the part of a simulation it sees */
+	Matrix payoff(int k, const MarketSimulation &paths) const
+	{
+		return payoff(k, paths, model);
+	}
+	/*  The same for paths simulated from another model of
+		the stocks */
+	Matrix payoff(int k, const MarketSimulation &paths,
+				  const MultiStockModel &pathModel) const;
+
+private:
+	/*  The control variates, which controls points into */
+	vector<ControlVariate> foundControls;
+	OptionGroup(const OptionGroup &) = delete;
+	OptionGroup &operator=(const OptionGroup &) = delete;
+};
+
+OptionGroup::OptionGroup(const MonteCarloPricer &pricer,
+						 const vector<const ContinuousTimeOption *> &options,
+						 const MultiStockModel &model,
+						 const TimeGrid &grid)
+	: options(options),
+	  model(model.getSubmodel(stocksOf(options))),
+	  nSteps(grid.nSteps),
+	  optionSteps(grid.optionSteps)
+{
+	ASSERT(!options.empty() && nSteps > 0);
+	ASSERT(optionSteps.size() == options.size());
+	int nOptions = (int)options.size();
+	double date = model.getDate();
+	double r = model.getRiskFreeRate();
+	maturity = date;
+	for (auto option : options)
+	{
+		maturity = max(maturity, option->getMaturity());
+		discounts.push_back(exp(-r * (option->getMaturity() - date)));
+	}
+
+	// controls points into foundControls, which mustn't move
+	foundControls.resize(nOptions);
+	summarise = pricer.usePathSummaries;
+	for (int k = 0; k < nOptions; k++)
+	{
+		const ControlVariate *control = findControlVariate(
+			pricer, *options[k], this->model, foundControls[k]);
+		controls.push_back(control);
+		PathStatistics optionStatistics = options[k]->getPathStatistics();
+		bridged.push_back(optionStatistics.needsBridge());
+		if (optionStatistics.isEmpty() || optionSteps[k] != nSteps)
+		{
+			summarise = false;
+		}
+		vector<PathStatistics> needed({optionStatistics});
+		if (control)
+		{
+			needed.push_back(control->statistics);
+		}
+		for (const PathStatistics &s : needed)
+		{
+			if (statistics.isCompatible(s))
+			{
+				statistics.include(s);
+			}
+			else
+			{
+				summarise = false;
+			}
+		}
+	}
+}
+
+OptionGroup::OptionGroup(const MonteCarloPricer &pricer,
+						 const ContinuousTimeOption &option,
+						 const MultiStockModel &model)
+	: OptionGroup(pricer, {&option}, model,
+				  fitGrid(pricer, {&option}, model.getDate(), numeric_limits<int>::max()))
+{
+}
+
+/*  An option's payoffs from whole paths with steps of length dt,
+	summarising each of its stocks' paths with the Brownian bridge
+	as they would have been summarised when generated */
+static Matrix bridgedPayoff(const ContinuousTimeOption &option,
+							const MarketSimulation &paths,
+							const MultiStockModel &pathModel,
+							double dt)
+{
+	PathStatistics optionStatistics = option.getPathStatistics();
+	MarketSimulation summaries;
+	for (const string &stock : option.getStocks())
+	{
+		BlackScholesModel bsm = pathModel.getBlackScholesModel(stock);
+		MatrixView prices = paths.getStockPrices(stock);
+		auto summary = make_shared<PathSummary>(prices.nRows(), optionStatistics);
+		summary->setBridge(bsm.stockPrice, bsm.volatility * bsm.volatility * dt);
+		summary->addSteps(prices);
+		summaries.addPathSummary(stock, summary);
+	}
+	return option.payoff(summaries);
+}
+
+Matrix OptionGroup::payoff(int k,
+						   const MarketSimulation &paths,
+						   const MultiStockModel &pathModel) const
+{
+	const ContinuousTimeOption &option = *options[k];
+	if (!bridged[k] || paths.hasPathSummaries())
+	{
+		return option.payoff(paths);
+	}
+	return bridgedPayoff(option, paths, pathModel,
+						 (maturity - pathModel.getDate()) / nSteps);
+}
+
+/*  Add one option's payoffs over a batch of scenarios to its
+	sums. mirror holds the antithetic paths if there are any. */
+static void addPayoffs(
+	const MonteCarloPricer &pricer,
+	const OptionGroup &group,
+	int k,
+	int nScenarios,
+	const MarketSimulation &sim,
+	const MarketSimulation &mirror,
+	PayoffSums &total)
+{
+	const ContinuousTimeOption &option = *group.options[k];
+	const ControlVariate *control = group.controls[k];
+	MarketSimulation paths = group.simulationFor(k, sim);
+	Matrix payoffs = group.payoff(k, paths);
+	total.addPaths(payoffs);
+	Matrix controls;
+	if (control)
+	{
+		controls = control->payoff(paths);
+	}
+	if (pricer.antithetic)
+	{
+		MarketSimulation mirrorPaths = group.simulationFor(k, mirror);
+		Matrix mirrorPayoffs = group.payoff(k, mirrorPaths);
+		total.addPaths(mirrorPayoffs);
+		payoffs = 0.5 * (lazy(payoffs) + mirrorPayoffs);
+		if (control)
+		{
+			Matrix mirrorControls = control->payoff(mirrorPaths);
+			controls = 0.5 * (lazy(controls) + mirrorControls);
+		}
+	}
+
+	total.n += nScenarios;
+	for (int i = 0; i < nScenarios; i++)
+	{
+		double payoff = payoffs(i);
+		total.sum += payoff;
+		total.sumSquares += payoff * payoff;
+		if (control)
+		{
+			double controlPayoff = controls(i);
+			total.controlSum += controlPayoff;
+			total.controlSumSquares += controlPayoff * controlPayoff;
+			total.crossSum += payoff * controlPayoff;
+		}
+	}
+}
 
-	MultiStockModel subModel = model.getSubmodel(
-		option.getStocks());
+/*  Sum each option's payoffs over nScenarios scenarios from
+	firstScenario on, using the pricer's variance reduction options */
+static vector<PayoffSums> sumPayoffs(
+	const MonteCarloPricer &pricer,
+	long long firstScenario,
+	int nScenarios,
+	const OptionGroup &group)
+{
+	int nOptions = (int)group.options.size();
+	vector<PayoffSums> totals(nOptions);
 
-	long long randSize = subModel.randSize(nScenarios,
-										   nSteps);
-	mt19937 rng;
-	rng.discard(randSize * taskNumber);
+	// Every scenario has its own random numbers, so the price
+	// doesn't depend on how the scenarios are split into tasks
+	Philox rng(pricer.seed);
+	SobolSequence sobol = sobolSequence(pricer, group.model, group.nSteps);
 
-	// We price at most one million scenarios at a time to avoid running out of memory
-	int batchSize = 1000000 / nSteps;
+	// We price at most one million paths at a time to avoid running out of memory
+	int pathsPerScenario = pricer.antithetic ? 2 : 1;
+	int batchSize = group.summarise ? SUMMARY_BATCH_SIZE : 1000000 / (group.nSteps * pathsPerScenario);
 	if (batchSize <= 0)
 	{
 		batchSize = 1;
 	}
 
+	// The matrices for a batch come from an arena which we reset for
+	// the next batch, so after the first batch we don't touch the heap.
+	// The group's submodel was created before this as it outlives the batches.
+	MatrixArena arena;
+	MatrixAllocatorScope scope(pricer.useArena ? (MatrixAllocator &)arena
+											   : MatrixAllocator::heap());
+
 	int scenariosRemaining = nScenarios;
 	while (scenariosRemaining > 0)
 	{
+		arena.reset();
 
 		int thisBatch = batchSize;
 		if (scenariosRemaining < batchSize)
@@ -61,77 +599,294 @@ double singleThreadedPrice(
 			thisBatch = scenariosRemaining;
 		}
 
-		MarketSimulation sim = subModel.generateRiskNeutralPricePaths(
-			rng,
-			option.getMaturity(),
-			thisBatch,
-			nSteps);
-		Matrix payoffs = option.payoff(sim);
-		total += sumCols(payoffs).asScalar();
+		MultiStockModel::NormalSource normals = scenarioNormals(
+			pricer, rng, sobol, firstScenario + nScenarios - scenariosRemaining, group.nSteps);
+		if (pricer.momentMatching)
+		{
+			normals = MultiStockModel::momentMatchedNormals(normals);
+		}
+		MarketSimulation sim = generateScenarios(
+			group.model, normals, thisBatch, group.nSteps, group.maturity,
+			group.summarise, group.statistics);
+		MarketSimulation mirror;
+		if (pricer.antithetic)
+		{
+			mirror = generateScenarios(
+				group.model, MultiStockModel::antitheticNormals(normals),
+				thisBatch, group.nSteps, group.maturity,
+				group.summarise, group.statistics);
+		}
+		for (int k = 0; k < nOptions; k++)
+		{
+			addPayoffs(pricer, group, k, thisBatch, sim, mirror, totals[k]);
+		}
 		scenariosRemaining -= thisBatch;
 	}
-	double mean = total / nScenarios;
-	double r = model.getRiskFreeRate();
-	double T = option.getMaturity() - model.getDate();
-	return exp(-r * T) * mean;
+	return totals;
 }
 
-class PriceTask : public Task
+/*  Add each option's sums from some more scenarios to sums */
+template <typename Sums>
+static void addSums(vector<Sums> &sums, const vector<Sums> &more)
 {
-public:
-	/*  Amount of random numbers to skip */
-	int taskNumber;
-	int nScenarios, nSteps;
-	const ContinuousTimeOption &option;
-	const MultiStockModel &model;
-	/*  Output data */
-	double result;
+	ASSERT(sums.size() == more.size());
+	for (int k = 0; k < (int)sums.size(); k++)
+	{
+		sums[k] += more[k];
+	}
+}
+
+/*  Sum each of nOptions options' samples over size scenarios from
+	first on, where sumScenarios(first, n) returns their sums over
+	n scenarios from first on. Each task sums a consecutive share
+	of the scenarios, and the tasks' sums are combined in task
+	order. */
+template <typename Sums, typename SumScenarios>
+static vector<Sums> sumConcurrently(
+	const MonteCarloPricer &pricer,
+	long long first,
+	long long size,
+	int nOptions,
+	SumScenarios sumScenarios)
+{
+	int nTasks = pricer.nTasks;
+	shared_ptr<Executor> executor = Executor::newSharedInstance();
+	vector<Sums> none(nOptions);
+	// one range per task, as the tasks' scenarios are fixed, and the
+	// sums are combined before estimating the controls' coefficients
+	return executor->parallelReduce(
+		0, nTasks, none,
+		[&](int firstTask, int lastTask)
+		{
+			vector<Sums> sums = none;
+			for (int i = firstTask; i < lastTask; i++)
+			{
+				long long taskFirst = first + size * i / nTasks;
+				long long taskLast = first + size * (i + 1) / nTasks;
+				if (taskLast > taskFirst)
+				{
+					addSums(sums, sumScenarios(taskFirst, (int)(taskLast - taskFirst)));
+				}
+			}
+			return sums;
+		},
+		[](vector<Sums> a, const vector<Sums> &b)
+		{
+			addSums(a, b);
+			return a;
+		},
+		1);
+}
+
+/*  Sum each option's payoffs over size scenarios from first on,
+	concurrently */
+static vector<PayoffSums> sumPayoffsConcurrently(
+	const MonteCarloPricer &pricer,
+	long long first,
+	long long size,
+	const OptionGroup &group)
+{
+	return sumConcurrently<PayoffSums>(
+		pricer, first, size, (int)group.options.size(),
+		[&](long long taskFirst, int n)
+		{
+			return sumPayoffs(pricer, taskFirst, n, group);
+		});
+}
 
-	PriceTask(
-		int taskNumber,
-		int nScenarios,
-		int nSteps,
-		const ContinuousTimeOption &option,
-		const MultiStockModel &model)
-		: taskNumber(taskNumber),
-		  nScenarios(nScenarios),
-		  nSteps(nSteps),
-		  option(option),
-		  model(model)
+/*  The prices of the options in a group */
+static vector<double> groupPrices(
+	const MonteCarloPricer &pricer,
+	const OptionGroup &group)
+{
+	vector<PayoffSums> totals = sumPayoffsConcurrently(
+		pricer, 0, pricer.nScenarios, group);
+	vector<double> prices;
+	for (int k = 0; k < (int)totals.size(); k++)
 	{
+		double discount = group.discounts[k];
+		prices.push_back(discount * estimatePayoff(totals[k], group.controls[k], discount).mean);
 	}
+	return prices;
+}
+
+/**
+ *   The number of blocks of one streaming pricing in existence
+ *   and the most there have been at once, which bounds the
+ *   memory used
+ */
+struct BlockCount
+{
+	atomic<int> live{0};
+	atomic<int> peak{0};
+};
 
-	void execute()
+/**
+ *   Some simulated paths on their way from generation to evaluation
+ */
+class PathBlock
+{
+public:
+	/*  The count may be null if the blocks aren't being counted */
+	PathBlock(int index, MarketSimulation simulation, BlockCount *count)
+		: index(index), simulation(simulation), count(count)
+	{
+		if (count)
+		{
+			int live = ++count->live;
+			int peak = count->peak;
+			while (live > peak && !count->peak.compare_exchange_weak(peak, live))
+			{
+			}
+		}
+	}
+	~PathBlock()
 	{
-		result = singleThreadedPrice(taskNumber,
-									 nScenarios, nSteps, option, model);
+		if (count)
+		{
+			count->live--;
+		}
 	}
+	/*  The position of the block in the sequence of scenarios */
+	int index;
+	MarketSimulation simulation;
+
+private:
+	BlockCount *count;
 };
 
 /**
- *   Price the option by Monte Carlo
+ *   Price with path generation and evaluation running concurrently.
+ *   Scenarios are numbered as in groupPrices, and each block
+ *   of payoffs is summed separately and added up in order at the end,
+ *   so the price depends on the block size but not on the number
+ *   of tasks. If peakBlocks isn't null it is set to the most blocks
+ *   that were in memory at once.
  */
-// double MonteCarloPricer::price(
-// 	const ContinuousTimeOption& option,
-// 	const MultiStockModel& model) const {
-// 	ASSERT(nTasks >= 1);
-// 	vector< shared_ptr<PriceTask> > tasks;
-// 	shared_ptr<Executor> executor =
-// 		Executor::newInstance(nTasks);
-// 	for (int i = 0; i<nTasks; i++) {
-// 		shared_ptr<PriceTask> task(new PriceTask(
-// 			i, nScenarios/nTasks,
-// 			nSteps, option, model));
-// 		tasks.push_back(task);
-// 		executor->addTask(task);
-// 	}
-// 	executor->join();
-// 	double total = 0.0;
-// 	for (int i = 0; i<nTasks; i++) {
-// 		total += tasks[i]->result;
-// 	}
-// 	return total / nTasks;
-// }
+static double streamingPrice(
+	const MonteCarloPricer &pricer,
+	const ContinuousTimeOption &option,
+	const MultiStockModel &model,
+	int *peakBlocks = nullptr)
+{
+	int nSteps = option.isPathDependent() ? pricer.nSteps : 1;
+	int nScenarios = pricer.nScenarios;
+	int blockSize = pricer.pathsPerBlock;
+	ASSERT(blockSize >= 1 && pricer.queueDepth >= 1);
+	int nBlocks = (nScenarios + blockSize - 1) / blockSize;
+	MultiStockModel subModel = model.getSubmodel(option.getStocks());
+	Philox rng(pricer.seed);
+	SobolSequence sobol = sobolSequence(pricer, subModel, nSteps);
+	PathStatistics statistics = option.getPathStatistics();
+	bool summarise = pricer.usePathSummaries && !statistics.isEmpty();
+	bool bridged = statistics.needsBridge() && !summarise;
+	double dt = (option.getMaturity() - subModel.getDate()) / nSteps;
+
+	vector<double> blockSums(nBlocks, 0.0);
+	// declared before the queue, which may still hold blocks
+	// when it is destroyed
+	BlockCount count;
+	BlockCount *counting = peakBlocks ? &count : nullptr;
+	MpmcPipeline<shared_ptr<PathBlock>> queue(pricer.queueDepth);
+	atomic<int> nextBlock(0);
+	int nProducers = pricer.nTasks;
+	int nConsumers = max(1, pricer.nTasks / 2);
+	atomic<int> producersRunning(nProducers);
+	// the first exception thrown by a stage. The stage closes the
+	// queue so the others stop instead of waiting for it forever.
+	exception_ptr error;
+	mutex errorMutex;
+	auto fail = [&]()
+	{
+		lock_guard<mutex> lock(errorMutex);
+		if (!error)
+		{
+			error = current_exception();
+		}
+		queue.close();
+	};
+
+	auto produce = [&]()
+	{
+		// blocks are freed by other threads, so they can't come
+		// from this thread's arena
+		MatrixAllocatorScope scope(MatrixAllocator::heap());
+		try
+		{
+			int block;
+			while ((block = nextBlock++) < nBlocks)
+			{
+				int firstScenario = block * blockSize;
+				MarketSimulation sim = generateScenarios(
+					subModel,
+					scenarioNormals(pricer, rng, sobol, firstScenario, nSteps),
+					min(blockSize, nScenarios - firstScenario),
+					nSteps,
+					option.getMaturity(),
+					summarise,
+					statistics);
+				if (!queue.write(make_shared<PathBlock>(block, sim, counting)))
+				{
+					break;
+				}
+			}
+		}
+		catch (...)
+		{
+			fail();
+		}
+		if (--producersRunning == 0)
+		{
+			queue.close();
+		}
+	};
+	auto consume = [&]()
+	{
+		MatrixAllocatorScope scope(MatrixAllocator::heap());
+		try
+		{
+			shared_ptr<PathBlock> block;
+			while (queue.read(block))
+			{
+				Matrix payoffs = bridged
+					? bridgedPayoff(option, block->simulation, subModel, dt)
+					: option.payoff(block->simulation);
+				blockSums[block->index] = sumCols(payoffs).asScalar();
+				block.reset();
+			}
+		}
+		catch (...)
+		{
+			fail();
+		}
+	};
+
+	// every stage waits on the queue, so each needs a thread of its
+	// own, which the blocking pool keeps between pricings
+	shared_ptr<Executor> executor = Executor::newSharedBlockingInstance();
+	for (int i = 0; i < nProducers; i++)
+	{
+		executor->addTask(produce);
+	}
+	for (int i = 0; i < nConsumers; i++)
+	{
+		executor->addTask(consume);
+	}
+	executor->join();
+	if (error)
+	{
+		rethrow_exception(error);
+	}
+	if (peakBlocks)
+	{
+		*peakBlocks = count.peak;
+	}
+
+	double mean = accumulate(blockSums.begin(), blockSums.end(), 0.0) / nScenarios;
+	double r = model.getRiskFreeRate();
+	double T = option.getMaturity() - model.getDate();
+	return exp(-r * T) * mean;
+}
 
 /**
  *   Price the option by Monte Carlo
@@ -141,54 +896,1588 @@ double MonteCarloPricer::price(
 	const MultiStockModel &model) const
 {
 	ASSERT(nTasks >= 1);
-	vector<double> prices(nTasks, 0.0);
-	shared_ptr<Executor> executor =
-		Executor::newInstance(nTasks);
-	for (int i = 0; i < nTasks; i++)
+	if (streaming)
 	{
-		auto lmbd = [this, i, &prices, &option, &model]()
-		{ prices[i] = singleThreadedPrice(i, this->nScenarios / this->nTasks, this->nSteps, option, model); };
-		executor->addTask(lmbd);
+		return streamingPrice(*this, option, model);
 	}
-	executor->join();
-	double total = accumulate(prices.begin(), prices.end(), 0.0);
-	return total / nTasks;
+	OptionGroup group(*this, option, model);
+	return groupPrices(*this, group)[0];
 }
 
-//////////////////////////////////////
-//
-//   Tests
-//
-//////////////////////////////////////
+/*  The options a group is made of */
+static vector<const ContinuousTimeOption *> optionPointers(
+	const vector<SPCContinuousTimeOption> &options)
+{
+	vector<const ContinuousTimeOption *> pointers;
+	for (auto &option : options)
+	{
+		pointers.push_back(option.get());
+	}
+	return pointers;
+}
 
-static void testPriceCallOption()
+/*  Price each group of the options that share paths with
+	priceGroup(group), returning the results in the order of
+	the options */
+template <typename Result, typename PriceGroup>
+static vector<Result> priceInGroups(
+	const MonteCarloPricer &pricer,
+	const vector<const ContinuousTimeOption *> &options,
+	const MultiStockModel &model,
+	PriceGroup priceGroup)
 {
-	rng("default");
+	vector<Result> results(options.size());
+	for (const GridGroup &entry : groupByGrid(pricer, options, model.getDate()))
+	{
+		OptionGroup group(pricer, selectOptions(options, entry.indices), model, entry.grid);
+		vector<Result> groupResults = priceGroup(group);
+		for (int k = 0; k < (int)entry.indices.size(); k++)
+		{
+			results[entry.indices[k]] = groupResults[k];
+		}
+	}
+	return results;
+}
 
-	CallOption c;
-	c.setStrike(110);
-	c.setMaturity(2);
+vector<double> MonteCarloPricer::price(
+	const vector<SPCContinuousTimeOption> &options,
+	const MultiStockModel &model) const
+{
+	ASSERT(nTasks >= 1);
+	if (options.empty())
+	{
+		return vector<double>();
+	}
+	return priceInGroups<double>(
+		*this, optionPointers(options), model,
+		[this](const OptionGroup &group)
+		{
+			return groupPrices(*this, group);
+		});
+}
 
-	BlackScholesModel m;
-	m.volatility = 0.1;
-	m.riskFreeRate = 0.05;
-	m.stockPrice = 100.0;
-	m.drift = 0.1;
-	m.date = 1;
+/*  The scenarios each task prices in the first round of an
+	adaptive pricing, which estimates the variance and speed */
+static const int PILOT_SCENARIOS_PER_TASK = 1024;
 
-	MultiStockModel msm(m);
+/*  Price the options in a group, also estimating the accuracy of
+	the prices. An adaptive pricing stops once every option's
+	standard error is below the target. */
+static vector<MonteCarloResult> groupPricesWithError(
+	const MonteCarloPricer &pricer,
+	const OptionGroup &group)
+{
+	ASSERT(pricer.nTasks >= 1 && pricer.nScenarios >= 1);
+	auto start = chrono::steady_clock::now();
+	int nOptions = (int)group.options.size();
+	int nTasks = pricer.nTasks;
+	double targetStandardError = pricer.targetStandardError;
+	double timeBudget = pricer.timeBudget;
+	bool isAdaptive = targetStandardError > 0.0 || timeBudget > 0.0;
+	long long maxScenarios = pricer.nScenarios;
 
-	MonteCarloPricer pricer;
-	pricer.nTasks = 1;
-	double price = pricer.price(c, m);
-	double expected = c.price(msm);
-	pricer.nTasks = 10;
+	vector<PayoffSums> totals(nOptions);
+	long long used = 0;
+	long long roundSize = isAdaptive
+							  ? min(maxScenarios, (long long)nTasks * PILOT_SCENARIOS_PER_TASK)
+							  : maxScenarios;
+	vector<MonteCarloResult> results(nOptions);
+	while (true)
+	{
+		addSums(totals, sumPayoffsConcurrently(pricer, used, roundSize, group));
+		used += roundSize;
+
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		double largestDeviation = 0.0;
+		double largestError = 0.0;
+		for (int k = 0; k < nOptions; k++)
+		{
+			double discount = group.discounts[k];
+			PayoffEstimate estimate = estimatePayoff(totals[k], group.controls[k], discount);
+			double sd = discount * sqrt(estimate.variance);
+			MonteCarloResult &result = results[k];
+			result.price = discount * estimate.mean;
+			result.standardError = sd / sqrt((double)used);
+			result.varianceReduction = estimate.varianceReduction;
+			result.controlCoefficient = estimate.controlCoefficient;
+			result.nScenarios = used;
+			result.elapsed = elapsed;
+			largestDeviation = max(largestDeviation, sd);
+			largestError = max(largestError, result.standardError);
+		}
+
+		if (!isAdaptive || used >= maxScenarios)
+		{
+			break;
+		}
+		if (targetStandardError > 0.0 && largestError <= targetStandardError)
+		{
+			break;
+		}
+		if (timeBudget > 0.0 && elapsed >= timeBudget)
+		{
+			break;
+		}
+		// at most double the scenarios each round, so a poor
+		// estimate from the pilot round can't overshoot by much
+		long long next = used;
+		if (targetStandardError > 0.0)
+		{
+			double ratio = largestDeviation / targetStandardError;
+			double needed = ceil(ratio * ratio);
+			next = min(next, max((long long)needed - used, (long long)nTasks * PILOT_SCENARIOS_PER_TASK));
+		}
+		if (timeBudget > 0.0)
+		{
+			double perScenario = elapsed / used;
+			next = min(next, (long long)((timeBudget - elapsed) / perScenario));
+		}
+		roundSize = min(next, maxScenarios - used);
+		if (roundSize <= 0)
+		{
+			break;
+		}
+	}
+	for (MonteCarloResult &result : results)
+	{
+		double halfWidth = 1.959963984540054 * result.standardError;
+		result.confidenceLower = result.price - halfWidth;
+		result.confidenceUpper = result.price + halfWidth;
+	}
+	return results;
+}
+
+MonteCarloResult MonteCarloPricer::priceWithError(
+	const ContinuousTimeOption &option,
+	const BlackScholesModel &model) const
+{
+	MultiStockModel msm(model);
+	return priceWithError(option, msm);
+}
+
+MonteCarloResult MonteCarloPricer::priceWithError(
+	const ContinuousTimeOption &option,
+	const MultiStockModel &model) const
+{
+	OptionGroup group(*this, option, model);
+	return groupPricesWithError(*this, group)[0];
+}
+
+vector<MonteCarloResult> MonteCarloPricer::priceWithError(
+	const vector<SPCContinuousTimeOption> &options,
+	const MultiStockModel &model) const
+{
+	if (options.empty())
+	{
+		return vector<MonteCarloResult>();
+	}
+	return priceInGroups<MonteCarloResult>(
+		*this, optionPointers(options), model,
+		[this](const OptionGroup &group)
+		{
+			return groupPricesWithError(*this, group);
+		});
+}
+
+/*  The samples whose means estimate the price and Greeks */
+enum GreekSample
+{
+	PRICE_SAMPLE,
+	DELTA_SAMPLE,
+	GAMMA_SAMPLE,
+	VEGA_SAMPLE,
+	GREEK_SAMPLES
+};
+
+/*  Sums of the samples of an option's price and Greeks */
+struct GreekSums
+{
+	long long n = 0;
+	double sums[GREEK_SAMPLES] = {};
+	double sumSquares[GREEK_SAMPLES] = {};
+
+	GreekSums &operator+=(const GreekSums &other)
+	{
+		n += other.n;
+		for (int i = 0; i < GREEK_SAMPLES; i++)
+		{
+			sums[i] += other.sums[i];
+			sumSquares[i] += other.sumSquares[i];
+		}
+		return *this;
+	}
+
+	/*  Add one sample */
+	void add(GreekSample sample, double value)
+	{
+		sums[sample] += value;
+		sumSquares[sample] += value * value;
+	}
+};
+
+/**
+ *   How the Greeks of a group of options on one stock are
+ *   estimated
+ */
+struct GreeksSetup
+{
+	/*  The model whose sensitivities are wanted */
+	BlackScholesModel model;
+	/*  The stock the options are on */
+	string stock;
+	/*  How each option's Greeks are estimated */
+	vector<GreeksMethod> methods;
+	/*  Are only summaries of the paths kept? The likelihood
+		ratio needs the whole paths. */
+	bool summarise;
+	/*  Are the normals of each step needed? */
+	bool likelihoodRatio;
+	/*  If any option is bumped, the models with the stock price
+		bumped up and down and then the volatility bumped up and
+		down. They are driven by the same normals as the model. */
+	vector<MultiStockModel> bumpedModels;
+	double priceBump;
+	double volatilityBump;
+};
+
+/*  How to estimate an option's Greeks, which is the pricer's
+	method if it applies and otherwise the next one that does */
+static GreeksMethod greeksMethod(
+	const MonteCarloPricer &pricer,
+	const ContinuousTimeOption &option)
+{
+	GreeksMethod method = pricer.greeksMethod;
+	if (method == GREEKS_PATHWISE && !option.hasPayoffDerivative())
+	{
+		method = GREEKS_LIKELIHOOD_RATIO;
+	}
+	if (method == GREEKS_LIKELIHOOD_RATIO && option.getPathStatistics().needsBridge())
+	{
+		method = GREEKS_BUMP;
+	}
+	return method;
+}
+
+/*  The final price of a stock on each path */
+static Matrix terminalPrices(const MarketSimulation &sim, const string &stock)
+{
+	if (sim.hasPathSummaries())
+	{
+		return sim.getPathSummary(stock).getTerminal();
+	}
+	MatrixView prices = sim.getStockPrices(stock);
+	return Matrix(prices.col(prices.nCols() - 1));
+}
+
+/*  Add one option's samples over a batch of scenarios to its sums.
+	firstNormals holds the normals of each path's first step and
+	vegaScores(i,j) the derivative with respect to the volatility
+	of the log density of path i's first j+1 steps, if the
+	likelihood ratio is used. */
+static void addGreeks(
+	const OptionGroup &group,
+	const GreeksSetup &setup,
+	int k,
+	int nScenarios,
+	const MarketSimulation &sim,
+	const vector<MarketSimulation> &bumped,
+	const Matrix &firstNormals,
+	const Matrix &vegaScores,
+	GreekSums &total)
+{
+	const ContinuousTimeOption &option = *group.options[k];
+	const BlackScholesModel &model = setup.model;
+	double S0 = model.stockPrice;
+	double sigma = model.volatility;
+	double r = model.riskFreeRate;
+	double discount = group.discounts[k];
+	MarketSimulation paths = group.simulationFor(k, sim);
+	Matrix payoffs = group.payoff(k, paths);
+	total.n += nScenarios;
+
+	switch (setup.methods[k])
+	{
+	case GREEKS_PATHWISE:
+	{
+		// the final price is S0*exp((r-sigma^2/2)*T + sigma*W), so
+		// it scales with S0 and its log has derivative W - sigma*T
+		// with respect to sigma
+		Matrix derivatives = option.payoffDerivative(paths);
+		Matrix finalPrices = terminalPrices(paths, setup.stock);
+		double T = option.getMaturity() - model.date;
+		double sigmaRootT = sigma * sqrt(T);
+		for (int i = 0; i < nScenarios; i++)
+		{
+			double ST = finalPrices(i);
+			double logReturn = log(ST / S0);
+			double pathwiseDelta = discount * derivatives(i) * ST / S0;
+			double z = (logReturn - (r - 0.5 * sigma * sigma) * T) / sigmaRootT;
+			total.add(PRICE_SAMPLE, discount * payoffs(i));
+			total.add(DELTA_SAMPLE, pathwiseDelta);
+			total.add(GAMMA_SAMPLE, pathwiseDelta / S0 * (z / sigmaRootT - 1.0));
+			total.add(VEGA_SAMPLE, pathwiseDelta * S0 * (logReturn - (r + 0.5 * sigma * sigma) * T) / sigma);
+		}
+		break;
+	}
+	case GREEKS_LIKELIHOOD_RATIO:
+	{
+		// only the first step's density depends on S0
+		double dt = (group.maturity - model.date) / group.nSteps;
+		double deviation = sigma * sqrt(dt);
+		int lastStep = group.optionSteps[k] - 1;
+		for (int i = 0; i < nScenarios; i++)
+		{
+			double price = discount * payoffs(i);
+			double z = firstNormals(i);
+			total.add(PRICE_SAMPLE, price);
+			total.add(DELTA_SAMPLE, price * z / (S0 * deviation));
+			total.add(GAMMA_SAMPLE, price * ((z * z - 1.0) / (deviation * deviation) - z / deviation) / (S0 * S0));
+			total.add(VEGA_SAMPLE, price * vegaScores(i, lastStep));
+		}
+		break;
+	}
+	case GREEKS_BUMP:
+	{
+		Matrix up = group.payoff(k, group.simulationFor(k, bumped[0]), setup.bumpedModels[0]);
+		Matrix down = group.payoff(k, group.simulationFor(k, bumped[1]), setup.bumpedModels[1]);
+		Matrix volatilityUp = group.payoff(k, group.simulationFor(k, bumped[2]), setup.bumpedModels[2]);
+		Matrix volatilityDown = group.payoff(k, group.simulationFor(k, bumped[3]), setup.bumpedModels[3]);
+		double h = setup.priceBump;
+		double v = setup.volatilityBump;
+		for (int i = 0; i < nScenarios; i++)
+		{
+			double price = discount * payoffs(i);
+			total.add(PRICE_SAMPLE, price);
+			total.add(DELTA_SAMPLE, discount * (up(i) - down(i)) / (2 * h));
+			total.add(GAMMA_SAMPLE, discount * (up(i) - 2 * payoffs(i) + down(i)) / (h * h));
+			total.add(VEGA_SAMPLE, discount * (volatilityUp(i) - volatilityDown(i)) / (2 * v));
+		}
+		break;
+	}
+	}
+}
+
+/*  Sum the samples of each option's price and Greeks over
+	nScenarios scenarios from firstScenario on */
+static vector<GreekSums> sumGreeks(
+	const MonteCarloPricer &pricer,
+	long long firstScenario,
+	int nScenarios,
+	const OptionGroup &group,
+	const GreeksSetup &setup)
+{
+	int nOptions = (int)group.options.size();
+	int nSteps = group.nSteps;
+	vector<GreekSums> totals(nOptions);
+	Philox rng(pricer.seed);
+	SobolSequence sobol = sobolSequence(pricer, group.model, nSteps);
+
+	int nSimulations = 1 + (int)setup.bumpedModels.size();
+	int batchSize = setup.summarise ? SUMMARY_BATCH_SIZE : 1000000 / (nSteps * nSimulations);
+	if (batchSize <= 0)
+	{
+		batchSize = 1;
+	}
+
+	MatrixArena arena;
+	MatrixAllocatorScope scope(pricer.useArena ? (MatrixAllocator &)arena
+											   : MatrixAllocator::heap());
+
+	const BlackScholesModel &model = setup.model;
+	double sigma = model.volatility;
+	double dt = (group.maturity - model.date) / nSteps;
+	double rootDt = sqrt(dt);
+	double logDrift = (model.riskFreeRate - 0.5 * sigma * sigma) * dt;
+
+	int scenariosRemaining = nScenarios;
+	while (scenariosRemaining > 0)
+	{
+		arena.reset();
+		int thisBatch = min(batchSize, scenariosRemaining);
+
+		// every simulation is driven by the same normals
+		MultiStockModel::NormalSource normals = scenarioNormals(
+			pricer, rng, sobol, firstScenario + nScenarios - scenariosRemaining, nSteps);
+		MarketSimulation sim = generateScenarios(
+			group.model, normals, thisBatch, nSteps, group.maturity,
+			setup.summarise, group.statistics);
+		vector<MarketSimulation> bumped;
+		for (const MultiStockModel &bumpedModel : setup.bumpedModels)
+		{
+			bumped.push_back(generateScenarios(
+				bumpedModel, normals, thisBatch, nSteps, group.maturity,
+				setup.summarise, group.statistics));
+		}
+
+		// recover the normals from the prices
+		Matrix firstNormals;
+		Matrix vegaScores;
+		if (setup.likelihoodRatio)
+		{
+			MatrixView prices = sim.getStockPrices(setup.stock);
+			firstNormals = Matrix(thisBatch, 1, false);
+			vegaScores = Matrix(thisBatch, nSteps, false);
+			for (int i = 0; i < thisBatch; i++)
+			{
+				double previous = model.stockPrice;
+				double score = 0.0;
+				for (int j = 0; j < nSteps; j++)
+				{
+					double z = (log(prices(i, j) / previous) - logDrift) / (sigma * rootDt);
+					if (j == 0)
+					{
+						firstNormals(i) = z;
+					}
+					score += (z * z - 1.0) / sigma - z * rootDt;
+					vegaScores(i, j) = score;
+					previous = prices(i, j);
+				}
+			}
+		}
+
+		for (int k = 0; k < nOptions; k++)
+		{
+			addGreeks(group, setup, k, thisBatch, sim, bumped,
+					  firstNormals, vegaScores, totals[k]);
+		}
+		scenariosRemaining -= thisBatch;
+	}
+	return totals;
+}
+
+/*  The Greeks of a group of options on the model's stock */
+static vector<MonteCarloGreeks> groupGreeks(
+	const MonteCarloPricer &pricer,
+	const OptionGroup &group,
+	const BlackScholesModel &model)
+{
+	ASSERT(pricer.nTasks >= 1 && pricer.nScenarios >= 1);
+	ASSERT(pricer.greeksBump > 0.0);
+	const vector<const ContinuousTimeOption *> &options = group.options;
+	int nOptions = (int)options.size();
+
+	GreeksSetup setup;
+	setup.model = model;
+	setup.stock = MultiStockModel::DEFAULT_STOCK;
+	setup.summarise = group.summarise;
+	setup.likelihoodRatio = false;
+	setup.priceBump = pricer.greeksBump * model.stockPrice;
+	setup.volatilityBump = pricer.greeksBump * model.volatility;
+	bool bump = false;
+	for (auto option : options)
+	{
+		ASSERT(option->getStocks() == set<string>({setup.stock}));
+		GreeksMethod method = greeksMethod(pricer, *option);
+		setup.methods.push_back(method);
+		if (method == GREEKS_LIKELIHOOD_RATIO)
+		{
+			setup.likelihoodRatio = true;
+			setup.summarise = false;
+		}
+		bump = bump || method == GREEKS_BUMP;
+	}
+	if (bump)
+	{
+		double bumps[4][2] = {
+			{setup.priceBump, 0.0},
+			{-setup.priceBump, 0.0},
+			{0.0, setup.volatilityBump},
+			{0.0, -setup.volatilityBump}};
+		for (auto &b : bumps)
+		{
+			BlackScholesModel bumpedModel = model;
+			bumpedModel.stockPrice += b[0];
+			bumpedModel.volatility += b[1];
+			setup.bumpedModels.push_back(MultiStockModel(bumpedModel));
+		}
+	}
+
+	// the same scenarios as groupPrices, so the prices agree
+	vector<GreekSums> totals = sumConcurrently<GreekSums>(
+		pricer, 0, pricer.nScenarios, nOptions,
+		[&](long long first, int n)
+		{
+			return sumGreeks(pricer, first, n, group, setup);
+		});
+
+	vector<MonteCarloGreeks> results(nOptions);
+	for (int k = 0; k < nOptions; k++)
+	{
+		const GreekSums &sums = totals[k];
+		double n = (double)sums.n;
+		double means[GREEK_SAMPLES];
+		double errors[GREEK_SAMPLES];
+		for (int i = 0; i < GREEK_SAMPLES; i++)
+		{
+			means[i] = sums.sums[i] / n;
+			double variance = sums.n > 1
+								  ? max(0.0, (sums.sumSquares[i] - n * means[i] * means[i]) / (n - 1))
+								  : 0.0;
+			errors[i] = sqrt(variance / n);
+		}
+		MonteCarloGreeks &result = results[k];
+		result.price = means[PRICE_SAMPLE];
+		result.delta = means[DELTA_SAMPLE];
+		result.gamma = means[GAMMA_SAMPLE];
+		result.vega = means[VEGA_SAMPLE];
+		result.priceError = errors[PRICE_SAMPLE];
+		result.deltaError = errors[DELTA_SAMPLE];
+		result.gammaError = errors[GAMMA_SAMPLE];
+		result.vegaError = errors[VEGA_SAMPLE];
+		result.method = setup.methods[k];
+		result.nScenarios = sums.n;
+	}
+	return results;
+}
+
+MonteCarloGreeks MonteCarloPricer::greeks(
+	const ContinuousTimeOption &option,
+	const BlackScholesModel &model) const
+{
+	MultiStockModel msm(model);
+	OptionGroup group(*this, option, msm);
+	return groupGreeks(*this, group, model)[0];
+}
+
+vector<MonteCarloGreeks> MonteCarloPricer::greeks(
+	const vector<SPCContinuousTimeOption> &options,
+	const BlackScholesModel &model) const
+{
+	if (options.empty())
+	{
+		return vector<MonteCarloGreeks>();
+	}
+	MultiStockModel msm(model);
+	return priceInGroups<MonteCarloGreeks>(
+		*this, optionPointers(options), msm,
+		[this, &model](const OptionGroup &group)
+		{
+			return groupGreeks(*this, group, model);
+		});
+}
+
+//////////////////////////////////////
+//
+//   Tests
+//
+//////////////////////////////////////
+
+static void testPriceCallOption()
+{
+	rng("default");
+
+	CallOption c;
+	c.setStrike(110);
+	c.setMaturity(2);
+
+	BlackScholesModel m;
+	m.volatility = 0.1;
+	m.riskFreeRate = 0.05;
+	m.stockPrice = 100.0;
+	m.drift = 0.1;
+	m.date = 1;
+
+	MultiStockModel msm(m);
+
+	MonteCarloPricer pricer;
+	pricer.nTasks = 1;
+	double price = pricer.price(c, m);
+	double expected = c.price(msm);
+	pricer.nTasks = 10;
 	double price2 = pricer.price(c, m);
 	ASSERT_APPROX_EQUAL(price, expected, 0.1);
 	ASSERT_APPROX_EQUAL(price2, price, 0.000001);
 }
 
+/*  The model most of the tests price in */
+static BlackScholesModel modelForTest()
+{
+	BlackScholesModel m;
+	m.volatility = 0.2;
+	m.riskFreeRate = 0.05;
+	m.stockPrice = 100.0;
+	m.date = 0;
+	return m;
+}
+
+/*  An up and out call on that model's stock */
+static UpAndOutOption upAndOutOptionForTest()
+{
+	UpAndOutOption o;
+	o.setBarrier(130);
+	o.setStrike(100);
+	o.setMaturity(1.0);
+	return o;
+}
+
+static void testIndependentOfTasks()
+{
+	BlackScholesModel m = modelForTest();
+
+	UpAndOutOption o = upAndOutOptionForTest();
+
+	// with 200 steps the scenarios are priced in several batches
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 60000;
+	pricer.nSteps = 200;
+	pricer.nTasks = 1;
+	double price1 = pricer.price(o, m);
+	pricer.nTasks = 3;
+	double price3 = pricer.price(o, m);
+	pricer.nTasks = 12;
+	double price12 = pricer.price(o, m);
+	ASSERT_APPROX_EQUAL(price1, price3, 1e-10);
+	ASSERT_APPROX_EQUAL(price1, price12, 1e-10);
+
+	// a number of scenarios the tasks can't share equally
+	pricer.nScenarios = 10001;
+	pricer.nTasks = 1;
+	price1 = pricer.price(o, m);
+	pricer.nTasks = 2;
+	double price2 = pricer.price(o, m);
+	ASSERT_APPROX_EQUAL(price1, price2, 1e-10);
+	ASSERT_APPROX_EQUAL(price1, pricer.priceWithError(o, m).price, 1e-10);
+}
+
+static void testSubmitPricings()
+{
+	BlackScholesModel m = modelForTest();
+
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	CallOption call;
+	call.setStrike(105);
+	call.setMaturity(0.5);
+
+	// each pricing can be collected as soon as it is done
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 20000;
+	pricer.nTasks = 4;
+	shared_ptr<Executor> executor = Executor::newSharedInstance();
+	Future<double> upAndOutPrice = executor->submit([&]()
+		{ return pricer.price(upAndOut, m); });
+	Future<double> callPrice = executor->submit([&]()
+		{ return pricer.price(call, m); });
+	ASSERT(callPrice.get() == pricer.price(call, m));
+	ASSERT(upAndOutPrice.get() == pricer.price(upAndOut, m));
+	executor->join();
+}
+
+static void testStreaming()
+{
+	BlackScholesModel m = modelForTest();
+
+	UpAndOutOption o = upAndOutOptionForTest();
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 100000;
+	pricer.nSteps = 100;
+	pricer.nTasks = 4;
+	auto start = chrono::steady_clock::now();
+	double batched = pricer.price(o, m);
+	double batchedTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// the same scenarios, added up in a different order
+	pricer.streaming = true;
+	pricer.pathsPerBlock = 1000;
+	pricer.queueDepth = 3;
+	start = chrono::steady_clock::now();
+	double streamed = pricer.price(o, m);
+	double streamedTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	ASSERT_APPROX_EQUAL(streamed, batched, 1e-10);
+	// blocks in the queue plus one per producer and consumer, and
+	// each producer may hold one more while waiting to write
+	int peakBlocks = 0;
+	ASSERT(streamingPrice(pricer, o, MultiStockModel(m), &peakBlocks) == streamed);
+	int nStages = pricer.nTasks + max(1, pricer.nTasks / 2);
+	ASSERT(peakBlocks >= 1);
+	ASSERT(peakBlocks <= pricer.queueDepth + nStages + pricer.nTasks);
+
+	// the result doesn't depend on the number of tasks
+	for (int nTasks : {1, 3})
+	{
+		pricer.nTasks = nTasks;
+		ASSERT(pricer.price(o, m) == streamed);
+	}
+
+	// and the block size only changes the rounding
+	pricer.pathsPerBlock = 4096;
+	ASSERT_APPROX_EQUAL(pricer.price(o, m), streamed, 1e-10);
+
+	INFO("Up and out option, 100000 scenarios, 100 steps, 4 tasks\n"
+		 << "Batched: " << batchedTime << "s\n"
+		 << "Streaming: " << streamedTime << "s, at most " << peakBlocks
+		 << " blocks of 1000 paths in memory");
+}
+
+/*  A call option whose payoff fails */
+class FailingCallOption : public CallOption
+{
+public:
+	Matrix payoffAtMaturity(const MatrixView &finalStockPrice) const
+	{
+		throw runtime_error("Payoff failed");
+	}
+};
+
+static void testStreamingFailure()
+{
+	BlackScholesModel m = modelForTest();
+
+	FailingCallOption o;
+	o.setStrike(100);
+	o.setMaturity(1.0);
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 100000;
+	pricer.nTasks = 4;
+	pricer.streaming = true;
+	pricer.pathsPerBlock = 1000;
+	pricer.queueDepth = 2;
+	// the producers stop rather than wait for the consumers forever
+	bool thrown = false;
+	try
+	{
+		pricer.price(o, m);
+	}
+	catch (const runtime_error &)
+	{
+		thrown = true;
+	}
+	ASSERT(thrown);
+
+	// and nothing is left behind to upset the next pricing
+	CallOption c;
+	c.setStrike(100);
+	c.setMaturity(1.0);
+	ASSERT_APPROX_EQUAL(pricer.price(c, m), c.price(MultiStockModel(m)), 0.2);
+}
+
+static void testPathSummaries()
+{
+	BlackScholesModel m = modelForTest();
+
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	DownAndOutOption downAndOut;
+	downAndOut.setBarrier(80);
+	downAndOut.setStrike(100);
+	downAndOut.setMaturity(1.0);
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 20000;
+	pricer.nSteps = 365;
+	pricer.nTasks = 2;
+	double timeTaken[2];
+	for (ContinuousTimeOption *option : {(ContinuousTimeOption *)&upAndOut, (ContinuousTimeOption *)&downAndOut})
+	{
+		double prices[2];
+		for (int summarise = 0; summarise <= 1; summarise++)
+		{
+			pricer.usePathSummaries = summarise;
+			auto start = chrono::steady_clock::now();
+			prices[summarise] = pricer.price(*option, m);
+			timeTaken[summarise] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+		// the same paths in different batches
+		ASSERT_APPROX_EQUAL(prices[0], prices[1], 1e-10);
+
+		// streaming uses the summaries too
+		pricer.streaming = true;
+		pricer.pathsPerBlock = 1000;
+		ASSERT_APPROX_EQUAL(pricer.price(*option, m), prices[1], 1e-10);
+		pricer.streaming = false;
+	}
+	INFO("Down and out option, " << pricer.nScenarios << " scenarios, "
+		<< pricer.nSteps << " steps\n"
+		<< "Whole paths: " << timeTaken[0] << "s, "
+		<< pricer.nSteps << " prices kept per path\n"
+		<< "Path summaries: " << timeTaken[1] << "s, "
+		<< "2 statistics kept per path");
+}
+
+static void testStandardError()
+{
+	BlackScholesModel m = modelForTest();
+	CallOption call;
+	call.setStrike(110);
+	call.setMaturity(1.0);
+	double expected = call.price(MultiStockModel(m));
+
+	// with neither a target nor a budget all the scenarios are used
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 50000;
+	pricer.nTasks = 4;
+	MonteCarloResult result = pricer.priceWithError(call, m);
+	ASSERT(result.nScenarios == pricer.nScenarios);
+	ASSERT_APPROX_EQUAL(result.price, pricer.price(call, m), 1e-10);
+	ASSERT(result.confidenceLower < expected && expected < result.confidenceUpper);
+	ASSERT_APPROX_EQUAL(result.confidenceUpper - result.confidenceLower,
+						2 * 1.959963984540054 * result.standardError, 1e-12);
+
+	// the standard error is close to that of a call option, whose
+	// payoff variance is known analytically
+	double sigma2T = m.volatility * m.volatility;
+	double forward = m.stockPrice * exp(m.riskFreeRate);
+	double d1 = (log(forward / 110) + 0.5 * sigma2T) / sqrt(sigma2T);
+	double d2 = d1 - sqrt(sigma2T);
+	double d3 = d1 + sqrt(sigma2T);
+	double secondMoment = forward * forward * exp(sigma2T) * normcdf(d3)
+		- 2 * 110 * forward * normcdf(d1) + 110 * 110 * normcdf(d2);
+	double discountedMean = expected * exp(m.riskFreeRate);
+	double sd = exp(-m.riskFreeRate) * sqrt(secondMoment - discountedMean * discountedMean);
+	ASSERT_APPROX_EQUAL(result.standardError, sd / sqrt(50000.0), 0.05 * sd / sqrt(50000.0));
+}
+
+static void testAdaptiveStopping()
+{
+	BlackScholesModel m = modelForTest();
+	CallOption atTheMoney;
+	atTheMoney.setStrike(100);
+	atTheMoney.setMaturity(1.0);
+	CallOption farOut;
+	farOut.setStrike(160);
+	farOut.setMaturity(1.0);
+
+	// a cheap option needs fewer scenarios for the same error
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 10000000;
+	pricer.nTasks = 4;
+	pricer.targetStandardError = 0.01;
+	MonteCarloResult hard = pricer.priceWithError(atTheMoney, m);
+	MonteCarloResult easy = pricer.priceWithError(farOut, m);
+	ASSERT(hard.standardError <= 0.01);
+	ASSERT(easy.standardError <= 0.01);
+	ASSERT(easy.nScenarios < hard.nScenarios);
+	ASSERT(hard.nScenarios < pricer.nScenarios);
+	double expected = atTheMoney.price(MultiStockModel(m));
+	ASSERT_APPROX_EQUAL(hard.price, expected, 4 * hard.standardError);
+
+	// nScenarios caps the work
+	pricer.nScenarios = 20000;
+	MonteCarloResult capped = pricer.priceWithError(atTheMoney, m);
+	ASSERT(capped.nScenarios == 20000);
+	ASSERT(capped.standardError > 0.01);
+
+	// and so does a time budget
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	pricer.nScenarios = 100000000;
+	pricer.nSteps = 100;
+	pricer.targetStandardError = 0.0;
+	pricer.timeBudget = 0.2;
+	MonteCarloResult budgeted = pricer.priceWithError(upAndOut, m);
+	// how far past the budget it runs depends on the machine's
+	// load, so it is only reported
+	ASSERT(budgeted.nScenarios < pricer.nScenarios);
+
+	INFO("Standard error 0.01\n"
+		 << "At the money call: " << hard.nScenarios << " scenarios, "
+		 << hard.elapsed << "s\n"
+		 << "Far out of the money call: " << easy.nScenarios << " scenarios, "
+		 << easy.elapsed << "s\n"
+		 << "Up and out option with a 0.2s budget: " << budgeted.nScenarios
+		 << " scenarios in " << budgeted.elapsed << "s, price " << budgeted.price << " +/- "
+		 << budgeted.standardError);
+}
+
+/*  The Margrabe option and model from its own tests */
+static MargrabeOption margrabeOptionForTest(MultiStockModel &model)
+{
+	MargrabeOption option;
+	option.stock1 = "Stock1";
+	option.stock2 = "Stock2";
+	option.maturity = 1.0;
+	model = MultiStockModel({option.stock1, option.stock2},
+							Matrix("100.0; 99.0"),
+							Matrix("0.0; 0.05"),
+							Matrix("0.1,0.05;0.05,0.2"));
+	model.setRiskFreeRate(0.05);
+	return option;
+}
+
+static void testVarianceReduction()
+{
+	BlackScholesModel m = modelForTest();
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	MultiStockModel margrabeModel(m);
+	MargrabeOption margrabe = margrabeOptionForTest(margrabeModel);
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 50000;
+	pricer.nSteps = 50;
+	pricer.nTasks = 2;
+
+	// without variance reduction nothing changes
+	MonteCarloResult plain = pricer.priceWithError(upAndOut, m);
+	ASSERT_APPROX_EQUAL(plain.varianceReduction, 1.0, 1e-12);
+	ASSERT(plain.controlCoefficient == 0.0);
+	ASSERT_APPROX_EQUAL(plain.price, pricer.price(upAndOut, m), 1e-10);
+
+	// each technique gives the same price, more accurately
+	for (int technique = 0; technique < 2; technique++)
+	{
+		pricer.antithetic = technique == 0;
+		pricer.controlVariate = technique == 1;
+		MonteCarloResult reduced = pricer.priceWithError(upAndOut, m);
+		// the continuously monitored option is a much better control
+		ASSERT(reduced.varianceReduction > (technique == 0 ? 1.2 : 4.0));
+		ASSERT(reduced.standardError < plain.standardError);
+		double error = sqrt(plain.standardError * plain.standardError + reduced.standardError * reduced.standardError);
+		ASSERT_APPROX_EQUAL(reduced.price, plain.price, 4 * error);
+		ASSERT_APPROX_EQUAL(reduced.price, pricer.price(upAndOut, m), 1e-10);
+	}
+	pricer.antithetic = false;
+
+	// the continuously monitored control can be computed from
+	// whole paths as well as from summaries
+	double summarised = pricer.price(upAndOut, m);
+	pricer.usePathSummaries = false;
+	ASSERT_APPROX_EQUAL(pricer.price(upAndOut, m), summarised, 1e-10);
+	pricer.usePathSummaries = true;
+
+	// the control's coefficient is one if the option is the control
+	CallOption call;
+	call.setStrike(100);
+	call.setMaturity(1.0);
+	UpAndOutOption unreachable = upAndOut;
+	unreachable.setBarrier(1e10);
+	MonteCarloResult exact = pricer.priceWithError(unreachable, m);
+	ASSERT_APPROX_EQUAL(exact.controlCoefficient, 1.0, 1e-10);
+	ASSERT_APPROX_EQUAL(exact.price, call.price(MultiStockModel(m)), 1e-10);
+	ASSERT(exact.standardError < 1e-10);
+
+	// the control for a Margrabe option is the difference
+	// of the stock prices
+	MonteCarloResult margrabePrice = pricer.priceWithError(margrabe, margrabeModel);
+	ASSERT(margrabePrice.varianceReduction > 1.2);
+	ASSERT_APPROX_EQUAL(margrabePrice.price, margrabe.analyticPrice(margrabeModel),
+						4 * margrabePrice.standardError);
+}
+
+static void testMomentMatching()
+{
+	BlackScholesModel m = modelForTest();
+	CallOption call;
+	call.setStrike(100);
+	call.setMaturity(1.0);
+	double expected = call.price(MultiStockModel(m));
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 20000;
+	pricer.nTasks = 1;
+	pricer.momentMatching = true;
+	double matched = pricer.price(call, m);
+	ASSERT_APPROX_EQUAL(matched, expected, 0.1);
+	MonteCarloResult result = pricer.priceWithError(call, m);
+	ASSERT_APPROX_EQUAL(result.price, matched, 1e-10);
+
+	// a forward is priced almost exactly, as its payoff is
+	// nearly linear in the normals for small volatilities
+	m.volatility = 0.01;
+	CallOption forward;
+	forward.setStrike(0.0);
+	forward.setMaturity(1.0);
+	double forwardPrice = pricer.price(forward, m);
+	pricer.momentMatching = false;
+	double plainForwardPrice = pricer.price(forward, m);
+	ASSERT(fabs(forwardPrice - m.stockPrice) < 0.01 * fabs(plainForwardPrice - m.stockPrice));
+}
+
+static void testVarianceReductionPerformance()
+{
+	BlackScholesModel m = modelForTest();
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	MultiStockModel upAndOutModel(m);
+	MultiStockModel margrabeModel(m);
+	MargrabeOption margrabe = margrabeOptionForTest(margrabeModel);
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 100000;
+	pricer.nSteps = 50;
+	pricer.nTasks = 2;
+	stringstream table;
+	table << "Option\tTechnique\tPrice\tStandard error\tVariance reduction\tTime\n";
+	const char *names[] = {"Plain", "Antithetic", "Control variate", "Moment matching", "All three"};
+	for (int option = 0; option < 2; option++)
+	{
+		for (int technique = 0; technique < 5; technique++)
+		{
+			pricer.antithetic = technique == 1 || technique == 4;
+			pricer.controlVariate = technique == 2 || technique == 4;
+			pricer.momentMatching = technique == 3 || technique == 4;
+			MonteCarloResult result = option == 0
+										  ? pricer.priceWithError(upAndOut, upAndOutModel)
+										  : pricer.priceWithError(margrabe, margrabeModel);
+			table << (option == 0 ? "Up and out" : "Margrabe") << "\t"
+				  << names[technique] << "\t" << result.price << "\t"
+				  << result.standardError << "\t" << result.varianceReduction << "\t"
+				  << result.elapsed << "s\n";
+		}
+	}
+	INFO(pricer.nScenarios << " scenarios, " << pricer.nSteps << " steps\n"
+		<< table.str() << "Moment matching's standard error ignores "
+		<< "the dependence it introduces, so its reduction isn't measured");
+}
+
+static void testQuasiMonteCarlo()
+{
+	BlackScholesModel m = modelForTest();
+	CallOption call;
+	call.setStrike(110);
+	call.setMaturity(1.0);
+	double expected = call.price(MultiStockModel(m));
+
+	MonteCarloPricer pricer;
+	pricer.quasiRandom = true;
+	pricer.nScenarios = 1 << 14;
+	pricer.nTasks = 1;
+	double price = pricer.price(call, m);
+	ASSERT_APPROX_EQUAL(price, expected, 0.01);
+
+	// each task jumps to its own points, so the tasks don't matter
+	pricer.nTasks = 4;
+	ASSERT_APPROX_EQUAL(pricer.price(call, m), price, 1e-10);
+
+	// with one step the bridge changes nothing
+	pricer.brownianBridge = false;
+	ASSERT_APPROX_EQUAL(pricer.price(call, m), price, 1e-10);
+
+	// streaming uses the same points
+	pricer.streaming = true;
+	pricer.pathsPerBlock = 1000;
+	ASSERT_APPROX_EQUAL(pricer.price(call, m), price, 1e-10);
+	pricer.streaming = false;
+
+	// a different scrambling gives a different price
+	pricer.seed = 1;
+	double rescrambled = pricer.price(call, m);
+	ASSERT(rescrambled != price);
+	ASSERT_APPROX_EQUAL(rescrambled, expected, 0.01);
+
+	// paths of several steps and stocks have the right distribution
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	upAndOut.setContinuouslyMonitored(true);
+	MultiStockModel margrabeModel(m);
+	MargrabeOption margrabe = margrabeOptionForTest(margrabeModel);
+	pricer.nSteps = 16;
+	for (int bridge = 0; bridge <= 1; bridge++)
+	{
+		pricer.brownianBridge = bridge;
+		ASSERT_APPROX_EQUAL(pricer.price(upAndOut, m),
+							upAndOut.continuousPrice(MultiStockModel(m)), 0.1);
+		ASSERT_APPROX_EQUAL(pricer.price(margrabe, margrabeModel),
+							margrabe.analyticPrice(margrabeModel), 0.02);
+	}
+}
+
+/*  The root mean square error of the prices from pricings with
+	independent seeds */
+static double rootMeanSquareError(MonteCarloPricer pricer,
+								  const ContinuousTimeOption &option,
+								  const MultiStockModel &model,
+								  double expected,
+								  int nSeeds)
+{
+	double total = 0.0;
+	for (int i = 0; i < nSeeds; i++)
+	{
+		pricer.seed = 1000 + i;
+		double error = pricer.price(option, model) - expected;
+		total += error * error;
+	}
+	return sqrt(total / nSeeds);
+}
+
+/*  The slope of the least squares line through some points */
+static double slope(const vector<double> &x, const vector<double> &y)
+{
+	int n = x.size();
+	double meanX = accumulate(x.begin(), x.end(), 0.0) / n;
+	double meanY = accumulate(y.begin(), y.end(), 0.0) / n;
+	double sxy = 0.0;
+	double sxx = 0.0;
+	for (int i = 0; i < n; i++)
+	{
+		sxy += (x[i] - meanX) * (y[i] - meanY);
+		sxx += (x[i] - meanX) * (x[i] - meanX);
+	}
+	return sxy / sxx;
+}
+
+static void testQuasiMonteCarloConvergence()
+{
+	BlackScholesModel m = modelForTest();
+	MultiStockModel callModel(m);
+	CallOption call;
+	call.setStrike(110);
+	call.setMaturity(1.0);
+	MultiStockModel margrabeModel(m);
+	MargrabeOption margrabe = margrabeOptionForTest(margrabeModel);
+	UpAndOutOption upAndOut = upAndOutOptionForTest();
+	upAndOut.setContinuouslyMonitored(true);
+
+	const ContinuousTimeOption *options[] = {&call, &margrabe, &upAndOut};
+	const MultiStockModel *models[] = {&callModel, &margrabeModel, &callModel};
+	double expected[] = {call.price(callModel), margrabe.analyticPrice(margrabeModel),
+						 upAndOut.continuousPrice(callModel)};
+	const char *optionNames[] = {"Call", "Margrabe", "Up and out, 16 steps"};
+	const char *methodNames[] = {"Philox", "Sobol", "Sobol with bridge"};
+	int nSeeds = 8;
+
+	MonteCarloPricer pricer;
+	pricer.nSteps = 16;
+	stringstream table;
+	table << "Root mean square error over " << nSeeds << " seeds\n"
+		  << "Option\tMethod";
+	for (int k = 10; k <= 15; k++)
+	{
+		table << "\t2^" << k;
+	}
+	table << "\tOrder\n";
+	double order[3][3];
+	double finalError[3][3];
+	for (int option = 0; option < 3; option++)
+	{
+		for (int method = 0; method < 3; method++)
+		{
+			pricer.quasiRandom = method > 0;
+			pricer.brownianBridge = method == 2;
+			table << optionNames[option] << "\t" << methodNames[method];
+			vector<double> logN;
+			vector<double> logError;
+			for (int k = 10; k <= 15; k++)
+			{
+				pricer.nScenarios = 1 << k;
+				double error = rootMeanSquareError(pricer, *options[option], *models[option],
+												   expected[option], nSeeds);
+				table << "\t" << error;
+				finalError[option][method] = error;
+				logN.push_back(log((double)pricer.nScenarios));
+				logError.push_back(log(error));
+			}
+			// the error is proportional to n to this power
+			order[option][method] = slope(logN, logError);
+			table << "\t" << order[option][method] << "\n";
+		}
+	}
+	// pseudo-random errors fall like 1/sqrt(n), quasi-random
+	// ones faster for the smooth payoffs
+	for (int option = 0; option < 3; option++)
+	{
+		ASSERT(order[option][0] > -0.8 && order[option][0] < -0.2);
+	}
+	ASSERT(order[0][1] < -0.75);
+	ASSERT(order[1][1] < -0.75);
+	// the barrier makes the paths matter, and the bridge
+	// lets the best dimensions decide them
+	ASSERT(finalError[2][2] < finalError[2][1]);
+	INFO(table.str());
+}
+
+static void testBatchPricing()
+{
+	MultiStockModel model = MultiStockModel::createTestModel();
+	model.setRiskFreeRate(0.05);
+	auto call = make_shared<CallOption>();
+	call->setStock("Acme");
+	call->setStrike(100);
+	call->setMaturity(1.0);
+	auto shortCall = make_shared<CallOption>();
+	shortCall->setStock("Bigbank");
+	shortCall->setStrike(210);
+	shortCall->setMaturity(0.5);
+	auto upAndOut = make_shared<UpAndOutOption>();
+	upAndOut->setStock("Chumhum");
+	upAndOut->setStrike(300);
+	upAndOut->setBarrier(400);
+	upAndOut->setMaturity(0.75);
+	vector<SPCContinuousTimeOption> options({call, shortCall, upAndOut});
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 100000;
+	pricer.nSteps = 4;
+	pricer.nTasks = 2;
+
+	// a batch of one is priced from the same paths as the option alone
+	ASSERT_APPROX_EQUAL(pricer.price(vector<SPCContinuousTimeOption>({upAndOut}), model)[0],
+						pricer.price(*upAndOut, model), 1e-10);
+
+	// the calls see the shared paths up to their own maturities
+	vector<MonteCarloResult> results = pricer.priceWithError(options, model);
+	ASSERT(results.size() == 3);
+	ASSERT_APPROX_EQUAL(results[0].price, call->price(model), 4 * results[0].standardError);
+	ASSERT_APPROX_EQUAL(results[1].price, shortCall->price(model), 4 * results[1].standardError);
+	// a grid for all three would need 8 steps rather than 2 and 4,
+	// so the up and out option has the paths it has on its own
+	ASSERT_APPROX_EQUAL(results[2].price, pricer.priceWithError(*upAndOut, model).price, 1e-10);
+	vector<double> prices = pricer.price(options, model);
+	for (int k = 0; k < 3; k++)
+	{
+		ASSERT_APPROX_EQUAL(prices[k], results[k].price, 1e-10);
+	}
+
+	// each option uses its own control variate
+	pricer.controlVariate = true;
+	pricer.antithetic = true;
+	vector<MonteCarloResult> reduced = pricer.priceWithError(options, model);
+	ASSERT(reduced[0].controlCoefficient == 0.0);
+	ASSERT(reduced[2].controlCoefficient != 0.0);
+	for (int k = 0; k < 3; k++)
+	{
+		ASSERT(reduced[k].varianceReduction > 1.0);
+		ASSERT_APPROX_EQUAL(reduced[k].price, results[k].price, 4 * results[k].standardError);
+	}
+	pricer.controlVariate = false;
+	pricer.antithetic = false;
+
+	// options with one maturity can be priced from summaries
+	upAndOut->setMaturity(1.0);
+	shortCall->setMaturity(1.0);
+	prices = pricer.price(options, model);
+	pricer.usePathSummaries = false;
+	vector<double> fromPaths = pricer.price(options, model);
+	for (int k = 0; k < 3; k++)
+	{
+		ASSERT_APPROX_EQUAL(prices[k], fromPaths[k], 1e-10);
+	}
+
+	// barriers that differ can't share summaries, so the whole
+	// paths are kept and each continuously monitored barrier gets
+	// the Brownian bridge from its own summaries of them
+	auto lowBarrier = make_shared<UpAndOutOption>(*upAndOut);
+	lowBarrier->setContinuouslyMonitored(true);
+	auto highBarrier = make_shared<UpAndOutOption>(*lowBarrier);
+	highBarrier->setBarrier(450);
+	pricer.usePathSummaries = true;
+	prices = pricer.price(vector<SPCContinuousTimeOption>({lowBarrier, highBarrier}), model);
+	ASSERT_APPROX_EQUAL(prices[0], pricer.price(*lowBarrier, model), 1e-10);
+	ASSERT_APPROX_EQUAL(prices[1], pricer.price(*highBarrier, model), 1e-10);
+	// as does one sharing the paths of an earlier maturity
+	auto earlyCall = make_shared<CallOption>();
+	earlyCall->setStock("Chumhum");
+	earlyCall->setStrike(300);
+	earlyCall->setMaturity(0.5);
+	prices = pricer.price(vector<SPCContinuousTimeOption>({lowBarrier, earlyCall}), model);
+	ASSERT_APPROX_EQUAL(prices[0], pricer.price(*lowBarrier, model), 1e-10);
+	// whole paths give the same price as summaries
+	pricer.usePathSummaries = false;
+	ASSERT_APPROX_EQUAL(pricer.price(*lowBarrier, model), prices[0], 1e-10);
+	pricer.streaming = true;
+	double streamed = pricer.price(*lowBarrier, model);
+	pricer.usePathSummaries = true;
+	ASSERT_APPROX_EQUAL(pricer.price(*lowBarrier, model), streamed, 1e-10);
+	pricer.streaming = false;
+	// which is worth less than if it were monitored at the steps
+	UpAndOutOption discrete = *lowBarrier;
+	discrete.setContinuouslyMonitored(false);
+	ASSERT(pricer.price(discrete, model) > prices[0]);
+
+	// maturities with an irrational ratio share no grid, so
+	// they are priced separately
+	shortCall->setMaturity(sqrt(0.5));
+	prices = pricer.price(options, model);
+	ASSERT_APPROX_EQUAL(prices[1], pricer.price(*shortCall, model), 1e-10);
+}
+
+static void testGridGroups()
+{
+	auto optionsFor = [](vector<double> maturities, bool pathDependent)
+	{
+		vector<SPCContinuousTimeOption> options;
+		for (double maturity : maturities)
+		{
+			shared_ptr<ContinuousTimeOptionBase> option;
+			if (pathDependent)
+			{
+				auto upAndOut = make_shared<UpAndOutOption>();
+				upAndOut->setBarrier(130);
+				option = upAndOut;
+			}
+			else
+			{
+				option = make_shared<CallOption>();
+			}
+			option->setMaturity(maturity);
+			options.push_back(option);
+		}
+		return options;
+	};
+	MonteCarloPricer pricer;
+	pricer.nSteps = 10;
+	auto groupsFor = [&](const vector<SPCContinuousTimeOption> &options)
+	{
+		return groupByGrid(pricer, optionPointers(options), 0.0);
+	};
+
+	// maturities that need a fine grid to share one are kept apart
+	for (double shortMaturity : {0.3333, 0.12345, sqrt(0.5)})
+	{
+		vector<GridGroup> groups = groupsFor(optionsFor({1.0, shortMaturity}, false));
+		ASSERT(groups.size() == 2);
+		ASSERT(groups[0].grid.nSteps == 1 && groups[1].grid.nSteps == 1);
+	}
+	// while ones a coarse grid fits share
+	vector<GridGroup> groups = groupsFor(optionsFor({1.0, 0.5, 1.0}, false));
+	ASSERT(groups.size() == 1);
+	ASSERT(groups[0].grid.nSteps == 2);
+	ASSERT(groups[0].indices == vector<int>({1, 0, 2}));
+	ASSERT(groups[0].grid.optionSteps == vector<int>({1, 2, 2}));
+	groups = groupsFor(optionsFor({1.0, 0.5}, true));
+	ASSERT(groups.size() == 1);
+	ASSERT(groups[0].grid.nSteps == 20);
+	// but not if a path dependent option would then need more
+	// steps than the separate grids
+	groups = groupsFor(optionsFor({1.0, 0.45}, true));
+	ASSERT(groups.size() == 2);
+	ASSERT(groups[0].grid.nSteps == 10 && groups[1].grid.nSteps == 10);
+}
+
+static void testBatchPricingPerformance()
+{
+	BlackScholesModel m = modelForTest();
+	MultiStockModel model(m);
+	vector<SPCContinuousTimeOption> options;
+	for (int i = 0; i < 8; i++)
+	{
+		auto option = make_shared<UpAndOutOption>();
+		option->setStrike(100);
+		option->setBarrier(120 + 5 * i);
+		option->setMaturity(i % 2 == 0 ? 1.0 : 0.5);
+		options.push_back(option);
+	}
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 100000;
+	pricer.nSteps = 20;
+
+	auto start = chrono::steady_clock::now();
+	for (auto &option : options)
+	{
+		pricer.price(*option, model);
+	}
+	double separately = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	start = chrono::steady_clock::now();
+	pricer.price(options, model);
+	double together = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	INFO("Pricing " << options.size() << " up and out options separately took " << separately << "s");
+	INFO("Pricing them from one set of paths took " << together << "s");
+}
+
+/*  Greeks from central differences of an exact price */
+static MonteCarloGreeks exactGreeks(
+	function<double(const BlackScholesModel &)> price,
+	const BlackScholesModel &model)
+{
+	double h = 1e-3 * model.stockPrice;
+	double v = 1e-4;
+	BlackScholesModel bumped = model;
+	MonteCarloGreeks greeks;
+	greeks.price = price(model);
+	bumped.stockPrice = model.stockPrice + h;
+	double up = price(bumped);
+	bumped.stockPrice = model.stockPrice - h;
+	double down = price(bumped);
+	bumped.stockPrice = model.stockPrice;
+	greeks.delta = (up - down) / (2 * h);
+	greeks.gamma = (up - 2 * greeks.price + down) / (h * h);
+	bumped.volatility = model.volatility + v;
+	up = price(bumped);
+	bumped.volatility = model.volatility - v;
+	down = price(bumped);
+	greeks.vega = (up - down) / (2 * v);
+	return greeks;
+}
+
+/*  Check Greeks are within four standard errors, plus the given
+	bias, of the exact ones */
+static void assertGreeks(const MonteCarloGreeks &estimate,
+						 const MonteCarloGreeks &exact,
+						 double bias)
+{
+	ASSERT_APPROX_EQUAL(estimate.price, exact.price, 4 * estimate.priceError + bias);
+	ASSERT_APPROX_EQUAL(estimate.delta, exact.delta, 4 * estimate.deltaError + bias);
+	ASSERT_APPROX_EQUAL(estimate.gamma, exact.gamma, 4 * estimate.gammaError + bias);
+	ASSERT_APPROX_EQUAL(estimate.vega, exact.vega, 4 * estimate.vegaError + bias);
+}
+
+static void testGreeks()
+{
+	BlackScholesModel m = modelForTest();
+	auto call = make_shared<CallOption>();
+	call->setStrike(105);
+	call->setMaturity(1.0);
+	auto put = make_shared<PutOption>();
+	put->setStrike(95);
+	put->setMaturity(0.5);
+	MonteCarloGreeks callGreeks = exactGreeks(
+		[&](const BlackScholesModel &model)
+		{ return call->price(MultiStockModel(model)); },
+		m);
+	MonteCarloGreeks putGreeks = exactGreeks(
+		[&](const BlackScholesModel &model)
+		{ return put->price(MultiStockModel(model)); },
+		m);
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 200000;
+	pricer.nTasks = 2;
+
+	// every method estimates the same Greeks, and the
+	// pathwise ones have the least variance
+	MonteCarloGreeks byMethod[3];
+	for (GreeksMethod method : {GREEKS_PATHWISE, GREEKS_LIKELIHOOD_RATIO, GREEKS_BUMP})
+	{
+		pricer.greeksMethod = method;
+		MonteCarloGreeks greeks = pricer.greeks(*call, m);
+		ASSERT(greeks.method == method);
+		ASSERT(greeks.nScenarios == pricer.nScenarios);
+		// the price comes from the same paths as price's
+		ASSERT_APPROX_EQUAL(greeks.price, pricer.price(*call, m), 1e-10);
+		// a 1% bump biases gamma by a few parts in a thousand
+		assertGreeks(greeks, callGreeks, method == GREEKS_BUMP ? 0.001 : 0.0);
+		byMethod[method] = greeks;
+	}
+	ASSERT(byMethod[GREEKS_PATHWISE].deltaError < byMethod[GREEKS_LIKELIHOOD_RATIO].deltaError);
+	ASSERT(byMethod[GREEKS_PATHWISE].vegaError < byMethod[GREEKS_LIKELIHOOD_RATIO].vegaError);
+	ASSERT(byMethod[GREEKS_PATHWISE].gammaError < byMethod[GREEKS_LIKELIHOOD_RATIO].gammaError);
+
+	// when the scenarios don't share out evenly between the tasks
+	// the Greeks and the price still use all of the same ones
+	pricer.nTasks = 3;
+	MonteCarloGreeks uneven = pricer.greeks(*call, m);
+	MonteCarloResult unevenPrice = pricer.priceWithError(*call, m);
+	ASSERT(uneven.nScenarios == pricer.nScenarios);
+	ASSERT(unevenPrice.nScenarios == uneven.nScenarios);
+	ASSERT_APPROX_EQUAL(uneven.price, unevenPrice.price, 1e-10);
+	pricer.nTasks = 2;
+
+	// options with different maturities share the paths
+	pricer.greeksMethod = GREEKS_PATHWISE;
+	vector<MonteCarloGreeks> both = pricer.greeks(
+		vector<SPCContinuousTimeOption>({call, put}), m);
+	ASSERT(both.size() == 2);
+	assertGreeks(both[0], callGreeks, 0.0);
+	assertGreeks(both[1], putGreeks, 0.0);
+	ASSERT(both[1].delta < 0.0);
+
+	// a discretely monitored barrier has no payoff derivative,
+	// so the likelihood ratio is used, which a continuously
+	// monitored one's bridge rules out
+	pricer.nSteps = 16;
+	auto upAndOut = make_shared<UpAndOutOption>(upAndOutOptionForTest());
+	auto continuous = make_shared<UpAndOutOption>(*upAndOut);
+	continuous->setContinuouslyMonitored(true);
+	MonteCarloGreeks discrete = pricer.greeks(*upAndOut, m);
+	ASSERT(discrete.method == GREEKS_LIKELIHOOD_RATIO);
+	MonteCarloGreeks bridged = pricer.greeks(*continuous, m);
+	ASSERT(bridged.method == GREEKS_BUMP);
+	MonteCarloGreeks continuousGreeks = exactGreeks(
+		[&](const BlackScholesModel &model)
+		{ return continuous->continuousPrice(MultiStockModel(model)); },
+		m);
+	assertGreeks(bridged, continuousGreeks, 0.002);
+	// the discrete barrier's likelihood ratio needs whole paths,
+	// which the continuous one still bridges when they share them
+	vector<MonteCarloGreeks> mixed = pricer.greeks(
+		vector<SPCContinuousTimeOption>({upAndOut, continuous}), m);
+	ASSERT_APPROX_EQUAL(mixed[1].price, bridged.price, 1e-10);
+	ASSERT_APPROX_EQUAL(mixed[1].delta, bridged.delta, 1e-10);
+	ASSERT_APPROX_EQUAL(mixed[1].vega, bridged.vega, 1e-10);
+
+	// bumping the discrete barrier gives the same delta and vega
+	pricer.greeksMethod = GREEKS_BUMP;
+	MonteCarloGreeks bumped = pricer.greeks(*upAndOut, m);
+	double deltaError = sqrt(discrete.deltaError * discrete.deltaError + bumped.deltaError * bumped.deltaError);
+	double vegaError = sqrt(discrete.vegaError * discrete.vegaError + bumped.vegaError * bumped.vegaError);
+	ASSERT_APPROX_EQUAL(discrete.delta, bumped.delta, 4 * deltaError + 0.002);
+	ASSERT_APPROX_EQUAL(discrete.vega, bumped.vega, 4 * vegaError + 0.02);
+}
+
+static void testGreeksPerformance()
+{
+	BlackScholesModel m = modelForTest();
+	CallOption call;
+	call.setStrike(105);
+	call.setMaturity(1.0);
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 200000;
+
+	// the old way, repricing in bumped models
+	auto start = chrono::steady_clock::now();
+	double h = 0.01 * m.stockPrice;
+	BlackScholesModel bumped = m;
+	double price = pricer.price(call, m);
+	bumped.stockPrice = m.stockPrice + h;
+	double up = pricer.price(call, bumped);
+	bumped.stockPrice = m.stockPrice - h;
+	double down = pricer.price(call, bumped);
+	double delta = (up - down) / (2 * h);
+	double gamma = (up - 2 * price + down) / (h * h);
+	double repriced = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	INFO("Repricing gave delta " << delta << " and gamma " << gamma << " in " << repriced << "s");
+
+	INFO("Method\tDelta\tStandard error\tGamma\tStandard error\tVega\tStandard error\tTime");
+	const char *names[] = {"Pathwise", "Likelihood ratio", "Bump"};
+	for (GreeksMethod method : {GREEKS_PATHWISE, GREEKS_LIKELIHOOD_RATIO, GREEKS_BUMP})
+	{
+		pricer.greeksMethod = method;
+		start = chrono::steady_clock::now();
+		MonteCarloGreeks greeks = pricer.greeks(call, m);
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		INFO(names[method] << "\t" << greeks.delta << "\t" << greeks.deltaError
+						   << "\t" << greeks.gamma << "\t" << greeks.gammaError
+						   << "\t" << greeks.vega << "\t" << greeks.vegaError
+						   << "\t" << elapsed);
+	}
+}
+
+static void testArenaPerformance()
+{
+	BlackScholesModel m = modelForTest();
+
+	UpAndOutOption o = upAndOutOptionForTest();
+
+	MonteCarloPricer pricer;
+	pricer.nScenarios = 400000;
+	pricer.nSteps = 50;
+	pricer.nTasks = 8;
+
+	double prices[2];
+	long long heapCalls[2];
+	double wallTime[2];
+	for (int useArena = 0; useArena <= 1; useArena++)
+	{
+		pricer.useArena = useArena;
+		long long before = MatrixAllocator::heapCallCount();
+		auto start = chrono::steady_clock::now();
+		prices[useArena] = pricer.price(o, m);
+		wallTime[useArena] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		heapCalls[useArena] = MatrixAllocator::heapCallCount() - before;
+	}
+	ASSERT_APPROX_EQUAL(prices[0], prices[1], 1e-10);
+	ASSERT(heapCalls[1] < heapCalls[0]);
+	INFO("Up and out option, " << pricer.nTasks << " tasks, "
+		<< pricer.nScenarios << " scenarios, " << pricer.nSteps << " steps\n"
+		<< "Heap: " << heapCalls[0] << " heap calls, " << wallTime[0] << "s\n"
+		<< "Arena: " << heapCalls[1] << " heap calls, " << wallTime[1] << "s");
+}
+
 void testMonteCarloPricer()
 {
 	TEST(testPriceCallOption);
+	TEST(testIndependentOfTasks);
+	TEST(testSubmitPricings);
+	TEST(testStreaming);
+	TEST(testStreamingFailure);
+	TEST(testPathSummaries);
+	TEST(testStandardError);
+	TEST(testAdaptiveStopping);
+	TEST(testVarianceReduction);
+	TEST(testMomentMatching);
+	TEST(testVarianceReductionPerformance);
+	TEST(testQuasiMonteCarlo);
+	TEST(testQuasiMonteCarloConvergence);
+	TEST(testBatchPricing);
+	TEST(testGridGroups);
+	TEST(testBatchPricingPerformance);
+	TEST(testGreeks);
+	TEST(testGreeksPerformance);
+	TEST(testArenaPerformance);
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 using namespace std;
 
 #include "matlib.h"
+#include "MatrixExpression.h"
+#include "MatrixAllocator.h"
+#include "MatrixKernels.h"
+#include "BrownianBridge.h"
 
 /*  The default name of a stock when non is provided */
 string const MultiStockModel::DEFAULT_STOCK = "Acme";
@@ -18,6 +22,7 @@ MultiStockModel::MultiStockModel(
 	drifts(0) = bsm.drift;
 	covarianceMatrix = Matrix(nStocks, 1);
 	covarianceMatrix(0, 0) = bsm.volatility*bsm.volatility;
+	nFactors = 0;
 	stockPrices = Matrix(nStocks, 1);
 	stockPrices(0) = bsm.stockPrice;
 	riskFreeRate = bsm.riskFreeRate;
@@ -28,7 +33,7 @@ MultiStockModel::MultiStockModel(
 MultiStockModel::MultiStockModel(std::vector<std::string> stocks,
 		Matrix stockPrices,
 		Matrix drifts,
-		Matrix covarianceMatrix) : riskFreeRate(1.0), date(0.0) {
+		Matrix covarianceMatrix) : nFactors(0), riskFreeRate(1.0), date(0.0) {
 	int n = stocks.size();
 	ASSERT(stockPrices.nRows() == n);
 	ASSERT(stockPrices.nCols() == 1);
@@ -46,6 +51,114 @@ MultiStockModel::MultiStockModel(std::vector<std::string> stocks,
 	}
 }
 
+MultiStockModel::MultiStockModel(std::vector<std::string> stocks,
+		Matrix stockPrices,
+		Matrix drifts,
+		Matrix factorLoadings,
+		Matrix idiosyncraticVariances) : riskFreeRate(1.0), date(0.0) {
+	int n = stocks.size();
+	ASSERT(stockPrices.nRows() == n);
+	ASSERT(stockPrices.nCols() == 1);
+	ASSERT(drifts.nRows() == n);
+	ASSERT(drifts.nCols() == 1);
+	ASSERT(factorLoadings.nRows() == n);
+	ASSERT(factorLoadings.nCols() >= 1);
+	ASSERT(idiosyncraticVariances.nRows() == n);
+	ASSERT(idiosyncraticVariances.nCols() == 1);
+	this->stockNames = stocks;
+	this->stockPrices = stockPrices;
+	this->drifts = drifts;
+	this->nFactors = factorLoadings.nCols();
+	this->factorLoadings = factorLoadings;
+	this->factorLoadingsTransposed = transpose(factorLoadings);
+	this->idiosyncraticVariances = idiosyncraticVariances;
+	int i = 0;
+	for (auto& s : stocks) {
+		ASSERT(idiosyncraticVariances(i) >= 0);
+		stockCodeToIndex[s] = i++;
+	}
+}
+
+Matrix MultiStockModel::getCovarianceMatrix() const {
+	if (!isFactorModel()) {
+		return covarianceMatrix;
+	}
+	Matrix cov = factorLoadings*factorLoadingsTransposed;
+	for (int i = 0; i < cov.nRows(); i++) {
+		cov(i, i) += idiosyncraticVariances(i);
+	}
+	return cov;
+}
+
+void MultiStockModel::setCovarianceMatrix(const Matrix& covarianceMatrix) {
+	int n = stockNames.size();
+	ASSERT(covarianceMatrix.nRows() == n);
+	ASSERT(covarianceMatrix.nCols() == n);
+	this->covarianceMatrix = covarianceMatrix;
+	nFactors = 0;
+	factorLoadings = Matrix();
+	factorLoadingsTransposed = Matrix();
+	idiosyncraticVariances = Matrix();
+	atomic_store(&cholesky, shared_ptr<const CholeskyFactor>());
+}
+
+double MultiStockModel::getCovariance(const string& stock1,
+	const string& stock2) const {
+	int i = getIndex(stock1);
+	int j = getIndex(stock2);
+	if (!isFactorModel()) {
+		return covarianceMatrix(i, j);
+	}
+	double covariance = (i == j) ? idiosyncraticVariances(i) : 0.0;
+	for (int k = 0; k < nFactors; k++) {
+		covariance += factorLoadings(i, k)*factorLoadings(j, k);
+	}
+	return covariance;
+}
+
+double MultiStockModel::getVariance(int idx) const {
+	if (!isFactorModel()) {
+		return covarianceMatrix(idx, idx);
+	}
+	double variance = idiosyncraticVariances(idx);
+	for (int k = 0; k < nFactors; k++) {
+		variance += factorLoadings(idx, k)*factorLoadings(idx, k);
+	}
+	return variance;
+}
+
+void MultiStockModel::setCholesky(const Matrix& lower, bool isLower) const {
+	MatrixAllocatorScope scope(MatrixAllocator::heap());
+	auto factor = make_shared<CholeskyFactor>();
+	factor->lower = lower;
+	factor->transposed = transpose(lower);
+	factor->isLower = isLower;
+	atomic_store(&cholesky, shared_ptr<const CholeskyFactor>(factor));
+}
+
+shared_ptr<const MultiStockModel::CholeskyFactor>
+	MultiStockModel::cachedCholesky() const {
+	shared_ptr<const CholeskyFactor> ret = atomic_load(&cholesky);
+	if (!ret) {
+		// estimated covariance matrices of many stocks are often
+		// semidefinite, which the pivoted factorisation copes with
+		Matrix cov = getCovarianceMatrix();
+		Matrix lower;
+		if (tryChol(cov, lower)) {
+			setCholesky(lower, true);
+		} else {
+			setCholesky(cholPivoted(cov), false);
+		}
+		ret = atomic_load(&cholesky);
+	}
+	return ret;
+}
+
+shared_ptr<const Matrix> MultiStockModel::getCholeskyFactor() const {
+	shared_ptr<const CholeskyFactor> factor = cachedCholesky();
+	return shared_ptr<const Matrix>(factor, &factor->lower);
+}
+
 /*  Get a sub model that uses only the given stocks */
 MultiStockModel MultiStockModel::getSubmodel(
 	set<string> stocks) const {
@@ -54,7 +167,6 @@ MultiStockModel MultiStockModel::getSubmodel(
 	Matrix drifts(n, 1);
 	Matrix stockPrices(n, 1);
 	vector<string> newStocks(stocks.begin(), stocks.end());
-	Matrix cov(n, n);
 
 	int newIndex = 0;
 	for (auto& stock : stocks) {
@@ -64,6 +176,27 @@ MultiStockModel MultiStockModel::getSubmodel(
 		newIndex++;
 	}
 
+	if (isFactorModel()) {
+		// a factor model's sub model uses the same factors
+		Matrix loadings(n, nFactors);
+		Matrix variances(n, 1);
+		newIndex = 0;
+		for (auto& stock : stocks) {
+			int idx = getIndex(stock);
+			for (int k = 0; k < nFactors; k++) {
+				loadings(newIndex, k) = factorLoadings(idx, k);
+			}
+			variances(newIndex) = idiosyncraticVariances(idx);
+			newIndex++;
+		}
+		MultiStockModel ret(newStocks, stockPrices, drifts, loadings, variances);
+		ret.setDate(getDate());
+		ret.setRiskFreeRate(getRiskFreeRate());
+		return ret;
+	}
+
+	Matrix cov(n, n);
+
 	int i = 0;
 	for (auto& stockI : stocks) {
 		int j = 0;
@@ -78,6 +211,55 @@ MultiStockModel MultiStockModel::getSubmodel(
 	MultiStockModel ret(newStocks, stockPrices, drifts, cov);
 	ret.setDate(getDate());
 	ret.setRiskFreeRate(getRiskFreeRate());
+
+	// when the stocks are all of ours, factoring our matrix costs
+	// no more than factoring theirs and every later sub model can
+	// share it, so the pricer's repeated calls factor it only once.
+	// A factor with its rows reordered is a factor of the reordered
+	// matrix.
+	if (n == (int)stockNames.size()) {
+		shared_ptr<const CholeskyFactor> factor = cachedCholesky();
+		bool isSameOrder = true;
+		for (int i = 0; i < n; i++) {
+			isSameOrder = isSameOrder && getIndex(newStocks[i]) == i;
+		}
+		if (isSameOrder) {
+			ret.cholesky = factor;
+		} else {
+			Matrix permuted(n, n);
+			for (int i = 0; i < n; i++) {
+				int oldI = getIndex(newStocks[i]);
+				for (int j = 0; j < n; j++) {
+					permuted(i, j) = factor->lower(oldI, j);
+				}
+			}
+			ret.setCholesky(permuted, false);
+		}
+		return ret;
+	}
+
+	// when the stocks are the first n of ours in the same order the
+	// top left of our factor is theirs. Otherwise, or if we haven't
+	// factored our matrix yet, it is cheaper to factor their smaller
+	// matrix when they need it.
+	bool isLeadingBlock = true;
+	newIndex = 0;
+	for (auto& stock : stocks) {
+		isLeadingBlock = isLeadingBlock && getIndex(stock) == newIndex;
+		newIndex++;
+	}
+	shared_ptr<const CholeskyFactor> factor = atomic_load(&cholesky);
+	if (isLeadingBlock && factor) {
+		if (factor->isLower) {
+			Matrix lower(n, n);
+			for (int j = 0; j < n; j++) {
+				for (int i = j; i < n; i++) {
+					lower(i, j) = factor->lower(i, j);
+				}
+			}
+			ret.setCholesky(lower, true);
+		}
+	}
 	return ret;
 }
 
@@ -87,7 +269,7 @@ BlackScholesModel MultiStockModel::getBlackScholesModel(
 	int idx = getIndex(stockCode);
 	BlackScholesModel bsm;
 	bsm.drift = drifts(idx, 0);
-	bsm.volatility = sqrt(covarianceMatrix(idx, idx));
+	bsm.volatility = sqrt(getVariance(idx));
 	bsm.riskFreeRate = riskFreeRate;
 	bsm.stockPrice = stockPrices(idx, 0);
 	bsm.date = date;
@@ -95,6 +277,106 @@ BlackScholesModel MultiStockModel::getBlackScholesModel(
 }
 
 
+/*  Draws each step's normals from a Mersenne Twister in turn */
+static MultiStockModel::NormalSource mersenneNormals(mt19937& rng) {
+	return [&rng](int step, Matrix& normals) {
+		normals = randn(rng, normals.nRows(), normals.nCols());
+	};
+}
+
+/*  Gives each time step and stock its own Philox stream, in
+	which path p uses position p. Any set of paths can then be
+	generated in constant time without reference to the others. */
+MultiStockModel::NormalSource MultiStockModel::philoxNormals(const Philox& rng, long long firstPath) {
+	Philox generator = rng;
+	return [generator, firstPath](int step, Matrix& normals) mutable {
+		int nPaths = normals.nRows();
+		int nStocks = normals.nCols();
+		for (int j = 0; j < nStocks; j++) {
+			generator.setStream((uint64_t)step*nStocks + j);
+			generator.setPosition(firstPath);
+			randn(generator, normals.begin() + j*nPaths, nPaths);
+		}
+	};
+}
+
+MultiStockModel::NormalSource MultiStockModel::sobolNormals(const SobolSequence& sobol,
+	long long firstPath,
+	int nSteps,
+	bool brownianBridge) {
+	// each path's normals come from one point, so they are all
+	// generated together and handed out a step at a time
+	struct SobolNormals {
+		SobolSequence sequence;
+		Matrix normals;
+		bool isGenerated;
+	};
+	auto state = make_shared<SobolNormals>(SobolNormals{ sobol, Matrix(), false });
+	return [state, firstPath, nSteps, brownianBridge](int step, Matrix& normals) {
+		int nPaths = normals.nRows();
+		int nColumns = normals.nCols();
+		if (!state->isGenerated) {
+			// column i*nColumns + j holds dimension i*nColumns + j
+			// of every path, which is column j of step i
+			int dimensions = nSteps*nColumns;
+			ASSERT(state->sequence.getDimensions() == dimensions);
+			Matrix& all = state->normals;
+			all = Matrix(nPaths, dimensions, false);
+			vector<double> point(dimensions);
+			state->sequence.setPosition(firstPath + 1);
+			for (int p = 0; p < nPaths; p++) {
+				state->sequence.nextUniform(&point[0]);
+				for (int d = 0; d < dimensions; d++) {
+					all(p, d) = point[d];
+				}
+			}
+			vectorNormInv(all.begin(), nPaths*dimensions);
+			if (brownianBridge) {
+				BrownianBridge bridge(nSteps);
+				for (int j = 0; j < nColumns; j++) {
+					bridge.transform(all.begin() + j*nPaths, nPaths, nColumns*nPaths);
+				}
+			}
+			state->isGenerated = true;
+		}
+		ASSERT(state->normals.nRows() == nPaths);
+		const double* stepNormals = state->normals.begin() + (size_t)step*nColumns*nPaths;
+		copy(stepNormals, stepNormals + nColumns*nPaths, normals.begin());
+	};
+}
+
+MultiStockModel::NormalSource MultiStockModel::antitheticNormals(NormalSource normals) {
+	return [normals](int step, Matrix& out) mutable {
+		normals(step, out);
+		out *= -1.0;
+	};
+}
+
+MultiStockModel::NormalSource MultiStockModel::momentMatchedNormals(NormalSource normals) {
+	return [normals](int step, Matrix& out) mutable {
+		normals(step, out);
+		int nPaths = out.nRows();
+		if (nPaths < 2) {
+			return;
+		}
+		for (int j = 0; j < out.nCols(); j++) {
+			double* column = out.begin() + j*nPaths;
+			double sum = 0.0;
+			double sumSquares = 0.0;
+			for (int i = 0; i < nPaths; i++) {
+				sum += column[i];
+				sumSquares += column[i] * column[i];
+			}
+			double mean = sum / nPaths;
+			double variance = (sumSquares - nPaths*mean*mean) / (nPaths - 1);
+			double scale = variance > 0.0 ? 1.0 / sqrt(variance) : 1.0;
+			for (int i = 0; i < nPaths; i++) {
+				column[i] = (column[i] - mean)*scale;
+			}
+		}
+	};
+}
+
 /*  Returns a simulation up to the given date
 in the P measure */
 MarketSimulation MultiStockModel::generatePricePaths(
@@ -102,7 +384,7 @@ MarketSimulation MultiStockModel::generatePricePaths(
 	double toDate,
 	int nPaths,
 	int nSteps) const {
-	return generatePricePaths(rng, toDate,nPaths,nSteps,drifts);
+	return generatePricePaths(mersenneNormals(rng), toDate, nPaths, nSteps, drifts);
 }
 
 /*  Returns a simulation up to the given date
@@ -113,35 +395,152 @@ MarketSimulation MultiStockModel::generateRiskNeutralPricePaths(
 	int nPaths,
 	int nSteps) const {
 	Matrix riskNeutralDrifts = ones(drifts.nRows(), 1)*riskFreeRate;
-	return generatePricePaths(rng, toDate, nPaths, nSteps, riskNeutralDrifts);
+	return generatePricePaths(mersenneNormals(rng), toDate, nPaths, nSteps, riskNeutralDrifts);
+}
+
+/*  Returns some of the paths of a simulation
+in the P measure */
+MarketSimulation MultiStockModel::generatePricePaths(
+	const Philox& rng,
+	long long firstPath,
+	double toDate,
+	int nPaths,
+	int nSteps) const {
+	return generatePricePaths(philoxNormals(rng, firstPath), toDate, nPaths, nSteps, drifts);
+}
+
+/*  Returns some of the paths of a simulation
+in the Q measure */
+MarketSimulation MultiStockModel::generateRiskNeutralPricePaths(
+	const Philox& rng,
+	long long firstPath,
+	double toDate,
+	int nPaths,
+	int nSteps) const {
+	return generateRiskNeutralPricePaths(philoxNormals(rng, firstPath), toDate, nPaths, nSteps);
+}
+
+/*  Returns a simulation in the Q measure
+driven by the given normals */
+MarketSimulation MultiStockModel::generateRiskNeutralPricePaths(
+	NormalSource normals,
+	double toDate,
+	int nPaths,
+	int nSteps) const {
+	Matrix riskNeutralDrifts = ones(drifts.nRows(), 1)*riskFreeRate;
+	return generatePricePaths(normals, toDate, nPaths, nSteps, riskNeutralDrifts);
+}
+
+
+/*  Returns summaries of some of the paths of a
+simulation in the Q measure */
+MarketSimulation MultiStockModel::generateRiskNeutralPathSummaries(
+	const Philox& rng,
+	long long firstPath,
+	double toDate,
+	int nPaths,
+	int nSteps,
+	const PathStatistics& statistics) const {
+	return generateRiskNeutralPathSummaries(philoxNormals(rng, firstPath),
+		toDate, nPaths, nSteps, statistics);
 }
 
+/*  Returns summaries of a simulation in the
+Q measure driven by the given normals */
+MarketSimulation MultiStockModel::generateRiskNeutralPathSummaries(
+	NormalSource normals,
+	double toDate,
+	int nPaths,
+	int nSteps,
+	const PathStatistics& statistics) const {
+	Matrix riskNeutralDrifts = ones(drifts.nRows(), 1)*riskFreeRate;
+	int nStocks = stockNames.size();
+	vector<shared_ptr<PathSummary>> summaries;
+	MarketSimulation sim;
+	double dt = (toDate - date) / nSteps;
+	for (int j = 0; j < nStocks; j++) {
+		summaries.push_back(make_shared<PathSummary>(nPaths, statistics));
+		if (statistics.needsBridge()) {
+			summaries[j]->setBridge(stockPrices(j), getVariance(j)*dt);
+		}
+		sim.addPathSummary(stockNames[j], summaries[j]);
+	}
+	Matrix currentStock(nPaths, 1, false);
+	simulateLogPrices(normals, toDate, nPaths, nSteps, riskNeutralDrifts,
+		[&](int step, const Matrix& logPrices) {
+		for (int j = 0; j < nStocks; j++) {
+			const double* logStock = logPrices.begin() + j*nPaths;
+			double* prices = currentStock.begin();
+			copy(logStock, logStock + nPaths, prices);
+			vectorExp(prices, nPaths);
+			summaries[j]->addStep(prices);
+		}
+	});
+	return sim;
+}
 
 /**
 *  Creates a price path according to the model parameters
 */
 MarketSimulation MultiStockModel::generatePricePaths(
-	mt19937& rng,
+	NormalSource normals,
 	double toDate,
 	int nPaths,
 	int nSteps,
 	Matrix drifts) const {
+	int nStocks = stockNames.size();
+	MarketSimulation sim(stockNames, nPaths, nSteps, pathLayout);
+	Matrix currentStock(nPaths, 1, false);
+	// write the prices straight into the simulation
+	simulateLogPrices(normals, toDate, nPaths, nSteps, drifts,
+		[&](int step, const Matrix& logPrices) {
+		for (int j = 0; j < nStocks; j++) {
+			const double* logStock = logPrices.begin() + j*nPaths;
+			double* block = sim.getStockBlock(j);
+			if (pathLayout == PATHS_BY_STEP) {
+				double* prices = block + (size_t)step*nPaths;
+				copy(logStock, logStock + nPaths, prices);
+				vectorExp(prices, nPaths);
+			} else {
+				double* prices = currentStock.begin();
+				copy(logStock, logStock + nPaths, prices);
+				vectorExp(prices, nPaths);
+				for (int p = 0; p < nPaths; p++) {
+					block[(size_t)p*nSteps + step] = prices[p];
+				}
+			}
+		}
+	});
+	return sim;
+}
+
+/**
+*  Simulates the log stock prices according to the model parameters
+*/
+void MultiStockModel::simulateLogPrices(
+	NormalSource normals,
+	double toDate,
+	int nPaths,
+	int nSteps,
+	Matrix drifts,
+	LogPriceSink sink) const {
 
 	int nStocks = stockPrices.nRows();
 	double dt = (toDate - date) / nSteps;
 	double rootDt = sqrt(dt);
 
-	// initialize matrices of simulations for 
-	// each stock
-	std::vector< SPMatrix> simulations;
-	for (int j = 0; j < nStocks; j++) {
-		SPMatrix matrix(new Matrix(nPaths, nSteps));
-		simulations.push_back(matrix);
+	// a factor model needs no factorisation, its stocks are driven
+	// by nFactors common normals plus one of their own
+	shared_ptr<const CholeskyFactor> factor;
+	Matrix idiosyncraticVols(nStocks, 1);
+	if (isFactorModel()) {
+		for (int j = 0; j < nStocks; j++) {
+			idiosyncraticVols(j) = sqrt(idiosyncraticVariances(j))*rootDt;
+		}
+	} else {
+		factor = cachedCholesky();
 	}
 
-	Matrix A = chol(covarianceMatrix);
-
-	
 	// create a matrix containing current log stock prices
 	// and a matrix contianing the drift term to add each
 	// time step
@@ -151,29 +550,39 @@ MarketSimulation MultiStockModel::generatePricePaths(
 	for (int j = 0; j < nStocks; j++) {
 		double S0 = stockPrices(j);
 		currentLogStock.setCol(j, oneV*log(S0), 0);
-		double logDrift = drifts(j) - 0.5*covarianceMatrix(j,j);
+		double logDrift = drifts(j) - 0.5*getVariance(j);
 		driftTerm.setCol(j, oneV*logDrift*dt, 0);
 	}
 
-	// comute paths at subsequent time steps
+	// comute paths at subsequent time steps. The temporaries
+	// are reused so at most the random numbers are allocated
+	// on each step
+	Matrix W(nPaths, nStocks, false);
+	Matrix Z(nPaths, nStocks + nFactors, false);
 	for (int i = 0; i < nSteps; i++) {
-		Matrix epsilons = randn(rng, nPaths, nStocks);
-		Matrix W = rootDt * epsilons * transpose(A);
-		currentLogStock += driftTerm + W;
-		Matrix currentStock = exp( currentLogStock );
-		for (int j = 0; j < nStocks; j++) {
-			auto stockPaths = simulations[j];
-			stockPaths->setCol(i, currentStock, j);
+		normals(i, Z);
+		if (isFactorModel()) {
+			gemm(nPaths, nStocks, nFactors,
+				rootDt,
+				Z.begin(), nPaths,
+				factorLoadingsTransposed.begin(), nFactors,
+				0.0,
+				W.begin(), nPaths);
+			const double* idiosyncratic = Z.begin() + nFactors*nPaths;
+			for (int j = 0; j < nStocks; j++) {
+				double vol = idiosyncraticVols(j);
+				double* w = W.begin() + j*nPaths;
+				const double* z = idiosyncratic + j*nPaths;
+				for (int p = 0; p < nPaths; p++) {
+					w[p] += vol*z[p];
+				}
+			}
+		} else {
+			multiply(Z, factor->transposed, W, rootDt);
 		}
+		currentLogStock += lazy(driftTerm) + W;
+		sink(i, currentLogStock);
 	}
-
-	// store the results in a Market Simulation
-	MarketSimulation sim;
-	for (int j = 0; j < nStocks; j++) {
-		auto stockPaths = simulations[j];
-		sim.addSimulation(stockNames[j], stockPaths);
-	}
-	return sim;
 }
 
 /*  
@@ -208,12 +617,12 @@ static void testCorrectCovarianceMatrix() {
 
 	auto stocks = msm.getStocks();
 	for (int i = 0; i < (int)stocks.size(); i++) {
-		SPCMatrix m = sim.getStockPrices(stocks[i]);	
-		x.setCol(0, *m, nSteps - 1);
+		MatrixView m = sim.getStockPrices(stocks[i]);
+		x = Matrix(m.col(nSteps - 1));
 		x.log();
 		for (int j = 0; j < (int)stocks.size(); j++) {
-			SPCMatrix n = sim.getStockPrices(stocks[j]);
-			y.setCol(0, *n, nSteps - 1);
+			MatrixView n = sim.getStockPrices(stocks[j]);
+			y = Matrix(n.col(nSteps - 1));
 			y.log();
 			x -= meanCols(x)(0,0);
 			y -= meanCols(y)(0, 0);
@@ -224,11 +633,298 @@ static void testCorrectCovarianceMatrix() {
 	}
 }
 
+static void testAllocationsPerStep() {
+	MultiStockModel msm = MultiStockModel::createTestModel();
+	int nPaths = 1000;
+	mt19937 rng;
+	long long before = Matrix::allocationCount();
+	msm.generatePricePaths(rng, 1.0, nPaths, 10);
+	long long tenSteps = Matrix::allocationCount() - before;
+	before = Matrix::allocationCount();
+	msm.generatePricePaths(rng, 1.0, nPaths, 20);
+	long long twentySteps = Matrix::allocationCount() - before;
+	double perStep = (twentySteps - tenSteps) / 10.0;
+	INFO("Matrix allocations per time step " << perStep);
+	ASSERT(perStep <= 1.0);
+}
+
+static void testPathsIndependentOfBatches() {
+	MultiStockModel msm = MultiStockModel::createTestModel();
+	Philox rng;
+	int nPaths = 1000;
+	int nSteps = 5;
+	MarketSimulation all = msm.generateRiskNeutralPricePaths(rng, 0, 1.0, nPaths, nSteps);
+	// generating the second half on its own gives the same paths
+	MarketSimulation half = msm.generateRiskNeutralPricePaths(rng, nPaths/2, 1.0, nPaths/2, nSteps);
+	for (auto& stock : msm.getStocks()) {
+		MatrixView expected = all.getStockPrices(stock).rowRange(nPaths/2, nPaths/2);
+		Matrix(expected).assertEquals(Matrix(half.getStockPrices(stock)), 1e-12);
+	}
+}
+
+static void testPathLayouts() {
+	MultiStockModel msm = MultiStockModel::createTestModel();
+	Philox rng;
+	int nPaths = 100;
+	int nSteps = 7;
+	MarketSimulation bySteps = msm.generateRiskNeutralPricePaths(rng, 0, 1.0, nPaths, nSteps);
+	ASSERT(bySteps.getLayout() == PATHS_BY_STEP);
+	msm.setPathLayout(PATHS_BY_PATH);
+	MarketSimulation byPaths = msm.generateRiskNeutralPricePaths(rng, 0, 1.0, nPaths, nSteps);
+	ASSERT(byPaths.getLayout() == PATHS_BY_PATH);
+	for (auto& stock : msm.getStocks()) {
+		MatrixView paths = byPaths.getStockPrices(stock);
+		ASSERT(paths.getRowStride() == nSteps && paths.getColStride() == 1);
+		Matrix(bySteps.getStockPrices(stock)).assertEquals(Matrix(paths), 0.0);
+	}
+}
+
+static void testNormalTransforms() {
+	Philox rng;
+	int nPaths = 1000;
+	MultiStockModel::NormalSource normals = MultiStockModel::philoxNormals(rng, 50);
+	Matrix z(nPaths, 3, false);
+	normals(2, z);
+
+	// antithetic normals are the negated normals
+	Matrix negated(nPaths, 3, false);
+	MultiStockModel::antitheticNormals(normals)(2, negated);
+	(-1.0*z).assertEquals(negated, 0.0);
+
+	// moment matched normals have exactly the right mean and variance
+	Matrix matched(nPaths, 3, false);
+	MultiStockModel::momentMatchedNormals(normals)(2, matched);
+	Matrix mean = meanCols(matched);
+	for (int j = 0; j < 3; j++) {
+		double sumSquares = 0.0;
+		for (int i = 0; i < nPaths; i++) {
+			sumSquares += matched(i, j)*matched(i, j);
+		}
+		ASSERT_APPROX_EQUAL(mean(j), 0.0, 1e-12);
+		ASSERT_APPROX_EQUAL(sumSquares / (nPaths - 1), 1.0, 1e-12);
+	}
+
+	// the paths from a source match those from the generator
+	MultiStockModel msm = MultiStockModel::createTestModel();
+	MarketSimulation fromGenerator = msm.generateRiskNeutralPricePaths(rng, 50, 1.0, nPaths, 4);
+	MarketSimulation fromSource = msm.generateRiskNeutralPricePaths(normals, 1.0, nPaths, 4);
+	for (auto& stock : msm.getStocks()) {
+		Matrix(fromGenerator.getStockPrices(stock)).assertEquals(
+			Matrix(fromSource.getStockPrices(stock)), 0.0);
+	}
+}
+
+static void testCholeskyCache() {
+	MultiStockModel msm = MultiStockModel::createTestModel();
+	shared_ptr<const Matrix> factor = msm.getCholeskyFactor();
+	chol(msm.getCovarianceMatrix()).assertEquals(*factor, 1e-14);
+	// the factor is computed once and shared with copies
+	ASSERT(msm.getCholeskyFactor() == factor);
+	Philox rng;
+	msm.generateRiskNeutralPricePaths(rng, 0, 1.0, 10, 2);
+	ASSERT(msm.getCholeskyFactor() == factor);
+	MultiStockModel copy = msm;
+	ASSERT(copy.getCholeskyFactor() == factor);
+
+	// the leading stocks reuse part of it, others are refactored
+	MultiStockModel all = msm.getSubmodel({ "Acme", "Bigbank", "Chumhum" });
+	ASSERT(all.getCholeskyFactor() == factor);
+	MultiStockModel leading = msm.getSubmodel({ "Acme", "Bigbank" });
+	chol(leading.getCovarianceMatrix()).assertEquals(*leading.getCholeskyFactor(), 1e-14);
+	MultiStockModel other = msm.getSubmodel({ "Bigbank", "Chumhum" });
+	chol(other.getCovarianceMatrix()).assertEquals(*other.getCholeskyFactor(), 1e-14);
+
+	// changing the covariance matrix invalidates the factor
+	Matrix cov = msm.getCovarianceMatrix();
+	cov *= 2.0;
+	copy.setCovarianceMatrix(cov);
+	chol(cov).assertEquals(*copy.getCholeskyFactor(), 1e-14);
+	ASSERT(msm.getCholeskyFactor() == factor);
+
+	// a sub model of all the stocks factors the whole matrix once,
+	// and every later one shares it
+	MultiStockModel unfactored = MultiStockModel::createTestModel();
+	MultiStockModel whole = unfactored.getSubmodel({ "Acme", "Bigbank", "Chumhum" });
+	chol(whole.getCovarianceMatrix()).assertEquals(*whole.getCholeskyFactor(), 1e-14);
+	ASSERT(whole.getCholeskyFactor() == unfactored.getCholeskyFactor());
+	MultiStockModel again = unfactored.getSubmodel({ "Acme", "Bigbank", "Chumhum" });
+	ASSERT(again.getCholeskyFactor() == whole.getCholeskyFactor());
+
+	// stocks listed in another order get our factor's rows reordered
+	Matrix unorderedCov("0.04,0.01,0.002;0.01,0.09,0.003;0.002,0.003,0.0625");
+	MultiStockModel unordered({ "Chumhum", "Acme", "Bigbank" },
+		ones(3, 1)*100.0, zeros(3, 1), unorderedCov);
+	MultiStockModel sorted = unordered.getSubmodel({ "Acme", "Bigbank", "Chumhum" });
+	shared_ptr<const Matrix> sortedFactor = sorted.getCholeskyFactor();
+	sorted.getCovarianceMatrix().assertEquals(
+		(*sortedFactor)*transpose(*sortedFactor), 1e-14);
+	ASSERT(sorted.getCovariance("Acme", "Chumhum") == 0.01);
+}
+
+/*  Names for a large universe of stocks */
+static vector<string> stockNamesForTest(int n) {
+	vector<string> names;
+	for (int i = 0; i < n; i++) {
+		names.push_back("S" + to_string(1000 + i));
+	}
+	return names;
+}
+
+static void testCachedFactorPerformance() {
+	// a large universe priced over a few steps, as when repricing
+	int n = 300;
+	vector<string> names = stockNamesForTest(n);
+	Matrix loadings = randn(n, 5);
+	Matrix cov = loadings*transpose(loadings)*0.001;
+	for (int i = 0; i < n; i++) {
+		cov(i, i) += 0.04;
+	}
+	MultiStockModel msm(names, ones(n, 1)*100.0, zeros(n, 1), cov);
+	Philox rng;
+	int nRepeats = 20;
+
+	clock_t start = clock();
+	for (int r = 0; r < nRepeats; r++) {
+		chol(cov);
+	}
+	double factorTime = (double)(clock() - start) / CLOCKS_PER_SEC / nRepeats;
+
+	// without the cache every repeat factors the matrix again
+	start = clock();
+	for (int r = 0; r < nRepeats; r++) {
+		MultiStockModel fresh(names, ones(n, 1)*100.0, zeros(n, 1), cov);
+		fresh.getSubmodel(set<string>(names.begin(), names.end()))
+			.generateRiskNeutralPricePaths(rng, 0, 1.0, 100, 2);
+	}
+	double uncachedTime = (double)(clock() - start) / CLOCKS_PER_SEC / nRepeats;
+
+	msm.getCholeskyFactor();
+	start = clock();
+	for (int r = 0; r < nRepeats; r++) {
+		msm.getSubmodel(set<string>(names.begin(), names.end()))
+			.generateRiskNeutralPricePaths(rng, 0, 1.0, 100, 2);
+	}
+	double pathTime = (double)(clock() - start) / CLOCKS_PER_SEC / nRepeats;
+	INFO(n << " stocks\n"
+		<< "Factorising the covariance matrix: " << factorTime << "s\n"
+		<< "A sub model's 100 paths without the cache: " << uncachedTime << "s\n"
+		<< "A sub model's 100 paths with the cached factor: " << pathTime << "s");
+}
+
+static void testSemidefiniteCovariance() {
+	// a covariance matrix of rank 2 between three stocks
+	Matrix loadings("0.2,0.1;0.1,0.3;0.3,0.4");
+	Matrix cov = loadings*transpose(loadings);
+	MultiStockModel msm({ "Acme", "Bigbank", "Chumhum" },
+		Matrix("100;200;300"), zeros(3, 1), cov);
+	shared_ptr<const Matrix> factor = msm.getCholeskyFactor();
+	cov.assertEquals((*factor)*transpose(*factor), 1e-14);
+	Philox rng;
+	MarketSimulation sim = msm.generateRiskNeutralPricePaths(rng, 0, 1.0, 10, 2);
+	for (auto& stock : msm.getStocks()) {
+		ASSERT(std::isfinite(sim.getStockPrices(stock)(9, 1)));
+	}
+	// a leading sub model can't use part of a pivoted factor
+	MultiStockModel leading = msm.getSubmodel({ "Acme", "Bigbank" });
+	chol(leading.getCovarianceMatrix()).assertEquals(*leading.getCholeskyFactor(), 1e-14);
+}
+
+static void testFactorModel() {
+	rng("default");
+	int n = 4;
+	Matrix loadings = randn(n, 2)*0.1;
+	Matrix variances("0.01;0.02;0.03;0.04");
+	vector<string> names = stockNamesForTest(n);
+	MultiStockModel factorModel(names, ones(n, 1)*100.0, zeros(n, 1), loadings, variances);
+	ASSERT(factorModel.isFactorModel());
+	ASSERT(factorModel.getNumberOfFactors() == 2);
+	Matrix cov = loadings*transpose(loadings);
+	for (int i = 0; i < n; i++) {
+		cov(i, i) += variances(i);
+	}
+	cov.assertEquals(factorModel.getCovarianceMatrix(), 1e-14);
+	ASSERT_APPROX_EQUAL(factorModel.getBlackScholesModel(names[2]).volatility,
+		sqrt(cov(2, 2)), 1e-14);
+	ASSERT_APPROX_EQUAL(factorModel.getCovariance(names[1], names[3]), cov(1, 3), 1e-14);
+	ASSERT_APPROX_EQUAL(factorModel.getCovariance(names[2], names[2]), cov(2, 2), 1e-14);
+
+	// sub models keep the factors
+	MultiStockModel sub = factorModel.getSubmodel({ names[1], names[3] });
+	ASSERT(sub.isFactorModel());
+	Matrix subCov = sub.getCovarianceMatrix();
+	ASSERT_APPROX_EQUAL(subCov(0, 1), cov(1, 3), 1e-14);
+	ASSERT_APPROX_EQUAL(subCov(1, 1), cov(3, 3), 1e-14);
+
+	// the log returns have the right covariance
+	Philox rng;
+	int nPaths = 100000;
+	MarketSimulation sim = factorModel.generatePricePaths(rng, 0, 1.0, nPaths, 1);
+	Matrix logReturns(nPaths, n);
+	for (int j = 0; j < n; j++) {
+		MatrixView prices = sim.getStockPrices(names[j]);
+		for (int p = 0; p < nPaths; p++) {
+			logReturns(p, j) = prices(p, 0);
+		}
+	}
+	logReturns.log();
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			double meanI = meanCols(logReturns)(0, i);
+			double meanJ = meanCols(logReturns)(0, j);
+			double sum = 0.0;
+			for (int p = 0; p < nPaths; p++) {
+				sum += (logReturns(p, i) - meanI)*(logReturns(p, j) - meanJ);
+			}
+			ASSERT_APPROX_EQUAL(cov(i, j), sum / nPaths, 0.001);
+		}
+	}
+
+	// setting a covariance matrix replaces the factors
+	factorModel.setCovarianceMatrix(cov);
+	ASSERT(!factorModel.isFactorModel());
+	cov.assertEquals(factorModel.getCovarianceMatrix(), 0.0);
+}
+
+static void testFactorModelPerformance() {
+	rng("default");
+	int n = 500;
+	int nFactors = 5;
+	vector<string> names = stockNamesForTest(n);
+	Matrix loadings = randn(n, nFactors)*0.1;
+	Matrix variances = ones(n, 1)*0.04;
+	MultiStockModel factorModel(names, ones(n, 1)*100.0, zeros(n, 1), loadings, variances);
+	MultiStockModel fullModel(names, ones(n, 1)*100.0, zeros(n, 1),
+		factorModel.getCovarianceMatrix());
+	Philox rng;
+	int nPaths = 1000;
+	int nSteps = 10;
+	fullModel.getCholeskyFactor();
+
+	clock_t start = clock();
+	fullModel.generateRiskNeutralPricePaths(rng, 0, 1.0, nPaths, nSteps);
+	double fullTime = (double)(clock() - start) / CLOCKS_PER_SEC / nSteps;
+	start = clock();
+	factorModel.generateRiskNeutralPricePaths(rng, 0, 1.0, nPaths, nSteps);
+	double factorTime = (double)(clock() - start) / CLOCKS_PER_SEC / nSteps;
+	INFO(n << " stocks, " << nFactors << " factors, " << nPaths << " paths\n"
+		<< "Time per step with the full covariance matrix: " << fullTime << "s\n"
+		<< "Time per step with the factor model: " << factorTime << "s");
+}
+
 void testMultiStockModel() {
 	// our tests of the BlackScholesModel perform a great deal
 	// of testing of this class already. This is because
 	// BlackScholesModel has been refactored to use a 
 	// MultiStockModel to generate stock prices.
-	testCorrectCovarianceMatrix();
+	TEST(testCorrectCovarianceMatrix);
+	TEST(testAllocationsPerStep);
+	TEST(testPathsIndependentOfBatches);
+	TEST(testPathLayouts);
+	TEST(testNormalTransforms);
+	TEST(testCholeskyCache);
+	TEST(testCachedFactorPerformance);
+	TEST(testSemidefiniteCovariance);
+	TEST(testFactorModel);
+	TEST(testFactorModelPerformance);
 }
 
@@ -0,0 +1,271 @@
+#include "PathSummary.h"
+#include "matlib.h"
+#include "MatrixView.h"
+#include "MatrixKernels.h"
+
+using namespace std;
+
+/*  A column for a statistic, or a placeholder if it isn't kept */
+static Matrix statisticColumn( int nPaths, bool isKept ) {
+    return isKept ? Matrix( nPaths, 1, false ) : Matrix();
+}
+
+PathSummary::PathSummary( int nPaths, const PathStatistics& statistics ) :
+    statistics( statistics ),
+    npaths( nPaths ),
+    nsteps( 0 ),
+    terminal( statisticColumn( nPaths, statistics.terminal ) ),
+    maximum( statisticColumn( nPaths, statistics.maximum ) ),
+    minimum( statisticColumn( nPaths, statistics.minimum ) ),
+    total( statisticColumn( nPaths, statistics.average ) ),
+    hitsUpper( statisticColumn( nPaths, statistics.hitsUpper ) ),
+    hitsLower( statisticColumn( nPaths, statistics.hitsLower ) ),
+    survivesUpper( statisticColumn( nPaths, statistics.survivesUpper ) ),
+    survivesLower( statisticColumn( nPaths, statistics.survivesLower ) ),
+    previousLogPrices( statisticColumn( nPaths, statistics.needsBridge() ) ),
+    logPrices( statisticColumn( nPaths, statistics.needsBridge() ) ),
+    scratch( statisticColumn( nPaths, statistics.needsBridge() ) ),
+    initialPrice( 0.0 ),
+    stepVariance( 0.0 ) {
+}
+
+void PathSummary::setBridge( double initialPrice, double stepVariance ) {
+    ASSERT( nsteps==0 && initialPrice>0 && stepVariance>0 );
+    this->initialPrice = initialPrice;
+    this->stepVariance = stepVariance;
+}
+
+/*  Multiply the probabilities that paths have stayed on one side of
+    a barrier by the probabilities that they don't reach it between
+    log prices x0 and x1. side is 1 for a barrier above the paths
+    and -1 for one below. Given its ends, a Brownian path of variance
+    v reaches the barrier with probability exp(-2 d0 d1 / v) where
+    d0 and d1 are the distances of the ends from the barrier. */
+static void multiplyBridgeSurvival( const double* x0, const double* x1,
+                                    double logBarrier, double side,
+                                    double stepVariance,
+                                    double* survival, double* scratch,
+                                    int n ) {
+    double factor = -2.0/stepVariance;
+    // paths with an end on the far side cross with probability
+    // exp(0). Paths far from the barrier are kept in the range
+    // vectorExp handles quickly, which makes no difference to 1-p.
+    for (int i=0; i<n; i++) {
+        double d0 = side*(logBarrier - x0[i]);
+        double d1 = side*(logBarrier - x1[i]);
+        double exponent = (d0>0 && d1>0) ? factor*d0*d1 : 0.0;
+        scratch[i] = (exponent > -700.0) ? exponent : -700.0;
+    }
+    vectorExp( scratch, n );
+    for (int i=0; i<n; i++) {
+        survival[i] *= 1.0 - scratch[i];
+    }
+}
+
+void PathSummary::addStep( const double* prices ) {
+    int n = npaths;
+    bool isFirst = nsteps==0;
+    if (statistics.terminal) {
+        copy( prices, prices + n, terminal.begin() );
+    }
+    if (statistics.maximum) {
+        double* m = maximum.begin();
+        for (int i=0; i<n; i++) {
+            m[i] = (isFirst || prices[i]>m[i]) ? prices[i] : m[i];
+        }
+    }
+    if (statistics.minimum) {
+        double* m = minimum.begin();
+        for (int i=0; i<n; i++) {
+            m[i] = (isFirst || prices[i]<m[i]) ? prices[i] : m[i];
+        }
+    }
+    if (statistics.average) {
+        double* t = total.begin();
+        for (int i=0; i<n; i++) {
+            t[i] = isFirst ? prices[i] : t[i] + prices[i];
+        }
+    }
+    if (statistics.hitsUpper) {
+        double* h = hitsUpper.begin();
+        double barrier = statistics.upperBarrier;
+        for (int i=0; i<n; i++) {
+            double hit = prices[i]>=barrier;
+            h[i] = isFirst ? hit : (h[i]>hit ? h[i] : hit);
+        }
+    }
+    if (statistics.hitsLower) {
+        double* h = hitsLower.begin();
+        double barrier = statistics.lowerBarrier;
+        for (int i=0; i<n; i++) {
+            double hit = prices[i]<=barrier;
+            h[i] = isFirst ? hit : (h[i]>hit ? h[i] : hit);
+        }
+    }
+    if (statistics.needsBridge()) {
+        ASSERT( stepVariance>0 );
+        double* x0 = previousLogPrices.begin();
+        double* x1 = logPrices.begin();
+        copy( prices, prices + n, x1 );
+        vectorLog( x1, n );
+        if (isFirst) {
+            fill( x0, x0 + n, log( initialPrice ) );
+            if (statistics.survivesUpper) {
+                fill( survivesUpper.begin(), survivesUpper.end(), 1.0 );
+            }
+            if (statistics.survivesLower) {
+                fill( survivesLower.begin(), survivesLower.end(), 1.0 );
+            }
+        }
+        if (statistics.survivesUpper) {
+            multiplyBridgeSurvival( x0, x1, log( statistics.upperBarrier ), 1.0,
+                                    stepVariance, survivesUpper.begin(),
+                                    scratch.begin(), n );
+        }
+        if (statistics.survivesLower) {
+            multiplyBridgeSurvival( x0, x1, log( statistics.lowerBarrier ), -1.0,
+                                    stepVariance, survivesLower.begin(),
+                                    scratch.begin(), n );
+        }
+        swap( previousLogPrices, logPrices );
+    }
+    nsteps++;
+}
+
+const Matrix& PathSummary::getTerminal() const {
+    ASSERT( statistics.terminal && nsteps>0 );
+    return terminal;
+}
+
+const Matrix& PathSummary::getMaximum() const {
+    ASSERT( statistics.maximum && nsteps>0 );
+    return maximum;
+}
+
+const Matrix& PathSummary::getMinimum() const {
+    ASSERT( statistics.minimum && nsteps>0 );
+    return minimum;
+}
+
+Matrix PathSummary::getAverage() const {
+    ASSERT( statistics.average && nsteps>0 );
+    return total*(1.0/nsteps);
+}
+
+const Matrix& PathSummary::getHitsUpper() const {
+    ASSERT( statistics.hitsUpper && nsteps>0 );
+    return hitsUpper;
+}
+
+const Matrix& PathSummary::getHitsLower() const {
+    ASSERT( statistics.hitsLower && nsteps>0 );
+    return hitsLower;
+}
+
+const Matrix& PathSummary::getSurvivesUpper() const {
+    ASSERT( statistics.survivesUpper && nsteps>0 );
+    return survivesUpper;
+}
+
+const Matrix& PathSummary::getSurvivesLower() const {
+    ASSERT( statistics.survivesLower && nsteps>0 );
+    return survivesLower;
+}
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+void PathSummary::addSteps( const MatrixView& prices ) {
+    ASSERT( prices.nRows()==npaths );
+    Matrix step( npaths, 1, false );
+    for (int j=0; j<prices.nCols(); j++) {
+        for (int i=0; i<npaths; i++) {
+            step(i) = prices(i,j);
+        }
+        addStep( step.begin() );
+    }
+}
+
+static void testMatchesPaths() {
+    rng("default");
+    int nPaths = 50;
+    int nSteps = 20;
+    Matrix paths = randuniform( nPaths, nSteps );
+    PathStatistics statistics;
+    statistics.terminal = true;
+    statistics.maximum = true;
+    statistics.minimum = true;
+    statistics.average = true;
+    statistics.hitsUpper = true;
+    statistics.upperBarrier = 0.95;
+    statistics.hitsLower = true;
+    statistics.lowerBarrier = 0.05;
+    PathSummary summary( nPaths, statistics );
+    for (int j=0; j<nSteps; j++) {
+        summary.addStep( paths.begin() + j*nPaths );
+    }
+    ASSERT( summary.nSteps()==nSteps );
+    Matrix( MatrixView(paths).col( nSteps-1 ) ).assertEquals( summary.getTerminal(), 0.0 );
+    maxOverRows( paths ).assertEquals( summary.getMaximum(), 0.0 );
+    minOverRows( paths ).assertEquals( summary.getMinimum(), 0.0 );
+    meanRows( paths ).assertEquals( summary.getAverage(), 1e-14 );
+    Matrix( maxOverRows( paths )>=0.95 ).assertEquals( summary.getHitsUpper(), 0.0 );
+    Matrix( minOverRows( paths )<=0.05 ).assertEquals( summary.getHitsLower(), 0.0 );
+
+    // the same from the whole paths at once
+    PathSummary whole( nPaths, statistics );
+    whole.addSteps( paths );
+    ASSERT( whole.nSteps()==nSteps );
+    Matrix( whole.getMaximum() ).assertEquals( summary.getMaximum(), 0.0 );
+    whole.getAverage().assertEquals( summary.getAverage(), 0.0 );
+}
+
+static void testOnlyRequestedStatistics() {
+    PathStatistics statistics;
+    ASSERT( statistics.isEmpty() );
+    statistics.maximum = true;
+    ASSERT( !statistics.isEmpty() );
+    PathSummary summary( 1000, statistics );
+    Matrix prices = ones( 1000, 1 );
+    summary.addStep( prices.begin() );
+    prices *= 2.0;
+    summary.addStep( prices.begin() );
+    ASSERT( summary.getMaximum().nRows()==1000 );
+    ASSERT( summary.getMaximum()(999)==2.0 );
+}
+
+static void testBridgeSurvival() {
+    PathStatistics statistics;
+    statistics.survivesUpper = true;
+    statistics.upperBarrier = 110.0;
+    statistics.survivesLower = true;
+    statistics.lowerBarrier = 90.0;
+    double variance = 0.01;
+    PathSummary summary( 3, statistics );
+    summary.setBridge( 100.0, variance );
+    // paths that end the step at 105, at 95 and above the barrier
+    Matrix prices("105;95;111");
+    summary.addStep( prices.begin() );
+    double up0 = log(110.0/100.0);
+    double down0 = log(100.0/90.0);
+    double survives105 = 1.0 - exp( -2.0*up0*log(110.0/105.0)/variance );
+    double survives95 = 1.0 - exp( -2.0*up0*log(110.0/95.0)/variance );
+    ASSERT_APPROX_EQUAL( summary.getSurvivesUpper()(0), survives105, 1e-14 );
+    ASSERT_APPROX_EQUAL( summary.getSurvivesUpper()(1), survives95, 1e-14 );
+    ASSERT( summary.getSurvivesUpper()(2)==0.0 );
+    ASSERT_APPROX_EQUAL( summary.getSurvivesLower()(1),
+        1.0 - exp( -2.0*down0*log(95.0/90.0)/variance ), 1e-14 );
+    // the next step multiplies the probabilities
+    summary.addStep( prices.begin() );
+    double stay105 = 1.0 - exp( -2.0*log(110.0/105.0)*log(110.0/105.0)/variance );
+    ASSERT_APPROX_EQUAL( summary.getSurvivesUpper()(0), survives105*stay105, 1e-14 );
+}
+
+void testPathSummary() {
+    TEST( testMatchesPaths );
+    TEST( testOnlyRequestedStatistics );
+    TEST( testBridgeSurvival );
+}
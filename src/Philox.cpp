@@ -0,0 +1,328 @@
+#include "Philox.h"
+#include "MatrixKernels.h"
+
+#ifdef FINMATLIB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/*  The multipliers and key increments from the Philox paper */
+static const uint32_t PHILOX_M0 = 0xD2511F53u;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57u;
+static const uint32_t PHILOX_W0 = 0x9E3779B9u;
+static const uint32_t PHILOX_W1 = 0xBB67AE85u;
+static const int PHILOX_ROUNDS = 10;
+
+/*  Marks the buffer as empty, no real block can have this number */
+static const uint64_t NO_BLOCK = ~(uint64_t)0;
+
+Philox::Philox( uint64_t seed ) {
+    this->seed( seed );
+}
+
+void Philox::seed( uint64_t seed ) {
+    key[0] = (uint32_t)seed;
+    key[1] = (uint32_t)(seed >> 32);
+    stream = 0;
+    position = 0;
+    bufferedBlock = NO_BLOCK;
+}
+
+void Philox::setStream( uint64_t stream ) {
+    this->stream = stream;
+    position = 0;
+    bufferedBlock = NO_BLOCK;
+}
+
+void Philox::setPosition( uint64_t position ) {
+    this->position = position;
+}
+
+void Philox::generateBlock( const uint32_t counter[4],
+                            const uint32_t key[2],
+                            uint32_t out[4] ) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round=0; round<PHILOX_ROUNDS; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t hi0 = (uint32_t)(p0 >> 32), lo0 = (uint32_t)p0;
+        uint32_t hi1 = (uint32_t)(p1 >> 32), lo1 = (uint32_t)p1;
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+void Philox::fillBuffer( uint64_t block ) {
+    uint32_t counter[4] = { (uint32_t)block, (uint32_t)(block >> 32),
+                            (uint32_t)stream, (uint32_t)(stream >> 32) };
+    generateBlock( counter, key, buffer );
+    bufferedBlock = block;
+}
+
+/*  Map 32 random bits to (0,1). Dividing by 2^32 is exact, so this
+    matches randuniform. */
+static const double UNIFORM_SCALE = 1.0/4294967296.0;
+
+static inline double toUniform( uint32_t x ) {
+    return (x + 0.5)*UNIFORM_SCALE;
+}
+
+/*  Write the uniforms from nBlocks whole blocks of a stream */
+static void uniformBlocksScalar( const uint32_t key[2], uint64_t stream,
+                                 uint64_t firstBlock, int nBlocks, double* out ) {
+    uint32_t counter[4] = { 0, 0, (uint32_t)stream, (uint32_t)(stream >> 32) };
+    uint32_t words[4];
+    for (int b=0; b<nBlocks; b++) {
+        uint64_t block = firstBlock + b;
+        counter[0] = (uint32_t)block;
+        counter[1] = (uint32_t)(block >> 32);
+        Philox::generateBlock( counter, key, words );
+        for (int w=0; w<4; w++) {
+            out[4*b+w] = toUniform( words[w] );
+        }
+    }
+}
+
+#ifdef FINMATLIB_X86_SIMD
+
+/*  Four blocks at once, with each 32 bit word in a 64 bit lane so
+    that _mm256_mul_epu32 gives the full product */
+__attribute__((target("avx2,fma")))
+static void uniformBlocksAvx2( const uint32_t key[2], uint64_t stream,
+                               uint64_t firstBlock, int nBlocks, double* out ) {
+    const __m256i low32 = _mm256_set1_epi64x( 0xFFFFFFFFll );
+    const __m256i m0 = _mm256_set1_epi64x( PHILOX_M0 );
+    const __m256i m1 = _mm256_set1_epi64x( PHILOX_M1 );
+    // or-ing x<2^32 into the mantissa of 2^52 gives 2^52+x
+    const __m256i twoTo52Bits = _mm256_set1_epi64x( 0x4330000000000000ll );
+    const __m256d twoTo52PlusHalf = _mm256_set1_pd( 4503599627370496.0 - 0.5 );
+    const __m256d scale = _mm256_set1_pd( UNIFORM_SCALE );
+    const __m256i streamLow = _mm256_set1_epi64x( (uint32_t)stream );
+    const __m256i streamHigh = _mm256_set1_epi64x( (uint32_t)(stream >> 32) );
+    int b = 0;
+    for (; b+4<=nBlocks; b+=4) {
+        uint64_t block = firstBlock + b;
+        __m256i blocks = _mm256_setr_epi64x( block, block+1, block+2, block+3 );
+        __m256i c0 = _mm256_and_si256( blocks, low32 );
+        __m256i c1 = _mm256_srli_epi64( blocks, 32 );
+        __m256i c2 = streamLow;
+        __m256i c3 = streamHigh;
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round=0; round<PHILOX_ROUNDS; round++) {
+            __m256i p0 = _mm256_mul_epu32( m0, c0 );
+            __m256i p1 = _mm256_mul_epu32( m1, c2 );
+            c0 = _mm256_xor_si256( _mm256_xor_si256( _mm256_srli_epi64( p1, 32 ), c1 ),
+                                   _mm256_set1_epi64x( k0 ) );
+            c1 = _mm256_and_si256( p1, low32 );
+            c2 = _mm256_xor_si256( _mm256_xor_si256( _mm256_srli_epi64( p0, 32 ), c3 ),
+                                   _mm256_set1_epi64x( k1 ) );
+            c3 = _mm256_and_si256( p0, low32 );
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        __m256d d0 = _mm256_mul_pd( _mm256_sub_pd( _mm256_castsi256_pd(
+            _mm256_or_si256( c0, twoTo52Bits ) ), twoTo52PlusHalf ), scale );
+        __m256d d1 = _mm256_mul_pd( _mm256_sub_pd( _mm256_castsi256_pd(
+            _mm256_or_si256( c1, twoTo52Bits ) ), twoTo52PlusHalf ), scale );
+        __m256d d2 = _mm256_mul_pd( _mm256_sub_pd( _mm256_castsi256_pd(
+            _mm256_or_si256( c2, twoTo52Bits ) ), twoTo52PlusHalf ), scale );
+        __m256d d3 = _mm256_mul_pd( _mm256_sub_pd( _mm256_castsi256_pd(
+            _mm256_or_si256( c3, twoTo52Bits ) ), twoTo52PlusHalf ), scale );
+        // transpose so that each block's words are stored together
+        __m256d t0 = _mm256_unpacklo_pd( d0, d1 );
+        __m256d t1 = _mm256_unpackhi_pd( d0, d1 );
+        __m256d t2 = _mm256_unpacklo_pd( d2, d3 );
+        __m256d t3 = _mm256_unpackhi_pd( d2, d3 );
+        double* o = out + 4*b;
+        _mm256_storeu_pd( o, _mm256_permute2f128_pd( t0, t2, 0x20 ) );
+        _mm256_storeu_pd( o+4, _mm256_permute2f128_pd( t1, t3, 0x20 ) );
+        _mm256_storeu_pd( o+8, _mm256_permute2f128_pd( t0, t2, 0x31 ) );
+        _mm256_storeu_pd( o+12, _mm256_permute2f128_pd( t1, t3, 0x31 ) );
+    }
+    uniformBlocksScalar( key, stream, firstBlock+b, nBlocks-b, out+4*b );
+}
+
+#endif
+
+void Philox::uniform( double* out, int n ) {
+    int i = 0;
+    // finish the current block one output at a time
+    while (i<n && (position & 3)!=0) {
+        out[i++] = toUniform( (*this)() );
+    }
+    int nBlocks = (n-i)/4;
+#ifdef FINMATLIB_X86_SIMD
+    // the AVX-512 level uses the AVX2 code, which is already
+    // limited by the multiplies rather than the width
+    if (getSimdLevel()>=SIMD_AVX2) {
+        uniformBlocksAvx2( key, stream, position >> 2, nBlocks, out+i );
+    } else {
+        uniformBlocksScalar( key, stream, position >> 2, nBlocks, out+i );
+    }
+#else
+    uniformBlocksScalar( key, stream, position >> 2, nBlocks, out+i );
+#endif
+    position += 4*(uint64_t)nBlocks;
+    i += 4*nBlocks;
+    while (i<n) {
+        out[i++] = toUniform( (*this)() );
+    }
+}
+
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static void testKnownAnswers() {
+    // test vectors from the Random123 distribution
+    uint32_t out[4];
+    uint32_t zeroCounter[4] = { 0, 0, 0, 0 };
+    uint32_t zeroKey[2] = { 0, 0 };
+    Philox::generateBlock( zeroCounter, zeroKey, out );
+    ASSERT( out[0]==0x6627e8d5u && out[1]==0xe169c58du
+         && out[2]==0xbc57ac4cu && out[3]==0x9b00dbd8u );
+
+    uint32_t onesCounter[4] = { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu };
+    uint32_t onesKey[2] = { 0xffffffffu, 0xffffffffu };
+    Philox::generateBlock( onesCounter, onesKey, out );
+    ASSERT( out[0]==0x408f276du && out[1]==0x41c83b0eu
+         && out[2]==0xa20bc7c6u && out[3]==0x6d5451fdu );
+
+    uint32_t piCounter[4] = { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u };
+    uint32_t piKey[2] = { 0xa4093822u, 0x299f31d0u };
+    Philox::generateBlock( piCounter, piKey, out );
+    ASSERT( out[0]==0xd16cfe09u && out[1]==0x94fdccebu
+         && out[2]==0x5001e420u && out[3]==0x24126ea1u );
+}
+
+static void testDiscard() {
+    Philox sequential;
+    vector<uint32_t> values( 1003 );
+    for (auto& v : values) {
+        v = sequential();
+    }
+    // jumping to any point gives the same values as reading up to it
+    for (int skip : { 0, 1, 3, 4, 5, 999, 1002 }) {
+        Philox jumped;
+        jumped.discard( skip );
+        ASSERT( jumped()==values[skip] );
+        ASSERT( jumped.getPosition()==(uint64_t)skip+1 );
+    }
+    Philox backwards;
+    backwards.setPosition( 1000 );
+    backwards();
+    backwards.setPosition( 7 );
+    ASSERT( backwards()==values[7] );
+}
+
+static void testStreams() {
+    Philox a;
+    Philox b;
+    b.setStream( 1 );
+    int nSame = 0;
+    for (int i=0; i<1000; i++) {
+        nSame += (a()==b());
+    }
+    ASSERT( nSame<5 );
+    // a different seed gives a different sequence
+    Philox c( 1 );
+    Philox d;
+    ASSERT( c()!=d() );
+}
+
+static void testUniform() {
+    Philox rng;
+    int n = 100000;
+    vector<double> u( n );
+    rng.uniform( &u[0], n );
+    double total = 0.0;
+    for (double x : u) {
+        ASSERT( x>0.0 && x<1.0 );
+        total += x;
+    }
+    ASSERT_APPROX_EQUAL( total/n, 0.5, 0.01 );
+    // works with the standard distributions
+    normal_distribution<double> normal;
+    double sumSq = 0.0;
+    for (int i=0; i<n; i++) {
+        double z = normal( rng );
+        sumSq += z*z;
+    }
+    ASSERT_APPROX_EQUAL( sumSq/n, 1.0, 0.02 );
+}
+
+static void testUniformMatchesOutputs() {
+    // bulk generation gives the same numbers as reading one at a time,
+    // whatever the starting point and length
+    SimdLevel best = detectSimdLevel();
+    for (int level=SIMD_SCALAR; level<=best; level++) {
+        setSimdLevel( (SimdLevel)level );
+        for (int start : { 0, 1, 3, 4, 13 }) {
+            for (int n : { 0, 1, 5, 16, 17, 63, 100 }) {
+                Philox bulk;
+                bulk.setStream( 0x100000002ull );
+                bulk.setPosition( 0xFFFFFFF0ull*4 + start );
+                vector<double> u( n );
+                if (n>0) {
+                    bulk.uniform( &u[0], n );
+                }
+                Philox single;
+                single.setStream( 0x100000002ull );
+                single.setPosition( 0xFFFFFFF0ull*4 + start );
+                for (int i=0; i<n; i++) {
+                    ASSERT( u[i]==(single() + 0.5)/4294967296.0 );
+                }
+                ASSERT( bulk.getPosition()==single.getPosition() );
+                ASSERT( bulk()==single() );
+            }
+        }
+    }
+    setSimdLevel( best );
+}
+
+static void testDiscardPerformance() {
+    unsigned long long skip = 100000000ull;
+    clock_t start = clock();
+    mt19937 mersenne;
+    mersenne.discard( skip );
+    double mersenneTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+    start = clock();
+    Philox philox;
+    philox.discard( skip );
+    philox();
+    double philoxTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+    int n = 10000000;
+    vector<double> u( n );
+    start = clock();
+    philox.uniform( &u[0], n );
+    double uniformTime = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+    INFO( "Skipping " << skip << " numbers\n"
+        << "mt19937: " << mersenneTime << "s\n"
+        << "Philox: " << philoxTime << "s\n"
+        << "Philox generates " << n/max( uniformTime, 1e-6 )*1e-6 << "M uniforms/s" );
+}
+
+void testPhilox() {
+    TEST( testKnownAnswers );
+    TEST( testDiscard );
+    TEST( testStreams );
+    TEST( testUniform );
+    TEST( testUniformMatchesOutputs );
+    TEST( testDiscardPerformance );
+}
@@ -92,7 +92,202 @@ static void testTwoThreads()
 	ASSERT_APPROX_EQUAL(r->total, 99.0 * 50.0, 0.1);
 }
 
+static void testSpscOrder()
+{
+	SpscPipeline<int> pipeline(100);
+	ASSERT(pipeline.capacity() == 128);
+	int n = 100000;
+	thread writer([&pipeline, n]()
+				  {
+		// mix single writes and batches of varying size
+		int i = 0;
+		while (i < n)
+		{
+			int batchSize = min(n - i, i % 7 == 0 ? 1 : 1 + i % 200);
+			vector<int> batch(batchSize);
+			for (int j = 0; j < batchSize; j++)
+			{
+				batch[j] = i + j;
+			}
+			if (batchSize == 1)
+			{
+				pipeline.write(i);
+			}
+			else
+			{
+				pipeline.writeN(&batch[0], batchSize);
+			}
+			i += batchSize;
+		}
+		pipeline.close(); });
+	vector<int> received;
+	int buffer[64];
+	int count;
+	while ((count = pipeline.readN(buffer, 1 + (int)received.size() % 64)) > 0)
+	{
+		received.insert(received.end(), buffer, buffer + count);
+	}
+	writer.join();
+	ASSERT((int)received.size() == n);
+	for (int i = 0; i < n; i++)
+	{
+		ASSERT(received[i] == i);
+	}
+	int value;
+	ASSERT(!pipeline.read(value));
+}
+
+static void testTryVariants()
+{
+	SpscPipeline<double> spsc(4);
+	MpmcPipeline<double> mpmc(4);
+	double values[] = {1, 2, 3, 4, 5, 6};
+	ASSERT(spsc.tryWriteN(values, 6) == 4);
+	ASSERT(mpmc.tryWriteN(values, 6) == 4);
+	ASSERT(!spsc.tryWrite(7.0));
+	ASSERT(!mpmc.tryWrite(7.0));
+	double out[6];
+	ASSERT(spsc.tryReadN(out, 6) == 4 && out[3] == 4.0);
+	ASSERT(mpmc.tryReadN(out, 6) == 4 && out[3] == 4.0);
+	ASSERT(!spsc.tryRead(out[0]));
+	ASSERT(!mpmc.tryRead(out[0]));
+	// nothing more can be written after the end of the stream
+	spsc.close();
+	mpmc.close();
+	ASSERT(!spsc.write(1.0));
+	ASSERT(!mpmc.write(1.0));
+	ASSERT(spsc.readN(out, 6) == 0);
+	ASSERT(mpmc.readN(out, 6) == 0);
+}
+
+static void testMpmcManyThreads()
+{
+	MpmcPipeline<long long> pipeline(64);
+	int nWriters = 3;
+	int nReaders = 3;
+	int perWriter = 20000;
+	vector<thread> writers;
+	for (int w = 0; w < nWriters; w++)
+	{
+		writers.push_back(thread([&pipeline, w, perWriter]()
+								 {
+			for (int i = 0; i < perWriter; i++)
+			{
+				pipeline.write((long long)w * perWriter + i);
+			} }));
+	}
+	vector<long long> sums(nReaders, 0);
+	vector<int> counts(nReaders, 0);
+	vector<thread> readers;
+	for (int r = 0; r < nReaders; r++)
+	{
+		readers.push_back(thread([&pipeline, &sums, &counts, r]()
+								 {
+			long long values[16];
+			int count;
+			while ((count = pipeline.readN(values, 16)) > 0)
+			{
+				for (int i = 0; i < count; i++)
+				{
+					sums[r] += values[i];
+				}
+				counts[r] += count;
+			} }));
+	}
+	for (thread &t : writers)
+	{
+		t.join();
+	}
+	pipeline.close();
+	for (thread &t : readers)
+	{
+		t.join();
+	}
+	long long total = nWriters * perWriter;
+	ASSERT(accumulate(counts.begin(), counts.end(), 0) == total);
+	ASSERT(accumulate(sums.begin(), sums.end(), 0ll) == total * (total - 1) / 2);
+}
+
+/*  Seconds for send on one thread and receive on another to finish */
+template <typename Send, typename Receive>
+static double timeTransfer(Send send, Receive receive)
+{
+	auto start = chrono::steady_clock::now();
+	thread writer(send);
+	receive();
+	writer.join();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void testThroughput()
+{
+	int n = 1000000;
+	int nSingleSlot = 20000;
+	int batchSize = 256;
+	stringstream report;
+	report << "Values per second from one thread to another";
+
+	Pipeline<double> singleSlot;
+	double total = 0.0;
+	double time = timeTransfer(
+		[&]()
+		{ for (int i = 0; i < nSingleSlot; i++) singleSlot.write(i); },
+		[&]()
+		{ for (int i = 0; i < nSingleSlot; i++) total += singleSlot.read(); });
+	ASSERT(total == 0.5 * nSingleSlot * (nSingleSlot - 1.0));
+	report << "\nPipeline: " << nSingleSlot / max(time, 1e-6) * 1e-6 << "M";
+
+	SpscPipeline<double> spsc(4096);
+	total = 0.0;
+	time = timeTransfer(
+		[&]()
+		{ for (int i = 0; i < n; i++) spsc.write(i); spsc.close(); },
+		[&]()
+		{ double x = 0.0; while (spsc.read(x)) total += x; });
+	ASSERT(total == 0.5 * n * (n - 1.0));
+	report << "\nSpscPipeline: " << n / max(time, 1e-6) * 1e-6 << "M";
+
+	SpscPipeline<double> spscBatched(4096);
+	total = 0.0;
+	time = timeTransfer(
+		[&]()
+		{
+			vector<double> batch(batchSize);
+			for (int i = 0; i < n; i += batchSize)
+			{
+				int count = min(batchSize, n - i);
+				for (int j = 0; j < count; j++) batch[j] = i + j;
+				spscBatched.writeN(&batch[0], count);
+			}
+			spscBatched.close(); },
+		[&]()
+		{
+			vector<double> batch(batchSize);
+			int count;
+			while ((count = spscBatched.readN(&batch[0], batchSize)) > 0)
+			{
+				for (int j = 0; j < count; j++) total += batch[j];
+			} });
+	ASSERT(total == 0.5 * n * (n - 1.0));
+	report << "\nSpscPipeline, batches of " << batchSize << ": " << n / max(time, 1e-6) * 1e-6 << "M";
+
+	MpmcPipeline<double> mpmc(4096);
+	total = 0.0;
+	time = timeTransfer(
+		[&]()
+		{ for (int i = 0; i < n; i++) mpmc.write(i); mpmc.close(); },
+		[&]()
+		{ double x = 0.0; while (mpmc.read(x)) total += x; });
+	ASSERT(total == 0.5 * n * (n - 1.0));
+	report << "\nMpmcPipeline: " << n / max(time, 1e-6) * 1e-6 << "M";
+	INFO(report.str());
+}
+
 void testPipeline()
 {
 	TEST(testTwoThreads);
+	TEST(testSpscOrder);
+	TEST(testTryVariants);
+	TEST(testMpmcManyThreads);
+	TEST(testThroughput);
 }
\ No newline at end of file
@@ -59,89 +59,16 @@ void PortfolioImpl::setQuantity( int index,
     quantities[index] = quantity;
 }
 
-//
-//  More efficient monte carlo pricing implementation
-//  
-
-/*  A Maturity Grouping is a sub portfolio consisting of
-	securities with the same maturity */
-class MaturityGrouping : public ContinuousTimeOption {
-public:
-
-	MaturityGrouping(double maturity) : maturity(maturity) {
-	}
-
-	double getMaturity() const {
-		return maturity;
-	}
-
-	bool isPathDependent() const {
-		for (auto& sec : securities) {
-			if (sec->isPathDependent()) {
-				return true;
-			}
-		}
-		return false;
-	}
-
-	set<string> getStocks() const {
-		set<string> ret;
-		for (auto& sec : securities) {
-			for (auto& stock : sec->getStocks()) {
-				ret.insert(stock);
-			}
-		}
-		return ret;
-	}
-
-	double price(const MultiStockModel& m) const {
-		MonteCarloPricer pricer;
-		return pricer.price(*this, m);
-	}
-
-	Matrix payoff(const MarketSimulation& simulation) const {
-		ASSERT(securities.size() > 0);
-		Matrix current = quantities[0]*securities[0]->payoff(simulation);
-		for (int i = 1; i < (int)securities.size(); i++) {
-			current += quantities[i] * securities[i]->payoff(simulation);
-		}
-		return current;
-	}
-
-	void add( double quantity, SPContinuousTimeOption o ) {
-		quantities.push_back(quantity);
-		securities.push_back(o);
-	}
-private:
-	vector<SPContinuousTimeOption> securities;
-	vector<double> quantities;
-	double maturity;
-
-};
-
-typedef shared_ptr<MaturityGrouping> SPMaturityGrouping;
-
 /*  Price this portfolio using one consistent set of monte carlo simulations */
 double PortfolioImpl::monteCarloPrice(
 	const MultiStockModel& model, const MonteCarloPricer& pricer) const {
-	map<double, SPMaturityGrouping> maturityGroupings;
-	for (int i = 0; i < (int)securities.size(); i++) {
-		auto security = securities[i];
-		double quantity = quantities[i];
-		double maturity = security->getMaturity();
-		auto pairPtr = maturityGroupings.find(maturity);
-		if (pairPtr == maturityGroupings.end()) {
-			SPMaturityGrouping newGrouping(new MaturityGrouping(maturity));
-			maturityGroupings[maturity] = newGrouping;
-			pairPtr = maturityGroupings.find(maturity);
-		}
-		pairPtr->second->add(quantity, security);
-	}
-
-	double ret = 0;
-	for (auto& pair : maturityGroupings) {
-		MaturityGrouping& grouping = *pair.second;
-		ret += pricer.price( grouping, model );
+	// securities whose maturities fit a coarse time grid share
+	// their paths, the others are priced separately
+	vector<SPCContinuousTimeOption> options(securities.begin(), securities.end());
+	vector<double> prices = pricer.price(options, model);
+	double ret = 0.0;
+	for (int i = 0; i < (int)prices.size(); i++) {
+		ret += quantities[i] * prices[i];
 	}
 	return ret;
 }
@@ -286,10 +213,40 @@ void testPerformanceImprovement() {
 
 }
 
+static void testMixedMaturities() {
+	// maturities with no small common grid
+	shared_ptr<Portfolio> portfolio = Portfolio::newInstance();
+	for (double maturity : { 1.0, 0.3333, 0.12345 }) {
+		shared_ptr<CallOption> c = make_shared<CallOption>();
+		c->setStrike(100);
+		c->setMaturity(maturity);
+		portfolio->add(1.0, c);
+		shared_ptr<PutOption> p = make_shared<PutOption>();
+		p->setStrike(100);
+		p->setMaturity(maturity);
+		portfolio->add(-1.0, p);
+	}
+
+	BlackScholesModel bsm;
+	bsm.volatility = 0.2;
+	bsm.stockPrice = 100;
+	bsm.riskFreeRate = 0.05;
+	MultiStockModel msm(bsm);
+
+	MonteCarloPricer pricer;
+	pricer.nTasks = 2;
+	auto start = clock();
+	double price = portfolio->monteCarloPrice(msm, pricer);
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	ASSERT_APPROX_EQUAL(price, portfolio->price(msm), 0.3);
+	INFO("Calls and puts with three maturities took " << elapsed << "s");
+}
+
 void testPortfolio() {
     TEST( testSingleSecurity );
     TEST( testPutCallParity );
 	TEST( testMultiStockPortfolio );
 	TEST(testPerformanceImprovement);
+	TEST(testMixedMaturities);
 }
 
@@ -1,11 +1,14 @@
 #include "PutOption.h"
 
 #include "matlib.h"
+#include "MatrixExpression.h"
 
-Matrix PutOption::payoffAtMaturity( const Matrix& stockAtMaturity ) const {
-    Matrix val = getStrike() - stockAtMaturity;
-    val.positivePart();
-    return val;
+Matrix PutOption::payoffAtMaturity( const MatrixView& stockAtMaturity ) const {
+    return positivePart( getStrike() - lazy(stockAtMaturity) );
+}
+
+Matrix PutOption::derivativeAtMaturity( const MatrixView& stockAtMaturity ) const {
+    return -(lazy(stockAtMaturity) < getStrike());
 }
 
 double PutOption::price(
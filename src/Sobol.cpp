@@ -0,0 +1,372 @@
+#include "Sobol.h"
+
+#include "Philox.h"
+#include "matlib.h"
+
+using namespace std;
+
+/*  The initial direction numbers of Joe and Kuo for the dimensions
+    after the first, whose primitive polynomials are the first ones
+    found by primitivePolynomials */
+static const int N_JOE_KUO = 20;
+static const uint32_t JOE_KUO_DIRECTIONS[N_JOE_KUO][7] = {
+    { 1 },
+    { 1, 3 },
+    { 1, 3, 1 },
+    { 1, 1, 1 },
+    { 1, 1, 3, 3 },
+    { 1, 3, 5, 13 },
+    { 1, 1, 5, 5, 17 },
+    { 1, 1, 5, 5, 5 },
+    { 1, 1, 7, 11, 19 },
+    { 1, 1, 5, 1, 1 },
+    { 1, 1, 1, 3, 11 },
+    { 1, 3, 5, 5, 31 },
+    { 1, 3, 3, 9, 7, 49 },
+    { 1, 1, 1, 15, 21, 21 },
+    { 1, 3, 1, 13, 27, 49 },
+    { 1, 1, 1, 15, 7, 5 },
+    { 1, 3, 1, 15, 13, 25 },
+    { 1, 1, 5, 5, 19, 61 },
+    { 1, 3, 7, 11, 23, 15, 103 },
+    { 1, 3, 7, 13, 13, 15, 69 }
+};
+
+/*  The key of the generator choosing the initial direction
+    numbers of the later dimensions */
+static const uint64_t DIRECTION_SEED = 0x50B01u;
+
+/*  a*b modulo the polynomial p of the given degree, where the bits
+    of each number are the coefficients of a polynomial over GF(2) */
+static uint64_t multiplyModulo( uint64_t a, uint64_t b, uint64_t p, int degree ) {
+    uint64_t result = 0;
+    uint64_t top = (uint64_t)1 << degree;
+    while (b) {
+        if (b & 1) {
+            result ^= a;
+        }
+        b >>= 1;
+        a <<= 1;
+        if (a & top) {
+            a ^= p;
+        }
+    }
+    return result;
+}
+
+/*  x^n modulo the polynomial p of the given degree */
+static uint64_t powerOfX( uint64_t n, uint64_t p, int degree ) {
+    uint64_t result = 1;
+    uint64_t square = (degree>1) ? 2 : (2 ^ p);
+    while (n) {
+        if (n & 1) {
+            result = multiplyModulo( result, square, p, degree );
+        }
+        square = multiplyModulo( square, square, p, degree );
+        n >>= 1;
+    }
+    return result;
+}
+
+/*  Is p primitive, that is does x have order 2^degree-1 modulo p?
+    primeFactors are the distinct prime factors of 2^degree-1. */
+static bool isPrimitive( uint64_t p, int degree,
+                         const vector<uint64_t>& primeFactors ) {
+    uint64_t order = ((uint64_t)1 << degree) - 1;
+    if (powerOfX( order, p, degree )!=1) {
+        return false;
+    }
+    for (uint64_t q : primeFactors) {
+        if (powerOfX( order/q, p, degree )==1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  The distinct prime factors of n */
+static vector<uint64_t> primeFactors( uint64_t n ) {
+    vector<uint64_t> factors;
+    for (uint64_t q=2; q*q<=n; q++) {
+        if (n % q==0) {
+            factors.push_back( q );
+            while (n % q==0) {
+                n /= q;
+            }
+        }
+    }
+    if (n>1) {
+        factors.push_back( n );
+    }
+    return factors;
+}
+
+void SobolSequence::primitivePolynomials( int n,
+                                          vector<int>& degrees,
+                                          vector<uint32_t>& coefficients ) {
+    degrees.clear();
+    coefficients.clear();
+    for (int degree=1; (int)degrees.size()<n; degree++) {
+        ASSERT( degree<BITS );
+        vector<uint64_t> factors = primeFactors( ((uint64_t)1 << degree) - 1 );
+        uint32_t nCoefficients = (uint32_t)1 << (degree - 1);
+        for (uint32_t a=0; a<nCoefficients && (int)degrees.size()<n; a++) {
+            uint64_t p = ((uint64_t)1 << degree) | ((uint64_t)a << 1) | 1;
+            if (isPrimitive( p, degree, factors )) {
+                degrees.push_back( degree );
+                coefficients.push_back( a );
+            }
+        }
+    }
+}
+
+SobolSequence::SobolSequence( int dimensions ) :
+    dimensions( dimensions ),
+    shift( dimensions, 0 ),
+    current( dimensions, 0 ),
+    position( 0 ) {
+    ASSERT( dimensions>=1 );
+    auto v = make_shared<vector<uint32_t> >( (size_t)dimensions*BITS );
+    // the van der Corput sequence
+    for (int i=0; i<BITS; i++) {
+        (*v)[i] = (uint32_t)1 << (BITS - 1 - i);
+    }
+    vector<int> degrees;
+    vector<uint32_t> coefficients;
+    primitivePolynomials( dimensions - 1, degrees, coefficients );
+    Philox rng( DIRECTION_SEED );
+    for (int d=1; d<dimensions; d++) {
+        int s = degrees[d-1];
+        uint32_t a = coefficients[d-1];
+        uint32_t* numbers = &(*v)[(size_t)d*BITS];
+        rng.setStream( d );
+        for (int i=0; i<s; i++) {
+            // m_i is odd and less than 2^(i+1)
+            uint32_t m = (d<=N_JOE_KUO) ? JOE_KUO_DIRECTIONS[d-1][i]
+                                        : ((rng() >> (BITS - 1 - i)) | 1);
+            numbers[i] = m << (BITS - 1 - i);
+        }
+        for (int i=s; i<BITS; i++) {
+            uint32_t value = numbers[i-s] ^ (numbers[i-s] >> s);
+            for (int k=1; k<s; k++) {
+                if ((a >> (s - 1 - k)) & 1) {
+                    value ^= numbers[i-k];
+                }
+            }
+            numbers[i] = value;
+        }
+    }
+    directions = v;
+}
+
+void SobolSequence::scramble( uint64_t seed ) {
+    Philox rng( seed );
+    for (int d=0; d<dimensions; d++) {
+        shift[d] = rng();
+    }
+}
+
+void SobolSequence::setPosition( uint64_t position ) {
+    ASSERT( position < ((uint64_t)1 << BITS) );
+    this->position = position;
+    uint64_t gray = position ^ (position >> 1);
+    const uint32_t* v = &(*directions)[0];
+    for (int d=0; d<dimensions; d++) {
+        uint32_t x = 0;
+        for (int i=0; i<BITS; i++) {
+            if ((gray >> i) & 1) {
+                x ^= v[(size_t)d*BITS + i];
+            }
+        }
+        current[d] = x;
+    }
+}
+
+/*  The lowest zero bit of n. The point after point n in Gray
+    code order differs from it in this direction. */
+static int lowestZeroBit( uint64_t n ) {
+    int bit = 0;
+    while ((n >> bit) & 1) {
+        bit++;
+    }
+    return bit;
+}
+
+void SobolSequence::next( uint32_t* out ) {
+    ASSERT( position < ((uint64_t)1 << BITS) - 1 );
+    const uint32_t* v = &(*directions)[lowestZeroBit( position )];
+    for (int d=0; d<dimensions; d++) {
+        out[d] = current[d] ^ shift[d];
+        current[d] ^= v[(size_t)d*BITS];
+    }
+    position++;
+}
+
+void SobolSequence::nextUniform( double* out ) {
+    ASSERT( position < ((uint64_t)1 << BITS) - 1 );
+    const double scale = 1.0/4294967296.0;
+    const uint32_t* v = &(*directions)[lowestZeroBit( position )];
+    for (int d=0; d<dimensions; d++) {
+        out[d] = ((current[d] ^ shift[d]) + 0.5)*scale;
+        current[d] ^= v[(size_t)d*BITS];
+    }
+    position++;
+}
+
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+static void testKnownAnswers() {
+    // the first points of the sequence of Joe and Kuo
+    double expected[8][3] = {
+        { 0, 0, 0 },
+        { 0.5, 0.5, 0.5 },
+        { 0.75, 0.25, 0.25 },
+        { 0.25, 0.75, 0.75 },
+        { 0.375, 0.375, 0.625 },
+        { 0.875, 0.875, 0.125 },
+        { 0.625, 0.125, 0.875 },
+        { 0.125, 0.625, 0.375 }
+    };
+    SobolSequence sobol( 3 );
+    uint32_t point[3];
+    for (int n=0; n<8; n++) {
+        sobol.next( point );
+        for (int d=0; d<3; d++) {
+            ASSERT( point[d]==(uint32_t)(expected[n][d]*4294967296.0) );
+        }
+    }
+}
+
+static void testPrimitivePolynomials() {
+    vector<int> degrees;
+    vector<uint32_t> coefficients;
+    SobolSequence::primitivePolynomials( 500, degrees, coefficients );
+    // the polynomials the direction numbers of Joe and Kuo are for
+    int joeKuoDegrees[] = { 1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 7, 7 };
+    uint32_t joeKuoCoefficients[] = { 0, 1, 1, 2, 1, 4, 2, 4, 7, 11, 13, 14,
+                                      1, 13, 16, 19, 22, 25, 1, 4 };
+    for (int i=0; i<N_JOE_KUO; i++) {
+        ASSERT( degrees[i]==joeKuoDegrees[i] );
+        ASSERT( coefficients[i]==joeKuoCoefficients[i] );
+    }
+    // there are phi(2^d-1)/d primitive polynomials of degree d
+    int expectedCounts[] = { 0, 1, 1, 2, 2, 6, 6, 18, 16, 48, 60 };
+    for (int degree=1; degree<=10; degree++) {
+        ASSERT( count( degrees.begin(), degrees.end(), degree )==expectedCounts[degree] );
+    }
+}
+
+static void testSetPosition() {
+    int dimensions = 50;
+    SobolSequence sequential( dimensions );
+    sequential.scramble( 7 );
+    vector<uint32_t> points( 1100*dimensions );
+    for (int n=0; n<1100; n++) {
+        sequential.next( &points[n*dimensions] );
+    }
+    // jumping to any point gives the same point as reading up to it
+    SobolSequence jumped = sequential;
+    for (int n : { 0, 1, 2, 3, 511, 512, 1023, 1024, 1099 }) {
+        jumped.setPosition( n );
+        vector<uint32_t> point( dimensions );
+        jumped.next( &point[0] );
+        for (int d=0; d<dimensions; d++) {
+            ASSERT( point[d]==points[n*dimensions + d] );
+        }
+        ASSERT( jumped.getPosition()==(uint64_t)n+1 );
+    }
+}
+
+static void testStratification() {
+    // each coordinate of the first 2^k points has one point in every
+    // interval of width 2^-k, whether or not it is scrambled
+    int dimensions = 1000;
+    int k = 10;
+    int n = 1 << k;
+    for (int scrambled=0; scrambled<=1; scrambled++) {
+        SobolSequence sobol( dimensions );
+        if (scrambled) {
+            sobol.scramble( 12345 );
+        }
+        vector<uint32_t> points( (size_t)n*dimensions );
+        for (int i=0; i<n; i++) {
+            sobol.next( &points[(size_t)i*dimensions] );
+        }
+        for (int d=0; d<dimensions; d++) {
+            vector<int> counts( n, 0 );
+            for (int i=0; i<n; i++) {
+                counts[ points[(size_t)i*dimensions + d] >> (32 - k) ]++;
+            }
+            ASSERT( *min_element( counts.begin(), counts.end() )==1 );
+        }
+    }
+}
+
+static void testUniform() {
+    // scrambling keeps the points in (0,1) and changes them
+    SobolSequence plain( 5 );
+    SobolSequence scrambled( 5 );
+    scrambled.scramble( 1 );
+    double u[5];
+    double v[5];
+    double total = 0.0;
+    int n = 4096;
+    for (int i=0; i<n; i++) {
+        plain.nextUniform( u );
+        scrambled.nextUniform( v );
+        for (int d=0; d<5; d++) {
+            ASSERT( u[d]>0.0 && u[d]<1.0 && v[d]>0.0 && v[d]<1.0 );
+            total += v[d];
+        }
+    }
+    ASSERT( u[0]!=v[0] );
+    ASSERT_APPROX_EQUAL( total/(5*n), 0.5, 1e-3 );
+}
+
+static void testIntegration() {
+    // integrate a smooth function of 8 variables, whose integral
+    // is 1, with Sobol points and with pseudo-random numbers
+    int dimensions = 8;
+    int n = 1 << 14;
+    SobolSequence sobol( dimensions );
+    sobol.scramble( 3 );
+    Philox philox;
+    vector<double> u( dimensions );
+    double sobolTotal = 0.0;
+    double philoxTotal = 0.0;
+    for (int i=0; i<n; i++) {
+        sobol.nextUniform( &u[0] );
+        double f = 1.0;
+        for (int d=0; d<dimensions; d++) {
+            f *= 1.0 + (u[d] - 0.5)/(d + 1);
+        }
+        sobolTotal += f;
+        philox.uniform( &u[0], dimensions );
+        f = 1.0;
+        for (int d=0; d<dimensions; d++) {
+            f *= 1.0 + (u[d] - 0.5)/(d + 1);
+        }
+        philoxTotal += f;
+    }
+    double sobolError = fabs( sobolTotal/n - 1.0 );
+    double philoxError = fabs( philoxTotal/n - 1.0 );
+    ASSERT( sobolError < 1e-4 );
+    ASSERT( sobolError < 0.1*philoxError );
+    INFO( "Integral of a smooth function in 8 dimensions, " << n << " points\n"
+        << "Sobol error: " << sobolError << "\n"
+        << "Philox error: " << philoxError );
+}
+
+void testSobol() {
+    TEST( testKnownAnswers );
+    TEST( testPrimitivePolynomials );
+    TEST( testSetPosition );
+    TEST( testStratification );
+    TEST( testUniform );
+    TEST( testIntegration );
+}
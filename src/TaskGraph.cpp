@@ -0,0 +1,477 @@
+#include "TaskGraph.h"
+#include "MonteCarloPricer.h"
+#include "CallOption.h"
+#include "textfunctions.h"
+
+using namespace std;
+
+int TaskGraph::add(const string &name,
+                   function<void()> work,
+                   const vector<int> &predecessors,
+                   double estimatedCost)
+{
+    ASSERT(estimatedCost >= 0.0);
+    nodes.push_back(Node{name, work, vector<int>(), 0, estimatedCost});
+    int id = (int)nodes.size() - 1;
+    for (int before : predecessors)
+    {
+        addDependency(before, id);
+    }
+    return id;
+}
+
+void TaskGraph::addDependency(int before, int after)
+{
+    ASSERT(before >= 0 && before < size());
+    ASSERT(after >= 0 && after < size());
+    nodes[before].successors.push_back(after);
+    nodes[after].nPredecessors++;
+}
+
+int TaskGraph::size() const
+{
+    return (int)nodes.size();
+}
+
+vector<double> TaskGraph::criticalPaths() const
+{
+    // Kahn's algorithm gives an order with every node after its
+    // predecessors
+    int n = size();
+    vector<int> remaining(n);
+    vector<int> order;
+    for (int i = 0; i < n; i++)
+    {
+        remaining[i] = nodes[i].nPredecessors;
+        if (remaining[i] == 0)
+        {
+            order.push_back(i);
+        }
+    }
+    for (int k = 0; k < (int)order.size(); k++)
+    {
+        for (int next : nodes[order[k]].successors)
+        {
+            if (--remaining[next] == 0)
+            {
+                order.push_back(next);
+            }
+        }
+    }
+    if ((int)order.size() != n)
+    {
+        throw invalid_argument("Task graph has a cycle");
+    }
+    vector<double> ret(n, 0.0);
+    for (int k = n - 1; k >= 0; k--)
+    {
+        int i = order[k];
+        double longest = 0.0;
+        for (int next : nodes[i].successors)
+        {
+            longest = max(longest, ret[next]);
+        }
+        ret[i] = nodes[i].cost + longest;
+    }
+    return ret;
+}
+
+/**
+ *   Each task runs whichever ready node is most critical when it
+ *   starts, rather than the node that made it, and so does the
+ *   calling thread, so the run never waits for a node that is still
+ *   queued. The tasks may run after the run has finished, when they
+ *   find no ready node and don't touch the graph.
+ */
+struct TaskGraph::Run : public enable_shared_from_this<TaskGraph::Run>
+{
+    Run(TaskGraph &graph, Executor &executor)
+        : graph(graph), executor(executor),
+          priority(graph.criticalPaths()),
+          skipped(graph.size(), false),
+          start(chrono::steady_clock::now())
+    {
+        for (const Node &node : graph.nodes)
+        {
+            remaining.push_back(node.nPredecessors);
+        }
+    }
+
+    /*  Run nodes until every one has finished or been skipped */
+    void runAll()
+    {
+        unique_lock<mutex> lock(mtx);
+        for (int i = 0; i < graph.size(); i++)
+        {
+            if (remaining[i] == 0)
+            {
+                makeReady(i);
+            }
+        }
+        while (nDone < graph.size())
+        {
+            if (ready.empty())
+            {
+                nodeDone.wait(lock);
+            }
+            else
+            {
+                lock.unlock();
+                runNext();
+                lock.lock();
+            }
+        }
+    }
+
+    /*  Run the most critical ready node, if there is one */
+    void runNext()
+    {
+        int id;
+        TaskGraphTiming timing;
+        {
+            lock_guard<mutex> lock(mtx);
+            if (ready.empty())
+            {
+                return;
+            }
+            id = -ready.top().second;
+            ready.pop();
+            timing.order = (int)trace.size();
+            trace.push_back(timing);
+            auto inserted = threadNumbers.insert(
+                make_pair(this_thread::get_id(), (int)threadNumbers.size()));
+            timing.thread = inserted.first->second;
+        }
+        Node &node = graph.nodes[id];
+        timing.name = node.name;
+        timing.criticalPath = priority[id];
+        timing.start = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        exception_ptr nodeError;
+        try
+        {
+            node.work();
+        }
+        catch (...)
+        {
+            nodeError = current_exception();
+        }
+        timing.finish = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        lock_guard<mutex> lock(mtx);
+        trace[timing.order] = timing;
+        nDone++;
+        if (nodeError)
+        {
+            if (!error)
+            {
+                error = nodeError;
+            }
+            skipDependents(id);
+        }
+        else
+        {
+            for (int next : node.successors)
+            {
+                if (--remaining[next] == 0)
+                {
+                    makeReady(next);
+                }
+            }
+        }
+        nodeDone.notify_all();
+    }
+
+    /*  Queue a task for a node whose predecessors have all
+        finished. Called with the lock held. */
+    void makeReady(int id)
+    {
+        ready.push(make_pair(priority[id], -id));
+        shared_ptr<Run> self = shared_from_this();
+        executor.addTask([self]()
+                         { self->runNext(); });
+    }
+
+    /*  Skip every node which depends on a failed one. Their count
+        of remaining predecessors never reaches zero, so they are
+        never made ready. Called with the lock held. */
+    void skipDependents(int failed)
+    {
+        vector<int> toSkip(graph.nodes[failed].successors);
+        while (!toSkip.empty())
+        {
+            int id = toSkip.back();
+            toSkip.pop_back();
+            if (!skipped[id])
+            {
+                skipped[id] = true;
+                nDone++;
+                const vector<int> &successors = graph.nodes[id].successors;
+                toSkip.insert(toSkip.end(), successors.begin(), successors.end());
+            }
+        }
+    }
+
+    /*  Only used while nodes remain */
+    TaskGraph &graph;
+    Executor &executor;
+    const vector<double> priority;
+    mutex mtx;
+    /*  Signalled when a node finishes, which may also make others ready */
+    condition_variable nodeDone;
+    /*  The remaining fields are guarded by mtx */
+    vector<int> remaining;
+    vector<bool> skipped;
+    /*  Ready nodes, most critical and then earliest added first */
+    priority_queue<pair<double, int>> ready;
+    /*  The number of nodes which have finished or been skipped */
+    int nDone = 0;
+    map<thread::id, int> threadNumbers;
+    vector<TaskGraphTiming> trace;
+    exception_ptr error;
+    const chrono::steady_clock::time_point start;
+};
+
+void TaskGraph::run(Executor &executor)
+{
+    auto state = make_shared<Run>(*this, executor);
+    state->runAll();
+    lock_guard<mutex> lock(state->mtx);
+    trace = state->trace;
+    if (state->error)
+    {
+        rethrow_exception(state->error);
+    }
+}
+
+void TaskGraph::run()
+{
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    run(*executor);
+}
+
+const vector<TaskGraphTiming> &TaskGraph::getTrace() const
+{
+    return trace;
+}
+
+void TaskGraph::writeTrace(ostream &out) const
+{
+    out << "{\"traceEvents\":[";
+    for (int i = 0; i < (int)trace.size(); i++)
+    {
+        const TaskGraphTiming &t = trace[i];
+        out << (i > 0 ? ",\n" : "\n")
+            << "{\"name\":\"" << escapeJsonString(t.name) << "\",\"ph\":\"X\",\"pid\":0"
+            << ",\"tid\":" << t.thread
+            << ",\"ts\":" << t.start * 1e6
+            << ",\"dur\":" << (t.finish - t.start) * 1e6
+            << ",\"args\":{\"order\":" << t.order
+            << ",\"criticalPath\":" << t.criticalPath << "}}";
+    }
+    out << "\n]}\n";
+}
+
+////////////////////////////////
+//
+//   TESTS
+//
+////////////////////////////////
+
+/*  Find a node's timing by name */
+static const TaskGraphTiming &timingOf(const TaskGraph &graph, const string &name)
+{
+    for (const TaskGraphTiming &t : graph.getTrace())
+    {
+        if (t.name == name)
+        {
+            return t;
+        }
+    }
+    ASSERT(false);
+    return graph.getTrace()[0];
+}
+
+static void testDependencies()
+{
+    // the shape of the nightly batch: calibrate, build models,
+    // simulate, evaluate, aggregate
+    TaskGraph graph;
+    double volatility = 0.0;
+    vector<BlackScholesModel> models(3);
+    vector<double> prices(3, 0.0);
+    double total = 0.0;
+
+    int calibrate = graph.add("calibrate", [&]()
+                              { volatility = 0.2; });
+    vector<int> pricings;
+    for (int i = 0; i < 3; i++)
+    {
+        int build = graph.add("model" + to_string(i), [&, i]()
+                              {
+                                  models[i].volatility = volatility;
+                                  models[i].stockPrice = 100.0 + 10.0 * i;
+                                  models[i].riskFreeRate = 0.05;
+                                  models[i].date = 0.0; },
+                              {calibrate});
+        int price = graph.add("price" + to_string(i), [&, i]()
+                              {
+                                  CallOption call;
+                                  call.setStrike(110.0);
+                                  call.setMaturity(1.0);
+                                  MonteCarloPricer pricer;
+                                  pricer.nScenarios = 10000;
+                                  prices[i] = pricer.price(call, models[i]); },
+                              {build}, 10.0);
+        pricings.push_back(price);
+    }
+    graph.add("aggregate", [&]()
+              { total = accumulate(prices.begin(), prices.end(), 0.0); },
+              pricings);
+    graph.run();
+
+    ASSERT((int)graph.getTrace().size() == graph.size());
+    for (int i = 0; i < 3; i++)
+    {
+        CallOption call;
+        call.setStrike(110.0);
+        call.setMaturity(1.0);
+        ASSERT_APPROX_EQUAL(prices[i], call.price(MultiStockModel(models[i])), 0.5);
+        const TaskGraphTiming &model = timingOf(graph, "model" + to_string(i));
+        const TaskGraphTiming &price = timingOf(graph, "price" + to_string(i));
+        ASSERT(model.start >= timingOf(graph, "calibrate").finish);
+        ASSERT(price.start >= model.finish);
+        ASSERT(timingOf(graph, "aggregate").start >= price.finish);
+    }
+    ASSERT_APPROX_EQUAL(total, prices[0] + prices[1] + prices[2], 1e-12);
+    ASSERT_APPROX_EQUAL(timingOf(graph, "calibrate").criticalPath, 13.0, 1e-12);
+
+    stringstream json;
+    graph.writeTrace(json);
+    ASSERT(json.str().find("\"name\":\"aggregate\"") != string::npos);
+
+    // names are escaped, so the trace is still valid JSON
+    TaskGraph quoted;
+    quoted.add("say \"hi\"\\\n", []() {});
+    quoted.run();
+    stringstream quotedJson;
+    quoted.writeTrace(quotedJson);
+    ASSERT(quotedJson.str().find("\"name\":\"say \\\"hi\\\"\\\\\\n\"") != string::npos);
+}
+
+static void testCriticalPathFirst()
+{
+    // a chain of three beside three independent nodes
+    TaskGraph graph;
+    for (int i = 0; i < 3; i++)
+    {
+        graph.add("independent" + to_string(i), []() {});
+    }
+    int a = graph.add("chain0", []() {});
+    int b = graph.add("chain1", []() {}, {a});
+    graph.add("chain2", []() {}, {b});
+    shared_ptr<Executor> executor = Executor::newInstance(1);
+    graph.run(*executor);
+    ASSERT(timingOf(graph, "chain0").order == 0);
+    ASSERT_APPROX_EQUAL(timingOf(graph, "chain0").criticalPath, 3.0, 1e-12);
+    ASSERT_APPROX_EQUAL(timingOf(graph, "independent0").criticalPath, 1.0, 1e-12);
+}
+
+static void testFailures()
+{
+    TaskGraph graph;
+    bool ranAfterFailure = false;
+    bool ranIndependent = false;
+    int failing = graph.add("failing", []()
+                            { throw runtime_error("calibration failed"); });
+    graph.add("after", [&]()
+              { ranAfterFailure = true; },
+              {failing});
+    graph.add("independent", [&]()
+              { ranIndependent = true; });
+    bool thrown = false;
+    try
+    {
+        graph.run();
+    }
+    catch (const runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT(!ranAfterFailure);
+    ASSERT(ranIndependent);
+
+    TaskGraph cyclic;
+    int x = cyclic.add("x", []() {});
+    int y = cyclic.add("y", []() {}, {x});
+    cyclic.addDependency(y, x);
+    thrown = false;
+    try
+    {
+        cyclic.run();
+    }
+    catch (const invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+}
+
+static void testRunFromTask()
+{
+    // the only thread runs the graph from a task, while an unrelated
+    // task waits for the graph and another one fails
+    shared_ptr<Executor> executor = Executor::newInstance(1);
+    atomic<bool> graphDone(false);
+    bool graphThrew = false;
+    int nRun = 0;
+    executor->addTask([&]()
+                      {
+                          TaskGraph graph;
+                          int first = graph.add("first", [&]()
+                                                { nRun++; });
+                          graph.add("second", [&]()
+                                    { nRun++; },
+                                    {first});
+                          graph.add("third", [&]()
+                                    { nRun++; },
+                                    {first});
+                          try
+                          {
+                              graph.run(*executor);
+                          }
+                          catch (...)
+                          {
+                              graphThrew = true;
+                          }
+                          graphDone = true; });
+    executor->addTask([&]()
+                      {
+                          while (!graphDone)
+                          {
+                              this_thread::yield();
+                          } });
+    executor->addTask([]()
+                      { throw runtime_error("unrelated failure"); });
+    bool thrown = false;
+    try
+    {
+        executor->join();
+    }
+    catch (const runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    ASSERT(graphDone);
+    ASSERT(!graphThrew);
+    ASSERT(nRun == 3);
+}
+
+void testTaskGraph()
+{
+    TEST(testDependencies);
+    TEST(testCriticalPathFirst);
+    TEST(testFailures);
+    TEST(testRunFromTask);
+}
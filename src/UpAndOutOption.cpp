@@ -2,18 +2,76 @@
 #include "KnockoutOption.h"
 #include "MonteCarloPricer.h"
 #include "matlib.h"
+#include "MatrixExpression.h"
 
 using namespace std;
 
 Matrix UpAndOutOption::payoff(
-        const Matrix& prices ) const {
+        const MatrixView& prices ) const {
     Matrix max = maxOverRows( prices );
-    Matrix didntHit = max < getBarrier();
-    Matrix p = prices.col( prices.nCols()-1);
-    p -= getStrike();
-    p.positivePart();
-    p.times(didntHit);
-    return p;
+    MatrixView finalPrices = prices.col( prices.nCols()-1 );
+    return times( positivePart( lazy(finalPrices) - getStrike() ),
+                  lazy(max) < getBarrier() );
+}
+
+PathStatistics UpAndOutOption::getPathStatistics() const {
+    PathStatistics statistics;
+    statistics.terminal = true;
+    if (isContinuouslyMonitored()) {
+        statistics.survivesUpper = true;
+        statistics.upperBarrier = getBarrier();
+    } else {
+        statistics.maximum = true;
+    }
+    return statistics;
+}
+
+Matrix UpAndOutOption::payoff(
+        const PathSummary& summary ) const {
+    if (isContinuouslyMonitored()) {
+        // the expected payoff given the prices at the steps
+        return times( positivePart( lazy(summary.getTerminal()) - getStrike() ),
+                      summary.getSurvivesUpper() );
+    }
+    return times( positivePart( lazy(summary.getTerminal()) - getStrike() ),
+                  lazy(summary.getMaximum()) < getBarrier() );
+}
+
+double UpAndOutOption::continuousPrice( const MultiStockModel& model ) const {
+    BlackScholesModel m = model.getBlackScholesModel( getStock() );
+    double S = m.stockPrice;
+    double K = getStrike();
+    double H = getBarrier();
+    double r = m.riskFreeRate;
+    double sigma = m.volatility;
+    double T = getMaturity() - m.date;
+    ASSERT( K<H && S<H );
+    double sigmaRootT = sigma*sqrt(T);
+    double lambda = (r + 0.5*sigma*sigma)/(sigma*sigma);
+    double x1 = log(S/H)/sigmaRootT + lambda*sigmaRootT;
+    double y = log(H*H/(S*K))/sigmaRootT + lambda*sigmaRootT;
+    double y1 = log(H/S)/sigmaRootT + lambda*sigmaRootT;
+    double discount = exp(-r*T);
+    double d1 = log(S/K)/sigmaRootT + lambda*sigmaRootT;
+    double call = S*normcdf(d1) - K*discount*normcdf(d1 - sigmaRootT);
+    // the up and in call, which together with this makes a call
+    double upAndIn = S*normcdf(x1) - K*discount*normcdf(x1 - sigmaRootT)
+        - S*pow(H/S, 2*lambda)*(normcdf(-y) - normcdf(-y1))
+        + K*discount*pow(H/S, 2*lambda - 2)
+            *(normcdf(-y + sigmaRootT) - normcdf(-y1 + sigmaRootT));
+    return call - upAndIn;
+}
+
+bool UpAndOutOption::getControlVariate( const MultiStockModel& model,
+                                        ControlVariate& control ) const {
+    double S = model.getBlackScholesModel( getStock() ).stockPrice;
+    if (!isContinuouslyMonitored() && getStrike()<getBarrier() && S<getBarrier()) {
+        auto continuous = make_shared<UpAndOutOption>( *this );
+        continuous->setContinuouslyMonitored( true );
+        getContinuousControl( continuous, continuousPrice( model ), model, control );
+        return true;
+    }
+    return KnockoutOption::getControlVariate( model, control );
 }
 
 /////////////////////////////////////
@@ -36,6 +94,47 @@ static void testPayoff() {
     ASSERT_APPROX_EQUAL( o.payoff( prices ).asScalar(), 0.0, 0.001);
 }
 
+static void testContinuousMonitoring() {
+    BlackScholesModel model;
+    model.stockPrice = 100;
+    model.volatility = 0.2;
+    model.riskFreeRate = 0.05;
+    model.date = 0;
+
+    UpAndOutOption o;
+    o.setBarrier(130);
+    o.setStrike(100);
+    o.setMaturity(1.0);
+    double expected = o.continuousPrice( MultiStockModel( model ) );
+
+    MonteCarloPricer pricer;
+    pricer.nScenarios = 100000;
+    std::stringstream table;
+    table << "Up and out call, " << pricer.nScenarios
+          << " scenarios, analytic price " << expected << "\n"
+          << "Steps\tDiscrete error\tTime\tBridge error\tTime\n";
+    for (int nSteps : {10, 20, 50, 365}) {
+        pricer.nSteps = nSteps;
+        double errors[2];
+        double times[2];
+        for (int continuous = 0; continuous<=1; continuous++) {
+            o.setContinuouslyMonitored( continuous );
+            clock_t start = clock();
+            errors[continuous] = pricer.price( o, model ) - expected;
+            times[continuous] = (double)(clock()-start)/CLOCKS_PER_SEC;
+        }
+        table << nSteps << "\t" << errors[0] << "\t" << times[0]
+              << "\t" << errors[1] << "\t" << times[1] << "\n";
+        // the correction is within the sampling error at any
+        // number of steps, unlike monitoring at the steps
+        ASSERT_APPROX_EQUAL( errors[1], 0.0, 0.05 );
+        if (nSteps<=20) {
+            ASSERT( errors[0]>0.3 );
+        }
+    }
+    INFO( table.str() );
+}
+
 static void testPerformance() {
     BlackScholesModel model;
     model.stockPrice = 100;
@@ -60,5 +159,6 @@ static void testPerformance() {
 
 void testUpAndOutOption() {
     TEST( testPayoff );
+    TEST( testContinuousMonitoring );
     TEST( testPerformance );
 }
\ No newline at end of file
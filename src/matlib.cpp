@@ -5,6 +5,7 @@
 #include "Histogram.h"
 #include "RealFunction.h"
 #include "Executor.h"
+#include "MatrixKernels.h"
 
 extern template class LineChart<double>;
 
@@ -39,21 +40,21 @@ Matrix linspace(double from, double to, int numPoints, bool rowVector)
 /**
  *  Sum the rows of a matrix
  */
-Matrix sumRows(const Matrix &m)
+Matrix sumRows(const MatrixView &m)
 {
     int nrow = m.nRows();
     int ncol = m.nCols();
-    Matrix ret(nrow, 1, 0);
-    for (int row = 0; row < nrow; row++)
+    Matrix ret(nrow, 1, 1);
+    double *total = ret.begin();
+    // work down the columns so we read memory in order
+    for (int col = 0; col < ncol; col++)
     {
-        double total = 0.0;
-        const double *start = m.begin() + m.offset(row, 0);
-        for (int col = 0; col < ncol; col++)
+        const double *start = m.begin() + col * m.getColStride();
+        int stride = m.getRowStride();
+        for (int row = 0; row < nrow; row++)
         {
-            total += *(start);
-            start += nrow;
+            total[row] += start[row * stride];
         }
-        ret(row, 0) = total;
     }
     return ret;
 }
@@ -61,18 +62,19 @@ Matrix sumRows(const Matrix &m)
 /**
  *  Sum the cols of a matrix
  */
-Matrix sumCols(const Matrix &m)
+Matrix sumCols(const MatrixView &m)
 {
+    int nrow = m.nRows();
     int ncol = m.nCols();
     Matrix ret(1, ncol, 0);
     for (int col = 0; col < ncol; col++)
     {
         double total = 0.0;
-        const double *start = m.begin() + m.offset(0, col);
-        const double *end = start + m.nRows();
-        while (start != end)
+        const double *start = m.begin() + col * m.getColStride();
+        int stride = m.getRowStride();
+        for (int row = 0; row < nrow; row++)
         {
-            total += *(start++);
+            total += start[row * stride];
         }
         ret(0, col) = total;
     }
@@ -82,7 +84,7 @@ Matrix sumCols(const Matrix &m)
 /**
  *  The mean of the rows of a matrix
  */
-Matrix meanRows(const Matrix &m)
+Matrix meanRows(const MatrixView &m)
 {
     Matrix ret = sumRows(m);
     ret *= (1.0 / m.nCols());
@@ -92,87 +94,106 @@ Matrix meanRows(const Matrix &m)
 /**
  *  The mean of the cols of a matrix
  */
-Matrix meanCols(const Matrix &m)
+Matrix meanCols(const MatrixView &m)
 {
     Matrix ret = sumCols(m);
     ret *= (1.0 / m.nRows());
     return ret;
 }
 
+/*  Turn sums and sums of squares of n values into standard deviations */
+static void standardDeviation(Matrix &total, const Matrix &totalSq, int n, bool population)
+{
+    double factor = population ? (1.0) / n : (1.0) / (n - 1);
+    double *p = total.begin();
+    const double *sq = totalSq.begin();
+    for (; p != total.end(); p++, sq++)
+    {
+        *p = factor * (*sq - (*p) * (*p) / n);
+    }
+    total.sqrt();
+}
+
 /*  Compute the standard deviation of a matrix's rows */
-Matrix stdRows(const Matrix &m, bool population)
+Matrix stdRows(const MatrixView &m, bool population)
 {
+    int nrow = m.nRows();
     int n = m.nCols();
-    Matrix total(m.nRows(), 1);
-    Matrix totalSq(m.nRows(), 1);
-    for (int i = 0; i < n; i++)
+    Matrix total(nrow, 1);
+    Matrix totalSq(nrow, 1);
+    for (int col = 0; col < n; col++)
     {
-        Matrix val = m.col(i);
-        total += val;
-        val.times(val);
-        totalSq += val;
+        const double *start = m.begin() + col * m.getColStride();
+        int stride = m.getRowStride();
+        for (int row = 0; row < nrow; row++)
+        {
+            double val = start[row * stride];
+            total(row) += val;
+            totalSq(row) += val * val;
+        }
     }
-    Matrix val = total;
-    val.times(val);
-    val *= (-1.0) / n;
-    val += totalSq;
-    double factor = population ? (1.0) / n : (1.0) / (n - 1);
-    val *= factor;
-    val.sqrt();
-    return val;
+    standardDeviation(total, totalSq, n, population);
+    return total;
 }
 
 /*  Compute the standard deviation of a matrix's cols */
-Matrix stdCols(const Matrix &m, bool population)
+Matrix stdCols(const MatrixView &m, bool population)
 {
     int n = m.nRows();
-    Matrix total(1, m.nCols(), 1);
-    Matrix totalSq(1, m.nCols(), 1);
-    for (int i = 0; i < n; i++)
+    int ncol = m.nCols();
+    Matrix total(1, ncol);
+    Matrix totalSq(1, ncol);
+    for (int col = 0; col < ncol; col++)
     {
-        Matrix val = m.row(i);
-        total += val;
-        val.times(val);
-        totalSq += val;
+        const double *start = m.begin() + col * m.getColStride();
+        int stride = m.getRowStride();
+        for (int row = 0; row < n; row++)
+        {
+            double val = start[row * stride];
+            total(col) += val;
+            totalSq(col) += val * val;
+        }
     }
-    Matrix val = total;
-    val.times(val);
-    val *= (-1.0) / n;
-    val += totalSq;
-    double factor = population ? (1.0) / n : (1.0) / (n - 1);
-    val *= factor;
-    val.sqrt();
-    return val;
+    standardDeviation(total, totalSq, n, population);
+    return total;
 }
 
 /**
  *   Find the minimum across the cols of a vector
  */
-Matrix minOverCols(const Matrix &m)
+Matrix minOverCols(const MatrixView &m)
 {
-    Matrix minRow = m.row(0);
+    Matrix minRow(m.row(0));
     for (int i = 1; i < m.nRows(); i++)
     {
-        Matrix currentRow = m.row(i);
-        Matrix test = currentRow < minRow;
-        test.test(currentRow, minRow);
-        minRow = test;
+        for (int j = 0; j < m.nCols(); j++)
+        {
+            double current = m(i, j);
+            if (current < minRow(j))
+            {
+                minRow(j) = current;
+            }
+        }
     }
     return minRow;
 }
 
 /**
- *   Find the minimum across the cols of a vector
+ *   Find the maximum across the cols of a vector
  */
-Matrix maxOverCols(const Matrix &m)
+Matrix maxOverCols(const MatrixView &m)
 {
-    Matrix maxRow = m.row(0);
+    Matrix maxRow(m.row(0));
     for (int i = 1; i < m.nRows(); i++)
     {
-        Matrix currentRow = m.row(i);
-        Matrix test = currentRow > maxRow;
-        test.test(currentRow, maxRow);
-        maxRow = test;
+        for (int j = 0; j < m.nCols(); j++)
+        {
+            double current = m(i, j);
+            if (current > maxRow(j))
+            {
+                maxRow(j) = current;
+            }
+        }
     }
     return maxRow;
 }
@@ -180,32 +201,41 @@ Matrix maxOverCols(const Matrix &m)
 /**
  *   Find the minimum across the rows of a vector
  */
-Matrix minOverRows(const Matrix &m)
+Matrix minOverRows(const MatrixView &m)
 {
-    Matrix minCol = m.col(0);
-    for (int i = 1; i < m.nCols(); i++)
+    Matrix minCol(m.col(0));
+    double *result = minCol.begin();
+    int nrow = m.nRows();
+    for (int j = 1; j < m.nCols(); j++)
     {
-        Matrix currentCol = m.col(i);
-        Matrix test = currentCol < minCol;
-        test.test(currentCol, minCol);
-        minCol = test;
+        const double *start = m.begin() + j * m.getColStride();
+        int stride = m.getRowStride();
+        for (int i = 0; i < nrow; i++)
+        {
+            double current = start[i * stride];
+            result[i] = (current < result[i]) ? current : result[i];
+        }
     }
     return minCol;
 }
 
 /**
- *   Find the minimum across the rows of a vector
+ *   Find the maximum across the rows of a vector
  */
-Matrix maxOverRows(const Matrix &m)
+Matrix maxOverRows(const MatrixView &m)
 {
-    Matrix maxCol = m.col(0);
-    for (int i = 1; i < m.nCols(); i++)
+    Matrix maxCol(m.col(0));
+    double *result = maxCol.begin();
+    int nrow = m.nRows();
+    for (int j = 1; j < m.nCols(); j++)
     {
-        Matrix currentCol = m.col(i);
-        Matrix test = currentCol > maxCol;
-        test.test(currentCol, maxCol);
-        ;
-        maxCol = test;
+        const double *start = m.begin() + j * m.getColStride();
+        int stride = m.getRowStride();
+        for (int i = 0; i < nrow; i++)
+        {
+            double current = start[i * stride];
+            result[i] = (current > result[i]) ? current : result[i];
+        }
     }
     return maxCol;
 }
@@ -269,6 +299,38 @@ Matrix randn(mt19937 &random, int rows, int cols)
     }
     return ret;
 }
+/*  Create uniformly distributed random numbers */
+Matrix randuniform(Philox &random, int rows, int cols)
+{
+    Matrix ret(rows, cols, 0);
+    random.uniform(ret.begin(), rows * cols);
+    return ret;
+}
+
+/*  Create normally distributed random numbers */
+Matrix randn(Philox &random, int rows, int cols, NormalMethod method)
+{
+    Matrix ret(rows, cols, 0);
+    randn(random, ret.begin(), rows * cols, method);
+    return ret;
+}
+
+/*  Write normally distributed random numbers to a buffer */
+void randn(Philox &random, double *out, int n, NormalMethod method)
+{
+    random.uniform(out, n);
+    // without SIMD the loop below, where norminv is inlined, is quicker
+    if (method == NORMAL_SIMD && getSimdLevel() != SIMD_SCALAR)
+    {
+        vectorNormInv(out, n);
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = norminv(out[i]);
+    }
+}
+
 /**
  *  Sort the rows of a matrix
  */
@@ -536,7 +598,7 @@ double integral2d(function<double(double, double)> f,
                   double b2,
                   int nPoints)
 {
-    default_random_engine engine1;
+    Philox engine1;
     uniform_real_distribution<> unifDistribution1(a1, a2);
     uniform_real_distribution<> unifDistribution2(b1, b2);
 
@@ -556,6 +618,10 @@ double integral2d(function<double(double, double)> f,
     return ((a2 - a1) * (b2 - b1) * totalSum) / static_cast<double>(nPoints);
 }
 
+/*  The number of points each task of integral2d sums. It is fixed
+    so that the answer doesn't depend on the number of threads. */
+static const int INTEGRAL2D_GRAIN = 4096;
+
 double integral2d(int nThreads,
                   function<double(double, double)> f,
                   double a1,
@@ -565,32 +631,25 @@ double integral2d(int nThreads,
                   int nPoints)
 {
     shared_ptr<Executor> executor = Executor::newInstance(nThreads);
-    vector<double> taskSum(nThreads);
-    int nPointsTask = (nPoints + nThreads - 1) / nThreads;
-    for (auto idx = 0; idx < nThreads; idx++)
+    auto sumPoints = [&](int first, int last)
     {
-        auto taskLambda = [&, idx]()
+        // each double uses two outputs of the generator, and
+        // jumping to our share of the sequence costs nothing
+        Philox engine;
+        engine.discard(2 * 2 * (unsigned long long)first);
+        uniform_real_distribution<> unifDistribution1(a1, a2);
+        uniform_real_distribution<> unifDistribution2(b1, b2);
+        double sum = 0.0;
+        for (int i = first; i < last; i++)
         {
-            int nPointsCurrTask = min(nPoints, (idx + 1) * nPointsTask) - idx * nPointsTask;
-            if (nPointsCurrTask == 0)
-            {
-                return;
-            }
-            default_random_engine engine;
-            engine.discard(2 * 2 * idx * nPointsTask);
-            uniform_real_distribution<> unifDistribution1(a1, a2);
-            uniform_real_distribution<> unifDistribution2(b1, b2);
-            for (int i = 0; i < nPointsCurrTask; i++)
-            {
-                double first = unifDistribution1(engine);
-                double second = unifDistribution2(engine);
-                taskSum[idx] += f(first, second);
-            }
-        };
-        executor->addTask(taskLambda);
-    }
-    executor->join();
-    double totalSum = accumulate(taskSum.begin(), taskSum.end(), 0.0);
+            double x = unifDistribution1(engine);
+            double y = unifDistribution2(engine);
+            sum += f(x, y);
+        }
+        return sum;
+    };
+    double totalSum = executor->parallelReduce(0, nPoints, sumPoints,
+                                               INTEGRAL2D_GRAIN);
     return ((a2 - a1) * (b2 - b1) * totalSum) / static_cast<double>(nPoints);
 }
 
@@ -715,11 +774,11 @@ Matrix transpose(const Matrix &in)
     return ret;
 }
 
-/*  Compute the cholesky decomposition */
-Matrix chol(const Matrix &A)
+/*  The unblocked algorithm, kept to check and time the blocked
+    one against. A must be positive definite. */
+static Matrix cholUnblocked(const Matrix &A)
 {
     int n = A.nRows();
-    ASSERT(n == A.nCols());
     Matrix L(n, n);
     for (int i = 0; i < n; i++)
     {
@@ -743,6 +802,197 @@ Matrix chol(const Matrix &A)
     return L;
 }
 
+/*  Factor the lower triangle of the n by n block at a in place,
+    returning false if a pivot isn't positive */
+static bool cholBlock(double *a, int n, int lda)
+{
+    for (int j = 0; j < n; j++)
+    {
+        double *colJ = a + j * lda;
+        double s = colJ[j];
+        for (int p = 0; p < j; p++)
+        {
+            s -= a[j + p * lda] * a[j + p * lda];
+        }
+        if (!(s > 0.0))
+        {
+            return false;
+        }
+        double d = sqrt(s);
+        colJ[j] = d;
+        for (int i = j + 1; i < n; i++)
+        {
+            double t = colJ[i];
+            for (int p = 0; p < j; p++)
+            {
+                t -= a[i + p * lda] * a[j + p * lda];
+            }
+            colJ[i] = t / d;
+        }
+    }
+    return true;
+}
+
+/*  The width of the column panels in the blocked factorisation */
+static const int CHOL_BLOCK = 64;
+
+/*  Right looking blocked Cholesky of the lower triangle of the
+    n by n matrix at a. Each step factors a diagonal block, solves
+    for the panel below it and then updates the trailing matrix with
+    gemm. The panel rows and the trailing column blocks are
+    independent, so they are shared out over the thread pool. */
+static bool cholBlocked(double *a, int n, int lda)
+{
+    shared_ptr<Executor> executor = Executor::newSharedInstance();
+    vector<double> panelTransposed;
+    for (int k0 = 0; k0 < n; k0 += CHOL_BLOCK)
+    {
+        int kb = min(CHOL_BLOCK, n - k0);
+        double *diagonal = a + k0 + k0 * lda;
+        if (!cholBlock(diagonal, kb, lda))
+        {
+            return false;
+        }
+        int first = k0 + kb;
+        int nBelow = n - first;
+        if (nBelow == 0)
+        {
+            break;
+        }
+
+        // L21 = A21 L11^-T, one row at a time, also keeping the
+        // panel transposed as gemm's right hand side
+        panelTransposed.resize((size_t)kb * nBelow);
+        double *lt = panelTransposed.data();
+        executor->parallelFor(first, n, [&](int rowBegin, int rowEnd)
+                              {
+            for (int i = rowBegin; i < rowEnd; i++)
+            {
+                double *ltRow = lt + (size_t)(i - first) * kb;
+                for (int j = 0; j < kb; j++)
+                {
+                    double t = a[i + (k0 + j) * lda];
+                    for (int p = 0; p < j; p++)
+                    {
+                        t -= ltRow[p] * diagonal[j + p * lda];
+                    }
+                    t /= diagonal[j + j * lda];
+                    ltRow[j] = t;
+                    a[i + (k0 + j) * lda] = t;
+                }
+            } }, 64);
+
+        // A22 -= L21 L21', one block of columns at a time, computing
+        // only the rows on or below the diagonal of each block
+        int nColumnBlocks = (nBelow + CHOL_BLOCK - 1) / CHOL_BLOCK;
+        executor->parallelFor(0, nColumnBlocks, [&](int blockBegin, int blockEnd)
+                              {
+            for (int b = blockBegin; b < blockEnd; b++)
+            {
+                int j0 = first + b * CHOL_BLOCK;
+                int width = min(CHOL_BLOCK, n - j0);
+                gemm(n - j0, width, kb,
+                     -1.0,
+                     a + j0 + k0 * lda, lda,
+                     lt + (size_t)(j0 - first) * kb, kb,
+                     1.0,
+                     a + j0 + j0 * lda, lda);
+            } }, 1);
+    }
+    return true;
+}
+
+bool tryChol(const Matrix &A, Matrix &L)
+{
+    int n = A.nRows();
+    ASSERT(n == A.nCols());
+    L = A;
+    if (!cholBlocked(L.begin(), n, n))
+    {
+        return false;
+    }
+    // clear the upper triangle, which held the input
+    double *l = L.begin();
+    for (int j = 1; j < n; j++)
+    {
+        for (int i = 0; i < j; i++)
+        {
+            l[i + j * n] = 0.0;
+        }
+    }
+    return true;
+}
+
+/*  Compute the cholesky decomposition */
+Matrix chol(const Matrix &A)
+{
+    Matrix L;
+    if (tryChol(A, L))
+    {
+        return L;
+    }
+    return cholPivoted(A);
+}
+
+Matrix cholPivoted(const Matrix &A, double tolerance, int *rank)
+{
+    int n = A.nRows();
+    ASSERT(n == A.nCols());
+    const double *a = A.begin();
+    // the factor is built transposed, so each stock's loadings
+    // are contiguous
+    Matrix factorTransposed(n, n);
+    double *bt = factorTransposed.begin();
+    vector<double> remaining(n);
+    vector<bool> used(n, false);
+    double largest = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        remaining[i] = a[i + i * n];
+        largest = max(largest, remaining[i]);
+    }
+    int r = 0;
+    for (; r < n; r++)
+    {
+        int pivot = -1;
+        for (int i = 0; i < n; i++)
+        {
+            if (!used[i] && (pivot < 0 || remaining[i] > remaining[pivot]))
+            {
+                pivot = i;
+            }
+        }
+        if (!(remaining[pivot] > tolerance * largest))
+        {
+            break;
+        }
+        used[pivot] = true;
+        double d = sqrt(remaining[pivot]);
+        const double *pivotRow = bt + (size_t)pivot * n;
+        bt[r + (size_t)pivot * n] = d;
+        for (int i = 0; i < n; i++)
+        {
+            if (used[i])
+            {
+                continue;
+            }
+            double *row = bt + (size_t)i * n;
+            double t = a[i + pivot * n];
+            for (int p = 0; p < r; p++)
+            {
+                t -= row[p] * pivotRow[p];
+            }
+            row[r] = t / d;
+            remaining[i] -= row[r] * row[r];
+        }
+    }
+    if (rank)
+    {
+        *rank = r;
+    }
+    return transpose(factorTransposed);
+}
+
 ///////////////////////////////////////////////
 //
 //   TESTS
@@ -838,6 +1088,29 @@ static void testRandn()
     ASSERT_APPROX_EQUAL(stdCols(m).asScalar(), 1.0, 0.1);
 }
 
+static void testRandnPhilox()
+{
+    Philox random;
+    Matrix m = randn(random, 10000, 2);
+    ASSERT(m.nRows() == 10000 && m.nCols() == 2);
+    Matrix mean = meanCols(m);
+    Matrix sd = stdCols(m);
+    for (int j = 0; j < 2; j++)
+    {
+        ASSERT_APPROX_EQUAL(mean(j), 0.0, 0.05);
+        ASSERT_APPROX_EQUAL(sd(j), 1.0, 0.05);
+    }
+    // the matrix is filled in column-major order
+    Philox again;
+    again.discard(10000);
+    Matrix secondColumn = randn(again, 10000, 1);
+    Matrix(MatrixView(m).col(1)).assertEquals(secondColumn, 0.0);
+    // both methods read the same uniforms
+    Philox scalar;
+    Matrix expected = randn(scalar, 10000, 2, NORMAL_SCALAR);
+    m.assertEquals(expected, 1e-12);
+}
+
 static void testNormCdf()
 {
     ASSERT_APPROX_EQUAL(normcdf(1.96), 0.975, 0.001);
@@ -937,6 +1210,8 @@ static void testIntegral2d()
 
     auto multiThreadedres = integral2d(10, func, 11, 14, 7, 10, 10000);
     ASSERT_APPROX_EQUAL(multiThreadedres, singleThreadedres, 1);
+    // the answer does not depend on the number of threads
+    ASSERT(integral2d(3, func, 11, 14, 7, 10, 10000) == multiThreadedres);
 }
 
 /**
@@ -1062,6 +1337,83 @@ static void testChol()
     m.assertEquals(product, 0.001);
 }
 
+/*  A random covariance matrix with the given number of factors
+    plus a little idiosyncratic variance */
+static Matrix randomCovariance(int n, int nFactors, double idiosyncratic)
+{
+    Matrix loadings = randn(n, nFactors);
+    Matrix cov = loadings * transpose(loadings) * 0.01;
+    for (int i = 0; i < n; i++)
+    {
+        cov(i, i) += idiosyncratic;
+    }
+    return cov;
+}
+
+static void testBlockedChol()
+{
+    rng("default");
+    // sizes either side of the block size
+    for (int n : {1, 63, 64, 65, 200})
+    {
+        Matrix m = randomCovariance(n, 10, 0.01);
+        Matrix c;
+        bool isDefinite = tryChol(m, c);
+        ASSERT(isDefinite);
+        m.assertEquals(c * transpose(c), 1e-12);
+        for (int j = 1; j < n; j++)
+        {
+            ASSERT(c(0, j) == 0.0 && c(j - 1, j) == 0.0);
+        }
+        cholUnblocked(m).assertEquals(c, 1e-10);
+    }
+}
+
+static void testPivotedChol()
+{
+    rng("default");
+    int n = 150;
+    int nFactors = 7;
+    // a rank 7 matrix, semidefinite only up to rounding
+    Matrix m = randomCovariance(n, nFactors, 0.0);
+    Matrix c;
+    bool isDefinite = tryChol(m, c);
+    ASSERT(!isDefinite);
+    // chol falls back to the pivoted factor
+    m.assertEquals(chol(m) * transpose(chol(m)), 1e-12);
+    int rank = 0;
+    Matrix b = cholPivoted(m, 1e-12, &rank);
+    ASSERT(rank == nFactors);
+    m.assertEquals(b * transpose(b), 1e-12);
+    // on a definite matrix it is a permuted Cholesky factor
+    Matrix definite = randomCovariance(n, nFactors, 0.02);
+    b = cholPivoted(definite, 1e-12, &rank);
+    ASSERT(rank == n);
+    definite.assertEquals(b * transpose(b), 1e-12);
+}
+
+static void testCholPerformance()
+{
+    rng("default");
+    int n = 600;
+    Matrix m = randomCovariance(n, 20, 0.01);
+    // wall clock time, as the blocked factorization runs on many threads
+    auto start = chrono::steady_clock::now();
+    Matrix unblocked = cholUnblocked(m);
+    double unblockedTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    Matrix blocked = chol(m);
+    double blockedTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    Matrix pivoted = cholPivoted(m);
+    double pivotedTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    unblocked.assertEquals(blocked, 1e-9);
+    INFO("Cholesky of a " << n << " by " << n << " matrix\n"
+                          << "Unblocked: " << unblockedTime << "s\n"
+                          << "Blocked: " << blockedTime << "s\n"
+                          << "Pivoted: " << pivotedTime << "s");
+}
+
 void testMatlib()
 {
     TEST(testLinspace);
@@ -1070,6 +1422,7 @@ void testMatlib()
     TEST(testStandardDeviation);
     TEST(testRanduniform);
     TEST(testRandn);
+    TEST(testRandnPhilox);
     TEST(testNormInv);
     TEST(testNormCdf);
     TEST(testPrctile);
@@ -1088,5 +1441,8 @@ void testMatlib()
     TEST(testSortCols);
     TEST(testTranspose);
     TEST(testChol);
+    TEST(testBlockedChol);
+    TEST(testPivotedChol);
+    TEST(testCholPerformance);
     TEST(testIntegral3);
 }
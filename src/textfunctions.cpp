@@ -35,6 +35,37 @@ std::string escapeJavascriptString( const std::string& in ) {
     return s.str();
 }
 
+/**
+ *  Replace quote characters etc in a string with
+ *  the escape sequences JSON requires. Unlike
+ *  Javascript, JSON has no \' sequence, and
+ *  every control character must be escaped.
+ */
+std::string escapeJsonString( const std::string& in ) {
+    int n = in.size();
+    stringstream s;
+    for (int i=0; i<n; i++) {
+        char c = in[i];
+        if (c=='\"') {
+            s<<"\\\"";
+        } else if (c=='\\') {
+            s<<"\\\\";
+        } else if (c=='\t') {
+            s<<"\\t";
+        } else if (c=='\n') {
+            s<<"\\n";
+        } else if (c=='\r') {
+            s<<"\\r";
+        } else if ((unsigned char)c<0x20) {
+            const char* hex = "0123456789abcdef";
+            s<<"\\u00"<<hex[(c>>4)&0xf]<<hex[c&0xf];
+        } else {
+            s<<c;
+        }
+    }
+    return s.str();
+}
+
 
 //
 //   TESTS
@@ -47,6 +78,13 @@ static void testEscapeJavascriptString() {
     ASSERT( escapeJavascriptString( in )==out );
 }
 
+static void testEscapeJsonString() {
+    string in = "\"\'\\\r\n\t\x01Not escaped";
+    string out = "\\\"\'\\\\\\r\\n\\t\\u0001Not escaped";
+    ASSERT( escapeJsonString( in )==out );
+}
+
 void testTextFunctions() {
     TEST( testEscapeJavascriptString );
+    TEST( testEscapeJsonString );
 }
\ No newline at end of file